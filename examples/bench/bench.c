@@ -24,6 +24,7 @@
 
 #include <wolftpm/tpm2.h>
 #include <wolftpm/tpm2_wrap.h>
+#include <wolftpm/version.h>
 
 #if !defined(WOLFTPM2_NO_WRAPPER) && !defined(NO_TPM_BENCH)
 
@@ -33,24 +34,226 @@
 #include <examples/bench/bench.h>
 
 #include <stdio.h>
+#include <stdlib.h> /* atoi, atof, qsort */
+#if defined(__linux__) && !defined(WOLFSSL_USER_CURRTIME)
+#include <time.h>
+#define TPM2_BENCH_CLOCK_GETTIME
+#endif
+
+#ifdef WOLFTPM_LINUX_DEV
+#include <wolftpm/tpm2_linux.h>
+#endif
+#ifdef WOLFTPM_SWTPM
+#include <wolftpm/tpm2_swtpm.h>
+#endif
+#if defined(WOLFTPM_REPLAY) && !defined(NO_FILESYSTEM)
+#define TPM2_BENCH_REPLAY
+#include <wolftpm/tpm2_replay.h>
+#endif
+#ifdef WOLFTPM_TIS
+#define TPM2_BENCH_TIS
+#include <wolftpm/tpm2_tis.h>
+#endif
 
 /* Configuration */
 #define TPM2_BENCH_DURATION_SEC         1
 #define TPM2_BENCH_DURATION_KEYGEN_SEC  15
 static int gUseBase2 = 1;
+static double gBenchDurationSec = TPM2_BENCH_DURATION_SEC;
+static double gBenchKeygenSec = TPM2_BENCH_DURATION_KEYGEN_SEC;
+static int gBenchIterations = 0; /* run for the duration when 0 */
+
+/* largest hash sequence benchmarked */
+#ifndef TPM2_BENCH_HASH_MAX
+#define TPM2_BENCH_HASH_MAX             (16 * 1024)
+#endif
+
+/* Latency of each operation in nanoseconds, for the percentiles. Past
+ * TPM2_BENCH_MAX_SAMPLES operations a uniform subset is kept. */
+#ifndef TPM2_BENCH_MAX_SAMPLES
+#define TPM2_BENCH_MAX_SAMPLES          65536
+#endif
+static UINT64 gBenchSamples[TPM2_BENCH_MAX_SAMPLES];
+static word32 gBenchSampleCnt;
+static word32 gBenchSeen;
+static word32 gBenchRand = 1;
+static UINT64 gBenchMaxNs;
+static UINT64 gBenchLastNs;
+
+/* Machine readable results (-json=file, -csv=file) */
+#if !defined(NO_FILESYSTEM) && !defined(WOLFTPM_CUSTOM_STDIO)
+#define TPM2_BENCH_OUTPUT
+static FILE* gBenchJson = NULL;
+static FILE* gBenchCsv = NULL;
+static int gBenchJsonCount;
+#endif
+
+#ifdef TPM2_BENCH_REPLAY
+/* largest trace that can be replayed */
+#ifndef TPM2_BENCH_TRACE_SZ
+#define TPM2_BENCH_TRACE_SZ             (1024 * 1024)
+#endif
+static byte gBenchTrace[TPM2_BENCH_TRACE_SZ];
+#endif
+
+#if defined(TPM2_BENCH_TIS) && defined(WOLFTPM_TIS_PROFILE)
+static TPM2_TIS_PROFILE gBenchProfile;
+
+/* Bus activity per command, averaged over the commands of each code */
+static void bench_tis_profile(const TPM2_TIS_PROFILE* profile)
+{
+    int i;
+    const TPM2_TIS_PROFILE_CC* cmd;
+    double n;
+
+    printf("TIS bus profile (per command):\n");
+    printf("  %-10s %7s %6s %6s %6s %6s %6s %6s %6s %8s %8s\n",
+        "cc", "count", "sts", "polls", "burst", "fifo w", "fifo r", "other",
+        "wait", "bytes", "bus us");
+    for (i = 0; i < TPM2_TIS_PROFILE_MAX_CC; i++) {
+        cmd = &profile->cmd[i];
+        if (cmd->commands == 0)
+            continue;
+        n = (double)cmd->commands;
+        printf("  0x%08x %7u %6.1f %6.1f %6.1f %6.1f %6.1f %6.1f %6.1f "
+            "%8.1f %8.1f\n", (unsigned)cmd->cc, (unsigned)cmd->commands,
+            cmd->stsReads / n, cmd->polls / n, cmd->burstReads / n,
+            cmd->fifoWrites / n, cmd->fifoReads / n, cmd->regAccesses / n,
+            cmd->waitStates / n, (double)cmd->bytes / n,
+            (double)cmd->busNs / n / 1000);
+    }
+    if (profile->dropped > 0)
+        printf("  %u commands counted as cc 0\n", (unsigned)profile->dropped);
+}
+#endif
+
+static UINT64 bench_time_ns(void)
+{
+#ifdef TPM2_BENCH_CLOCK_GETTIME
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (UINT64)now.tv_sec * 1000000000ULL + (UINT64)now.tv_nsec;
+#else
+    return (UINT64)(gettime_secs(0) * 1000000000.0);
+#endif
+}
+
+static void bench_stats_sample(UINT64 ns)
+{
+    word32 idx;
+
+    if (ns > gBenchMaxNs)
+        gBenchMaxNs = ns;
+    gBenchSeen++;
+    if (gBenchSampleCnt < TPM2_BENCH_MAX_SAMPLES) {
+        gBenchSamples[gBenchSampleCnt++] = ns;
+        return;
+    }
+    /* reservoir sampling */
+    gBenchRand = gBenchRand * 1103515245 + 12345;
+    idx = (gBenchRand >> 1) % gBenchSeen;
+    if (idx < TPM2_BENCH_MAX_SAMPLES)
+        gBenchSamples[idx] = ns;
+}
 
 static inline void bench_stats_start(int* count, double* start)
 {
     *count = 0;
+    gBenchSampleCnt = 0;
+    gBenchSeen = 0;
+    gBenchMaxNs = 0;
     *start = gettime_secs(1);
+    gBenchLastNs = bench_time_ns();
 }
 
+/* Count the operation just done and check if the benchmark goes on, for
+ * gBenchIterations operations or else maxDurSec seconds */
 static inline int bench_stats_check(double start, int* count, double maxDurSec)
 {
+    UINT64 now = bench_time_ns();
+
+    bench_stats_sample(now - gBenchLastNs);
+    gBenchLastNs = now;
     (*count)++;
+    if (gBenchIterations > 0)
+        return (*count < gBenchIterations);
     return ((gettime_secs(0) - start) < maxDurSec);
 }
 
+static int bench_cmp_u64(const void* a, const void* b)
+{
+    UINT64 x = *(const UINT64*)a, y = *(const UINT64*)b;
+    return (x > y) - (x < y);
+}
+
+/* Latency percentiles of the last benchmark in nanoseconds */
+typedef struct BenchLatency {
+    UINT64 p50;
+    UINT64 p90;
+    UINT64 p99;
+    UINT64 max;
+} BenchLatency;
+
+static UINT64 bench_percentile(word32 pct)
+{
+    /* nearest rank */
+    word32 rank = (word32)(((UINT64)gBenchSampleCnt * pct + 99) / 100);
+    if (rank == 0)
+        rank = 1;
+    return gBenchSamples[rank - 1];
+}
+
+static void bench_stats_latency(BenchLatency* lat)
+{
+    XMEMSET(lat, 0, sizeof(*lat));
+    if (gBenchSampleCnt == 0)
+        return;
+    qsort(gBenchSamples, gBenchSampleCnt, sizeof(UINT64), bench_cmp_u64);
+    lat->p50 = bench_percentile(50);
+    lat->p90 = bench_percentile(90);
+    lat->p99 = bench_percentile(99);
+    lat->max = gBenchMaxNs;
+}
+
+/* Write a result to the JSON and CSV files. size is the strength of asym
+ * algorithms or the bytes per operation of the others. */
+static void bench_stats_record(const char* algo, int size, const char* op,
+    int count, double total, double bytesSec, const BenchLatency* lat)
+{
+#ifdef TPM2_BENCH_OUTPUT
+    double opsSec = (total > 0) ? count / total : 0;
+    double avgNs = (count > 0) ? total * 1000000000.0 / count : 0;
+
+    if (gBenchJson != NULL) {
+        fprintf(gBenchJson, "%s\n    {\"algo\": \"%s\", \"size\": %d, "
+            "\"op\": \"%s\", \"count\": %d, \"seconds\": %.6f, "
+            "\"ops_per_sec\": %.3f, \"bytes_per_sec\": %.0f, "
+            "\"avg_ns\": %.0f, \"p50_ns\": %llu, \"p90_ns\": %llu, "
+            "\"p99_ns\": %llu, \"max_ns\": %llu}",
+            (gBenchJsonCount++ > 0) ? "," : "", algo, size, op, count, total,
+            opsSec, bytesSec, avgNs, (unsigned long long)lat->p50,
+            (unsigned long long)lat->p90, (unsigned long long)lat->p99,
+            (unsigned long long)lat->max);
+    }
+    if (gBenchCsv != NULL) {
+        fprintf(gBenchCsv, "%s,%d,%s,%d,%.6f,%.3f,%.0f,%.0f,%llu,%llu,%llu,"
+            "%llu\n", algo, size, op, count, total, opsSec, bytesSec, avgNs,
+            (unsigned long long)lat->p50, (unsigned long long)lat->p90,
+            (unsigned long long)lat->p99, (unsigned long long)lat->max);
+    }
+#else
+    (void)algo; (void)size; (void)op; (void)count; (void)total;
+    (void)bytesSec; (void)lat;
+#endif
+}
+
+static void bench_stats_print_latency(const BenchLatency* lat)
+{
+    printf("%-16s latency p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, "
+        "max %.3f ms\n", "", lat->p50 / 1000000.0, lat->p90 / 1000000.0,
+        lat->p99 / 1000000.0, lat->max / 1000000.0);
+}
+
 /* countSz is number of bytes that 1 count represents. Normally bench_size,
  * except for AES direct that operates on AES_BLOCK_SIZE blocks */
 static void bench_stats_sym_finish(const char* desc, int count, int countSz,
@@ -58,6 +261,7 @@ static void bench_stats_sym_finish(const char* desc, int count, int countSz,
 {
     double total, persec = 0, blocks = count;
     const char* blockType;
+    BenchLatency lat;
 
     total = gettime_secs(0) - start;
 
@@ -103,12 +307,17 @@ static void bench_stats_sym_finish(const char* desc, int count, int countSz,
     /* format and print to terminal */
     printf("%-16s %5.0f %s took %5.3f seconds, %8.3f %s/s\n",
         desc, blocks, blockType, total, persec, blockType);
+    bench_stats_latency(&lat);
+    bench_stats_print_latency(&lat);
+    bench_stats_record(desc, countSz, "", count, total,
+        (total > 0) ? (double)count * countSz / total : 0, &lat);
 }
 
 static void bench_stats_asym_finish(const char* algo, int strength,
     const char* desc, int count, double start)
 {
     double total, each = 0, opsSec, milliEach;
+    BenchLatency lat;
 
     total = gettime_secs(0) - start;
     if (count > 0)
@@ -119,6 +328,9 @@ static void bench_stats_asym_finish(const char* algo, int strength,
     printf("%-6s %5d %-9s %6d ops took %5.3f sec, avg %5.3f ms,"
         " %.3f ops/sec\n", algo, strength, desc,
         count, total, milliEach, opsSec);
+    bench_stats_latency(&lat);
+    bench_stats_print_latency(&lat);
+    bench_stats_record(algo, strength, desc, count, total, 0, &lat);
 }
 
 static int bench_sym_hash(WOLFTPM2_DEV* dev, const char* desc, int algo,
@@ -139,7 +351,7 @@ static int bench_sym_hash(WOLFTPM2_DEV* dev, const char* desc, int algo,
         if (rc != 0) goto exit;
         rc = wolfTPM2_HashFinish(dev, &hash, digest, &digestSz);
         if (rc != 0) goto exit;
-    } while (bench_stats_check(start, &count, TPM2_BENCH_DURATION_SEC));
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
     bench_stats_sym_finish(desc, count, inSz, start);
 
 exit:
@@ -173,7 +385,7 @@ static int bench_sym_aes(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* storageKey,
         rc = wolfTPM2_EncryptDecrypt(dev, &aesKey, in, out, inOutSz, NULL, 0,
             isDecrypt);
         if (rc != 0) goto exit;
-    } while (bench_stats_check(start, &count, TPM2_BENCH_DURATION_SEC));
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
     bench_stats_sym_finish(desc, count, inOutSz, start);
 
 exit:
@@ -182,11 +394,286 @@ exit:
     return rc;
 }
 
+/* PCR extend and read of a resettable (debug) PCR */
+#ifndef TPM2_BENCH_PCR
+#define TPM2_BENCH_PCR                  16
+#endif
+static int bench_pcr(WOLFTPM2_DEV* dev, byte* digest)
+{
+    int rc;
+    int count;
+    int digestSz;
+    double start;
+
+    XMEMSET(digest, 0x11, TPM_SHA256_DIGEST_SIZE);
+    bench_stats_start(&count, &start);
+    do {
+        rc = wolfTPM2_ExtendPCR(dev, TPM2_BENCH_PCR, TPM_ALG_SHA256, digest,
+            TPM_SHA256_DIGEST_SIZE);
+        if (rc != 0) goto exit;
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
+    bench_stats_asym_finish("PCR", TPM2_BENCH_PCR, "extend", count, start);
+
+    bench_stats_start(&count, &start);
+    do {
+        digestSz = TPM_SHA256_DIGEST_SIZE;
+        rc = wolfTPM2_ReadPCR(dev, TPM2_BENCH_PCR, TPM_ALG_SHA256, digest,
+            &digestSz);
+        if (rc != 0) goto exit;
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
+    bench_stats_asym_finish("PCR", TPM2_BENCH_PCR, "read", count, start);
+
+exit:
+    return rc;
+}
+
+/* NV write and read throughput. NV writes wear the TPM flash, so this only
+ * runs with -nv. */
+static int bench_nv(WOLFTPM2_DEV* dev, byte* buf, word32 bufSz)
+{
+    int rc;
+    int count;
+    double start;
+    word32 nvAttributes;
+    word32 readSz;
+    WOLFTPM2_HANDLE parent;
+    WOLFTPM2_NV nv;
+
+    XMEMSET(&parent, 0, sizeof(parent));
+    parent.hndl = TPM_RH_OWNER;
+    rc = wolfTPM2_GetNvAttributesTemplate(parent.hndl, &nvAttributes);
+    if (rc != 0) return rc;
+    rc = wolfTPM2_NVCreateAuth(dev, &parent, &nv, TPM2_DEMO_NV_BENCH_INDEX,
+        nvAttributes, bufSz, (byte*)gNvAuth, sizeof(gNvAuth)-1);
+    if (rc == NOT_COMPILED_IN) {
+        printf("Benchmark NV not supported!\n");
+        return 0;
+    }
+    if (rc == TPM_RC_NV_DEFINED) {
+        /* not ours, do not overwrite or delete it */
+        printf("Benchmark NV index 0x%x already defined, skipped\n",
+            TPM2_DEMO_NV_BENCH_INDEX);
+        return 0;
+    }
+    if (rc != 0) return rc;
+
+    XMEMSET(buf, 0x11, bufSz);
+    bench_stats_start(&count, &start);
+    do {
+        rc = wolfTPM2_NVWriteAuth(dev, &nv, TPM2_DEMO_NV_BENCH_INDEX, buf,
+            bufSz, 0);
+        if (rc != 0) goto exit;
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
+    bench_stats_sym_finish("NV write", count, bufSz, start);
+
+    bench_stats_start(&count, &start);
+    do {
+        readSz = bufSz;
+        rc = wolfTPM2_NVReadAuth(dev, &nv, TPM2_DEMO_NV_BENCH_INDEX, buf,
+            &readSz, 0);
+        if (rc != 0) goto exit;
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
+    bench_stats_sym_finish("NV read", count, bufSz, start);
+
+exit:
+    /* only reached once the index was created */
+    wolfTPM2_NVDeleteAuth(dev, &parent, TPM2_DEMO_NV_BENCH_INDEX);
+    return rc;
+}
+
+/* Cost of starting an authorization session, salted with the storage key
+ * when given */
+static int bench_session(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* saltKey,
+    const char* desc)
+{
+    int rc;
+    int count;
+    double start;
+    WOLFTPM2_SESSION session;
+
+    bench_stats_start(&count, &start);
+    do {
+        rc = wolfTPM2_StartSession(dev, &session, saltKey, NULL, TPM_SE_HMAC,
+            TPM_ALG_NULL);
+        if (rc != 0) goto exit;
+        rc = wolfTPM2_UnloadHandle(dev, &session.handle);
+        if (rc != 0) goto exit;
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
+    bench_stats_asym_finish("Session", 0, desc, count, start);
+
+exit:
+    return rc;
+}
+
+/* Key creation as TPM2_Create then TPM2_Load, against one TPM2_CreateLoaded
+ * when the TPM has it */
+static int bench_keygen(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* storageKey,
+    TPMT_PUBLIC* publicTemplate, const char* algo, int strength,
+    double maxDurSec)
+{
+    int rc;
+    int count;
+    double start;
+    WOLFTPM2_KEYBLOB keyBlob;
+
+    bench_stats_start(&count, &start);
+    do {
+        rc = wolfTPM2_CreateKey(dev, &keyBlob, &storageKey->handle,
+            publicTemplate, (byte*)gKeyAuth, sizeof(gKeyAuth)-1);
+        if (rc == 0)
+            rc = wolfTPM2_LoadKey(dev, &keyBlob, &storageKey->handle);
+        if (rc != 0) goto exit;
+        rc = wolfTPM2_UnloadHandle(dev, &keyBlob.handle);
+        if (rc != 0) goto exit;
+    } while (bench_stats_check(start, &count, maxDurSec));
+    bench_stats_asym_finish(algo, strength, "Create+Load", count, start);
+
+    bench_stats_start(&count, &start);
+    do {
+        rc = wolfTPM2_CreateLoadedKey(dev, &keyBlob, &storageKey->handle,
+            publicTemplate, (byte*)gKeyAuth, sizeof(gKeyAuth)-1);
+        if (rc == TPM_RC_COMMAND_CODE) {
+            printf("%-6s %5d CreateLoaded not supported\n", algo, strength);
+            rc = 0;
+            goto exit;
+        }
+        if (rc != 0) goto exit;
+        rc = wolfTPM2_UnloadHandle(dev, &keyBlob.handle);
+        if (rc != 0) goto exit;
+    } while (bench_stats_check(start, &count, maxDurSec));
+    bench_stats_asym_finish(algo, strength, "CreateLoaded", count, start);
+
+exit:
+    return rc;
+}
+
+#ifndef WOLFTPM2_NO_WOLFCRYPT
+/* GetRandom with the response encrypted by a salted session */
+static int bench_param_enc(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* storageKey,
+    const char* desc, TPM_ALG_ID paramEncAlg, byte* buf, word32 bufSz)
+{
+    int rc;
+    int count;
+    double start;
+    WOLFTPM2_SESSION session;
+
+    XMEMSET(&session, 0, sizeof(session));
+    rc = wolfTPM2_StartSession(dev, &session, storageKey, NULL, TPM_SE_HMAC,
+        paramEncAlg);
+    if (rc != 0) goto exit;
+    rc = wolfTPM2_SetAuthSession(dev, 1, &session, (TPMA_SESSION_decrypt |
+        TPMA_SESSION_encrypt | TPMA_SESSION_continueSession));
+    if (rc != 0) goto exit;
+
+    bench_stats_start(&count, &start);
+    do {
+        rc = wolfTPM2_GetRandom(dev, buf, bufSz);
+        if (rc != 0) goto exit;
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
+    bench_stats_sym_finish(desc, count, bufSz, start);
+
+exit:
+    wolfTPM2_UnsetAuth(dev, 1);
+    wolfTPM2_UnloadHandle(dev, &session.handle);
+    return rc;
+}
+#endif
+
+#ifdef WOLFTPM_LINUX_DEV
+/* Compare opening the TPM device for each command against keeping it open */
+static int bench_linux_dev(WOLFTPM2_DEV* dev, byte* buf, word32 bufSz)
+{
+    int rc;
+    int count;
+    double start;
+    const char* devPath = dev->ctx.devCtx.path;
+    int keepOpen = dev->ctx.devCtx.keepOpen;
+
+    rc = TPM2_LINUX_SetDev(&dev->ctx, devPath, 0);
+    if (rc == 0 && !dev->ctx.devCtx.keepOpen) {
+        bench_stats_start(&count, &start);
+        do {
+            rc = wolfTPM2_GetRandom(dev, buf, bufSz);
+            if (rc != 0) goto exit;
+        } while (bench_stats_check(start, &count, gBenchDurationSec));
+        bench_stats_sym_finish("RNG (reopen)", count, bufSz, start);
+    }
+
+    rc = TPM2_LINUX_SetDev(&dev->ctx, devPath, 1);
+    if (rc != 0) goto exit;
+    bench_stats_start(&count, &start);
+    do {
+        rc = wolfTPM2_GetRandom(dev, buf, bufSz);
+        if (rc != 0) goto exit;
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
+    bench_stats_sym_finish("RNG (keep open)", count, bufSz, start);
+
+exit:
+    /* restore original mode */
+    TPM2_LINUX_SetDev(&dev->ctx, devPath, keepOpen);
+    return rc;
+}
+#endif
+
+#ifdef WOLFTPM_SWTPM
+/* Compare swtpm round trips over TCP and a Unix domain socket */
+static int bench_swtpm(WOLFTPM2_DEV* dev, byte* buf, word32 bufSz,
+    const char* unixPath)
+{
+    int rc;
+    int count;
+    double start;
+
+    /* the device may be on another built-in transport */
+    rc = TPM2_SetTransport(&dev->ctx, TPM2_SWTPM_GetTransport(), NULL);
+    if (rc == 0)
+        rc = TPM2_SWTPM_SetServer(&dev->ctx, NULL, NULL, 1);
+    if (rc != 0) goto exit;
+    bench_stats_start(&count, &start);
+    do {
+        rc = wolfTPM2_GetRandom(dev, buf, bufSz);
+        if (rc != 0) goto exit;
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
+    bench_stats_asym_finish("RNG", bufSz, "tcp", count, start);
+
+    rc = TPM2_SWTPM_SetUnixSocket(&dev->ctx, unixPath, 1);
+    if (rc != 0) goto exit;
+    bench_stats_start(&count, &start);
+    do {
+        rc = wolfTPM2_GetRandom(dev, buf, bufSz);
+        if (rc != 0) goto exit;
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
+    bench_stats_asym_finish("RNG", bufSz, "unix", count, start);
+
+exit:
+    if (rc != 0) {
+        printf("swtpm transport benchmark failed 0x%x: %s\n", rc,
+            TPM2_GetRCString(rc));
+    }
+    return rc;
+}
+#endif
+
 static void usage(void)
 {
     printf("Expected usage:\n");
     printf("./examples/bench/bench [-aes/xor]\n");
     printf("* -aes/xor: Use Parameter Encryption\n");
+#ifdef WOLFTPM_SWTPM
+    printf("* -unix=path: Compare swtpm TCP and Unix socket (path) only\n");
+#endif
+    printf("* -duration=sec: Run each benchmark for sec seconds (default %d, "
+        "key gen %d)\n", TPM2_BENCH_DURATION_SEC, TPM2_BENCH_DURATION_KEYGEN_SEC);
+    printf("* -iterations=n: Run each benchmark n times instead\n");
+    printf("* -nv: Also benchmark NV write/read (wears the TPM NV)\n");
+#ifdef TPM2_BENCH_OUTPUT
+    printf("* -json=file / -csv=file: Write the results and latency "
+        "percentiles\n");
+#endif
+#ifdef TPM2_BENCH_REPLAY
+    printf("* -record=file: Save the TPM commands and responses to a trace\n");
+    printf("* -replay=file: Answer the commands from a trace (host cost only)\n");
+#endif
 }
 
 /******************************************************************************/
@@ -213,6 +700,22 @@ int TPM2_Wrapper_BenchArgs(void* userCtx, int argc, char *argv[])
     int count;
     TPM_ALG_ID paramEncAlg = TPM_ALG_NULL;
     WOLFTPM2_SESSION tpmSession;
+#ifdef WOLFTPM_SWTPM
+    const char* unixPath = NULL;
+#endif
+    int benchNv = 0;
+    static byte hashData[TPM2_BENCH_HASH_MAX];
+#ifdef TPM2_BENCH_OUTPUT
+    const char* jsonFile = NULL;
+    const char* csvFile = NULL;
+    WOLFTPM2_CAPS caps;
+#endif
+#ifdef TPM2_BENCH_REPLAY
+    const char* recordFile = NULL;
+    const char* replayFile = NULL;
+    TPM2_REPLAY replay;
+    word32 traceSz = sizeof(gBenchTrace);
+#endif
 
     if (argc >= 2) {
         if (XSTRNCMP(argv[1], "-?", 2) == 0 ||
@@ -229,6 +732,37 @@ int TPM2_Wrapper_BenchArgs(void* userCtx, int argc, char *argv[])
         if (XSTRNCMP(argv[argc-1], "-xor", 4) == 0) {
             paramEncAlg = TPM_ALG_XOR;
         }
+        if (XSTRNCMP(argv[argc-1], "-duration=", 10) == 0) {
+            gBenchDurationSec = atof(argv[argc-1] + 10);
+            gBenchKeygenSec = gBenchDurationSec;
+        }
+        if (XSTRNCMP(argv[argc-1], "-iterations=", 12) == 0) {
+            gBenchIterations = atoi(argv[argc-1] + 12);
+        }
+        if (XSTRNCMP(argv[argc-1], "-nv", 4) == 0) {
+            benchNv = 1;
+        }
+    #ifdef TPM2_BENCH_OUTPUT
+        if (XSTRNCMP(argv[argc-1], "-json=", 6) == 0) {
+            jsonFile = argv[argc-1] + 6;
+        }
+        if (XSTRNCMP(argv[argc-1], "-csv=", 5) == 0) {
+            csvFile = argv[argc-1] + 5;
+        }
+    #endif
+    #ifdef WOLFTPM_SWTPM
+        if (XSTRNCMP(argv[argc-1], "-unix=", 6) == 0) {
+            unixPath = argv[argc-1] + 6;
+        }
+    #endif
+    #ifdef TPM2_BENCH_REPLAY
+        if (XSTRNCMP(argv[argc-1], "-record=", 8) == 0) {
+            recordFile = argv[argc-1] + 8;
+        }
+        if (XSTRNCMP(argv[argc-1], "-replay=", 8) == 0) {
+            replayFile = argv[argc-1] + 8;
+        }
+    #endif
         argc--;
     }
 
@@ -236,6 +770,9 @@ int TPM2_Wrapper_BenchArgs(void* userCtx, int argc, char *argv[])
     XMEMSET(&eccKey, 0, sizeof(eccKey));
     XMEMSET(&rsaKey, 0, sizeof(rsaKey));
     XMEMSET(&tpmSession, 0, sizeof(tpmSession));
+#ifdef TPM2_BENCH_REPLAY
+    XMEMSET(&replay, 0, sizeof(replay));
+#endif
 
 
     printf("TPM2 Benchmark using Wrapper API's\n");
@@ -245,6 +782,65 @@ int TPM2_Wrapper_BenchArgs(void* userCtx, int argc, char *argv[])
     rc = wolfTPM2_Init(&dev, TPM2_IoCb, userCtx);
     if (rc != 0) return rc;
 
+#if defined(TPM2_BENCH_TIS) && defined(WOLFTPM_TIS_PROFILE)
+    TPM2_TIS_SetProfile(&dev.ctx, &gBenchProfile);
+#endif
+
+#ifdef TPM2_BENCH_OUTPUT
+    /* identify the TPM, to compare results across firmware versions */
+    XMEMSET(&caps, 0, sizeof(caps));
+    wolfTPM2_GetCapabilities(&dev, &caps);
+    if (jsonFile != NULL) {
+        gBenchJson = fopen(jsonFile, "w");
+        if (gBenchJson == NULL) {
+            printf("Cannot open %s\n", jsonFile);
+            rc = BAD_FUNC_ARG; goto exit;
+        }
+        fprintf(gBenchJson, "{\"library\": \"wolfTPM\", \"version\": \"%s\", "
+            "\"tpm\": {\"mfg\": \"%s\", \"vendor\": \"%s\", "
+            "\"fw\": \"%u.%u.%u\"}, \"param_enc\": \"%s\",\n"
+            "  \"results\": [", LIBWOLFTPM_VERSION_STRING, caps.mfgStr,
+            caps.vendorStr, caps.fwVerMajor, caps.fwVerMinor,
+            (unsigned)caps.fwVerVendor, TPM2_GetAlgName(paramEncAlg));
+    }
+    if (csvFile != NULL) {
+        gBenchCsv = fopen(csvFile, "w");
+        if (gBenchCsv == NULL) {
+            printf("Cannot open %s\n", csvFile);
+            rc = BAD_FUNC_ARG; goto exit;
+        }
+        fprintf(gBenchCsv, "algo,size,op,count,seconds,ops_per_sec,"
+            "bytes_per_sec,avg_ns,p50_ns,p90_ns,p99_ns,max_ns\n");
+    }
+#endif
+
+#ifdef TPM2_BENCH_REPLAY
+    /* the TPM startup is not part of the trace */
+    if (recordFile != NULL) {
+        rc = TPM2_Replay_Record(&dev.ctx, &replay, recordFile);
+        if (rc != 0) goto exit;
+        printf("\tRecording trace: %s\n", recordFile);
+    }
+    else if (replayFile != NULL) {
+        rc = TPM2_Replay_LoadFile(replayFile, gBenchTrace, &traceSz);
+        if (rc == 0)
+            rc = TPM2_Replay_Start(&dev.ctx, &replay, gBenchTrace, traceSz,
+                TPM2_REPLAY_FLAG_LOOSE);
+        if (rc != 0) goto exit;
+        printf("\tReplaying trace: %s (%u commands)\n", replayFile,
+            replay.entries);
+    }
+#endif
+
+#ifdef WOLFTPM_SWTPM
+    if (unixPath != NULL) {
+        /* the two endpoints may be different simulator instances, so only
+         * run the transport comparison */
+        rc = bench_swtpm(&dev, message.buffer, 32, unixPath);
+        goto exit;
+    }
+#endif
+
     /* See if primary storage key already exists */
     rc = getPrimaryStoragekey(&dev, &storageKey, TPM_ALG_RSA);
     if (rc != 0) goto exit;
@@ -264,12 +860,43 @@ int TPM2_Wrapper_BenchArgs(void* userCtx, int argc, char *argv[])
     }
 
     /* RNG Benchmark */
+#ifdef TPM2_BENCH_TIS
+    TPM2_TIS_ResetStats(&dev.ctx);
+#endif
     bench_stats_start(&count, &start);
     do {
         rc = wolfTPM2_GetRandom(&dev, message.buffer, sizeof(message.buffer));
         if (rc != 0) goto exit;
-    } while (bench_stats_check(start, &count, TPM2_BENCH_DURATION_SEC));
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
     bench_stats_sym_finish("RNG", count, sizeof(message.buffer), start);
+#ifdef TPM2_BENCH_TIS
+    {
+        TPM2_TIS_STATS tisStats;
+        if (TPM2_TIS_GetStats(&dev.ctx, &tisStats) == 0 &&
+                tisStats.commands > 0) {
+            printf("RNG TIS bus accesses: %u per command (last %u)\n",
+                (unsigned)((tisStats.regReads + tisStats.regWrites +
+                    tisStats.fifoReads + tisStats.fifoWrites) /
+                    tisStats.commands),
+                (unsigned)tisStats.lastCmdAccesses);
+        }
+    }
+#endif
+
+    /* RNG latency of a small request */
+    bench_stats_start(&count, &start);
+    do {
+        rc = wolfTPM2_GetRandom(&dev, message.buffer, 32);
+        if (rc != 0) goto exit;
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
+    bench_stats_sym_finish("RNG 32", count, 32, start);
+
+#ifdef WOLFTPM_LINUX_DEV
+    if (TPM2_GetTransport(&dev.ctx, NULL) == TPM2_LINUX_GetTransport()) {
+        rc = bench_linux_dev(&dev, message.buffer, sizeof(message.buffer));
+        if (rc != 0) goto exit;
+    }
+#endif
 
     /* AES Benchmarks */
     /* AES CBC */
@@ -331,6 +958,42 @@ int TPM2_Wrapper_BenchArgs(void* userCtx, int argc, char *argv[])
     rc = bench_sym_hash(&dev, "SHA512", TPM_ALG_SHA512, message.buffer,
         sizeof(message.buffer), cipher.buffer, TPM_SHA512_DIGEST_SIZE);
     if (rc != 0 && (rc & TPM_RC_HASH) != TPM_RC_HASH) goto exit;
+    /* SHA256 sequences of other sizes */
+    XMEMSET(hashData, 0x11, sizeof(hashData));
+    rc = bench_sym_hash(&dev, "SHA256 64B", TPM_ALG_SHA256, hashData, 64,
+        cipher.buffer, TPM_SHA256_DIGEST_SIZE);
+    if (rc != 0 && (rc & TPM_RC_HASH) != TPM_RC_HASH) goto exit;
+    rc = bench_sym_hash(&dev, "SHA256 16KB", TPM_ALG_SHA256, hashData,
+        sizeof(hashData), cipher.buffer, TPM_SHA256_DIGEST_SIZE);
+    if (rc != 0 && (rc & TPM_RC_HASH) != TPM_RC_HASH) goto exit;
+
+    /* PCR Benchmarks */
+    rc = bench_pcr(&dev, cipher.buffer);
+    if (rc != 0) goto exit;
+
+    /* NV Benchmarks */
+    if (benchNv) {
+        rc = bench_nv(&dev, message.buffer, TPM2_DEMO_NV_TEST_SIZE);
+        if (rc != 0) goto exit;
+    }
+
+    /* Session Benchmarks */
+    rc = bench_session(&dev, NULL, "unsalted");
+    if (rc != 0) goto exit;
+#ifndef WOLFTPM2_NO_WOLFCRYPT
+    rc = bench_session(&dev, &storageKey, "salted");
+    if (rc != 0) goto exit;
+
+    /* Parameter encryption, when not already on for all benchmarks */
+    if (paramEncAlg == TPM_ALG_NULL) {
+        rc = bench_param_enc(&dev, &storageKey, "RNG (XOR)", TPM_ALG_XOR,
+            message.buffer, sizeof(message.buffer));
+        if (rc != 0) goto exit;
+        rc = bench_param_enc(&dev, &storageKey, "RNG (CFB)", TPM_ALG_CFB,
+            message.buffer, sizeof(message.buffer));
+        if (rc != 0) goto exit;
+    }
+#endif
 
 
     /* Create RSA key for encrypt/decrypt */
@@ -347,7 +1010,7 @@ int TPM2_Wrapper_BenchArgs(void* userCtx, int argc, char *argv[])
         rc = wolfTPM2_CreateAndLoadKey(&dev, &rsaKey, &storageKey.handle,
             &publicTemplate, (byte*)gKeyAuth, sizeof(gKeyAuth)-1);
         if (rc != 0) goto exit;
-    } while (bench_stats_check(start, &count, TPM2_BENCH_DURATION_KEYGEN_SEC));
+    } while (bench_stats_check(start, &count, gBenchKeygenSec));
     bench_stats_asym_finish("RSA", 2048, "key gen", count, start);
 
     /* Perform RSA encrypt / decrypt (no pad) */
@@ -360,7 +1023,7 @@ int TPM2_Wrapper_BenchArgs(void* userCtx, int argc, char *argv[])
         rc = wolfTPM2_RsaEncrypt(&dev, &rsaKey, TPM_ALG_NULL,
             message.buffer, message.size, cipher.buffer, &cipher.size);
         if (rc != 0) goto exit;
-    } while (bench_stats_check(start, &count, TPM2_BENCH_DURATION_SEC));
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
     bench_stats_asym_finish("RSA", 2048, "Public", count, start);
 
     bench_stats_start(&count, &start);
@@ -369,7 +1032,7 @@ int TPM2_Wrapper_BenchArgs(void* userCtx, int argc, char *argv[])
         rc = wolfTPM2_RsaDecrypt(&dev, &rsaKey, TPM_ALG_NULL,
             cipher.buffer, cipher.size, plain.buffer, &plain.size);
         if (rc != 0) goto exit;
-    } while (bench_stats_check(start, &count, TPM2_BENCH_DURATION_SEC));
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
     bench_stats_asym_finish("RSA", 2048, "Private", count, start);
 
 
@@ -383,7 +1046,7 @@ int TPM2_Wrapper_BenchArgs(void* userCtx, int argc, char *argv[])
         rc = wolfTPM2_RsaEncrypt(&dev, &rsaKey, TPM_ALG_OAEP,
             message.buffer, message.size, cipher.buffer, &cipher.size);
         if (rc != 0) goto exit;
-    } while (bench_stats_check(start, &count, TPM2_BENCH_DURATION_SEC));
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
     bench_stats_asym_finish("RSA", 2048, "Pub  OAEP", count, start);
 
     bench_stats_start(&count, &start);
@@ -392,7 +1055,7 @@ int TPM2_Wrapper_BenchArgs(void* userCtx, int argc, char *argv[])
         rc = wolfTPM2_RsaDecrypt(&dev, &rsaKey, TPM_ALG_OAEP,
             cipher.buffer, cipher.size, plain.buffer, &plain.size);
         if (rc != 0) goto exit;
-    } while (bench_stats_check(start, &count, TPM2_BENCH_DURATION_SEC));
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
     bench_stats_asym_finish("RSA", 2048, "Priv OAEP", count, start);
 
     rc = wolfTPM2_UnloadHandle(&dev, &rsaKey.handle);
@@ -414,8 +1077,11 @@ int TPM2_Wrapper_BenchArgs(void* userCtx, int argc, char *argv[])
         rc = wolfTPM2_CreateAndLoadKey(&dev, &eccKey, &storageKey.handle,
             &publicTemplate, (byte*)gKeyAuth, sizeof(gKeyAuth)-1);
         if (rc != 0) goto exit;
-    } while (bench_stats_check(start, &count, TPM2_BENCH_DURATION_SEC));
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
     bench_stats_asym_finish("ECC", 256, "key gen", count, start);
+    rc = bench_keygen(&dev, &storageKey, &publicTemplate, "ECC", 256,
+        gBenchDurationSec);
+    if (rc != 0) goto exit;
 
     /* Perform sign / verify */
     message.size = TPM_SHA256_DIGEST_SIZE; /* test message 0x11,0x11,etc */
@@ -427,7 +1093,7 @@ int TPM2_Wrapper_BenchArgs(void* userCtx, int argc, char *argv[])
         rc = wolfTPM2_SignHash(&dev, &eccKey, message.buffer, message.size,
             cipher.buffer, &cipher.size);
         if (rc != 0) goto exit;
-    } while (bench_stats_check(start, &count, TPM2_BENCH_DURATION_SEC));
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
     bench_stats_asym_finish("ECDSA", 256, "sign", count, start);
 
     bench_stats_start(&count, &start);
@@ -435,7 +1101,7 @@ int TPM2_Wrapper_BenchArgs(void* userCtx, int argc, char *argv[])
         rc = wolfTPM2_VerifyHash(&dev, &eccKey, cipher.buffer, cipher.size,
             message.buffer, message.size);
         if (rc != 0) goto exit;
-    } while (bench_stats_check(start, &count, TPM2_BENCH_DURATION_SEC));
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
     bench_stats_asym_finish("ECDSA", 256, "verify", count, start);
 
     rc = wolfTPM2_UnloadHandle(&dev, &eccKey.handle);
@@ -459,7 +1125,7 @@ int TPM2_Wrapper_BenchArgs(void* userCtx, int argc, char *argv[])
         rc = wolfTPM2_ECDHGen(&dev, &eccKey, &pubPoint,
             cipher.buffer, &cipher.size);
         if (rc != 0) goto exit;
-    } while (bench_stats_check(start, &count, TPM2_BENCH_DURATION_SEC));
+    } while (bench_stats_check(start, &count, gBenchDurationSec));
     bench_stats_asym_finish("ECDHE", 256, "agree", count, start);
 
     rc = wolfTPM2_UnloadHandle(&dev, &eccKey.handle);
@@ -475,6 +1141,29 @@ exit:
     wolfTPM2_UnloadHandle(&dev, &eccKey.handle);
     wolfTPM2_UnloadHandle(&dev, &tpmSession.handle);
 
+#ifdef TPM2_BENCH_OUTPUT
+    if (gBenchJson != NULL) {
+        fprintf(gBenchJson, "\n  ]}\n");
+        fclose(gBenchJson);
+        gBenchJson = NULL;
+    }
+    if (gBenchCsv != NULL) {
+        fclose(gBenchCsv);
+        gBenchCsv = NULL;
+    }
+#endif
+#if defined(TPM2_BENCH_TIS) && defined(WOLFTPM_TIS_PROFILE)
+    bench_tis_profile(&gBenchProfile);
+    TPM2_TIS_SetProfile(&dev.ctx, NULL);
+#endif
+#ifdef TPM2_BENCH_REPLAY
+    if (replayFile != NULL && replay.commands > 0) {
+        printf("Replay: %u commands, %u exact, %u masked, %u loose, "
+            "%u missed\n", replay.commands, replay.exact, replay.masked,
+            replay.loose, replay.misses);
+    }
+    TPM2_Replay_Stop(&dev.ctx, &replay);
+#endif
     wolfTPM2_Cleanup(&dev);
 
     return rc;
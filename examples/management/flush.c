@@ -41,13 +41,15 @@ static void usage(void)
     printf("./tool/management/flush [handle]\n");
     printf("* handle is a valid TPM2.0 handle index\n");
     printf("Note: Default behavior, without parameters, the tool flushes\n"
-           "\tall transient TPM2.0 objects (0x8000000x, 0x300000x)\n");
+           "\tall loaded TPM2.0 objects and sessions (0x80xxxxxx, 0x02xxxxxx,"
+           "\n\t0x03xxxxxx) reported by the TPM\n");
 }
 
 int TPM2_Flush_Tool(void* userCtx, int argc, char *argv[])
 {
     int rc = TPM_RC_FAILURE;
     int allTransientObjects = 0, handle = 0;
+    word32 flushed = 0, failed = 0;
     WOLFTPM2_DEV dev;
     FlushContext_In flushCtx;
 
@@ -78,6 +80,21 @@ int TPM2_Flush_Tool(void* userCtx, int argc, char *argv[])
     printf("wolfTPM2_Init: success\n");
 
     if (allTransientObjects) {
+        /* Flush the objects and sessions the TPM reports */
+        rc = wolfTPM2_UnloadHandles_Loaded(&dev, WOLFTPM2_FLUSH_ALL, &flushed,
+            &failed);
+        if (rc == TPM_RC_SUCCESS || failed > 0) {
+            printf("Freed %d objects and sessions, %d failed\n",
+                (int)flushed, (int)failed);
+        }
+        if (failed > 0) {
+            printf("First failure 0x%x: %s\n", rc, TPM2_GetRCString(rc));
+        }
+    }
+    if (allTransientObjects && rc != TPM_RC_SUCCESS && failed == 0) {
+        printf("Listing handles failed 0x%x: %s, trying each handle\n",
+            rc, TPM2_GetRCString(rc));
+        rc = TPM_RC_SUCCESS;
         /* Flush key objects */
         for (handle=0x80000000; handle < (int)0x8000000A; handle+=4) {
             flushCtx.flushHandle = handle;
@@ -91,7 +108,7 @@ int TPM2_Flush_Tool(void* userCtx, int argc, char *argv[])
             TPM2_FlushContext(&flushCtx);
         }
     }
-    else {
+    else if (!allTransientObjects) {
         flushCtx.flushHandle = handle;
         printf("Freeing %X object\n", handle);
         TPM2_FlushContext(&flushCtx);
@@ -30,9 +30,68 @@
 /******************************************************************************/
 /* --- BEGIN IO Callback Logic -- */
 /******************************************************************************/
-#if ! (defined(WOLFTPM_LINUX_DEV) || \
-       defined(WOLFTPM_SWTPM) ||     \
-       defined(WOLFTPM_WINAPI) )
+#if defined(WOLFTPM_TIS) && (defined(WOLFTPM_TIS_SIM) || \
+    !(defined(WOLFTPM_LINUX_DEV) || defined(WOLFTPM_SWTPM)))
+
+#ifdef WOLFTPM_TIS_SIM
+/* TIS register simulator, commands run on a SW TPM. The bus model can be
+ * set with environment variables for benchmarking, for example:
+ *   TPM2_TIS_SIM_BYTE_NS=800 TPM2_TIS_SIM_BURST=32 ./examples/bench/bench */
+#include <wolftpm/tpm2_tis_sim.h>
+#include <stdlib.h>
+
+static TPM2_TIS_SIM gTisSim;
+static int gTisSimInit = 0;
+
+static void TPM2_TisSimEnv(const char* name, word32* value)
+{
+    const char* env = getenv(name);
+    if (env != NULL)
+        *value = (word32)strtoul(env, NULL, 0);
+}
+
+static TPM2_TIS_SIM* TPM2_TisSimGet(void)
+{
+    word32 val;
+    const char* env;
+
+    if (!gTisSimInit) {
+        TPM2_TisSim_Init(&gTisSim);
+        if ((env = getenv("TPM2_TIS_SIM_HOST")) != NULL)
+            gTisSim.host = env;
+        if ((env = getenv("TPM2_TIS_SIM_PORT")) != NULL)
+            gTisSim.port = env;
+        val = gTisSim.burstCount;
+        TPM2_TisSimEnv("TPM2_TIS_SIM_BURST", &val);
+        gTisSim.burstCount = (val > 0 && val <= 0xFFFF) ? (word16)val : 1;
+        val = gTisSim.waitStates;
+        TPM2_TisSimEnv("TPM2_TIS_SIM_WAIT_STATES", &val);
+        gTisSim.waitStates = (word16)val;
+        TPM2_TisSimEnv("TPM2_TIS_SIM_ACCESS_NS", &gTisSim.accessNs);
+        TPM2_TisSimEnv("TPM2_TIS_SIM_BYTE_NS", &gTisSim.byteNs);
+        TPM2_TisSimEnv("TPM2_TIS_SIM_EXEC_US", &gTisSim.execUs);
+        gTisSimInit = 1;
+    }
+    return &gTisSim;
+}
+
+#ifdef WOLFTPM_ADV_IO
+int TPM2_IoCb(TPM2_CTX* ctx, int isRead, word32 addr, byte* buf, word16 size,
+    void* userCtx)
+{
+    (void)userCtx;
+    return TPM2_TisSim_IoCb(ctx, isRead, addr, buf, size, TPM2_TisSimGet());
+}
+#else
+int TPM2_IoCb(TPM2_CTX* ctx, const byte* txBuf, byte* rxBuf,
+    word16 xferSz, void* userCtx)
+{
+    (void)userCtx;
+    return TPM2_TisSim_IoCb(ctx, txBuf, rxBuf, xferSz, TPM2_TisSimGet());
+}
+#endif /* WOLFTPM_ADV_IO */
+
+#else /* !WOLFTPM_TIS_SIM */
 
 /* Configuration for the SPI interface */
 /* SPI Requirement: Mode 0 (CPOL=0, CPHA=0) */
@@ -51,6 +110,7 @@
         #include <sys/ioctl.h>
         #include <sys/types.h>
         #include <sys/stat.h>
+        #include <time.h>
     #else
         #include <linux/spi/spidev.h>
     #endif
@@ -122,33 +182,46 @@
 #if defined(__linux__)
 #if defined(WOLFTPM_I2C)
     #define TPM_I2C_TRIES 10
-    static int i2c_read(int fd, word32 reg, byte* data, int len)
+
+    /* Default adapter, used when no TPM2_LINUX_I2C is passed as userCtx */
+    static TPM2_LINUX_I2C gI2cDev = TPM2_LINUX_I2C_INIT(NULL);
+
+    static UINT64 i2c_time_us(void)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (UINT64)now.tv_sec * 1000000 + (UINT64)(now.tv_nsec / 1000);
+    }
+
+    /* Leave the bus idle for the guard time since the last transaction */
+    static void i2c_guard(TPM2_LINUX_I2C* i2cDev)
+    {
+        UINT64 elapsed;
+        if (i2cDev->guardUs == 0)
+            return;
+        elapsed = i2c_time_us() - i2cDev->lastUs;
+        if (elapsed < i2cDev->guardUs)
+            usleep((useconds_t)(i2cDev->guardUs - elapsed));
+    }
+
+    static int i2c_transfer(TPM2_LINUX_I2C* i2cDev, struct i2c_msg* msgs,
+        int nmsgs)
     {
         int rc;
         struct i2c_rdwr_ioctl_data rdwr;
-        struct i2c_msg msgs[2];
-        unsigned char buf[2];
         int timeout = TPM_I2C_TRIES;
 
         rdwr.msgs = msgs;
-        rdwr.nmsgs = 2;
-        buf[0] = (reg & 0xFF); /* address */
-
-        msgs[0].flags = 0;
-        msgs[0].buf = buf;
-        msgs[0].len = 1;
-        msgs[0].addr = TPM2_I2C_ADDR;
-
-        msgs[1].flags = I2C_M_RD;
-        msgs[1].buf =  data;
-        msgs[1].len =  len;
-        msgs[1].addr = TPM2_I2C_ADDR;
+        rdwr.nmsgs = nmsgs;
 
         /* The I2C device may hold clock low to indicate busy, which results in
          * ioctl failure here. Typically the retry completes in 1-3 retries.
          * Its important to keep device open during these retries */
         do {
-            rc = ioctl(fd, I2C_RDWR, &rdwr);
+            i2c_guard(i2cDev);
+            rc = ioctl(i2cDev->fd, I2C_RDWR, &rdwr);
+            if (i2cDev->guardUs > 0)
+                i2cDev->lastUs = i2c_time_us();
             if (rc != -1)
                 break;
         } while (--timeout > 0);
@@ -156,102 +229,159 @@
         return (rc == -1) ? TPM_RC_FAILURE : TPM_RC_SUCCESS;
     }
 
-    static int i2c_write(int fd, word32 reg, byte* data, int len)
+    /* Register address write and data read in one combined transaction
+     * (repeated start) */
+    static int i2c_read(TPM2_LINUX_I2C* i2cDev, word32 reg, byte* data,
+        int len)
+    {
+        struct i2c_msg msgs[2];
+        unsigned char buf[1];
+
+        buf[0] = (reg & 0xFF); /* address */
+
+        msgs[0].flags = 0;
+        msgs[0].buf = buf;
+        msgs[0].len = 1;
+        msgs[0].addr = i2cDev->addr;
+
+        msgs[1].flags = I2C_M_RD;
+        msgs[1].buf =  data;
+        msgs[1].len =  len;
+        msgs[1].addr = i2cDev->addr;
+
+        return i2c_transfer(i2cDev, msgs, 2);
+    }
+
+    static int i2c_write(TPM2_LINUX_I2C* i2cDev, word32 reg, byte* data,
+        int len)
     {
-        int rc;
-        struct i2c_rdwr_ioctl_data rdwr;
         struct i2c_msg msgs[1];
-        byte buf[MAX_SPI_FRAMESIZE+1];
-        int timeout = TPM_I2C_TRIES;
+        byte buf[MAX_TIS_FRAMESIZE+1];
 
         /* TIS layer should never provide a buffer larger than this,
            but double check for good coding practice */
-        if (len > MAX_SPI_FRAMESIZE)
+        if (len > MAX_TIS_FRAMESIZE)
             return BAD_FUNC_ARG;
 
-        rdwr.msgs = msgs;
-        rdwr.nmsgs = 1;
         buf[0] = (reg & 0xFF); /* address */
         XMEMCPY(buf + 1, data, len);
 
         msgs[0].flags = 0;
         msgs[0].buf = buf;
         msgs[0].len = len + 1;
-        msgs[0].addr = TPM2_I2C_ADDR;
+        msgs[0].addr = i2cDev->addr;
 
-        /* The I2C device may hold clock low to indicate busy, which results in
-         * ioctl failure here. Typically the retry completes in 1-3 retries.
-         * Its important to keep device open during these retries */
-        do {
-            rc = ioctl(fd, I2C_RDWR, &rdwr);
-            if (rc != -1)
-                break;
-        } while (--timeout > 0);
+        return i2c_transfer(i2cDev, msgs, 1);
+    }
 
-        return (rc == -1) ? TPM_RC_FAILURE : TPM_RC_SUCCESS;
+    void TPM2_IoCb_Linux_I2C_Close(void* userCtx)
+    {
+        TPM2_LINUX_I2C* i2cDev = (userCtx != NULL) ?
+            (TPM2_LINUX_I2C*)userCtx : &gI2cDev;
+        if (i2cDev->fd >= 0) {
+            close(i2cDev->fd);
+            i2cDev->fd = -1;
+        }
     }
 
-    /* Use Linux I2C */
+    /* Use Linux I2C. The adapter is opened once and kept open */
     static int TPM2_IoCb_Linux_I2C(TPM2_CTX* ctx, int isRead, word32 addr, byte* buf,
         word16 size, void* userCtx)
     {
-        int ret = TPM_RC_FAILURE;
-        int i2cDev = open(TPM2_I2C_DEV, O_RDWR);
-        if (i2cDev >= 0) {
-            if (isRead)
-                ret = i2c_read(i2cDev, addr, buf, size);
-            else
-                ret = i2c_write(i2cDev, addr, buf, size);
+        int ret;
+        TPM2_LINUX_I2C* i2cDev = (userCtx != NULL) ?
+            (TPM2_LINUX_I2C*)userCtx : &gI2cDev;
 
-            close(i2cDev);
+        if (i2cDev->fd < 0) {
+            i2cDev->fd = open((i2cDev->dev != NULL) ? i2cDev->dev :
+                TPM2_I2C_DEV, O_RDWR);
+            if (i2cDev->fd < 0)
+                return TPM_RC_FAILURE;
         }
+        if (i2cDev->addr == 0)
+            i2cDev->addr = TPM2_I2C_ADDR;
+
+        if (isRead)
+            ret = i2c_read(i2cDev, addr, buf, size);
+        else
+            ret = i2c_write(i2cDev, addr, buf, size);
+
+        /* reopen on the next transfer after an error */
+        if (ret != TPM_RC_SUCCESS)
+            TPM2_IoCb_Linux_I2C_Close(i2cDev);
 
         (void)ctx;
-        (void)userCtx;
 
         return ret;
     }
 
 #else
+    /* Default spidev, used when no TPM2_LINUX_SPI is passed as userCtx */
+    static TPM2_LINUX_SPI gSpiDev = TPM2_LINUX_SPI_INIT(NULL);
+
+    /* Open and configure the spidev once, it stays open for later transfers */
+    static int TPM2_Linux_SPI_Open(TPM2_LINUX_SPI* spiDev)
+    {
+        /* Note: PI has issue with 5-10Mhz on packets sized over 130 bytes */
+        unsigned int maxSpeed = TPM2_SPI_HZ;
+        int mode = 0; /* Mode 0 (CPOL=0, CPHA=0) */
+        int bits_per_word = 8; /* 8-bits */
+
+        spiDev->fd = open((spiDev->dev != NULL) ? spiDev->dev : TPM2_SPI_DEV,
+            O_RDWR);
+        if (spiDev->fd < 0)
+            return TPM_RC_FAILURE;
+
+        ioctl(spiDev->fd, SPI_IOC_WR_MODE, &mode);
+        ioctl(spiDev->fd, SPI_IOC_WR_MAX_SPEED_HZ, &maxSpeed);
+        ioctl(spiDev->fd, SPI_IOC_WR_BITS_PER_WORD, &bits_per_word);
+
+        return TPM_RC_SUCCESS;
+    }
+
+    void TPM2_IoCb_Linux_SPI_Close(void* userCtx)
+    {
+        TPM2_LINUX_SPI* spiDev = (userCtx != NULL) ?
+            (TPM2_LINUX_SPI*)userCtx : &gSpiDev;
+        if (spiDev->fd >= 0) {
+            close(spiDev->fd);
+            spiDev->fd = -1;
+        }
+    }
+
     /* Use Linux SPI synchronous access */
     static int TPM2_IoCb_Linux_SPI(TPM2_CTX* ctx, const byte* txBuf, byte* rxBuf,
         word16 xferSz, void* userCtx)
     {
         int ret = TPM_RC_FAILURE;
-        int spiDev;
+        TPM2_LINUX_SPI* spiDev = (userCtx != NULL) ?
+            (TPM2_LINUX_SPI*)userCtx : &gSpiDev;
     #ifdef WOLFTPM_CHECK_WAIT_STATE
         int timeout = TPM_SPI_WAIT_RETRY;
     #endif
 
-        /* Note: PI has issue with 5-10Mhz on packets sized over 130 bytes */
-        unsigned int maxSpeed = TPM2_SPI_HZ;
-        int mode = 0; /* Mode 0 (CPOL=0, CPHA=0) */
-        int bits_per_word = 8; /* 8-bits */
-
     #ifdef WOLFTPM_AUTODETECT
     tryagain:
     #endif
 
-        spiDev = open(TPM2_SPI_DEV, O_RDWR);
-        if (spiDev >= 0) {
+        if (spiDev->fd >= 0 || TPM2_Linux_SPI_Open(spiDev) == TPM_RC_SUCCESS) {
             struct spi_ioc_transfer spi;
             size_t size;
 
-            ioctl(spiDev, SPI_IOC_WR_MODE, &mode);
-            ioctl(spiDev, SPI_IOC_WR_MAX_SPEED_HZ, &maxSpeed);
-            ioctl(spiDev, SPI_IOC_WR_BITS_PER_WORD, &bits_per_word);
-
             XMEMSET(&spi, 0, sizeof(spi));
-            spi.cs_change = 1; /* strobe CS between transfers */
 
     #ifdef WOLFTPM_CHECK_WAIT_STATE
-            /* Send Header */
+            /* Send Header. The number of wait states is only known from the
+             * response, so the header, wait state polls and payload are
+             * separate messages with CS held between them (cs_change on the
+             * last transfer of a message keeps CS asserted) */
             spi.tx_buf   = (unsigned long)txBuf;
             spi.rx_buf   = (unsigned long)rxBuf;
             spi.len      = TPM_TIS_HEADER_SZ;
-            size = ioctl(spiDev, SPI_IOC_MESSAGE(1), &spi);
+            spi.cs_change = 1;
+            size = ioctl(spiDev->fd, SPI_IOC_MESSAGE(1), &spi);
             if (size != TPM_TIS_HEADER_SZ) {
-                close(spiDev);
+                TPM2_IoCb_Linux_SPI_Close(spiDev);
                 return TPM_RC_FAILURE;
             }
 
@@ -260,12 +390,16 @@
                 do {
                     /* Check for SPI ready */
                     spi.len = 1;
-                    size = ioctl(spiDev, SPI_IOC_MESSAGE(1), &spi);
+                    size = ioctl(spiDev->fd, SPI_IOC_MESSAGE(1), &spi);
                     if (rxBuf[0] & TPM_TIS_READY_MASK)
                         break;
                 } while (size == 1 && --timeout > 0);
             #ifdef WOLFTPM_DEBUG_TIMEOUT
                 printf("SPI Ready Timeout %d\n", TPM_SPI_WAIT_RETRY - timeout);
+            #endif
+            #ifdef WOLFTPM_TIS_PROFILE
+                TPM2_TIS_ProfileWaitStates(ctx,
+                    (word32)(TPM_SPI_WAIT_RETRY - timeout + 1));
             #endif
                 if (size == 1 && timeout > 0) {
                     ret = TPM_RC_SUCCESS;
@@ -276,31 +410,34 @@
             }
 
             if (ret == TPM_RC_SUCCESS) {
-                /* Remainder of message */
+                /* Remainder of message, then release CS */
                 spi.tx_buf   = (unsigned long)&txBuf[TPM_TIS_HEADER_SZ];
                 spi.rx_buf   = (unsigned long)&rxBuf[TPM_TIS_HEADER_SZ];
                 spi.len      = xferSz - TPM_TIS_HEADER_SZ;
-                size = ioctl(spiDev, SPI_IOC_MESSAGE(1), &spi);
+                spi.cs_change = 0;
+                size = ioctl(spiDev->fd, SPI_IOC_MESSAGE(1), &spi);
 
-                if (size == (size_t)xferSz - TPM_TIS_HEADER_SZ)
-                    ret = TPM_RC_SUCCESS;
+                if (size != (size_t)xferSz - TPM_TIS_HEADER_SZ)
+                    ret = TPM_RC_FAILURE;
             }
     #else
             /* Send Entire Message - no wait states */
             spi.tx_buf   = (unsigned long)txBuf;
             spi.rx_buf   = (unsigned long)rxBuf;
             spi.len      = xferSz;
-            size = ioctl(spiDev, SPI_IOC_MESSAGE(1), &spi);
+            size = ioctl(spiDev->fd, SPI_IOC_MESSAGE(1), &spi);
             if (size == (size_t)xferSz)
                 ret = TPM_RC_SUCCESS;
     #endif /* WOLFTPM_CHECK_WAIT_STATE */
 
-            close(spiDev);
+            /* reopen on the next transfer after an error */
+            if (ret != TPM_RC_SUCCESS)
+                TPM2_IoCb_Linux_SPI_Close(spiDev);
         }
 
     #ifdef WOLFTPM_AUTODETECT
         /* if response is not 0xFF then we "found" something */
-        if (!foundSpiDev) {
+        if (!foundSpiDev && spiDev == &gSpiDev) {
             if (ret == TPM_RC_SUCCESS && rxBuf[0] != 0xFF) {
         #ifdef DEBUG_WOLFTPM
                 printf("Found TPM @ %s\n", TPM2_SPI_DEV);
@@ -309,6 +446,7 @@
             }
             else {
                 int devLen = (int)XSTRLEN(TPM2_SPI_DEV);
+                TPM2_IoCb_Linux_SPI_Close(spiDev);
                 /* tries spidev0.[0-4] */
                 if (TPM2_SPI_DEV[devLen-1] <= MAX_SPI_DEV_CS) {
                     TPM2_SPI_DEV[devLen-1]++;
@@ -319,7 +457,6 @@
     #endif
 
         (void)ctx;
-        (void)userCtx;
 
         return ret;
     }
@@ -333,12 +470,12 @@
     {
         int rc;
         int i2cAddr = (TPM2_I2C_ADDR << 1) | 0x01; /* For I2C read LSB is 1 */
-        byte buf[MAX_SPI_FRAMESIZE+1];
+        byte buf[MAX_TIS_FRAMESIZE+1];
         I2C_HandleTypeDef* hi2c = (I2C_HandleTypeDef*)userCtx;
 
         /* TIS layer should never provide a buffer larger than this,
            but double check for good coding practice */
-        if (len > MAX_SPI_FRAMESIZE)
+        if (len > MAX_TIS_FRAMESIZE)
             return BAD_FUNC_ARG;
 
         buf[0] = (reg & 0xFF);
@@ -356,12 +493,12 @@
     {
         int rc;
         int i2cAddr = (TPM2_I2C_ADDR << 1); /* I2C write operation, LSB is 0 */
-        byte buf[MAX_SPI_FRAMESIZE+1];
+        byte buf[MAX_TIS_FRAMESIZE+1];
         I2C_HandleTypeDef* hi2c = (I2C_HandleTypeDef*)userCtx;
 
         /* TIS layer should never provide a buffer larger than this,
            but double check for good coding practice */
-        if (len > MAX_SPI_FRAMESIZE)
+        if (len > MAX_TIS_FRAMESIZE)
             return BAD_FUNC_ARG;
 
         buf[0] = (reg & 0xFF); /* TPM register address */
@@ -432,6 +569,10 @@
             } while (status == HAL_OK && --timeout > 0);
         #ifdef WOLFTPM_DEBUG_TIMEOUT
             printf("SPI Ready Wait %d\n", TPM_SPI_WAIT_RETRY - timeout);
+        #endif
+        #ifdef WOLFTPM_TIS_PROFILE
+            TPM2_TIS_ProfileWaitStates(ctx,
+                (word32)(TPM_SPI_WAIT_RETRY - timeout + 1));
         #endif
             if (timeout <= 0) {
             #ifndef USE_HW_SPI_CS
@@ -555,6 +696,10 @@
             } while (ret == TPM_RC_SUCCESS && --timeout > 0);
         #ifdef WOLFTPM_DEBUG_TIMEOUT
             printf("SPI Ready Wait %d\n", TPM_SPI_WAIT_RETRY - timeout);
+        #endif
+        #ifdef WOLFTPM_TIS_PROFILE
+            TPM2_TIS_ProfileWaitStates(ctx,
+                (word32)(TPM_SPI_WAIT_RETRY - timeout + 1));
         #endif
             if (timeout <= 0) {
                 SPI0->SPI_CR = SPI_CR_SPIDIS;
@@ -768,6 +913,10 @@
             } while (ret == TPM_RC_SUCCESS && --timeout > 0);
         #ifdef WOLFTPM_DEBUG_TIMEOUT
             printf("SPI Ready Wait %d\n", TPM_SPI_WAIT_RETRY - timeout);
+        #endif
+        #ifdef WOLFTPM_TIS_PROFILE
+            TPM2_TIS_ProfileWaitStates(ctx,
+                (word32)(TPM_SPI_WAIT_RETRY - timeout + 1));
         #endif
             if (timeout <= 0) {
                 XSpiPs_SetSlaveSelect(&SpiInstance, 0xF); /* deselect CS (set high) */
@@ -936,7 +1085,8 @@ int TPM2_IoCb(TPM2_CTX* ctx, const byte* txBuf, byte* rxBuf,
 }
 
 #endif /* WOLFTPM_ADV_IO */
-#endif /* !(WOLFTPM_LINUX_DEV || WOLFTPM_SWTPM || WOLFTPM_WINAPI) */
+#endif /* WOLFTPM_TIS_SIM */
+#endif /* WOLFTPM_TIS && no built-in transport */
 
 /******************************************************************************/
 /* --- END IO Callback Logic -- */
@@ -28,11 +28,50 @@
     extern "C" {
 #endif
 
-/* TPM2 IO Examples */
-#if defined(WOLFTPM_LINUX_DEV) || defined(WOLFTPM_SWTPM) || defined(WOLFTPM_WINAPI)
+/* TPM2 IO Examples. The built-in devtpm, swtpm or TBS transport is used
+ * when there is one, unless the TIS simulator is enabled */
+#if !defined(WOLFTPM_TIS) || (!defined(WOLFTPM_TIS_SIM) && \
+    (defined(WOLFTPM_LINUX_DEV) || defined(WOLFTPM_SWTPM)))
 #define TPM2_IoCb NULL
 #else
 
+#if defined(__linux__) && !defined(WOLFTPM_I2C) && !defined(WOLFTPM_TIS_SIM)
+/* Linux spidev. The device is opened and configured on the first transfer
+ * and kept open. Pass a TPM2_LINUX_SPI as the userCtx to select the device,
+ * or NULL to use the default. */
+typedef struct TPM2_LINUX_SPI {
+    const char* dev;    /* for example "/dev/spidev0.1", NULL for default */
+    int fd;
+} TPM2_LINUX_SPI;
+#define TPM2_LINUX_SPI_INIT(dev) { (dev), -1 }
+
+/* Close the spidev, pass the userCtx given to TPM2_Init */
+void TPM2_IoCb_Linux_SPI_Close(void* userCtx);
+#endif
+
+#if defined(__linux__) && defined(WOLFTPM_I2C) && !defined(WOLFTPM_TIS_SIM)
+/* Minimum bus idle time between I2C transactions (TCG PTP GUARD_TIME). Set
+ * for TPMs that NACK instead of stretching the clock while busy */
+#ifndef TPM2_I2C_GUARD_US
+#define TPM2_I2C_GUARD_US 0
+#endif
+
+/* Linux i2c-dev. The adapter is opened on the first transfer and kept open.
+ * Pass a TPM2_LINUX_I2C as the userCtx to select the adapter, TPM address and
+ * guard time, or NULL to use the defaults. */
+typedef struct TPM2_LINUX_I2C {
+    const char* dev;    /* for example "/dev/i2c-1", NULL for default */
+    word16 addr;        /* 7-bit TPM address, 0 for default */
+    word32 guardUs;
+    int fd;
+    UINT64 lastUs;      /* end of the last transaction */
+} TPM2_LINUX_I2C;
+#define TPM2_LINUX_I2C_INIT(dev) { (dev), 0, TPM2_I2C_GUARD_US, -1, 0 }
+
+/* Close the I2C adapter, pass the userCtx given to TPM2_Init */
+void TPM2_IoCb_Linux_I2C_Close(void* userCtx);
+#endif
+
 #ifdef WOLFTPM_ADV_IO
 int TPM2_IoCb(TPM2_CTX*, int isRead, word32 addr, byte* buf, word16 size,
     void* userCtx);
@@ -40,7 +79,7 @@ int TPM2_IoCb(TPM2_CTX*, int isRead, word32 addr, byte* buf, word16 size,
 int TPM2_IoCb(TPM2_CTX* ctx, const byte* txBuf, byte* rxBuf,
     word16 xferSz, void* userCtx);
 #endif
-#endif /* !(WOLFTPM_LINUX_DEV || WOLFTPM_SWTPM || WOLFTPM_WINAPI) */
+#endif /* !WOLFTPM_TIS || built-in transport */
 
 #ifdef __cplusplus
     }  /* extern "C" */
@@ -27,33 +27,114 @@
 #include <wolftpm/tpm2_swtpm.h>
 #include <wolftpm/tpm2_winapi.h>
 #include <wolftpm/tpm2_param_enc.h>
+#if defined(WOLFTPM_LINUX_DEV) || defined(WOLFTPM_SWTPM)
+    #include <poll.h>
+    #include <time.h>
+    #include <errno.h>
+#endif
+#ifdef WOLFTPM_TIME_NS_GETTIME
+    #include <time.h>
+#endif
 
 /******************************************************************************/
 /* --- Local Variables -- */
 /******************************************************************************/
 
-static TPM2_CTX* gActiveTPM;
+/* active context, one per thread with WOLFTPM_THREAD_LOCAL_CTX */
+static WOLFTPM_THREAD_LS TPM2_CTX* gActiveTPM;
 #ifndef WOLFTPM2_NO_WOLFCRYPT
 static volatile int gWolfCryptRefCount = 0;
 #endif
 
-#ifdef WOLFTPM_LINUX_DEV
-#define INTERNAL_SEND_COMMAND      TPM2_LINUX_SendCommand
-#define TPM2_INTERNAL_CLEANUP(ctx)
-#elif defined(WOLFTPM_SWTPM)
-#define INTERNAL_SEND_COMMAND      TPM2_SWTPM_SendCommand
-#define TPM2_INTERNAL_CLEANUP(ctx)
-#elif defined(WOLFTPM_WINAPI)
-#define INTERNAL_SEND_COMMAND      TPM2_WinApi_SendCommand
-#define TPM2_INTERNAL_CLEANUP(ctx) TPM2_WinApi_Cleanup(ctx)
-#else
-#define INTERNAL_SEND_COMMAND      TPM2_TIS_SendCommand
-#define TPM2_INTERNAL_CLEANUP(ctx)
+/* The context lock (hwLock) protects a context's command buffer while a
+ * command is marshalled and its response parsed. The session crypto of a
+ * command with auth sessions (nonces, cpHash and HMAC, parameter encryption
+ * and the response check) runs on a copy of the command under the session
+ * lock instead, so threads sharing a context overlap it with each other's
+ * commands. The two are never held together. The bus lock serializes only
+ * the exchange with the TPM. It is per bus: contexts on a shared bus
+ * transport (TIS) with the same HAL callback and user context use the same
+ * one, other contexts their own. */
+#if !defined(WOLFTPM2_NO_WOLFCRYPT) && !defined(SINGLE_THREADED)
+    #define WOLFTPM_BUS_LOCK
+#endif
+
+#ifndef WOLFTPM2_MAX_BUS
+    #define WOLFTPM2_MAX_BUS 4
+#endif
+static TPM2_BUS gBus[WOLFTPM2_MAX_BUS];
+#ifdef WOLFTPM_BUS_LOCK
+/* taken only while a context attaches to or leaves a shared bus */
+static wolfSSL_Mutex gBusTableLock;
+static int gBusTableLockInit = 0;
+#endif
+
+/* Transports with a descriptor TPM2_AsyncWait can wait on */
+#if defined(WOLFTPM_LINUX_DEV) || defined(WOLFTPM_SWTPM)
+    #define TPM2_ASYNC_POLL_FD
 #endif
 
 /******************************************************************************/
 /* --- Local Functions -- */
 /******************************************************************************/
+#ifdef WOLFTPM_TIME_NS_GETTIME
+UINT64 TPM2_TimeNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (UINT64)now.tv_sec * 1000000000ULL + (UINT64)now.tv_nsec;
+}
+#endif
+
+#ifdef WOLFTPM_HOOKS
+/* A command built in ctx->cmdBuf gets its start time in TPM2_Packet_Init,
+ * before it is marshalled */
+
+static void TPM2_HookSend(TPM2_CTX* ctx, TPM2_HOOK_INFO* info,
+    const byte* cmd, int cmdSz)
+{
+    UINT32 cc;
+
+    XMEMCPY(&cc, &cmd[6], sizeof(cc));
+    info->cc = TPM2_Packet_SwapU32(cc);
+    info->cmdSz = (word32)cmdSz;
+    info->sendNs = XTPM_TIME_NS();
+    ctx->hookCb(ctx, TPM2_HOOK_SEND, info, ctx->hookCtx);
+}
+
+static void TPM2_HookRecv(TPM2_CTX* ctx, TPM2_HOOK_INFO* info,
+    const byte* rsp, TPM_RC rc)
+{
+    UINT32 val;
+
+    info->recvNs = XTPM_TIME_NS();
+    info->rc = rc;
+    if (rc == TPM_RC_SUCCESS) {
+        XMEMCPY(&val, &rsp[2], sizeof(val));
+        info->rspSz = TPM2_Packet_SwapU32(val);
+        XMEMCPY(&val, &rsp[6], sizeof(val));
+        info->rc = TPM2_Packet_SwapU32(val);
+    }
+    ctx->hookCb(ctx, TPM2_HOOK_RECV, info, ctx->hookCtx);
+}
+
+static void TPM2_HookDone(TPM2_CTX* ctx, TPM2_HOOK_INFO* info)
+{
+    info->doneNs = XTPM_TIME_NS();
+    ctx->hookCb(ctx, TPM2_HOOK_DONE, info, ctx->hookCtx);
+    info->cc = 0;
+}
+
+/* An asynchronous command is marshalled by the caller */
+static void TPM2_HookAsyncSend(TPM2_CTX* ctx, TPM2_ASYNC* req)
+{
+    if (ctx->hookCb != NULL) {
+        req->hook.startNs = XTPM_TIME_NS();
+        TPM2_HookSend(ctx, &req->hook, req->buf, req->cmdSz);
+    }
+}
+#endif /* WOLFTPM_HOOKS */
+
 static TPM_RC TPM2_AcquireLock(TPM2_CTX* ctx)
 {
 #if defined(WOLFTPM2_NO_WOLFCRYPT) || defined(SINGLE_THREADED)
@@ -66,6 +147,11 @@ static TPM_RC TPM2_AcquireLock(TPM2_CTX* ctx)
             WOLFSSL_MSG("TPM Mutex Init failed");
             return TPM_RC_FAILURE;
         }
+        if (wc_InitMutex(&ctx->sessionLock) != 0) {
+            WOLFSSL_MSG("TPM Mutex Init failed");
+            wc_FreeMutex(&ctx->hwLock);
+            return TPM_RC_FAILURE;
+        }
         ctx->hwLockInit = 1;
     }
 
@@ -76,7 +162,7 @@ static TPM_RC TPM2_AcquireLock(TPM2_CTX* ctx)
     return TPM_RC_SUCCESS;
 }
 
-static void TPM2_ReleaseLock(TPM2_CTX* ctx)
+static void TPM2_UnlockCtx(TPM2_CTX* ctx)
 {
 #if defined(WOLFTPM2_NO_WOLFCRYPT) || defined(SINGLE_THREADED)
     (void)ctx;
@@ -85,6 +171,291 @@ static void TPM2_ReleaseLock(TPM2_CTX* ctx)
 #endif
 }
 
+static void TPM2_ReleaseLock(TPM2_CTX* ctx)
+{
+#ifdef WOLFTPM_HOOKS
+    /* the command sent from ctx->cmdBuf has been parsed */
+    if (ctx->hookCb != NULL && ctx->hookInfo.cc != 0)
+        TPM2_HookDone(ctx, &ctx->hookInfo);
+#endif
+    TPM2_UnlockCtx(ctx);
+}
+
+/* Call with the context lock held, it is initialized then */
+static TPM_RC TPM2_AcquireSessionLock(TPM2_CTX* ctx)
+{
+#if defined(WOLFTPM2_NO_WOLFCRYPT) || defined(SINGLE_THREADED)
+    (void)ctx;
+#else
+    if (wc_LockMutex(&ctx->sessionLock) != 0)
+        return TPM_RC_FAILURE;
+#endif
+    return TPM_RC_SUCCESS;
+}
+
+static void TPM2_ReleaseSessionLock(TPM2_CTX* ctx)
+{
+#if defined(WOLFTPM2_NO_WOLFCRYPT) || defined(SINGLE_THREADED)
+    (void)ctx;
+#else
+    wc_UnLockMutex(&ctx->sessionLock);
+#endif
+}
+
+static TPM_RC TPM2_BusInit(TPM2_BUS* bus)
+{
+    XMEMSET(bus, 0, sizeof(TPM2_BUS));
+#ifdef WOLFTPM_BUS_LOCK
+    if (wc_InitMutex(&bus->lock) != 0) {
+        WOLFSSL_MSG("TPM Mutex Init failed");
+        return TPM_RC_FAILURE;
+    }
+    bus->lockInit = 1;
+#endif
+    return TPM_RC_SUCCESS;
+}
+
+static void TPM2_BusFree(TPM2_BUS* bus)
+{
+#ifdef WOLFTPM_BUS_LOCK
+    if (bus->lockInit)
+        wc_FreeMutex(&bus->lock);
+#endif
+    XMEMSET(bus, 0, sizeof(TPM2_BUS));
+}
+
+/* Leave the context's bus. Call with no command pending. */
+static void TPM2_DetachBus(TPM2_CTX* ctx)
+{
+    TPM2_BUS* bus = ctx->bus;
+
+    ctx->bus = NULL;
+    if (bus == NULL)
+        return;
+    if (bus == &ctx->ownBus) {
+        TPM2_BusFree(bus);
+        return;
+    }
+#ifdef WOLFTPM_BUS_LOCK
+    if (!gBusTableLockInit || wc_LockMutex(&gBusTableLock) != 0)
+        return;
+#endif
+    if (bus->owner == ctx)
+        bus->owner = NULL;
+    if (--bus->refs == 0)
+        TPM2_BusFree(bus);
+#ifdef WOLFTPM_BUS_LOCK
+    wc_UnLockMutex(&gBusTableLock);
+#endif
+}
+
+/* Attach the context to the bus of its transport and HAL callback. Call
+ * with no command pending, after either one changes. */
+static TPM_RC TPM2_SelectBus(TPM2_CTX* ctx)
+{
+    TPM_RC rc = TPM_RC_SUCCESS;
+    TPM2_BUS* bus = NULL;
+    int i;
+
+    TPM2_DetachBus(ctx);
+
+    if (ctx->transport == NULL) {
+        /* no transport built in */
+        return BAD_FUNC_ARG;
+    }
+    if ((ctx->transport->flags & TPM2_TRANSPORT_FLAG_SHARED_BUS) == 0) {
+        rc = TPM2_BusInit(&ctx->ownBus);
+        if (rc == TPM_RC_SUCCESS)
+            ctx->bus = &ctx->ownBus;
+        return rc;
+    }
+
+#ifdef WOLFTPM_BUS_LOCK
+    if (!gBusTableLockInit || wc_LockMutex(&gBusTableLock) != 0)
+        return TPM_RC_FAILURE;
+#endif
+    for (i = 0; i < WOLFTPM2_MAX_BUS; i++) {
+        if (gBus[i].refs > 0 && gBus[i].ioCb == ctx->ioCb &&
+                gBus[i].userCtx == ctx->userCtx) {
+            bus = &gBus[i];
+            break;
+        }
+    }
+    for (i = 0; bus == NULL && i < WOLFTPM2_MAX_BUS; i++) {
+        if (gBus[i].refs == 0) {
+            rc = TPM2_BusInit(&gBus[i]);
+            if (rc != TPM_RC_SUCCESS)
+                break;
+            bus = &gBus[i];
+            bus->ioCb = ctx->ioCb;
+            bus->userCtx = ctx->userCtx;
+        }
+    }
+    if (bus != NULL) {
+        bus->refs++;
+        ctx->bus = bus;
+    }
+    else if (rc == TPM_RC_SUCCESS) {
+    #ifdef DEBUG_WOLFTPM
+        printf("No free TPM bus, see WOLFTPM2_MAX_BUS\n");
+    #endif
+        rc = TPM_RC_FAILURE;
+    }
+#ifdef WOLFTPM_BUS_LOCK
+    wc_UnLockMutex(&gBusTableLock);
+#endif
+    return rc;
+}
+
+static void TPM2_ReleaseBusLock(TPM2_CTX* ctx)
+{
+#ifdef WOLFTPM_BUS_LOCK
+    wc_UnLockMutex(&ctx->bus->lock);
+#else
+    (void)ctx;
+#endif
+}
+
+/* Returns TPM_RC_RETRY while an asynchronous command owns the bus */
+static TPM_RC TPM2_AcquireBusLock(TPM2_CTX* ctx)
+{
+    if (ctx->bus == NULL)
+        return TPM_RC_FAILURE;
+#ifdef WOLFTPM_BUS_LOCK
+    if (wc_LockMutex(&ctx->bus->lock) != 0)
+        return TPM_RC_FAILURE;
+#endif
+    if (ctx->bus->owner != NULL || ctx->asyncReq != NULL) {
+        TPM2_ReleaseBusLock(ctx);
+        return TPM_RC_RETRY;
+    }
+    return TPM_RC_SUCCESS;
+}
+
+/* End the context's asynchronous command, exchanges may use the bus again */
+static void TPM2_ReleaseBusOwner(TPM2_CTX* ctx)
+{
+    TPM2_BUS* bus = ctx->bus;
+
+#ifdef WOLFTPM_BUS_LOCK
+    if (bus != NULL && wc_LockMutex(&bus->lock) != 0)
+        bus = NULL;
+#endif
+    if (bus != NULL && bus->owner == ctx)
+        bus->owner = NULL;
+    ctx->asyncReq = NULL;
+#ifdef WOLFTPM_BUS_LOCK
+    if (bus != NULL)
+        wc_UnLockMutex(&bus->lock);
+#endif
+}
+
+#ifdef WOLFTPM_TIS
+/* The TPM is accessed through the TIS registers, so it may need a chip
+ * startup and its polling follows the TIS state machine */
+static int TPM2_IsTisTransport(TPM2_CTX* ctx)
+{
+    return ctx->transport == TPM2_TIS_GetTransport();
+}
+#else
+#define TPM2_IsTisTransport(ctx) 0
+#endif
+
+/* Exchange a marshalled command for its response with the TPM */
+static TPM_RC TPM2_TransportExchange(TPM2_CTX* ctx, TPM2_Packet* packet)
+{
+    TPM_RC rc = TPM2_AcquireBusLock(ctx);
+    if (rc == TPM_RC_SUCCESS) {
+        rc = (TPM_RC)ctx->transport->sendCommand(ctx, packet->buf,
+            packet->pos, packet->size, ctx->transportCtx);
+        TPM2_ReleaseBusLock(ctx);
+    }
+    return rc;
+}
+
+static TPM_RC TPM2_TransportSend(TPM2_CTX* ctx, TPM2_Packet* packet)
+{
+    TPM_RC rc;
+#ifdef WOLFTPM_HOOKS
+    TPM2_HOOK_INFO aux;
+    TPM2_HOOK_INFO* info = NULL;
+#endif
+
+    /* the transport is busy with an asynchronous command */
+    if (ctx->asyncReq != NULL)
+        return TPM_RC_RETRY;
+
+#ifdef WOLFTPM_HOOKS
+    if (ctx->hookCb != NULL) {
+        /* a command from ctx->cmdBuf is done when the context is unlocked,
+         * others (nonce pool refills) once the response is received */
+        if (packet->buf == ctx->cmdBuf) {
+            info = &ctx->hookInfo;
+        }
+        else {
+            XMEMSET(&aux, 0, sizeof(aux));
+            aux.startNs = XTPM_TIME_NS();
+            info = &aux;
+        }
+        TPM2_HookSend(ctx, info, packet->buf, packet->pos);
+    }
+#endif
+
+    rc = TPM2_TransportExchange(ctx, packet);
+
+#ifdef WOLFTPM_HOOKS
+    if (info != NULL) {
+        TPM2_HookRecv(ctx, info, packet->buf, rc);
+        if (info == &aux)
+            TPM2_HookDone(ctx, info);
+    }
+#endif
+    return rc;
+}
+
+/* Record the result of the context's asynchronous command and free the
+ * context and bus for the next command. Call with the context lock held. */
+static TPM_RC TPM2_AsyncComplete(TPM2_CTX* ctx, TPM2_ASYNC* req, TPM_RC rc)
+{
+    TPM2_Packet packet;
+
+    TPM2_ReleaseBusOwner(ctx);
+
+#ifdef WOLFTPM_HOOKS
+    if (ctx->hookCb != NULL && req->hook.cc != 0) {
+        TPM2_HookRecv(ctx, &req->hook, req->buf, rc);
+    }
+#endif
+
+    if (rc == TPM_RC_SUCCESS) {
+        packet.buf = req->buf;
+        packet.pos = 0;
+        packet.size = req->bufSz;
+        rc = TPM2_Packet_Parse(rc, &packet);
+        req->rspSz = packet.size;
+    }
+    req->rc = rc;
+    req->fd = -1;
+#ifdef WOLFTPM_HOOKS
+    if (ctx->hookCb != NULL && req->hook.cc != 0) {
+        req->hook.rc = rc;
+        TPM2_HookDone(ctx, &req->hook);
+    }
+#endif
+    return rc;
+}
+
+/* Drop a pending asynchronous command. Call with the context lock held. */
+static void TPM2_AsyncAbandon(TPM2_CTX* ctx)
+{
+    TPM2_ASYNC* req = ctx->asyncReq;
+    if (req != NULL) {
+        if (ctx->transport->asyncCancel != NULL)
+            ctx->transport->asyncCancel(ctx, req, ctx->transportCtx);
+        (void)TPM2_AsyncComplete(ctx, req, TPM_RC_CANCELED);
+    }
+}
+
 /* Send Command Wrapper */
 typedef enum CmdFlags {
     CMD_FLAG_NONE = 0x00,
@@ -102,6 +473,129 @@ typedef struct {
     int flags;        /* If command allows param enc or dec - fixed */
 } CmdInfo_t;
 
+#ifndef WOLFTPM2_USE_WOLF_RNG
+static TPM_RC TPM2_SendCommand(TPM2_CTX* ctx, TPM2_Packet* packet);
+
+/* Top up the nonce pool with TPM random. Uses its own packet buffer, so it is
+ * safe while a command is being built in ctx->cmdBuf */
+static int TPM2_NoncePool_Fill(TPM2_CTX* ctx)
+{
+    int rc = TPM_RC_SUCCESS;
+    byte buf[TPM2_HEADER_SIZE + sizeof(UINT16) + sizeof(TPMU_HA)];
+    TPM2_Packet packet;
+    UINT16 randSz;
+    int fillSz;
+
+    while (ctx->noncePoolAvail < sizeof(ctx->noncePool)) {
+        fillSz = (int)sizeof(ctx->noncePool) - ctx->noncePoolAvail;
+        if (fillSz > (int)sizeof(TPMU_HA))
+            fillSz = (int)sizeof(TPMU_HA);
+
+        packet.buf = buf;
+        packet.pos = TPM2_HEADER_SIZE;
+        packet.size = sizeof(buf);
+        TPM2_Packet_AppendU16(&packet, fillSz);
+        TPM2_Packet_Finalize(&packet, TPM_ST_NO_SESSIONS, TPM_CC_GetRandom);
+
+        rc = TPM2_SendCommand(ctx, &packet);
+        if (rc != TPM_RC_SUCCESS)
+            break;
+
+        TPM2_Packet_ParseU16(&packet, &randSz);
+        if (randSz == 0 || randSz > fillSz) {
+            rc = TPM_RC_FAILURE;
+            break;
+        }
+        TPM2_Packet_ParseBytes(&packet,
+            &ctx->noncePool[ctx->noncePoolAvail], randSz);
+        ctx->noncePoolAvail += randSz;
+    }
+
+    XMEMSET(buf, 0, sizeof(buf));
+
+    return rc;
+}
+
+/* Remove sz bytes of TPM random from the pool */
+static int TPM2_NoncePool_Take(TPM2_CTX* ctx, byte* out, int sz)
+{
+    int rc = TPM_RC_SUCCESS;
+    byte* src;
+
+    if (sz > (int)sizeof(ctx->noncePool))
+        return BUFFER_E;
+
+    if (ctx->noncePoolAvail < sz) {
+        rc = TPM2_NoncePool_Fill(ctx);
+    }
+    if (rc == TPM_RC_SUCCESS) {
+        ctx->noncePoolAvail -= sz;
+        src = &ctx->noncePool[ctx->noncePoolAvail];
+        XMEMCPY(out, src, sz);
+        XMEMSET(src, 0, sz); /* never hand out the same bytes twice */
+    }
+    return rc;
+}
+
+/* Generate a session nonce from the pool */
+static int TPM2_NoncePool_Get(TPM2_CTX* ctx, byte* nonceBuf, int nonceSz)
+{
+    int rc = TPM_RC_SUCCESS;
+#ifdef WOLFTPM2_NONCE_EXPAND
+    wc_HashAlg hash;
+    byte counter[sizeof(UINT32)];
+    byte digest[TPM_SHA256_DIGEST_SIZE];
+    int pos = 0, sz;
+#endif
+
+    /* refill in bulk ahead of need. On failure keep serving what is left */
+    if (ctx->noncePoolAvail < TPM2_NONCE_POOL_REFILL) {
+        (void)TPM2_NoncePool_Fill(ctx);
+    }
+
+#ifdef WOLFTPM2_NONCE_EXPAND
+    /* take a fresh seed after TPM2_NONCE_MAX_REUSE nonces */
+    if (ctx->nonceSeedUses == 0 ||
+            ctx->nonceSeedUses >= TPM2_NONCE_MAX_REUSE) {
+        ctx->nonceSeedUses = 0;
+        rc = TPM2_NoncePool_Take(ctx, ctx->nonceSeed,
+            sizeof(ctx->nonceSeed));
+    }
+    /* nonce block = SHA256(seed || BE32(use << 8 | block index)) */
+    while (rc == TPM_RC_SUCCESS && pos < nonceSz) {
+        TPM2_Packet_U32ToByteArray((ctx->nonceSeedUses << 8) |
+            (pos / TPM_SHA256_DIGEST_SIZE), counter);
+        rc = wc_HashInit(&hash, WC_HASH_TYPE_SHA256);
+        if (rc == 0) {
+            rc = wc_HashUpdate(&hash, WC_HASH_TYPE_SHA256, ctx->nonceSeed,
+                sizeof(ctx->nonceSeed));
+            if (rc == 0)
+                rc = wc_HashUpdate(&hash, WC_HASH_TYPE_SHA256, counter,
+                    sizeof(counter));
+            if (rc == 0)
+                rc = wc_HashFinal(&hash, WC_HASH_TYPE_SHA256, digest);
+            wc_HashFree(&hash, WC_HASH_TYPE_SHA256);
+        }
+        if (rc == 0) {
+            sz = nonceSz - pos;
+            if (sz > TPM_SHA256_DIGEST_SIZE)
+                sz = TPM_SHA256_DIGEST_SIZE;
+            XMEMCPY(&nonceBuf[pos], digest, sz);
+            pos += sz;
+        }
+    }
+    if (rc == TPM_RC_SUCCESS) {
+        ctx->nonceSeedUses++;
+    }
+    XMEMSET(digest, 0, sizeof(digest));
+#else
+    rc = TPM2_NoncePool_Take(ctx, nonceBuf, nonceSz);
+#endif
+
+    return rc;
+}
+#endif /* !WOLFTPM2_USE_WOLF_RNG */
+
 static int TPM2_CommandProcess(TPM2_CTX* ctx, TPM2_Packet* packet,
     CmdInfo_t* info, TPM_CC cmdCode, UINT32 cmdSz)
 {
@@ -150,8 +644,14 @@ static int TPM2_CommandProcess(TPM2_CTX* ctx, TPM2_Packet* packet,
 
         if (session->sessionHandle != TPM_RS_PW) {
             /* Generate fresh nonce */
+        #ifdef WOLFTPM2_USE_WOLF_RNG
             rc = TPM2_GetNonce(session->nonceCaller.buffer,
                 session->nonceCaller.size);
+        #else
+            /* TPM2_GetRandom would overwrite this command in ctx->cmdBuf */
+            rc = TPM2_NoncePool_Get(ctx, session->nonceCaller.buffer,
+                session->nonceCaller.size);
+        #endif
             if (rc != TPM_RC_SUCCESS) {
                 return rc;
             }
@@ -352,21 +852,105 @@ static int TPM2_ResponseProcess(TPM2_CTX* ctx, TPM2_Packet* packet,
     return rc;
 }
 
+/* Run the session crypto and exchange of a command with HMAC or policy
+ * sessions on a copy of it, with the context unlocked so other threads can
+ * use the context meanwhile. The session lock keeps each session's nonces
+ * in step with the TPM. Returns with the context locked again and the
+ * response in packet. */
+static TPM_RC TPM2_SendCommandSessions(TPM2_CTX* ctx, TPM2_Packet* packet,
+    CmdInfo_t* info, TPM_CC cmdCode, UINT32 cmdSz)
+{
+    TPM_RC rc, lockRc;
+    TPM2_Packet call;
+    UINT32 respSz;
+    TPM_ST tag;
+    byte buf[MAX_COMMAND_SIZE];
+#ifdef WOLFTPM_HOOKS
+    TPM2_HOOK_INFO hook;
+#endif
+
+    XMEMCPY(buf, packet->buf, cmdSz);
+    call.buf = buf;
+    call.pos = 0;
+    call.size = sizeof(buf);
+#ifdef WOLFTPM_HOOKS
+    hook = ctx->hookInfo;
+    hook.sessions = info->authCnt;
+#endif
+
+    TPM2_UnlockCtx(ctx);
+
+    rc = TPM2_AcquireSessionLock(ctx);
+    if (rc == TPM_RC_SUCCESS) {
+        rc = TPM2_CommandProcess(ctx, &call, info, cmdCode, cmdSz);
+        if (rc == TPM_RC_SUCCESS) {
+            /* submit command and wait for response */
+            call.pos = cmdSz;
+        #ifdef WOLFTPM_HOOKS
+            if (ctx->hookCb != NULL)
+                TPM2_HookSend(ctx, &hook, call.buf, call.pos);
+        #endif
+            rc = TPM2_TransportExchange(ctx, &call);
+        #ifdef WOLFTPM_HOOKS
+            if (ctx->hookCb != NULL)
+                TPM2_HookRecv(ctx, &hook, call.buf, rc);
+        #endif
+        }
+        if (rc == TPM_RC_SUCCESS) {
+            /* parse response */
+            rc = TPM2_Packet_Parse(rc, &call);
+            respSz = call.size;
+
+            /* restart the unmarshalling position */
+            call.pos = 0;
+            TPM2_Packet_ParseU16(&call, &tag);
+            if (rc == TPM_RC_SUCCESS && tag == TPM_ST_SESSIONS) {
+                rc = TPM2_ResponseProcess(ctx, &call, info, cmdCode, respSz);
+            #ifdef WOLFTPM_HOOKS
+                if (rc != TPM_RC_SUCCESS)
+                    hook.rc = rc;
+            #endif
+            }
+
+            /* hand the response to the caller */
+            if (respSz > sizeof(buf))
+                respSz = sizeof(buf);
+            XMEMCPY(packet->buf, buf, respSz);
+            packet->size = call.size;
+        }
+        TPM2_ReleaseSessionLock(ctx);
+    }
+
+    lockRc = TPM2_AcquireLock(ctx);
+    if (rc == TPM_RC_SUCCESS)
+        rc = lockRc;
+#ifdef WOLFTPM_HOOKS
+    /* done once the caller has parsed the response */
+    ctx->hookInfo = hook;
+#endif
+
+    /* the copy held the unencrypted parameters */
+    XMEMSET(buf, 0, sizeof(buf));
+
+    /* Caller expects packet position to be at end of header */
+    packet->pos = TPM2_HEADER_SIZE;
+
+    return rc;
+}
+
 static TPM_RC TPM2_SendCommandAuth(TPM2_CTX* ctx, TPM2_Packet* packet,
     CmdInfo_t* info)
 {
     TPM_RC rc = TPM_RC_FAILURE;
     TPM_ST tag;
     TPM_CC cmdCode;
-    BYTE *cmd;
     UINT32 cmdSz, respSz;
+    int i;
 
     if (ctx == NULL || packet == NULL || info == NULL)
         return BAD_FUNC_ARG;
 
-    cmd = packet->buf;
     cmdSz = packet->pos;
-    (void)cmd;
 
     /* restart the unmarshalling position */
     packet->pos = 0;
@@ -384,6 +968,13 @@ static TPM_RC TPM2_SendCommandAuth(TPM2_CTX* ctx, TPM2_Packet* packet,
         printf("Found %d auth sessions\n", info->authCnt);
     #endif
 
+        /* HMAC and policy sessions need host crypto */
+        for (i=0; i<info->authCnt; i++) {
+            if (ctx->session[i].sessionHandle != TPM_RS_PW)
+                return TPM2_SendCommandSessions(ctx, packet, info, cmdCode,
+                    cmdSz);
+        }
+
         rc = TPM2_CommandProcess(ctx, packet, info, cmdCode, cmdSz);
         if (rc != 0)
             return rc;
@@ -391,9 +982,13 @@ static TPM_RC TPM2_SendCommandAuth(TPM2_CTX* ctx, TPM2_Packet* packet,
 
     /* reset packet->pos to total command length (send command requires it) */
     packet->pos = cmdSz;
+#ifdef WOLFTPM_HOOKS
+    if (tag == TPM_ST_SESSIONS)
+        ctx->hookInfo.sessions = info->authCnt;
+#endif
 
     /* submit command and wait for response */
-    rc = (TPM_RC)INTERNAL_SEND_COMMAND(ctx, packet);
+    rc = TPM2_TransportSend(ctx, packet);
     if (rc != 0)
         return rc;
 
@@ -408,6 +1003,10 @@ static TPM_RC TPM2_SendCommandAuth(TPM2_CTX* ctx, TPM2_Packet* packet,
     /* Is auth session required for this TPM command? */
     if (rc == TPM_RC_SUCCESS && tag == TPM_ST_SESSIONS) {
         rc = TPM2_ResponseProcess(ctx, packet, info, cmdCode, respSz);
+    #ifdef WOLFTPM_HOOKS
+        if (rc != TPM_RC_SUCCESS)
+            ctx->hookInfo.rc = rc;
+    #endif
     }
 
     /* Caller expects packet position to be at end of header */
@@ -424,7 +1023,7 @@ static TPM_RC TPM2_SendCommand(TPM2_CTX* ctx, TPM2_Packet* packet)
         return BAD_FUNC_ARG;
 
     /* submit command and wait for response */
-    rc = (TPM_RC)INTERNAL_SEND_COMMAND(ctx, packet);
+    rc = TPM2_TransportSend(ctx, packet);
     if (rc != 0)
         return rc;
 
@@ -453,6 +1052,11 @@ static inline void TPM2_WolfCrypt_Init(void)
     #endif
 
         wolfCrypt_Init();
+
+    #ifdef WOLFTPM_BUS_LOCK
+        if (!gBusTableLockInit && wc_InitMutex(&gBusTableLock) == 0)
+            gBusTableLockInit = 1;
+    #endif
     }
     gWolfCryptRefCount++;
 }
@@ -527,18 +1131,22 @@ TPM_RC TPM2_ChipStartup(TPM2_CTX* ctx, int timeoutTries)
 
     rc = TPM2_AcquireLock(ctx);
     if (rc == TPM_RC_SUCCESS) {
-
-        /* Wait for chip startup to complete */
-        rc = TPM2_TIS_StartupWait(ctx, timeoutTries);
+        rc = TPM2_AcquireBusLock(ctx);
         if (rc == TPM_RC_SUCCESS) {
-
-            /* Request locality for TPM module */
-            rc = TPM2_TIS_RequestLocality(ctx, timeoutTries);
+            /* Wait for chip startup to complete */
+            rc = TPM2_TIS_StartupWait(ctx, timeoutTries);
             if (rc == TPM_RC_SUCCESS) {
 
-                /* Get device information */
-                rc = TPM2_TIS_GetInfo(ctx);
+                /* Request locality for TPM module */
+                rc = TPM2_TIS_RequestLocality(ctx, timeoutTries);
+                if (rc == TPM_RC_SUCCESS) {
+
+                    /* Get device information */
+                    rc = TPM2_TIS_GetInfo(ctx);
+                }
             }
+
+            TPM2_ReleaseBusLock(ctx);
         }
 
         TPM2_ReleaseLock(ctx);
@@ -557,8 +1165,14 @@ TPM_RC TPM2_SetHalIoCb(TPM2_CTX* ctx, TPM2HalIoCb ioCb, void* userCtx)
 
     rc = TPM2_AcquireLock(ctx);
     if (rc == TPM_RC_SUCCESS) {
-        ctx->ioCb = ioCb;
-        ctx->userCtx = userCtx;
+        if (ctx->asyncReq != NULL) {
+            rc = TPM_RC_RETRY;
+        }
+        else {
+            ctx->ioCb = ioCb;
+            ctx->userCtx = userCtx;
+            rc = TPM2_SelectBus(ctx);
+        }
 
         TPM2_ReleaseLock(ctx);
     }
@@ -568,40 +1182,64 @@ TPM_RC TPM2_SetHalIoCb(TPM2_CTX* ctx, TPM2HalIoCb ioCb, void* userCtx)
 
 /* If timeoutTries <= 0 then it will not try and startup chip and will
     use existing default locality */
-TPM_RC TPM2_Init_ex(TPM2_CTX* ctx, TPM2HalIoCb ioCb, void* userCtx,
-    int timeoutTries)
+static void TPM2_InitCtx(TPM2_CTX* ctx)
 {
-    TPM_RC rc = TPM_RC_SUCCESS;
-
-    if (ctx == NULL) {
-        return BAD_FUNC_ARG;
-    }
-
     XMEMSET(ctx, 0, sizeof(TPM2_CTX));
+    ctx->transport = TPM2_GetBuiltinTransport();
 
 #ifndef WOLFTPM2_NO_WOLFCRYPT
     TPM2_WolfCrypt_Init();
 #endif
+    /* on failure commands fail until a transport or HAL callback is set */
+    (void)TPM2_SelectBus(ctx);
 
+#if defined(WOLFTPM_LINUX_DEV)
+    (void)TPM2_LINUX_InitDev(&ctx->devCtx, NULL, TPM2_LINUX_DEV_KEEP_OPEN);
+#endif
 #if defined(WOLFTPM_SWTPM)
-    ctx->tcpCtx.fd = -1;
+    (void)TPM2_SWTPM_InitTcp(&ctx->tcpCtx, NULL, NULL, TPM2_SWTPM_KEEP_ALIVE);
+#ifdef TPM2_SWTPM_UNIX_PATH
+    ctx->tcpCtx.host = TPM2_SWTPM_UNIX_PATH;
+    ctx->tcpCtx.isUnix = 1;
+#endif
+#endif
+#if defined(WOLFTPM_TIS_LOCK) && defined(WOLFTPM_TIS)
+    ctx->tisCtx.lockFd = -1;
 #endif
+}
 
-    #if defined(WOLFTPM_LINUX_DEV) || defined(WOLFTPM_SWTPM) || defined(WOLFTPM_WINAPI)
-    if (ioCb != NULL || userCtx != NULL) {
+TPM_RC TPM2_Init_ex(TPM2_CTX* ctx, TPM2HalIoCb ioCb, void* userCtx,
+    int timeoutTries)
+{
+    TPM_RC rc = TPM_RC_SUCCESS;
+
+    if (ctx == NULL) {
         return BAD_FUNC_ARG;
     }
+
+    TPM2_InitCtx(ctx);
+
+    if (ioCb != NULL) {
+    #ifdef WOLFTPM_TIS
+        /* Setup HAL IO Callback */
+        ctx->transport = TPM2_TIS_GetTransport();
+        rc = TPM2_SetHalIoCb(ctx, ioCb, userCtx);
+        if (rc != TPM_RC_SUCCESS)
+          return rc;
     #else
-    /* Setup HAL IO Callback */
-    rc = TPM2_SetHalIoCb(ctx, ioCb, userCtx);
-    if (rc != TPM_RC_SUCCESS)
-      return rc;
+        return BAD_FUNC_ARG;
     #endif
+    }
+    else if (userCtx != NULL || ctx->transport == NULL ||
+            TPM2_IsTisTransport(ctx)) {
+        /* no built-in transport without the HAL IO callback */
+        return BAD_FUNC_ARG;
+    }
 
     /* Set the active TPM global */
     TPM2_SetActiveCtx(ctx);
 
-    if (timeoutTries > 0) {
+    if (timeoutTries > 0 && TPM2_IsTisTransport(ctx)) {
         /* Perform chip startup and assign locality */
         rc = TPM2_ChipStartup(ctx, timeoutTries);
     }
@@ -613,6 +1251,105 @@ TPM_RC TPM2_Init_ex(TPM2_CTX* ctx, TPM2HalIoCb ioCb, void* userCtx,
     return rc;
 }
 
+TPM_RC TPM2_Init_Transport(TPM2_CTX* ctx, const TPM2_TRANSPORT* transport,
+    void* transportCtx)
+{
+    if (ctx == NULL || transport == NULL || transport->sendCommand == NULL) {
+        return BAD_FUNC_ARG;
+    }
+
+    TPM2_InitCtx(ctx);
+    ctx->transport = transport;
+    ctx->transportCtx = transportCtx;
+    ctx->locality = WOLFTPM_LOCALITY_DEFAULT;
+
+    /* Set the active TPM global */
+    TPM2_SetActiveCtx(ctx);
+
+    return TPM2_SelectBus(ctx);
+}
+
+#ifdef WOLFTPM_HOOKS
+TPM_RC TPM2_SetHook(TPM2_CTX* ctx, TPM2HookCb hookCb, void* hookCtx)
+{
+    TPM_RC rc;
+
+    if (ctx == NULL)
+        return BAD_FUNC_ARG;
+
+    rc = TPM2_AcquireLock(ctx);
+    if (rc == TPM_RC_SUCCESS) {
+        ctx->hookCb = hookCb;
+        ctx->hookCtx = hookCtx;
+        ctx->hookInfo.cc = 0;
+
+        TPM2_ReleaseLock(ctx);
+    }
+    return rc;
+}
+#endif
+
+TPM_RC TPM2_SetTransport(TPM2_CTX* ctx, const TPM2_TRANSPORT* transport,
+    void* transportCtx)
+{
+    TPM_RC rc;
+
+    if (ctx == NULL || (transport != NULL && transport->sendCommand == NULL)) {
+        return BAD_FUNC_ARG;
+    }
+
+    rc = TPM2_AcquireLock(ctx);
+    if (rc == TPM_RC_SUCCESS) {
+        if (ctx->asyncReq != NULL) {
+            rc = TPM_RC_RETRY;
+        }
+        else {
+            if (transport == NULL) {
+                /* the transport TPM2_Init sets */
+                transport = TPM2_GetBuiltinTransport();
+            #ifdef WOLFTPM_TIS
+                if (ctx->ioCb != NULL)
+                    transport = TPM2_TIS_GetTransport();
+            #endif
+                transportCtx = NULL;
+            }
+            if (ctx->transport != NULL && ctx->transport->cleanup != NULL)
+                ctx->transport->cleanup(ctx, ctx->transportCtx);
+            ctx->transport = transport;
+            ctx->transportCtx = transportCtx;
+            rc = TPM2_SelectBus(ctx);
+        }
+
+        TPM2_ReleaseLock(ctx);
+    }
+
+    return rc;
+}
+
+const TPM2_TRANSPORT* TPM2_GetTransport(TPM2_CTX* ctx, void** transportCtx)
+{
+    if (ctx == NULL)
+        return NULL;
+    if (transportCtx != NULL)
+        *transportCtx = ctx->transportCtx;
+    return ctx->transport;
+}
+
+const TPM2_TRANSPORT* TPM2_GetBuiltinTransport(void)
+{
+#if defined(WOLFTPM_LINUX_DEV)
+    return TPM2_LINUX_GetTransport();
+#elif defined(WOLFTPM_SWTPM)
+    return TPM2_SWTPM_GetTransport();
+#elif defined(WOLFTPM_WINAPI)
+    return TPM2_WinApi_GetTransport();
+#elif defined(WOLFTPM_TIS)
+    return TPM2_TIS_GetTransport();
+#else
+    return NULL;
+#endif
+}
+
 TPM_RC TPM2_Init_minimal(TPM2_CTX* ctx)
 {
     return TPM2_Init_ex(ctx, NULL, NULL, 0);
@@ -634,8 +1371,13 @@ TPM_RC TPM2_Cleanup(TPM2_CTX* ctx)
     rc = TPM2_AcquireLock(ctx);
     if (rc == TPM_RC_SUCCESS) {
 
+        /* the context may have been active on another thread, so always
+         * release the transport */
+        TPM2_AsyncAbandon(ctx);
+        if (ctx->transport != NULL && ctx->transport->cleanup != NULL)
+            ctx->transport->cleanup(ctx, ctx->transportCtx);
+        TPM2_DetachBus(ctx);
         if (TPM2_GetActiveCtx() == ctx) {
-            TPM2_INTERNAL_CLEANUP(ctx);
             /* set non-active */
             TPM2_SetActiveCtx(NULL);
         }
@@ -643,8 +1385,18 @@ TPM_RC TPM2_Cleanup(TPM2_CTX* ctx)
         TPM2_ReleaseLock(ctx);
     }
 
+#ifndef WOLFTPM2_USE_WOLF_RNG
+    /* wipe unused TPM random */
+    XMEMSET(ctx->noncePool, 0, sizeof(ctx->noncePool));
+    ctx->noncePoolAvail = 0;
+    #ifdef WOLFTPM2_NONCE_EXPAND
+    XMEMSET(ctx->nonceSeed, 0, sizeof(ctx->nonceSeed));
+    ctx->nonceSeedUses = 0;
+    #endif
+#endif
+
 #ifndef WOLFTPM2_NO_WOLFCRYPT
-    #ifndef WC_NO_RNG
+    #ifdef WOLFTPM2_USE_WOLF_RNG
     if (ctx->rngInit) {
         ctx->rngInit = 0;
         wc_FreeRng(&ctx->rng);
@@ -653,6 +1405,7 @@ TPM_RC TPM2_Cleanup(TPM2_CTX* ctx)
     #ifndef SINGLE_THREADED
     if (ctx->hwLockInit) {
         ctx->hwLockInit = 0;
+        wc_FreeMutex(&ctx->sessionLock);
         wc_FreeMutex(&ctx->hwLock);
     }
     #endif
@@ -663,6 +1416,12 @@ TPM_RC TPM2_Cleanup(TPM2_CTX* ctx)
     if (gWolfCryptRefCount < 0)
         gWolfCryptRefCount = 0;
     if (gWolfCryptRefCount == 0) {
+    #ifdef WOLFTPM_BUS_LOCK
+        if (gBusTableLockInit) {
+            gBusTableLockInit = 0;
+            wc_FreeMutex(&gBusTableLock);
+        }
+    #endif
         wolfCrypt_Cleanup();
     }
 #endif /* !WOLFTPM2_NO_WOLFCRYPT */
@@ -844,6 +1603,32 @@ TPM_RC TPM2_GetCapability(GetCapability_In* in, GetCapability_Out* out)
                     }
                     break;
                 }
+                case TPM_CAP_HANDLES: {
+                    TPML_HANDLE* handles =
+                        &out->capabilityData.data.handles;
+                    TPM2_Packet_ParseU32(&packet, &handles->count);
+                    if (handles->count > MAX_CAP_HANDLES) {
+                        handles->count = MAX_CAP_HANDLES;
+                        out->moreData = YES;
+                    }
+                    for (i=0; i<(int)handles->count; i++) {
+                        TPM2_Packet_ParseU32(&packet, &handles->handle[i]);
+                    }
+                    break;
+                }
+                case TPM_CAP_COMMANDS: {
+                    TPML_CCA* cmds = &out->capabilityData.data.command;
+                    TPM2_Packet_ParseU32(&packet, &cmds->count);
+                    if (cmds->count > MAX_CAP_CC) {
+                        cmds->count = MAX_CAP_CC;
+                        out->moreData = YES;
+                    }
+                    for (i=0; i<(int)cmds->count; i++) {
+                        TPM2_Packet_ParseU32(&packet,
+                            &cmds->commandAttributes[i]);
+                    }
+                    break;
+                }
                 default:
             #ifdef DEBUG_WOLFTPM
                     printf("Unknown capability type 0x%x\n",
@@ -1155,6 +1940,54 @@ TPM_RC TPM2_CreatePrimary(CreatePrimary_In* in, CreatePrimary_Out* out)
 }
 
 
+TPM_RC TPM2_CreateLoaded(CreateLoaded_In* in, CreateLoaded_Out* out)
+{
+    TPM_RC rc;
+    TPM2_CTX* ctx = TPM2_GetActiveCtx();
+
+    if (ctx == NULL || in == NULL || out == NULL || ctx->session == NULL)
+        return BAD_FUNC_ARG;
+
+    rc = TPM2_AcquireLock(ctx);
+    if (rc == TPM_RC_SUCCESS) {
+        CmdInfo_t info = {
+            .inHandleCnt = 1,
+            .outHandleCnt = 1,
+            .flags = (CMD_FLAG_ENC2 | CMD_FLAG_DEC2),
+        };
+        TPM2_Packet packet;
+        TPM2_Packet_Init(ctx, &packet);
+        TPM2_Packet_AppendU32(&packet, in->parentHandle);
+        info.authCnt = TPM2_Packet_AppendAuth(&packet, ctx);
+        TPM2_Packet_AppendSensitiveCreate(&packet, &in->inSensitive);
+        TPM2_Packet_AppendTemplate(&packet, &in->inPublic);
+        TPM2_Packet_Finalize(&packet, TPM_ST_SESSIONS, TPM_CC_CreateLoaded);
+
+        /* send command */
+        rc = TPM2_SendCommandAuth(ctx, &packet, &info);
+        if (rc == TPM_RC_SUCCESS) {
+            UINT32 paramSz = 0;
+
+            TPM2_Packet_ParseU32(&packet, &out->objectHandle);
+
+            TPM2_Packet_ParseU32(&packet, &paramSz);
+
+            TPM2_Packet_ParseU16(&packet, &out->outPrivate.size);
+            TPM2_Packet_ParseBytes(&packet, out->outPrivate.buffer,
+                out->outPrivate.size);
+
+            TPM2_Packet_ParsePublic(&packet, &out->outPublic);
+
+            TPM2_Packet_ParseU16(&packet, &out->name.size);
+            TPM2_Packet_ParseBytes(&packet, out->name.name, out->name.size);
+        }
+
+        TPM2_ReleaseLock(ctx);
+    }
+    return rc;
+}
+
+
 TPM_RC TPM2_Load(Load_In* in, Load_Out* out)
 {
     TPM_RC rc;
@@ -5123,6 +5956,219 @@ TPM_RC TPM2_NV_Certify(NV_Certify_In* in, NV_Certify_Out* out)
 /******************************************************************************/
 
 
+/******************************************************************************/
+/* --- Asynchronous Commands -- */
+/******************************************************************************/
+TPM_RC TPM2_AsyncSubmit(TPM2_CTX* ctx, TPM2_ASYNC* req, byte* buf,
+    int cmdSz, int bufSz, TPM2AsyncCb cb, void* cbCtx)
+{
+    TPM_RC rc;
+    int done = 0;
+    TPM2_Packet packet;
+
+    if (ctx == NULL || req == NULL || buf == NULL ||
+            cmdSz < TPM2_HEADER_SIZE || bufSz < cmdSz)
+        return BAD_FUNC_ARG;
+
+    XMEMSET(req, 0, sizeof(TPM2_ASYNC));
+    req->ctx = ctx;
+    req->buf = buf;
+    req->bufSz = bufSz;
+    req->cmdSz = cmdSz;
+    req->rc = TPM_RC_YIELDED;
+    req->cb = cb;
+    req->cbCtx = cbCtx;
+    req->fd = -1;
+
+    rc = TPM2_AcquireLock(ctx);
+    if (rc != TPM_RC_SUCCESS)
+        return rc;
+
+    if (ctx->asyncReq != NULL) {
+        rc = TPM_RC_RETRY;
+    }
+    else if (ctx->transport != NULL && ctx->transport->asyncSend != NULL) {
+        rc = TPM2_AcquireBusLock(ctx);
+        if (rc == TPM_RC_SUCCESS) {
+            if (ctx->transport->flags & TPM2_TRANSPORT_FLAG_SHARED_BUS)
+                ctx->bus->owner = ctx;
+        #ifdef WOLFTPM_HOOKS
+            TPM2_HookAsyncSend(ctx, req);
+        #endif
+            ctx->asyncReq = req;
+            rc = (TPM_RC)ctx->transport->asyncSend(ctx, req,
+                ctx->transportCtx);
+            TPM2_ReleaseBusLock(ctx);
+            if (rc != TPM_RC_SUCCESS) {
+                (void)TPM2_AsyncComplete(ctx, req, rc);
+            }
+        }
+    }
+    else {
+    #ifdef WOLFTPM_HOOKS
+        TPM2_HookAsyncSend(ctx, req);
+    #endif
+        /* transport has no separate send and receive, complete it now */
+        packet.buf = buf;
+        packet.pos = cmdSz;
+        packet.size = bufSz;
+        (void)TPM2_AsyncComplete(ctx, req,
+            TPM2_TransportExchange(ctx, &packet));
+        done = 1;
+    }
+
+    TPM2_ReleaseLock(ctx);
+
+    if (done && req->cb != NULL) {
+        req->cb(req, req->cbCtx);
+    }
+
+    return rc;
+}
+
+TPM_RC TPM2_AsyncPoll(TPM2_ASYNC* req)
+{
+    TPM_RC rc;
+    TPM2_CTX* ctx;
+    int done = 0;
+
+    if (req == NULL || req->ctx == NULL)
+        return BAD_FUNC_ARG;
+    if (req->rc != TPM_RC_YIELDED)
+        return req->rc;
+
+    ctx = req->ctx;
+    rc = TPM2_AcquireLock(ctx);
+    if (rc != TPM_RC_SUCCESS)
+        return rc;
+
+    if (ctx->asyncReq == req && ctx->transport->asyncRecv != NULL) {
+        rc = (TPM_RC)ctx->transport->asyncRecv(ctx, req, ctx->transportCtx);
+        if (rc != TPM_RC_YIELDED) {
+            rc = TPM2_AsyncComplete(ctx, req, rc);
+            done = 1;
+        }
+    }
+    else {
+        /* completed by another thread or during submit */
+        rc = req->rc;
+    }
+
+    TPM2_ReleaseLock(ctx);
+
+    if (done && req->cb != NULL) {
+        req->cb(req, req->cbCtx);
+    }
+
+    return rc;
+}
+
+TPM_RC TPM2_AsyncWait(TPM2_ASYNC* req, int timeoutMs)
+{
+    TPM_RC rc;
+#ifdef TPM2_ASYNC_POLL_FD
+    struct pollfd fds;
+    struct timespec now;
+    long startMs, waitMs = timeoutMs;
+    int rc_poll;
+#endif
+#if defined(WOLFTPM_TIS) && defined(WOLFTPM_TIMED_POLL)
+    UINT64 startUs, elapsedUs;
+    word32 delayUs;
+#endif
+
+    rc = TPM2_AsyncPoll(req);
+
+#if defined(WOLFTPM_TIS) && defined(WOLFTPM_TIMED_POLL)
+    if (rc == TPM_RC_YIELDED &&
+            (req->ctx->transport->flags & TPM2_TRANSPORT_FLAG_SHARED_BUS)) {
+        /* sleep until the TIS state machine will poll the TPM again */
+        startUs = XTPM_TIME_US();
+        while (rc == TPM_RC_YIELDED) {
+            delayUs = TPM2_IsTisTransport(req->ctx) ?
+                TPM2_TIS_PollDelayUs(req->ctx) : TPM_TIS_POLL_MIN_US;
+            if (timeoutMs >= 0) {
+                elapsedUs = XTPM_TIME_US() - startUs;
+                if (elapsedUs >= (UINT64)timeoutMs * 1000)
+                    break;
+                if (delayUs > (UINT64)timeoutMs * 1000 - elapsedUs)
+                    delayUs = (word32)((UINT64)timeoutMs * 1000 - elapsedUs);
+            }
+            if (delayUs > 0)
+                XTPM_SLEEP_US(delayUs);
+            rc = TPM2_AsyncPoll(req);
+        }
+        return rc;
+    }
+#endif
+
+#ifdef TPM2_ASYNC_POLL_FD
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    startMs = (long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+    while (rc == TPM_RC_YIELDED) {
+        if (timeoutMs >= 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            waitMs = timeoutMs -
+                ((long)now.tv_sec * 1000 + now.tv_nsec / 1000000 - startMs);
+            if (waitMs <= 0)
+                break;
+        }
+        if (req->fd < 0) {
+            /* transport without a descriptor, poll it */
+            XTPM_WAIT();
+            rc = TPM2_AsyncPoll(req);
+            continue;
+        }
+
+        fds.fd = req->fd;
+        fds.events = POLLIN;
+        rc_poll = poll(&fds, 1, (timeoutMs >= 0) ? (int)waitMs : -1);
+        if (rc_poll < 0 && errno != EINTR)
+            break;
+        if (rc_poll > 0)
+            rc = TPM2_AsyncPoll(req);
+    }
+#else
+    /* no descriptor to wait on, poll the transport. The TIS state machine
+     * times out after TPM_TIMEOUT_TRIES polls */
+    (void)timeoutMs;
+    while (rc == TPM_RC_YIELDED) {
+        XTPM_WAIT();
+        rc = TPM2_AsyncPoll(req);
+    }
+#endif
+
+    return rc;
+}
+
+int TPM2_AsyncGetFd(TPM2_ASYNC* req)
+{
+    if (req == NULL || req->rc != TPM_RC_YIELDED)
+        return -1;
+    return req->fd;
+}
+
+TPM_RC TPM2_AsyncCancel(TPM2_ASYNC* req)
+{
+    TPM_RC rc;
+    TPM2_CTX* ctx;
+
+    if (req == NULL || req->ctx == NULL)
+        return BAD_FUNC_ARG;
+
+    ctx = req->ctx;
+    rc = TPM2_AcquireLock(ctx);
+    if (rc == TPM_RC_SUCCESS) {
+        if (ctx->asyncReq == req) {
+            TPM2_AsyncAbandon(ctx);
+        }
+        TPM2_ReleaseLock(ctx);
+    }
+    return rc;
+}
+
+
 /******************************************************************************/
 /* --- BEGIN Manufacture Specific TPM API's -- */
 /******************************************************************************/
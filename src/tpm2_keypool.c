@@ -0,0 +1,559 @@
+/* tpm2_keypool.c
+ *
+ * Copyright (C) 2006-2020 wolfSSL Inc.
+ *
+ * This file is part of wolfTPM.
+ *
+ * wolfTPM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfTPM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+
+
+/**
+ * Key pre-generation pool. Keys are created ahead of time with TPM2_Create
+ * and kept as blobs (in memory and optionally in a file), so a request for
+ * a key only costs a TPM2_Load.
+ *
+ * Build with --enable-keypool
+ */
+
+#ifdef WOLFTPM_KEYPOOL
+#include <wolftpm/tpm2.h>
+#include <wolftpm/tpm2_wrap.h>
+#include <wolftpm/tpm2_keypool.h>
+
+#include <string.h>
+#include <stdio.h>
+
+
+static int KeyPoolLock(WOLFTPM2_KEYPOOL* pool)
+{
+#if !defined(WOLFTPM2_NO_WOLFCRYPT) && !defined(SINGLE_THREADED)
+    if (wc_LockMutex(&pool->lock) != 0)
+        return TPM_RC_FAILURE;
+#else
+    (void)pool;
+#endif
+    return TPM_RC_SUCCESS;
+}
+
+static void KeyPoolUnlock(WOLFTPM2_KEYPOOL* pool)
+{
+#if !defined(WOLFTPM2_NO_WOLFCRYPT) && !defined(SINGLE_THREADED)
+    wc_UnLockMutex(&pool->lock);
+#else
+    (void)pool;
+#endif
+}
+
+/* The name of a key is the digest of its public area, so it stays the same
+ * when a primary key is created again with another handle */
+static int KeyPoolSameParent(const WOLFTPM2_HANDLE* a, const WOLFTPM2_HANDLE* b)
+{
+    if (a->name.size == 0 && b->name.size == 0)
+        return a->hndl == b->hndl;
+    return a->name.size == b->name.size &&
+        XMEMCMP(a->name.name, b->name.name, a->name.size) == 0;
+}
+
+static void KeyPoolDrop(WOLFTPM2_KEYPOOL* pool)
+{
+    pool->discarded += pool->count;
+    pool->count = 0;
+    pool->generation++;
+    XMEMSET(pool->blob, 0, sizeof(pool->blob));
+}
+
+/* Only errors about the blob itself (TPM2_Load inPrivate is parameter 1 and
+ * inPublic parameter 2) make it useless. Session errors (wrong parent auth)
+ * and handle errors (parent flushed) are not the blob's fault, and trying
+ * the next blob would only empty the pool and add to the DA counter. */
+static int KeyPoolBlobError(int rc)
+{
+    int n;
+
+    if (rc < 0 || (rc & RC_FMT1) == 0)
+        return 0;
+    if ((rc & RC_MAX_FMT1) == TPM_RC_INTEGRITY)
+        return 1;
+    if ((rc & TPM_RC_P) == 0)
+        return 0; /* TPM_RC_H or TPM_RC_S */
+    n = rc & TPM_RC_N_MASK;
+    if (n != TPM_RC_1 && n != TPM_RC_2)
+        return 0;
+    return (rc & RC_MAX_FMT1) == TPM_RC_SIZE ||
+           (rc & RC_MAX_FMT1) == TPM_RC_VALUE;
+}
+
+
+/******************************************************************************/
+/* --- BEGIN Key Blob File -- */
+/******************************************************************************/
+
+/* File: magic, parent name (U16 size), template and blob count (U32), then
+ * each blob public (as TPM2B_PUBLIC) and private (U16 size). Sizes are big
+ * endian. */
+#ifndef NO_FILESYSTEM
+static void KeyPoolPutU16(byte* b, word32 v)
+{
+    b[0] = (byte)(v >> 8); b[1] = (byte)v;
+}
+
+static word16 KeyPoolGetU16(const byte* b)
+{
+    return (word16)((b[0] << 8) | b[1]);
+}
+
+static void KeyPoolPutU32(byte* b, word32 v)
+{
+    b[0] = (byte)(v >> 24); b[1] = (byte)(v >> 16);
+    b[2] = (byte)(v >> 8);  b[3] = (byte)v;
+}
+
+static word32 KeyPoolGetU32(const byte* b)
+{
+    return ((word32)b[0] << 24) | ((word32)b[1] << 16) |
+           ((word32)b[2] << 8) | b[3];
+}
+
+static int KeyPoolWrite(XFILE fp, const byte* data, word32 sz)
+{
+    return (XFWRITE(data, 1, sz, fp) == sz) ? 0 : TPM_RC_FAILURE;
+}
+
+static int KeyPoolRead(XFILE fp, byte* data, word32 sz)
+{
+    return (XFREAD(data, 1, sz, fp) == sz) ? 0 : TPM_RC_FAILURE;
+}
+
+/* U16 size then bytes, into a buffer of bufSz */
+static int KeyPoolReadSized(XFILE fp, byte* buf, word32 bufSz, word32* sz)
+{
+    int rc;
+
+    rc = KeyPoolRead(fp, buf, 2);
+    if (rc == 0) {
+        *sz = 2 + KeyPoolGetU16(buf);
+        if (*sz > bufSz)
+            rc = BUFFER_E;
+    }
+    if (rc == 0)
+        rc = KeyPoolRead(fp, buf + 2, *sz - 2);
+    return rc;
+}
+
+static int KeyPoolTemplate(WOLFTPM2_KEYPOOL* pool, byte* buf, word32 bufSz,
+    int* sz)
+{
+    TPM2B_PUBLIC pub;
+
+    XMEMSET(&pub, 0, sizeof(pub));
+    pub.publicArea = pool->publicTemplate;
+    return TPM2_AppendPublic(buf, bufSz, sz, &pub);
+}
+
+/* called with the pool locked */
+static int KeyPoolSave(WOLFTPM2_KEYPOOL* pool)
+{
+    int rc, sz = 0;
+    XFILE fp;
+    word32 i;
+    byte buf[sizeof(TPM2B_PUBLIC)];
+
+    if (pool->file == NULL)
+        return TPM_RC_SUCCESS;
+
+    fp = XFOPEN(pool->file, "wb");
+    if (fp == XBADFILE)
+        return TPM_RC_FAILURE;
+
+    rc = KeyPoolWrite(fp, (const byte*)WOLFTPM2_KEYPOOL_MAGIC,
+        WOLFTPM2_KEYPOOL_MAGIC_SZ);
+    if (rc == 0) {
+        KeyPoolPutU16(buf, pool->parent.name.size);
+        rc = KeyPoolWrite(fp, buf, 2);
+    }
+    if (rc == 0)
+        rc = KeyPoolWrite(fp, pool->parent.name.name, pool->parent.name.size);
+    if (rc == 0)
+        rc = KeyPoolTemplate(pool, buf, sizeof(buf), &sz);
+    if (rc == 0)
+        rc = KeyPoolWrite(fp, buf, (word32)sz);
+    if (rc == 0) {
+        KeyPoolPutU32(buf, pool->count);
+        rc = KeyPoolWrite(fp, buf, 4);
+    }
+    for (i = 0; rc == 0 && i < pool->count; i++) {
+        WOLFTPM2_KEYPOOL_BLOB* blob = &pool->blob[i];
+        rc = TPM2_AppendPublic(buf, sizeof(buf), &sz, &blob->pub);
+        if (rc == 0)
+            rc = KeyPoolWrite(fp, buf, (word32)sz);
+        if (rc == 0) {
+            KeyPoolPutU16(buf, blob->priv.size);
+            rc = KeyPoolWrite(fp, buf, 2);
+        }
+        if (rc == 0)
+            rc = KeyPoolWrite(fp, blob->priv.buffer, blob->priv.size);
+    }
+    XFCLOSE(fp);
+
+#ifdef DEBUG_WOLFTPM
+    if (rc != 0)
+        printf("KeyPool: writing %s failed\n", pool->file);
+#endif
+    return rc;
+}
+
+/* Use the blobs of the file when made under the same parent and template */
+static int KeyPoolLoad(WOLFTPM2_KEYPOOL* pool)
+{
+    int rc, sz = 0;
+    XFILE fp;
+    word32 i, count = 0, bufSz = 0;
+    byte buf[sizeof(TPM2B_PUBLIC)];
+    byte tmpl[sizeof(TPM2B_PUBLIC)];
+    TPM2B_NAME name;
+
+    fp = XFOPEN(pool->file, "rb");
+    if (fp == XBADFILE)
+        return TPM_RC_SUCCESS; /* first start */
+
+    rc = KeyPoolRead(fp, buf, WOLFTPM2_KEYPOOL_MAGIC_SZ);
+    if (rc == 0 && XMEMCMP(buf, WOLFTPM2_KEYPOOL_MAGIC,
+            WOLFTPM2_KEYPOOL_MAGIC_SZ) != 0) {
+        rc = BAD_FUNC_ARG;
+    }
+    if (rc == 0)
+        rc = KeyPoolReadSized(fp, buf, sizeof(name.name) + 2, &bufSz);
+    if (rc == 0) {
+        name.size = (UINT16)(bufSz - 2);
+        XMEMCPY(name.name, buf + 2, name.size);
+        rc = KeyPoolReadSized(fp, buf, sizeof(buf), &bufSz);
+    }
+    if (rc == 0)
+        rc = KeyPoolTemplate(pool, tmpl, sizeof(tmpl), &sz);
+    if (rc == 0 && ((word32)sz != bufSz || XMEMCMP(buf, tmpl, bufSz) != 0 ||
+            name.size != pool->parent.name.size ||
+            XMEMCMP(name.name, pool->parent.name.name, name.size) != 0)) {
+        /* another parent or template, the blobs are of no use */
+        rc = TPM_RC_SUCCESS;
+        goto exit;
+    }
+    if (rc == 0)
+        rc = KeyPoolRead(fp, buf, 4);
+    if (rc == 0) {
+        count = KeyPoolGetU32(buf);
+        if (count > WOLFTPM2_KEYPOOL_MAX)
+            rc = BUFFER_E;
+    }
+    for (i = 0; rc == 0 && i < count; i++) {
+        WOLFTPM2_KEYPOOL_BLOB* blob = &pool->blob[i];
+        rc = KeyPoolReadSized(fp, buf, sizeof(buf), &bufSz);
+        if (rc == 0)
+            rc = TPM2_ParsePublic(&blob->pub, buf, sizeof(buf), &sz);
+        if (rc == 0)
+            rc = KeyPoolRead(fp, buf, 2);
+        if (rc == 0) {
+            blob->priv.size = KeyPoolGetU16(buf);
+            if (blob->priv.size > sizeof(blob->priv.buffer))
+                rc = BUFFER_E;
+        }
+        if (rc == 0)
+            rc = KeyPoolRead(fp, blob->priv.buffer, blob->priv.size);
+    }
+    if (rc == 0)
+        pool->count = count;
+
+exit:
+    XFCLOSE(fp);
+    if (rc != 0) {
+    #ifdef DEBUG_WOLFTPM
+        printf("KeyPool: reading %s failed %d\n", pool->file, rc);
+    #endif
+        XMEMSET(pool->blob, 0, sizeof(pool->blob));
+        rc = TPM_RC_SUCCESS; /* start empty */
+    }
+    /* the file is written again without the blobs it had */
+    if (pool->count == 0)
+        rc = KeyPoolSave(pool);
+    return rc;
+}
+#else
+static int KeyPoolSave(WOLFTPM2_KEYPOOL* pool)
+{
+    (void)pool;
+    return TPM_RC_SUCCESS;
+}
+#endif /* !NO_FILESYSTEM */
+
+
+/******************************************************************************/
+/* --- BEGIN Key Pool API -- */
+/******************************************************************************/
+
+int wolfTPM2_KeyPool_Init(WOLFTPM2_KEYPOOL* pool, WOLFTPM2_HANDLE* parent,
+    TPMT_PUBLIC* publicTemplate, const byte* auth, int authSz,
+    word32 lowWater, word32 highWater, const char* file)
+{
+    int rc = TPM_RC_SUCCESS;
+
+    if (pool == NULL || parent == NULL || publicTemplate == NULL ||
+            authSz < 0 || authSz > (int)sizeof(pool->auth.buffer) ||
+            (auth == NULL && authSz > 0) || lowWater == 0 ||
+            lowWater > highWater || highWater > WOLFTPM2_KEYPOOL_MAX) {
+        return BAD_FUNC_ARG;
+    }
+#ifdef NO_FILESYSTEM
+    if (file != NULL)
+        return BAD_FUNC_ARG;
+#endif
+
+    XMEMSET(pool, 0, sizeof(WOLFTPM2_KEYPOOL));
+    pool->parent = *parent;
+    pool->publicTemplate = *publicTemplate;
+    if (authSz > 0)
+        XMEMCPY(pool->auth.buffer, auth, authSz);
+    pool->auth.size = (UINT16)authSz;
+    pool->lowWater = lowWater;
+    pool->highWater = highWater;
+    pool->file = file;
+
+#ifndef NO_FILESYSTEM
+    if (file != NULL)
+        rc = KeyPoolLoad(pool);
+#endif
+#if !defined(WOLFTPM2_NO_WOLFCRYPT) && !defined(SINGLE_THREADED)
+    if (rc == TPM_RC_SUCCESS && wc_InitMutex(&pool->lock) != 0)
+        rc = TPM_RC_FAILURE;
+#endif
+
+#ifdef DEBUG_WOLFTPM
+    printf("KeyPool: %u blobs ready, water marks %u / %u\n",
+        pool->count, lowWater, highWater);
+#endif
+    return rc;
+}
+
+int wolfTPM2_KeyPool_NeedsFill(WOLFTPM2_KEYPOOL* pool)
+{
+    int needs;
+
+    if (pool == NULL || KeyPoolLock(pool) != TPM_RC_SUCCESS)
+        return 0;
+    needs = (pool->filling || pool->count < pool->lowWater) &&
+        pool->count < pool->highWater;
+    KeyPoolUnlock(pool);
+    return needs;
+}
+
+int wolfTPM2_KeyPool_Fill(WOLFTPM2_KEYPOOL* pool, WOLFTPM2_DEV* dev,
+    word32 maxKeys, word32* created)
+{
+    int rc = TPM_RC_SUCCESS;
+    word32 made = 0, generation;
+    WOLFTPM2_HANDLE parent;
+    WOLFTPM2_KEYBLOB keyBlob;
+
+    if (pool == NULL || dev == NULL)
+        return BAD_FUNC_ARG;
+
+    while (rc == TPM_RC_SUCCESS) {
+        rc = KeyPoolLock(pool);
+        if (rc != TPM_RC_SUCCESS)
+            break;
+        /* start below the low water mark, stop at the high one */
+        if (pool->count < pool->lowWater)
+            pool->filling = 1;
+        if (pool->count >= pool->highWater)
+            pool->filling = 0;
+        if (!pool->filling || (maxKeys > 0 && made >= maxKeys)) {
+            KeyPoolUnlock(pool);
+            break;
+        }
+        parent = pool->parent;
+        generation = pool->generation;
+        KeyPoolUnlock(pool);
+
+        /* takes seconds for RSA, the pool is not locked */
+        rc = wolfTPM2_CreateKey(dev, &keyBlob, &parent, &pool->publicTemplate,
+            pool->auth.buffer, pool->auth.size);
+        if (rc != TPM_RC_SUCCESS)
+            break;
+        made++;
+
+        rc = KeyPoolLock(pool);
+        if (rc != TPM_RC_SUCCESS)
+            break;
+        pool->created++;
+        if (generation == pool->generation &&
+                pool->count < WOLFTPM2_KEYPOOL_MAX) {
+            pool->blob[pool->count].pub = keyBlob.pub;
+            pool->blob[pool->count].priv = keyBlob.priv;
+            pool->count++;
+            rc = KeyPoolSave(pool);
+        }
+        else {
+            /* the parent changed while creating */
+            pool->discarded++;
+        }
+        KeyPoolUnlock(pool);
+    }
+
+    if (created != NULL)
+        *created = made;
+    return rc;
+}
+
+int wolfTPM2_KeyPool_Take(WOLFTPM2_KEYPOOL* pool, WOLFTPM2_DEV* dev,
+    WOLFTPM2_KEYBLOB* key)
+{
+    int rc;
+    int have;
+    word32 generation;
+    WOLFTPM2_HANDLE parent;
+    WOLFTPM2_KEYPOOL_BLOB blob;
+
+    if (pool == NULL || dev == NULL || key == NULL)
+        return BAD_FUNC_ARG;
+
+    for (;;) {
+        rc = KeyPoolLock(pool);
+        if (rc != TPM_RC_SUCCESS)
+            return rc;
+        have = (pool->count > 0);
+        if (have) {
+            /* a blob is never loaded twice, also after a restart */
+            pool->count--;
+            blob = pool->blob[pool->count];
+            XMEMSET(&pool->blob[pool->count], 0, sizeof(blob));
+            rc = KeyPoolSave(pool);
+            if (rc != TPM_RC_SUCCESS)
+                pool->discarded++;
+        }
+        parent = pool->parent;
+        generation = pool->generation;
+        KeyPoolUnlock(pool);
+        if (rc != TPM_RC_SUCCESS)
+            return rc;
+
+        if (!have) {
+            rc = wolfTPM2_CreateKey(dev, key, &parent, &pool->publicTemplate,
+                pool->auth.buffer, pool->auth.size);
+            if (rc == TPM_RC_SUCCESS)
+                rc = wolfTPM2_LoadKey(dev, key, &parent);
+            if (KeyPoolLock(pool) == TPM_RC_SUCCESS) {
+                pool->misses++;
+                KeyPoolUnlock(pool);
+            }
+            return rc;
+        }
+
+        XMEMSET(key, 0, sizeof(WOLFTPM2_KEYBLOB));
+        key->pub = blob.pub;
+        key->priv = blob.priv;
+        rc = wolfTPM2_LoadKey(dev, key, &parent);
+        if (rc == TPM_RC_SUCCESS) {
+            key->handle.auth = pool->auth;
+            key->handle.symmetric =
+                key->pub.publicArea.parameters.asymDetail.symmetric;
+            if (KeyPoolLock(pool) == TPM_RC_SUCCESS) {
+                pool->taken++;
+                KeyPoolUnlock(pool);
+            }
+            return rc;
+        }
+
+    #ifdef DEBUG_WOLFTPM
+        printf("KeyPool: blob load failed %d: %s\n", rc,
+            wolfTPM2_GetRCString(rc));
+    #endif
+        if (!KeyPoolBlobError(rc)) {
+            /* the blob was not loaded, so it goes back for the next try */
+            if (KeyPoolLock(pool) == TPM_RC_SUCCESS) {
+                if (generation == pool->generation &&
+                        pool->count < WOLFTPM2_KEYPOOL_MAX) {
+                    pool->blob[pool->count] = blob;
+                    pool->count++;
+                    (void)KeyPoolSave(pool);
+                }
+                else {
+                    pool->discarded++;
+                }
+                KeyPoolUnlock(pool);
+            }
+            XMEMSET(&blob, 0, sizeof(blob));
+            return rc;
+        }
+        /* the blob is corrupted or of another parent, try the next one */
+        if (KeyPoolLock(pool) == TPM_RC_SUCCESS) {
+            pool->discarded++;
+            KeyPoolUnlock(pool);
+        }
+    }
+}
+
+int wolfTPM2_KeyPool_SetParent(WOLFTPM2_KEYPOOL* pool, WOLFTPM2_HANDLE* parent)
+{
+    int rc;
+
+    if (pool == NULL || parent == NULL)
+        return BAD_FUNC_ARG;
+
+    rc = KeyPoolLock(pool);
+    if (rc != TPM_RC_SUCCESS)
+        return rc;
+    if (!KeyPoolSameParent(&pool->parent, parent)) {
+        KeyPoolDrop(pool);
+        pool->parent = *parent;
+        rc = KeyPoolSave(pool);
+    }
+    else {
+        pool->parent = *parent;
+    }
+    KeyPoolUnlock(pool);
+    return rc;
+}
+
+int wolfTPM2_KeyPool_Discard(WOLFTPM2_KEYPOOL* pool)
+{
+    int rc;
+
+    if (pool == NULL)
+        return BAD_FUNC_ARG;
+
+    rc = KeyPoolLock(pool);
+    if (rc != TPM_RC_SUCCESS)
+        return rc;
+    KeyPoolDrop(pool);
+    rc = KeyPoolSave(pool);
+    KeyPoolUnlock(pool);
+    return rc;
+}
+
+int wolfTPM2_KeyPool_Free(WOLFTPM2_KEYPOOL* pool)
+{
+    if (pool == NULL)
+        return BAD_FUNC_ARG;
+
+#if !defined(WOLFTPM2_NO_WOLFCRYPT) && !defined(SINGLE_THREADED)
+    wc_FreeMutex(&pool->lock);
+#endif
+    XMEMSET(pool->blob, 0, sizeof(pool->blob));
+    pool->count = 0;
+    pool->file = NULL;
+    return TPM_RC_SUCCESS;
+}
+
+#endif /* WOLFTPM_KEYPOOL */
@@ -33,12 +33,6 @@
 #include <string.h>
 
 
-#ifndef TPM2_LINUX_DEV
-#define TPM2_LINUX_DEV "/dev/tpm0"
-#endif
-
-#define TPM2_LINUX_DEV_POLL_TIMEOUT -1 /* Infinite time for poll events */
-
 /* Linux kernels older than v4.20 (before December 2018) do not support
  * partial reads. The only way to receive a complete response is to read
  * the maximum allowed TPM response from the kernel, which is 4K. And most
@@ -49,30 +43,133 @@
  * the WOLFTPM2_BUFFER in wolfTPM wrappers */
 
 
+/* Maximum time to wait for the kernel to return a response */
+static int TPM2_LINUX_GetTimeout(TPM_CC cc)
+{
+    switch (cc) {
+        case TPM_CC_CreatePrimary:
+        case TPM_CC_Create:
+        case TPM_CC_CreateLoaded:
+        case TPM_CC_SelfTest:
+        case TPM_CC_Clear:
+        case TPM_CC_ChangeEPS:
+        case TPM_CC_ChangePPS:
+            return TPM2_LINUX_DEV_TIMEOUT_LONG;
+        case TPM_CC_GetRandom:
+        case TPM_CC_StirRandom:
+        case TPM_CC_GetCapability:
+        case TPM_CC_GetTestResult:
+        case TPM_CC_PCR_Read:
+        case TPM_CC_PCR_Extend:
+        case TPM_CC_ReadPublic:
+        case TPM_CC_FlushContext:
+        case TPM_CC_ContextSave:
+        case TPM_CC_ContextLoad:
+        case TPM_CC_NV_ReadPublic:
+        case TPM_CC_Startup:
+        case TPM_CC_Shutdown:
+            return TPM2_LINUX_DEV_TIMEOUT_SHORT;
+        default:
+            break;
+    }
+    return TPM2_LINUX_DEV_TIMEOUT_MEDIUM;
+}
+
+/* Read and drop the response of a cancelled command, waiting at most
+ * timeoutMs for it. Returns 0 once it is read. */
+static int TPM2_LINUX_Drain(struct wolfTPM_devContext* dev, int timeoutMs)
+{
+    struct pollfd fds;
+    byte rsp[MAX_RESPONSE_SIZE];
+
+    fds.fd = dev->fd;
+    fds.events = POLLIN;
+    fds.revents = 0;
+    if (poll(&fds, 1, timeoutMs) <= 0 || (fds.revents & POLLIN) == 0)
+        return -1;
+    /* the whole response in one read, for kernels before v4.20 */
+    if (read(dev->fd, rsp, sizeof(rsp)) < 0 && errno == EAGAIN)
+        return -1;
+    dev->drain = 0;
+    return 0;
+}
+
+static int TPM2_LINUX_Open(struct wolfTPM_devContext* dev)
+{
+    int fd = dev->fd;
+    if (fd >= 0 && dev->drain &&
+            TPM2_LINUX_Drain(dev, TPM2_LINUX_DEV_TIMEOUT_LONG) != 0) {
+        /* give up on the connection, so a write does not fail with EBUSY */
+        close(fd);
+        fd = dev->fd = -1;
+        dev->drain = 0;
+    }
+    if (fd < 0) {
+        fd = open(dev->path, O_RDWR | O_NONBLOCK);
+    #ifdef DEBUG_WOLFTPM
+        if (fd < 0 && errno == EACCES) {
+            printf("Permission denied. Use sudo or change the user group.\n");
+        }
+        else if (fd < 0) {
+            perror("Failed to open device");
+        }
+    #endif
+    }
+    return fd;
+}
+
+static void TPM2_LINUX_Close(struct wolfTPM_devContext* dev, int fd, int rc)
+{
+    /* keep open only on success, so no stale response is left behind */
+    if (rc == TPM_RC_SUCCESS && dev->keepOpen) {
+        dev->fd = fd;
+    }
+    else {
+        close(fd);
+        dev->fd = -1;
+    }
+}
+
+/* Device of the transport, the context's own unless one is given */
+static struct wolfTPM_devContext* TPM2_LINUX_GetDev(TPM2_CTX* ctx,
+    void* transportCtx)
+{
+    if (transportCtx != NULL)
+        return (struct wolfTPM_devContext*)transportCtx;
+    return &ctx->devCtx;
+}
+
 /* Talk to a TPM device exposed by the Linux tpm_tis driver */
-int TPM2_LINUX_SendCommand(TPM2_CTX* ctx, TPM2_Packet* packet)
+static int TPM2_LINUX_SendCommand(TPM2_CTX* ctx, byte* buf, int cmdSz,
+    int bufSz, void* transportCtx)
 {
+    struct wolfTPM_devContext* dev = TPM2_LINUX_GetDev(ctx, transportCtx);
     int rc = TPM_RC_FAILURE;
     int fd;
     int rc_poll, nfds = 1; /* Polling single TPM dev file */
     struct pollfd fds;
-    size_t rspSz = 0;
+    ssize_t rspSz = 0;
+    TPM_CC cc;
 
 #ifdef WOLFTPM_DEBUG_VERBOSE
-    printf("Command size: %d\n", packet->pos);
-    TPM2_PrintBin(packet->buf, packet->pos);
+    printf("Command size: %d\n", cmdSz);
+    TPM2_PrintBin(buf, cmdSz);
 #endif
 
-    fd = open(TPM2_LINUX_DEV, O_RDWR | O_NONBLOCK);
-    if (fd > 0) {
+    /* command code is last field of header */
+    XMEMCPY(&cc, &buf[TPM2_HEADER_SIZE - sizeof(UINT32)], sizeof(cc));
+    cc = TPM2_Packet_SwapU32(cc);
+
+    fd = TPM2_LINUX_Open(dev);
+    if (fd >= 0) {
         /* Send the TPM command */
-        if (write(fd, packet->buf, packet->pos) == packet->pos) {
+        if (write(fd, buf, cmdSz) == cmdSz) {
             fds.fd = fd;
             fds.events = POLLIN;
             /* Wait for response to be available */
-            rc_poll = poll(&fds, nfds, TPM2_LINUX_DEV_POLL_TIMEOUT);
+            rc_poll = poll(&fds, nfds, TPM2_LINUX_GetTimeout(cc));
             if (rc_poll > 0 && fds.revents == POLLIN) {
-                rspSz = read(fd, packet->buf, packet->size);
+                rspSz = read(fd, buf, bufSz);
                 /* The caller parses the TPM_Packet for correctness */
                 if (rspSz >= TPM2_HEADER_SIZE) {
                     /* Enough bytes for a TPM response */
@@ -89,6 +186,13 @@ int TPM2_LINUX_SendCommand(TPM2_CTX* ctx, TPM2_Packet* packet)
                 }
                 #endif
             }
+            else if (rc_poll == 0) {
+            #ifdef DEBUG_WOLFTPM
+                printf("Timeout waiting for TPM response to command 0x%x\n",
+                    (unsigned int)cc);
+            #endif
+                rc = TPM_RC_TIMEOUT;
+            }
         #ifdef WOLFTPM_DEBUG_VERBOSE
             else {
                 printf("Failed to get a response from fd %d, got errno %d ="
@@ -103,26 +207,168 @@ int TPM2_LINUX_SendCommand(TPM2_CTX* ctx, TPM2_Packet* packet)
         }
         #endif
 
-        close(fd);
-    }
-#ifdef DEBUG_WOLFTPM
-    else if (fd == -1 && errno == EACCES) {
-        printf("Permission denied. Use sudo or change the user group.\n");
+        TPM2_LINUX_Close(dev, fd, rc);
     }
-    else {
-        perror("Failed to open device");
+
+#ifdef WOLFTPM_DEBUG_VERBOSE
+    if (rspSz > 0) {
+        printf("Response size: %d\n", (int)rspSz);
+        TPM2_PrintBin(buf, rspSz);
     }
 #endif
 
+    return rc;
+}
+
+/* Write the command and leave the response to TPM2_LINUX_AsyncRecv. The
+ * kernel (v4.20 or later) processes commands written to a non-blocking
+ * descriptor in the background and signals POLLIN when the response is
+ * ready. Older kernels complete the command during the write. */
+static int TPM2_LINUX_AsyncSend(TPM2_CTX* ctx, TPM2_ASYNC* req,
+    void* transportCtx)
+{
+    struct wolfTPM_devContext* dev = TPM2_LINUX_GetDev(ctx, transportCtx);
+    int rc = TPM_RC_FAILURE;
+    int fd;
+
+    fd = TPM2_LINUX_Open(dev);
+    if (fd >= 0) {
+        if (write(fd, req->buf, req->cmdSz) == req->cmdSz) {
+            req->fd = fd;
+            rc = TPM_RC_SUCCESS;
+        }
+        else {
+        #ifdef WOLFTPM_DEBUG_VERBOSE
+            printf("Failed to send the TPM command to fd %d, got errno %d ="
+                "%s\n", fd, errno, strerror(errno));
+        #endif
+            TPM2_LINUX_Close(dev, fd, rc);
+        }
+    }
+
+    return rc;
+}
+
+/* Read the response if available, returns TPM_RC_YIELDED if not yet */
+static int TPM2_LINUX_AsyncRecv(TPM2_CTX* ctx, TPM2_ASYNC* req,
+    void* transportCtx)
+{
+    struct wolfTPM_devContext* dev = TPM2_LINUX_GetDev(ctx, transportCtx);
+    int rc = TPM_RC_FAILURE;
+    struct pollfd fds;
+    ssize_t rspSz = 0;
+
+    fds.fd = req->fd;
+    fds.events = POLLIN;
+    fds.revents = 0;
+    if (poll(&fds, 1, 0) < 0 && errno == EINTR) {
+        return TPM_RC_YIELDED;
+    }
+    if (fds.revents & POLLIN) {
+        rspSz = read(req->fd, req->buf, req->bufSz);
+        if (rspSz >= TPM2_HEADER_SIZE) {
+            rc = TPM_RC_SUCCESS;
+        }
+        else if (rspSz < 0 && (errno == EAGAIN || errno == EINTR)) {
+            return TPM_RC_YIELDED;
+        }
+        #ifdef DEBUG_WOLFTPM
+        else {
+            printf("Failed to read from TPM device %d, got errno %d"
+                " = %s\n", req->fd, errno, strerror(errno));
+        }
+        #endif
+    }
+    else if (fds.revents == 0) {
+        return TPM_RC_YIELDED;
+    }
+
+    TPM2_LINUX_Close(dev, req->fd, rc);
+    req->fd = -1;
+
 #ifdef WOLFTPM_DEBUG_VERBOSE
     if (rspSz > 0) {
         printf("Response size: %d\n", (int)rspSz);
-        TPM2_PrintBin(packet->buf, rspSz);
+        TPM2_PrintBin(req->buf, rspSz);
     }
 #endif
 
-    (void)ctx;
-
     return rc;
 }
+
+/* The descriptor is kept: close() waits for the command to finish and, on
+ * the resource manager, flushes the connection's objects and sessions. The
+ * response is dropped now if ready, otherwise before the next command. */
+static int TPM2_LINUX_AsyncCancel(TPM2_CTX* ctx, TPM2_ASYNC* req,
+    void* transportCtx)
+{
+    struct wolfTPM_devContext* dev = TPM2_LINUX_GetDev(ctx, transportCtx);
+
+    if (req->fd >= 0) {
+        dev->fd = req->fd;
+        dev->drain = 1;
+        if (TPM2_LINUX_Drain(dev, 0) == 0) {
+            TPM2_LINUX_Close(dev, req->fd, TPM_RC_SUCCESS);
+        }
+        req->fd = -1;
+    }
+    return TPM_RC_SUCCESS;
+}
+
+/* Close the TPM device, if left open */
+static void TPM2_LINUX_CloseDev(struct wolfTPM_devContext* dev)
+{
+    if (dev->fd >= 0) {
+        close(dev->fd);
+        dev->fd = -1;
+    }
+    dev->drain = 0;
+}
+
+static void TPM2_LINUX_Cleanup(TPM2_CTX* ctx, void* transportCtx)
+{
+    TPM2_LINUX_CloseDev(TPM2_LINUX_GetDev(ctx, transportCtx));
+}
+
+/* The kernel starts the TPM */
+static const TPM2_TRANSPORT gLinuxTransport = {
+    "devtpm",
+    TPM2_TRANSPORT_FLAG_STARTED,
+    TPM2_LINUX_SendCommand,
+    TPM2_LINUX_AsyncSend,
+    TPM2_LINUX_AsyncRecv,
+    TPM2_LINUX_AsyncCancel,
+    TPM2_LINUX_Cleanup
+};
+
+const TPM2_TRANSPORT* TPM2_LINUX_GetTransport(void)
+{
+    return &gLinuxTransport;
+}
+
+int TPM2_LINUX_InitDev(struct wolfTPM_devContext* dev, const char* devPath,
+    int keepOpen)
+{
+    if (dev == NULL)
+        return BAD_FUNC_ARG;
+
+    XMEMSET(dev, 0, sizeof(*dev));
+    dev->fd = -1;
+    dev->path = (devPath != NULL) ? devPath : TPM2_LINUX_DEV;
+    /* the resource manager flushes transient objects when closed */
+    if (strstr(dev->path, "tpmrm") != NULL)
+        keepOpen = 1;
+    dev->keepOpen = keepOpen;
+
+    return TPM_RC_SUCCESS;
+}
+
+int TPM2_LINUX_SetDev(TPM2_CTX* ctx, const char* devPath, int keepOpen)
+{
+    if (ctx == NULL)
+        return BAD_FUNC_ARG;
+
+    TPM2_LINUX_CloseDev(&ctx->devCtx);
+    return TPM2_LINUX_InitDev(&ctx->devCtx, devPath, keepOpen);
+}
 #endif
@@ -0,0 +1,478 @@
+/* tpm2_objmgr.c
+ *
+ * Copyright (C) 2006-2020 wolfSSL Inc.
+ *
+ * This file is part of wolfTPM.
+ *
+ * wolfTPM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfTPM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+
+
+/**
+ * Object manager transport. Virtualizes the transient object handles so a
+ * process can use more keys than the TPM has object slots: the least
+ * recently used objects are saved and flushed, then loaded again from their
+ * saved context when used.
+ *
+ * Build with --enable-objmgr
+ */
+
+#ifdef WOLFTPM_OBJMGR
+#include <wolftpm/tpm2.h>
+#include <wolftpm/tpm2_objmgr.h>
+#include <wolftpm/tpm2_packet.h>
+
+#include <string.h>
+#include <stdio.h>
+
+/* largest handle count before the authorization area of a command */
+#define OBJMGR_MAX_HANDLES      3
+
+/* Handles of each command code from TPM_CC_FIRST to TPM_CC_LAST:
+ * bits 0-1 handles in the command handle area */
+#define OBJMGR_HANDLES_MASK     0x03
+#define OBJMGR_RSP_HANDLE       0x04    /* response returns a handle */
+#define OBJMGR_SEQUENCE         0x08    /* ... of a hash or HMAC sequence */
+
+#define OBJMGR_R                OBJMGR_RSP_HANDLE
+#define OBJMGR_S                (OBJMGR_RSP_HANDLE | OBJMGR_SEQUENCE)
+
+static const byte gObjMgrCmdAttr[TPM_CC_LAST - TPM_CC_FIRST + 1] = {
+    /* 0x11F NV_UndefineSpaceSpecial .. 0x126 Clear */
+    2, 2, 1, 2, 0, 1, 1, 1,
+    /* 0x127 ClearControl .. 0x12E SetPrimaryPolicy */
+    1, 1, 1, 1, 1, 1, 1, 1,
+    /* 0x12F FieldUpgradeStart .. 0x136 NV_Extend */
+    2, 1, 1 | OBJMGR_R, 1, 2, 2, 2, 2,
+    /* 0x137 NV_Write .. 0x13E SequenceComplete */
+    2, 2, 1, 1, 1, 1, 1, 1,
+    /* 0x13F SetAlgorithmSet .. 0x146 StirRandom */
+    1, 1, 0, 0, 0, 0, 0, 0,
+    /* 0x147 ActivateCredential .. 0x14E NV_Read */
+    2, 2, 3, 2, 2, 2, 3, 2,
+    /* 0x14F NV_ReadLock .. 0x156 Import */
+    2, 2, 2, 2, 1, 1, 1, 1,
+    /* 0x157 Load .. 0x15E Unseal */
+    1 | OBJMGR_R, 1, 1, 0, 1 | OBJMGR_S, 1, 1, 1,
+    /* 0x15F .. 0x166 */
+    0, 2, 0 | OBJMGR_R, 1, 1, 1, 0, 0,
+    /* 0x167 LoadExternal .. 0x16E PolicyCpHash */
+    0 | OBJMGR_R, 1, 1, 1, 1, 1, 1, 1,
+    /* 0x16F PolicyLocality .. 0x176 StartAuthSession */
+    1, 1, 1, 1, 1, 1, 0, 2 | OBJMGR_R,
+    /* 0x177 VerifySignature .. 0x17E PCR_Read */
+    1, 0, 0, 0, 0, 0, 0, 0,
+    /* 0x17F PolicyPCR .. 0x186 HashSequenceStart */
+    1, 1, 0, 1, 1, 3, 2, 0 | OBJMGR_S,
+    /* 0x187 PolicyPhysicalPresence .. 0x18E EC_Ephemeral */
+    1, 1, 1, 0, 1, 1, 1, 0,
+    /* 0x18F PolicyNvWritten .. 0x193 EncryptDecrypt2 */
+    1, 1, 1 | OBJMGR_R, 3, 1
+};
+
+
+static word32 ObjMgrGetU32(const byte* b)
+{
+    return ((word32)b[0] << 24) | ((word32)b[1] << 16) |
+           ((word32)b[2] << 8) | b[3];
+}
+
+static void ObjMgrPutU32(byte* b, word32 v)
+{
+    b[0] = (byte)(v >> 24); b[1] = (byte)(v >> 16);
+    b[2] = (byte)(v >> 8);  b[3] = (byte)v;
+}
+
+static int ObjMgrIsVirtual(TPM_HANDLE handle)
+{
+    return handle >= TPM2_OBJMGR_HANDLE_FIRST &&
+           handle <= TPM2_OBJMGR_HANDLE_LAST;
+}
+
+static byte ObjMgrCmdAttr(TPM_CC cc)
+{
+    if (cc < TPM_CC_FIRST || cc > TPM_CC_LAST)
+        return 0;
+    return gObjMgrCmdAttr[cc - TPM_CC_FIRST];
+}
+
+/* Answer the command without the TPM */
+static void ObjMgrRespond(byte* buf, TPM_RC rc)
+{
+    buf[0] = (byte)(TPM_ST_NO_SESSIONS >> 8);
+    buf[1] = (byte)TPM_ST_NO_SESSIONS;
+    ObjMgrPutU32(&buf[2], TPM2_HEADER_SIZE);
+    ObjMgrPutU32(&buf[6], rc);
+}
+
+/* Send a command of the manager with one parameter from mgr->buf. Returns
+ * the transport error or the response code. */
+static int ObjMgrCommand(TPM2_CTX* ctx, TPM2_OBJMGR* mgr, TPM_CC cc,
+    const byte* param, word32 paramSz)
+{
+    int rc;
+    word32 cmdSz = TPM2_HEADER_SIZE + paramSz;
+
+    if (cmdSz > sizeof(mgr->buf))
+        return TPM_RC_SIZE;
+    mgr->buf[0] = (byte)(TPM_ST_NO_SESSIONS >> 8);
+    mgr->buf[1] = (byte)TPM_ST_NO_SESSIONS;
+    ObjMgrPutU32(&mgr->buf[2], cmdSz);
+    ObjMgrPutU32(&mgr->buf[6], cc);
+    XMEMCPY(&mgr->buf[TPM2_HEADER_SIZE], param, paramSz);
+
+    rc = mgr->inner->sendCommand(ctx, mgr->buf, (int)cmdSz,
+        (int)sizeof(mgr->buf), mgr->innerCtx);
+    if (rc == TPM_RC_SUCCESS)
+        rc = (int)ObjMgrGetU32(&mgr->buf[6]);
+    return rc;
+}
+
+static int ObjMgrPinned(const int* pin, int pinCnt, int idx)
+{
+    int i;
+    for (i = 0; i < pinCnt; i++) {
+        if (pin[i] == idx)
+            return 1;
+    }
+    return 0;
+}
+
+/* Save (unless its saved context is still valid) and flush the least
+ * recently used loaded object not used by the current command */
+static int ObjMgrEvict(TPM2_CTX* ctx, TPM2_OBJMGR* mgr, const int* pin,
+    int pinCnt)
+{
+    int rc, i, lru = -1;
+    word32 rspSz;
+    byte handle[4];
+    TPM2_OBJMGR_ENTRY* obj;
+
+    for (i = 0; i < TPM2_OBJMGR_MAX_OBJECTS; i++) {
+        obj = &mgr->obj[i];
+        if (!obj->used || obj->handle == 0 || ObjMgrPinned(pin, pinCnt, i))
+            continue;
+        if (lru < 0 || (int)(obj->lastUse - mgr->obj[lru].lastUse) < 0)
+            lru = i;
+    }
+    if (lru < 0)
+        return TPM_RC_OBJECT_MEMORY;
+    obj = &mgr->obj[lru];
+    ObjMgrPutU32(handle, obj->handle);
+
+    /* a sequence changes with each update, keys do not */
+    if (obj->contextSz == 0 || obj->sequence) {
+        rc = ObjMgrCommand(ctx, mgr, TPM_CC_ContextSave, handle,
+            sizeof(handle));
+        if (rc != TPM_RC_SUCCESS)
+            return rc;
+        rspSz = ObjMgrGetU32(&mgr->buf[2]);
+        if (rspSz <= TPM2_HEADER_SIZE || rspSz > sizeof(mgr->buf))
+            return TPM_RC_SIZE;
+        obj->contextSz = (word16)(rspSz - TPM2_HEADER_SIZE);
+        XMEMCPY(obj->context, &mgr->buf[TPM2_HEADER_SIZE], obj->contextSz);
+        mgr->saves++;
+    }
+
+    rc = ObjMgrCommand(ctx, mgr, TPM_CC_FlushContext, handle, sizeof(handle));
+    if (rc != TPM_RC_SUCCESS)
+        return rc;
+#ifdef DEBUG_WOLFTPM
+    printf("ObjMgr: evicted 0x%x (TPM handle 0x%x)\n",
+        (word32)(TPM2_OBJMGR_HANDLE_FIRST + lru), (word32)obj->handle);
+#endif
+    obj->handle = 0;
+    mgr->loaded--;
+    mgr->evictions++;
+    return TPM_RC_SUCCESS;
+}
+
+/* Load a saved object again, evicting others as needed */
+static int ObjMgrReload(TPM2_CTX* ctx, TPM2_OBJMGR* mgr, int idx,
+    const int* pin, int pinCnt)
+{
+    int rc;
+    TPM2_OBJMGR_ENTRY* obj = &mgr->obj[idx];
+
+    if (mgr->maxLoaded > 0 && mgr->loaded >= mgr->maxLoaded) {
+        rc = ObjMgrEvict(ctx, mgr, pin, pinCnt);
+        if (rc != TPM_RC_SUCCESS)
+            return rc;
+    }
+    for (;;) {
+        rc = ObjMgrCommand(ctx, mgr, TPM_CC_ContextLoad, obj->context,
+            obj->contextSz);
+        if (rc != TPM_RC_OBJECT_MEMORY)
+            break;
+        rc = ObjMgrEvict(ctx, mgr, pin, pinCnt);
+        if (rc != TPM_RC_SUCCESS)
+            break;
+    }
+    if (rc != TPM_RC_SUCCESS)
+        return rc;
+    if (ObjMgrGetU32(&mgr->buf[2]) < TPM2_HEADER_SIZE + 4)
+        return TPM_RC_SIZE;
+
+    obj->handle = ObjMgrGetU32(&mgr->buf[TPM2_HEADER_SIZE]);
+    mgr->loaded++;
+    mgr->reloads++;
+    return TPM_RC_SUCCESS;
+}
+
+/* Give a virtual handle for the object handle in the response */
+static void ObjMgrAdd(TPM2_CTX* ctx, TPM2_OBJMGR* mgr, byte* buf, byte attr)
+{
+    int i;
+    TPM_HANDLE handle = ObjMgrGetU32(&buf[TPM2_HEADER_SIZE]);
+    TPM2_OBJMGR_ENTRY* obj;
+
+    if ((handle >> HR_SHIFT) != TPM_HT_TRANSIENT)
+        return; /* session */
+
+    for (i = 0; i < TPM2_OBJMGR_MAX_OBJECTS; i++) {
+        if (!mgr->obj[i].used)
+            break;
+    }
+    if (i == TPM2_OBJMGR_MAX_OBJECTS) {
+        /* no virtual handle left, the object can't be used */
+        byte param[4];
+        ObjMgrPutU32(param, handle);
+        (void)ObjMgrCommand(ctx, mgr, TPM_CC_FlushContext, param,
+            sizeof(param));
+        ObjMgrRespond(buf, TPM_RC_OBJECT_MEMORY);
+        return;
+    }
+
+    obj = &mgr->obj[i];
+    obj->handle = handle;
+    obj->lastUse = mgr->clock;
+    obj->used = 1;
+    obj->sequence = (attr & OBJMGR_SEQUENCE) ? 1 : 0;
+    obj->contextSz = 0;
+    mgr->loaded++;
+    ObjMgrPutU32(&buf[TPM2_HEADER_SIZE], TPM2_OBJMGR_HANDLE_FIRST + i);
+}
+
+static void ObjMgrRemove(TPM2_OBJMGR* mgr, int idx)
+{
+    if (mgr->obj[idx].handle != 0)
+        mgr->loaded--;
+    mgr->obj[idx].handle = 0;
+    mgr->obj[idx].used = 0;
+    mgr->obj[idx].contextSz = 0;
+}
+
+/* TPM2_FlushContext of a virtual handle. A saved object is only
+ * forgotten. */
+static int ObjMgrFlush(TPM2_CTX* ctx, TPM2_OBJMGR* mgr, byte* buf,
+    int cmdSz, int bufSz)
+{
+    int rc, idx;
+    TPM2_OBJMGR_ENTRY* obj;
+
+    idx = (int)(ObjMgrGetU32(&buf[TPM2_HEADER_SIZE]) -
+        TPM2_OBJMGR_HANDLE_FIRST);
+    obj = &mgr->obj[idx];
+    if (!obj->used) {
+        ObjMgrRespond(buf, TPM_RC_HANDLE + TPM_RC_P + TPM_RC_1);
+        return TPM_RC_SUCCESS;
+    }
+    if (obj->handle == 0) {
+        ObjMgrRemove(mgr, idx);
+        ObjMgrRespond(buf, TPM_RC_SUCCESS);
+        return TPM_RC_SUCCESS;
+    }
+
+    ObjMgrPutU32(&buf[TPM2_HEADER_SIZE], obj->handle);
+    rc = mgr->inner->sendCommand(ctx, buf, cmdSz, bufSz, mgr->innerCtx);
+    if (rc == TPM_RC_SUCCESS && ObjMgrGetU32(&buf[6]) == TPM_RC_SUCCESS)
+        ObjMgrRemove(mgr, idx);
+    return rc;
+}
+
+/* TPM2_GetCapability(TPM_CAP_HANDLES) of transient handles lists the
+ * virtual handles */
+static int ObjMgrGetHandles(TPM2_OBJMGR* mgr, byte* buf, int bufSz)
+{
+    int i;
+    word32 property = ObjMgrGetU32(&buf[TPM2_HEADER_SIZE + 4]);
+    word32 count = ObjMgrGetU32(&buf[TPM2_HEADER_SIZE + 8]);
+    word32 found = 0, pos;
+    byte moreData = NO;
+
+    if (count > MAX_CAP_HANDLES)
+        count = MAX_CAP_HANDLES;
+    /* moreData, capability, count */
+    pos = TPM2_HEADER_SIZE + 1 + 4 + 4;
+    for (i = 0; i < TPM2_OBJMGR_MAX_OBJECTS; i++) {
+        if (!mgr->obj[i].used ||
+                (word32)(TPM2_OBJMGR_HANDLE_FIRST + i) < property) {
+            continue;
+        }
+        if (found == count || pos + 4 > (word32)bufSz) {
+            moreData = YES;
+            break;
+        }
+        ObjMgrPutU32(&buf[pos], TPM2_OBJMGR_HANDLE_FIRST + i);
+        pos += 4;
+        found++;
+    }
+
+    ObjMgrRespond(buf, TPM_RC_SUCCESS);
+    ObjMgrPutU32(&buf[2], pos);
+    buf[TPM2_HEADER_SIZE] = moreData;
+    ObjMgrPutU32(&buf[TPM2_HEADER_SIZE + 1], TPM_CAP_HANDLES);
+    ObjMgrPutU32(&buf[TPM2_HEADER_SIZE + 5], found);
+    return TPM_RC_SUCCESS;
+}
+
+static int ObjMgrSend(TPM2_CTX* ctx, byte* buf, int cmdSz, int bufSz,
+    void* transportCtx)
+{
+    TPM2_OBJMGR* mgr = (TPM2_OBJMGR*)transportCtx;
+    int rc, i, cnt, retry;
+    int pin[OBJMGR_MAX_HANDLES];
+    TPM_CC cc;
+    TPM_HANDLE handle;
+    byte attr;
+
+    if (cmdSz < TPM2_HEADER_SIZE || bufSz < TPM2_HEADER_SIZE + 9)
+        return mgr->inner->sendCommand(ctx, buf, cmdSz, bufSz, mgr->innerCtx);
+    cc = ObjMgrGetU32(&buf[6]);
+    mgr->clock++;
+
+    if (cc == TPM_CC_FlushContext && cmdSz >= TPM2_HEADER_SIZE + 4 &&
+            ObjMgrIsVirtual(ObjMgrGetU32(&buf[TPM2_HEADER_SIZE]))) {
+        return ObjMgrFlush(ctx, mgr, buf, cmdSz, bufSz);
+    }
+    if (cc == TPM_CC_GetCapability && cmdSz >= TPM2_HEADER_SIZE + 12 &&
+            ObjMgrGetU32(&buf[TPM2_HEADER_SIZE]) == TPM_CAP_HANDLES &&
+            (ObjMgrGetU32(&buf[TPM2_HEADER_SIZE + 4]) >> HR_SHIFT) ==
+                                                        TPM_HT_TRANSIENT) {
+        return ObjMgrGetHandles(mgr, buf, bufSz);
+    }
+
+    /* virtual handles of the command, loaded and replaced by TPM ones */
+    attr = ObjMgrCmdAttr(cc);
+    cnt = attr & OBJMGR_HANDLES_MASK;
+    if (cmdSz < TPM2_HEADER_SIZE + cnt * 4)
+        cnt = 0;
+    for (i = 0; i < cnt; i++) {
+        pin[i] = -1;
+        handle = ObjMgrGetU32(&buf[TPM2_HEADER_SIZE + i * 4]);
+        if (!ObjMgrIsVirtual(handle))
+            continue;
+        pin[i] = (int)(handle - TPM2_OBJMGR_HANDLE_FIRST);
+        if (!mgr->obj[pin[i]].used) {
+            ObjMgrRespond(buf, TPM_RC_HANDLE + TPM_RC_H + TPM_RC_1 * (i + 1));
+            return TPM_RC_SUCCESS;
+        }
+        mgr->obj[pin[i]].lastUse = mgr->clock;
+    }
+    for (i = 0; i < cnt; i++) {
+        if (pin[i] < 0)
+            continue;
+        if (mgr->obj[pin[i]].handle == 0) {
+            rc = ObjMgrReload(ctx, mgr, pin[i], pin, cnt);
+            if (rc < 0)
+                return rc; /* transport error */
+            if (rc != TPM_RC_SUCCESS) {
+                ObjMgrRespond(buf, (TPM_RC)rc);
+                return TPM_RC_SUCCESS;
+            }
+        }
+        ObjMgrPutU32(&buf[TPM2_HEADER_SIZE + i * 4],
+            mgr->obj[pin[i]].handle);
+    }
+
+    /* make room before loading another object */
+    if ((attr & OBJMGR_RSP_HANDLE) && mgr->maxLoaded > 0 &&
+            mgr->loaded >= mgr->maxLoaded) {
+        (void)ObjMgrEvict(ctx, mgr, pin, cnt);
+    }
+
+    /* the response overwrites the command, keep it to send again */
+    retry = (cmdSz <= (int)sizeof(mgr->cmd));
+    if (retry)
+        XMEMCPY(mgr->cmd, buf, cmdSz);
+    for (;;) {
+        rc = mgr->inner->sendCommand(ctx, buf, cmdSz, bufSz, mgr->innerCtx);
+        if (rc != TPM_RC_SUCCESS || !retry ||
+                ObjMgrGetU32(&buf[6]) != TPM_RC_OBJECT_MEMORY ||
+                ObjMgrEvict(ctx, mgr, pin, cnt) != TPM_RC_SUCCESS) {
+            break;
+        }
+        XMEMCPY(buf, mgr->cmd, cmdSz);
+    }
+    if (rc != TPM_RC_SUCCESS || ObjMgrGetU32(&buf[6]) != TPM_RC_SUCCESS)
+        return rc;
+
+    if ((attr & OBJMGR_RSP_HANDLE) &&
+            ObjMgrGetU32(&buf[2]) >= TPM2_HEADER_SIZE + 4) {
+        ObjMgrAdd(ctx, mgr, buf, attr);
+    }
+    /* the TPM flushes a completed sequence */
+    else if (cc == TPM_CC_SequenceComplete && cnt == 1 && pin[0] >= 0) {
+        ObjMgrRemove(mgr, pin[0]);
+    }
+    else if (cc == TPM_CC_EventSequenceComplete && cnt == 2 && pin[1] >= 0) {
+        ObjMgrRemove(mgr, pin[1]);
+    }
+    return rc;
+}
+
+/* asynchronous commands are completed by TPM2_AsyncSubmit with send */
+static const TPM2_TRANSPORT gObjMgrTransport = {
+    "objmgr", 0, ObjMgrSend, NULL, NULL, NULL, NULL
+};
+
+int TPM2_ObjMgr_Start(TPM2_CTX* ctx, TPM2_OBJMGR* mgr, word32 maxLoaded)
+{
+    if (ctx == NULL || mgr == NULL)
+        return BAD_FUNC_ARG;
+
+    XMEMSET(mgr, 0, sizeof(TPM2_OBJMGR));
+    mgr->maxLoaded = maxLoaded;
+    mgr->inner = TPM2_GetTransport(ctx, &mgr->innerCtx);
+    return TPM2_SetTransport(ctx, &gObjMgrTransport, mgr);
+}
+
+int TPM2_ObjMgr_Stop(TPM2_CTX* ctx, TPM2_OBJMGR* mgr)
+{
+    int rc = TPM_RC_SUCCESS, i;
+    void* transportCtx = NULL;
+    FlushContext_In in;
+
+    if (ctx == NULL || mgr == NULL)
+        return BAD_FUNC_ARG;
+    if (TPM2_GetTransport(ctx, &transportCtx) != &gObjMgrTransport ||
+            transportCtx != mgr) {
+        return BAD_FUNC_ARG;
+    }
+
+    TPM2_SetActiveCtx(ctx);
+    for (i = 0; i < TPM2_OBJMGR_MAX_OBJECTS; i++) {
+        if (!mgr->obj[i].used)
+            continue;
+        in.flushHandle = TPM2_OBJMGR_HANDLE_FIRST + i;
+        if (TPM2_FlushContext(&in) != TPM_RC_SUCCESS)
+            ObjMgrRemove(mgr, i);
+    }
+    rc = TPM2_SetTransport(ctx, mgr->inner, mgr->innerCtx);
+    return rc;
+}
+
+#endif /* WOLFTPM_OBJMGR */
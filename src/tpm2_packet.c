@@ -146,6 +146,13 @@ void TPM2_Packet_Init(TPM2_CTX* ctx, TPM2_Packet* packet)
         packet->buf  = ctx->cmdBuf;
         packet->pos = TPM2_HEADER_SIZE; /* skip header (fill during finalize) */
         packet->size = sizeof(ctx->cmdBuf);
+    #ifdef WOLFTPM_HOOKS
+        /* the command is marshalled from here */
+        if (ctx->hookCb != NULL) {
+            XMEMSET(&ctx->hookInfo, 0, sizeof(ctx->hookInfo));
+            ctx->hookInfo.startNs = XTPM_TIME_NS();
+        }
+    #endif
     }
 }
 
@@ -676,6 +683,13 @@ void TPM2_Packet_AppendPublic(TPM2_Packet* packet, TPM2B_PUBLIC* pub)
 
     pub->size = TPM2_Packet_PlaceU16(packet, tmpSz);
 }
+/* TPM2B_TEMPLATE for TPM2_CreateLoaded. The template of an ordinary or
+ * primary object is a marshalled TPMT_PUBLIC, the same bytes as a
+ * TPM2B_PUBLIC. */
+void TPM2_Packet_AppendTemplate(TPM2_Packet* packet, TPM2B_PUBLIC* pub)
+{
+    TPM2_Packet_AppendPublic(packet, pub);
+}
 void TPM2_Packet_ParsePublic(TPM2_Packet* packet, TPM2B_PUBLIC* pub)
 {
     TPM2_Packet_ParseU16(packet, &pub->size);
@@ -0,0 +1,493 @@
+/* tpm2_replay.c
+ *
+ * Copyright (C) 2006-2020 wolfSSL Inc.
+ *
+ * This file is part of wolfTPM.
+ *
+ * wolfTPM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfTPM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+
+
+/**
+ * Record / replay transports. Recording saves every command and response
+ * sent through a context to a trace file. Replaying answers the commands
+ * from that trace in memory, for benchmarking the host side of wolfTPM
+ * without TPM latency and for deterministic tests.
+ *
+ * Build with --enable-replay
+ */
+
+#ifdef WOLFTPM_REPLAY
+#include <wolftpm/tpm2.h>
+#include <wolftpm/tpm2_replay.h>
+#include <wolftpm/tpm2_packet.h>
+
+#include <string.h>
+#include <stdio.h>
+
+/* largest handle count before the authorization area of a command */
+#define REPLAY_MAX_HANDLES  3
+
+
+static word32 ReplayGetU32(const byte* b)
+{
+    return ((word32)b[0] << 24) | ((word32)b[1] << 16) |
+           ((word32)b[2] << 8) | b[3];
+}
+
+static word16 ReplayGetU16(const byte* b)
+{
+    return (word16)((b[0] << 8) | b[1]);
+}
+
+static void ReplayPutU32(byte* b, word32 v)
+{
+    b[0] = (byte)(v >> 24); b[1] = (byte)(v >> 16);
+    b[2] = (byte)(v >> 8);  b[3] = (byte)v;
+}
+
+
+/******************************************************************************/
+/* --- BEGIN Recording -- */
+/******************************************************************************/
+
+#ifndef NO_FILESYSTEM
+static int ReplayWrite(TPM2_REPLAY* replay, const byte* data, word32 sz)
+{
+    byte len[4];
+
+    ReplayPutU32(len, sz);
+    if (XFWRITE(len, 1, sizeof(len), replay->fp) != sizeof(len) ||
+            (sz > 0 && XFWRITE(data, 1, sz, replay->fp) != sz)) {
+        return TPM_RC_FAILURE;
+    }
+    return TPM_RC_SUCCESS;
+}
+
+static int ReplayRecordSend(TPM2_CTX* ctx, byte* buf, int cmdSz, int bufSz,
+    void* transportCtx)
+{
+    TPM2_REPLAY* replay = (TPM2_REPLAY*)transportCtx;
+    int rc, wrc;
+    word32 rspSz = 0;
+
+    if (replay->fp == XBADFILE)
+        return TPM_RC_FAILURE;
+
+    /* the command is overwritten by the response */
+    wrc = ReplayWrite(replay, buf, (word32)cmdSz);
+    rc = replay->inner->sendCommand(ctx, buf, cmdSz, bufSz, replay->innerCtx);
+    if (rc == TPM_RC_SUCCESS) {
+        rspSz = ReplayGetU32(&buf[2]);
+        if (rspSz < TPM2_HEADER_SIZE || rspSz > (word32)bufSz)
+            rspSz = 0;
+    }
+    if (wrc == TPM_RC_SUCCESS)
+        wrc = ReplayWrite(replay, buf, rspSz);
+    replay->commands++;
+
+#ifdef DEBUG_WOLFTPM
+    if (wrc != TPM_RC_SUCCESS)
+        printf("Replay: writing the trace failed\n");
+#endif
+    return (rc != TPM_RC_SUCCESS) ? rc : wrc;
+}
+
+static void ReplayRecordCleanup(TPM2_CTX* ctx, void* transportCtx)
+{
+    TPM2_REPLAY* replay = (TPM2_REPLAY*)transportCtx;
+
+    if (replay->inner->cleanup != NULL)
+        replay->inner->cleanup(ctx, replay->innerCtx);
+    if (replay->fp != XBADFILE) {
+        XFCLOSE(replay->fp);
+        replay->fp = XBADFILE;
+    }
+}
+
+/* asynchronous commands are completed by TPM2_AsyncSubmit with send */
+static const TPM2_TRANSPORT gReplayRecordTransport = {
+    "record", 0, ReplayRecordSend, NULL, NULL, NULL, ReplayRecordCleanup
+};
+
+int TPM2_Replay_Record(TPM2_CTX* ctx, TPM2_REPLAY* replay, const char* file)
+{
+    int rc;
+
+    if (ctx == NULL || replay == NULL || file == NULL)
+        return BAD_FUNC_ARG;
+
+    XMEMSET(replay, 0, sizeof(TPM2_REPLAY));
+    replay->inner = TPM2_GetTransport(ctx, &replay->innerCtx);
+    replay->fp = XFOPEN(file, "wb");
+    if (replay->fp == XBADFILE)
+        return BAD_FUNC_ARG;
+    if (XFWRITE(TPM2_REPLAY_MAGIC, 1, TPM2_REPLAY_MAGIC_SZ, replay->fp) !=
+            TPM2_REPLAY_MAGIC_SZ) {
+        rc = TPM_RC_FAILURE;
+    }
+    else {
+        rc = TPM2_SetTransport(ctx, &gReplayRecordTransport, replay);
+    }
+    if (rc != TPM_RC_SUCCESS) {
+        XFCLOSE(replay->fp);
+        replay->fp = XBADFILE;
+    }
+    return rc;
+}
+
+int TPM2_Replay_LoadFile(const char* file, byte* buf, word32* bufSz)
+{
+    int rc = TPM_RC_SUCCESS;
+    XFILE fp;
+    long fileSz;
+
+    if (file == NULL || buf == NULL || bufSz == NULL)
+        return BAD_FUNC_ARG;
+
+    fp = XFOPEN(file, "rb");
+    if (fp == XBADFILE)
+        return BAD_FUNC_ARG;
+    XFSEEK(fp, 0, XSEEK_END);
+    fileSz = XFTELL(fp);
+    XREWIND(fp);
+    if (fileSz < 0 || (word32)fileSz > *bufSz) {
+        rc = BUFFER_E;
+    }
+    else if (XFREAD(buf, 1, (size_t)fileSz, fp) != (size_t)fileSz) {
+        rc = TPM_RC_FAILURE;
+    }
+    else {
+        *bufSz = (word32)fileSz;
+    }
+    XFCLOSE(fp);
+    return rc;
+}
+#endif /* !NO_FILESYSTEM */
+
+/******************************************************************************/
+/* --- END Recording -- */
+/******************************************************************************/
+
+
+/******************************************************************************/
+/* --- BEGIN Replaying -- */
+/******************************************************************************/
+
+/* Walk the sessions of an authorization area at off. Returns the area end
+ * if the sessions fill it exactly, otherwise 0. */
+static word32 ReplayAuthEnd(const byte* cmd, word32 cmdSz, word32 off)
+{
+    word32 p, end, authSz;
+
+    if (off + 4 > cmdSz)
+        return 0;
+    authSz = ReplayGetU32(&cmd[off]);
+    p = off + 4;
+    if (authSz == 0 || authSz > cmdSz - p)
+        return 0;
+    end = p + authSz;
+
+    while (p < end) {
+        /* handle, nonce */
+        if (end - p < 6)
+            return 0;
+        p += 6 + ReplayGetU16(&cmd[p + 4]);
+        /* attributes, hmac */
+        if (p > end || end - p < 3)
+            return 0;
+        p += 3 + ReplayGetU16(&cmd[p + 1]);
+    }
+    return (p == end) ? end : 0;
+}
+
+/* Compare the TPM2B at *p of both commands by its size only */
+static int ReplaySkipSized(const byte* rec, const byte* cmd, word32 sz,
+    word32* p)
+{
+    word32 n;
+
+    if (sz - *p < 2 || XMEMCMP(&rec[*p], &cmd[*p], 2) != 0)
+        return 0;
+    n = ReplayGetU16(&rec[*p]);
+    if (n > sz - *p - 2)
+        return 0;
+    *p += 2 + n;
+    return 1;
+}
+
+/* Match a recorded command against one of the same size, ignoring what
+ * changes with each run: the caller nonce and encrypted salt of
+ * StartAuthSession, the session nonces and HMACs, and the first parameter
+ * when it is encrypted by a session. */
+static int ReplayMaskedMatch(const byte* rec, const byte* cmd, word32 sz)
+{
+    word32 p, off = 0, end = 0;
+    int i, decrypt = 0;
+
+    if (XMEMCMP(rec, cmd, TPM2_HEADER_SIZE) != 0)
+        return 0;
+
+    if (ReplayGetU32(&rec[6]) == TPM_CC_StartAuthSession) {
+        /* tpmKey, bind, nonceCaller, encryptedSalt */
+        p = TPM2_HEADER_SIZE + 8;
+        if (sz < p || XMEMCMP(rec, cmd, p) != 0)
+            return 0;
+        for (i = 0; i < 2; i++) {
+            if (!ReplaySkipSized(rec, cmd, sz, &p))
+                return 0;
+        }
+        return XMEMCMP(&rec[p], &cmd[p], sz - p) == 0;
+    }
+
+    if (ReplayGetU16(rec) != TPM_ST_SESSIONS)
+        return 0;
+    for (i = 0; i <= REPLAY_MAX_HANDLES && end == 0; i++) {
+        off = TPM2_HEADER_SIZE + i * 4;
+        end = ReplayAuthEnd(rec, sz, off);
+    }
+    if (end == 0 || ReplayAuthEnd(cmd, sz, off) != end)
+        return 0;
+
+    /* header, handles and authorization size */
+    p = off + 4;
+    if (XMEMCMP(rec, cmd, p) != 0)
+        return 0;
+    while (p < end) {
+        /* session handle, nonce size, then skip the nonce */
+        if (XMEMCMP(&rec[p], &cmd[p], 4) != 0)
+            return 0;
+        p += 4;
+        if (!ReplaySkipSized(rec, cmd, end, &p))
+            return 0;
+        if (rec[p] != cmd[p])
+            return 0;
+        if (rec[p] & TPMA_SESSION_decrypt)
+            decrypt = 1;
+        p++;
+        if (!ReplaySkipSized(rec, cmd, end, &p))
+            return 0;
+    }
+
+    if (decrypt && !ReplaySkipSized(rec, cmd, sz, &p))
+        return 0;
+    return XMEMCMP(&rec[p], &cmd[p], sz - p) == 0;
+}
+
+/* Put the recorded caller nonces in the context sessions, the response HMAC
+ * and parameter decryption use them */
+static void ReplayRestoreNonces(TPM2_CTX* ctx, const byte* rec, word32 sz)
+{
+    word32 p, off, end = 0, n;
+    int i;
+    TPM2_AUTH_SESSION* session;
+
+    if (ctx->session == NULL || ReplayGetU16(rec) != TPM_ST_SESSIONS)
+        return;
+    for (i = 0, off = 0; i <= REPLAY_MAX_HANDLES && end == 0; i++) {
+        off = TPM2_HEADER_SIZE + i * 4;
+        end = ReplayAuthEnd(rec, sz, off);
+    }
+
+    p = off + 4;
+    for (i = 0; p < end && i < MAX_SESSION_NUM; i++) {
+        session = &ctx->session[i];
+        n = ReplayGetU16(&rec[p + 4]);
+        if (session->sessionHandle == ReplayGetU32(&rec[p]) &&
+                session->nonceCaller.size == n) {
+            XMEMCPY(session->nonceCaller.buffer, &rec[p + 6], n);
+        }
+        p += 6 + n;
+        p += 3 + ReplayGetU16(&rec[p + 1]);
+    }
+}
+
+/* Check the entry at p against the command. A loose match only compares
+ * the command header. */
+static int ReplayMatch(TPM2_CTX* ctx, TPM2_REPLAY* replay, word32 p,
+    const byte* cmd, word32 cmdSz, int loose)
+{
+    const byte* rec = &replay->trace[p + 4];
+
+    if (ReplayGetU32(&replay->trace[p]) != cmdSz)
+        return 0;
+    if (loose) {
+        if (XMEMCMP(rec, cmd, TPM2_HEADER_SIZE) != 0)
+            return 0;
+        replay->loose++;
+        return 1;
+    }
+    if (XMEMCMP(rec, cmd, cmdSz) == 0) {
+        replay->exact++;
+        return 1;
+    }
+    if (ReplayMaskedMatch(rec, cmd, cmdSz)) {
+        ReplayRestoreNonces(ctx, rec, cmdSz);
+        replay->masked++;
+        return 1;
+    }
+    return 0;
+}
+
+/* Offset of the entry after the one at p */
+static word32 ReplayNext(const TPM2_REPLAY* replay, word32 p)
+{
+    p += 4 + ReplayGetU32(&replay->trace[p]);
+    return p + 4 + ReplayGetU32(&replay->trace[p]);
+}
+
+static int ReplaySend(TPM2_CTX* ctx, byte* buf, int cmdSz, int bufSz,
+    void* transportCtx)
+{
+    TPM2_REPLAY* replay = (TPM2_REPLAY*)transportCtx;
+    word32 p = replay->pos, rsp, rspSz, i;
+    int match = 0, loose;
+
+    replay->commands++;
+    if (p >= replay->traceSz)
+        p = TPM2_REPLAY_MAGIC_SZ;
+
+    /* the entry expected next, then the last one again, so a loop running
+     * more times than when recorded repeats its last iteration */
+    for (i = 0; i < 2 && !match; i++) {
+        loose = (i == 1);
+        if (i == 1 && (replay->flags & TPM2_REPLAY_FLAG_LOOSE) == 0)
+            break;
+        if (replay->entries > 0 &&
+                ReplayMatch(ctx, replay, p, buf, cmdSz, loose)) {
+            match = 1;
+        }
+        else if (replay->last != 0 &&
+                ReplayMatch(ctx, replay, replay->last, buf, cmdSz, loose)) {
+            p = replay->last;
+            match = 1;
+        }
+    }
+    /* otherwise search the rest of the trace, wrapping around once */
+    for (i = 1; i < replay->entries && !match; i++) {
+        p = ReplayNext(replay, p);
+        if (p >= replay->traceSz)
+            p = TPM2_REPLAY_MAGIC_SZ;
+        match = ReplayMatch(ctx, replay, p, buf, cmdSz, 0);
+    }
+
+    if (!match) {
+        replay->misses++;
+    #ifdef DEBUG_WOLFTPM
+        printf("Replay: no recorded response for command 0x%x\n",
+            (unsigned int)ReplayGetU32(&buf[6]));
+    #endif
+        return TPM_RC_FAILURE;
+    }
+
+    replay->last = p;
+    replay->pos = ReplayNext(replay, p);
+    rsp = p + 4 + ReplayGetU32(&replay->trace[p]);
+    rspSz = ReplayGetU32(&replay->trace[rsp]);
+    if (rspSz == 0)
+        return TPM_RC_FAILURE;
+    if (rspSz > (word32)bufSz)
+        return TPM_RC_SIZE;
+    XMEMCPY(buf, &replay->trace[rsp + 4], rspSz);
+    return TPM_RC_SUCCESS;
+}
+
+/* the TPM is not used while replaying, release its connection */
+static void ReplayCleanup(TPM2_CTX* ctx, void* transportCtx)
+{
+    TPM2_REPLAY* replay = (TPM2_REPLAY*)transportCtx;
+
+    if (replay->inner->cleanup != NULL)
+        replay->inner->cleanup(ctx, replay->innerCtx);
+}
+
+static const TPM2_TRANSPORT gReplayTransport = {
+    "replay", 0, ReplaySend, NULL, NULL, NULL, ReplayCleanup
+};
+
+int TPM2_Replay_Start(TPM2_CTX* ctx, TPM2_REPLAY* replay, const byte* trace,
+    word32 traceSz, word32 flags)
+{
+    word32 p, sz;
+    int i;
+
+    if (ctx == NULL || replay == NULL || trace == NULL ||
+            traceSz < TPM2_REPLAY_MAGIC_SZ ||
+            XMEMCMP(trace, TPM2_REPLAY_MAGIC, TPM2_REPLAY_MAGIC_SZ) != 0) {
+        return BAD_FUNC_ARG;
+    }
+
+    XMEMSET(replay, 0, sizeof(TPM2_REPLAY));
+#ifndef NO_FILESYSTEM
+    replay->fp = XBADFILE;
+#endif
+
+    /* check each entry fits, so replaying needs no bounds checks */
+    p = TPM2_REPLAY_MAGIC_SZ;
+    while (p < traceSz) {
+        for (i = 0; i < 2; i++) {
+            if (traceSz - p < 4)
+                return BUFFER_E;
+            sz = ReplayGetU32(&trace[p]);
+            p += 4;
+            if (sz > traceSz - p || (i == 0 && sz < TPM2_HEADER_SIZE))
+                return BUFFER_E;
+            p += sz;
+        }
+        replay->entries++;
+    }
+
+    replay->flags = flags;
+    replay->trace = trace;
+    replay->traceSz = traceSz;
+    replay->pos = TPM2_REPLAY_MAGIC_SZ;
+    replay->inner = TPM2_GetTransport(ctx, &replay->innerCtx);
+    return TPM2_SetTransport(ctx, &gReplayTransport, replay);
+}
+
+/******************************************************************************/
+/* --- END Replaying -- */
+/******************************************************************************/
+
+
+int TPM2_Replay_Stop(TPM2_CTX* ctx, TPM2_REPLAY* replay)
+{
+    int rc = TPM_RC_SUCCESS;
+    void* transportCtx = NULL;
+    const TPM2_TRANSPORT* transport;
+
+    if (ctx == NULL || replay == NULL)
+        return BAD_FUNC_ARG;
+
+    /* the record transport cleanup closes the trace file */
+    transport = TPM2_GetTransport(ctx, &transportCtx);
+    if (transportCtx == replay && (transport == &gReplayTransport
+    #ifndef NO_FILESYSTEM
+            || transport == &gReplayRecordTransport
+    #endif
+        )) {
+        rc = TPM2_SetTransport(ctx, replay->inner, replay->innerCtx);
+    }
+#ifndef NO_FILESYSTEM
+    if (rc == TPM_RC_SUCCESS && replay->fp != XBADFILE) {
+        XFCLOSE(replay->fp);
+        replay->fp = XBADFILE;
+    }
+#endif
+    return rc;
+}
+
+#endif /* WOLFTPM_REPLAY */
@@ -0,0 +1,364 @@
+/* tpm2_stats.c
+ *
+ * Copyright (C) 2006-2020 wolfSSL Inc.
+ *
+ * This file is part of wolfTPM.
+ *
+ * wolfTPM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfTPM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+
+
+/**
+ * Command statistics registry. A TPM2_SetHook callback that keeps a latency
+ * histogram and error counters for each command code, and writes them in the
+ * Prometheus text format for monitoring.
+ *
+ * Build with --enable-hooks
+ */
+
+#ifdef WOLFTPM_HOOKS
+#include <wolftpm/tpm2.h>
+#include <wolftpm/tpm2_stats.h>
+
+/* Counters are updated without a lock. Without the GCC / Clang atomic
+ * builtins a registry must only be used from one thread. */
+#if defined(__GNUC__) && !defined(SINGLE_THREADED)
+    #define STATS_ADD(p, v)     (void)__atomic_fetch_add((p), (v), \
+                                    __ATOMIC_RELAXED)
+    #define STATS_LOAD(p)       __atomic_load_n((p), __ATOMIC_ACQUIRE)
+    #define STATS_CAS(p, e, d)  __atomic_compare_exchange_n((p), (e), (d), \
+                                    0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#else
+    #define STATS_ADD(p, v)     (*(p) += (v))
+    #define STATS_LOAD(p)       (*(p))
+    #define STATS_CAS(p, e, d)  (*(p) == *(e) ? (*(p) = (d), 1) : \
+                                    (*(e) = *(p), 0))
+#endif
+
+
+static int StatsBucket(word32 us)
+{
+    int e = TPM2_STATS_SUB_BITS;
+
+    if (us < TPM2_STATS_SUB_BUCKETS)
+        return (int)us;
+    if (us >> TPM2_STATS_MAX_BITS)
+        return TPM2_STATS_BUCKETS - 1;
+    while ((us >> (e + 1)) != 0)
+        e++;
+    return (e - TPM2_STATS_SUB_BITS + 1) * TPM2_STATS_SUB_BUCKETS +
+        (int)((us >> (e - TPM2_STATS_SUB_BITS)) &
+            (TPM2_STATS_SUB_BUCKETS - 1));
+}
+
+/* Smallest value above the bucket */
+static word32 StatsBucketEnd(int idx)
+{
+    int e, sub;
+
+    if (idx < TPM2_STATS_SUB_BUCKETS)
+        return (word32)idx + 1;
+    e = idx / TPM2_STATS_SUB_BUCKETS - 1 + TPM2_STATS_SUB_BITS;
+    sub = idx % TPM2_STATS_SUB_BUCKETS;
+    return (word32)(TPM2_STATS_SUB_BUCKETS + sub + 1) <<
+        (e - TPM2_STATS_SUB_BITS);
+}
+
+/* Find the slot of a command code, claiming a free one */
+static TPM2_STATS_CC* StatsSlot(TPM2_STATS* stats, TPM_CC cc)
+{
+    int i;
+    TPM_CC cur;
+
+    for (i = 0; i < TPM2_STATS_MAX_CC; i++) {
+        cur = STATS_LOAD(&stats->cmd[i].cc);
+        if (cur == 0) {
+            if (STATS_CAS(&stats->cmd[i].cc, &cur, cc))
+                return &stats->cmd[i];
+            /* claimed by another thread, cur is its command code */
+        }
+        if (cur == cc)
+            return &stats->cmd[i];
+    }
+    return NULL;
+}
+
+int TPM2_Stats_Init(TPM2_STATS* stats)
+{
+    if (stats == NULL)
+        return BAD_FUNC_ARG;
+    XMEMSET(stats, 0, sizeof(TPM2_STATS));
+    return TPM_RC_SUCCESS;
+}
+
+void TPM2_Stats_Hook(TPM2_CTX* ctx, TPM2_HOOK_EVENT event,
+    const TPM2_HOOK_INFO* info, void* hookCtx)
+{
+    TPM2_STATS* stats = (TPM2_STATS*)hookCtx;
+    TPM2_STATS_CC* cmd;
+    UINT64 ns;
+    word32 us, max;
+
+    (void)ctx;
+    if (event != TPM2_HOOK_DONE || stats == NULL || info->cc == 0)
+        return;
+
+    cmd = StatsSlot(stats, info->cc);
+    if (cmd == NULL) {
+        STATS_ADD(&stats->dropped, 1);
+        return;
+    }
+
+    ns = (info->doneNs > info->startNs) ? info->doneNs - info->startNs : 0;
+    us = (ns / 1000 > 0xFFFFFFFFUL) ? 0xFFFFFFFFUL : (word32)(ns / 1000);
+    STATS_ADD(&cmd->buckets[StatsBucket(us)], 1);
+    STATS_ADD(&cmd->totalNs, ns);
+    if (info->recvNs > info->sendNs)
+        STATS_ADD(&cmd->transportNs, info->recvNs - info->sendNs);
+    if (info->rc != TPM_RC_SUCCESS) {
+        STATS_ADD(&cmd->errors, 1);
+        if (info->rspSz == 0)
+            STATS_ADD(&cmd->noResponse, 1);
+    }
+    max = STATS_LOAD(&cmd->maxUs);
+    while (us > max && !STATS_CAS(&cmd->maxUs, &max, us)) {
+        /* max reloaded, retry while still larger */
+    }
+    /* counted last, so a reader never sees more commands than samples */
+    STATS_ADD(&cmd->count, 1);
+}
+
+const TPM2_STATS_CC* TPM2_Stats_Get(const TPM2_STATS* stats, TPM_CC cc)
+{
+    int i;
+
+    if (stats == NULL || cc == 0)
+        return NULL;
+    for (i = 0; i < TPM2_STATS_MAX_CC; i++) {
+        if (stats->cmd[i].cc == cc)
+            return &stats->cmd[i];
+    }
+    return NULL;
+}
+
+int TPM2_Stats_Percentile(const TPM2_STATS_CC* cmd, word32 share,
+    word32* us)
+{
+    UINT64 total = 0, rank, seen = 0;
+    int i;
+
+    if (cmd == NULL || us == NULL || share > 10000)
+        return BAD_FUNC_ARG;
+
+    for (i = 0; i < TPM2_STATS_BUCKETS; i++)
+        total += cmd->buckets[i];
+    if (total == 0)
+        return BAD_FUNC_ARG;
+
+    /* smallest bucket holding at least share of the samples */
+    rank = (total * share + 9999) / 10000;
+    if (rank == 0)
+        rank = 1;
+    for (i = 0; i < TPM2_STATS_BUCKETS - 1; i++) {
+        seen += cmd->buckets[i];
+        if (seen >= rank)
+            break;
+    }
+    *us = (i == TPM2_STATS_BUCKETS - 1) ? cmd->maxUs : StatsBucketEnd(i);
+    return TPM_RC_SUCCESS;
+}
+
+
+/******************************************************************************/
+/* --- BEGIN Text Output -- */
+/******************************************************************************/
+
+typedef struct StatsWriter {
+    char*  buf;
+    word32 sz;
+    word32 pos;
+    int    full;
+} StatsWriter;
+
+static void StatsPut(StatsWriter* w, const char* str)
+{
+    word32 len = (word32)XSTRLEN(str);
+
+    if (w->full || len >= w->sz - w->pos) {
+        w->full = 1;
+        return;
+    }
+    XMEMCPY(&w->buf[w->pos], str, len);
+    w->pos += len;
+    w->buf[w->pos] = '\0';
+}
+
+static void StatsPutU64(StatsWriter* w, UINT64 val)
+{
+    char digits[21];
+    int i = (int)sizeof(digits) - 1;
+
+    digits[i] = '\0';
+    do {
+        digits[--i] = (char)('0' + (val % 10));
+        val /= 10;
+    } while (val != 0);
+    StatsPut(w, &digits[i]);
+}
+
+/* Microseconds with three decimals */
+static void StatsPutUs(StatsWriter* w, UINT64 ns)
+{
+    char frac[5];
+
+    StatsPutU64(w, ns / 1000);
+    frac[0] = '.';
+    frac[1] = (char)('0' + (ns / 100) % 10);
+    frac[2] = (char)('0' + (ns / 10) % 10);
+    frac[3] = (char)('0' + ns % 10);
+    frac[4] = '\0';
+    StatsPut(w, frac);
+}
+
+/* metric{cc="0x0000017b" */
+static void StatsPutName(StatsWriter* w, const char* metric, TPM_CC cc)
+{
+    static const char hex[] = "0123456789abcdef";
+    char ccStr[11];
+    int i;
+
+    ccStr[0] = '0';
+    ccStr[1] = 'x';
+    for (i = 0; i < 8; i++)
+        ccStr[2 + i] = hex[(cc >> (28 - 4 * i)) & 0xF];
+    ccStr[10] = '\0';
+
+    StatsPut(w, metric);
+    StatsPut(w, "{cc=\"");
+    StatsPut(w, ccStr);
+    StatsPut(w, "\"");
+}
+
+static void StatsPutCounter(StatsWriter* w, const TPM2_STATS* stats,
+    const char* metric, const char* help, int noResponse)
+{
+    int i;
+    const TPM2_STATS_CC* cmd;
+
+    StatsPut(w, "# HELP "); StatsPut(w, metric); StatsPut(w, " ");
+    StatsPut(w, help); StatsPut(w, "\n");
+    StatsPut(w, "# TYPE "); StatsPut(w, metric); StatsPut(w, " counter\n");
+    for (i = 0; i < TPM2_STATS_MAX_CC; i++) {
+        cmd = &stats->cmd[i];
+        if (cmd->cc == 0)
+            continue;
+        StatsPutName(w, metric, cmd->cc);
+        StatsPut(w, "} ");
+        StatsPutU64(w, noResponse ? cmd->noResponse : cmd->errors);
+        StatsPut(w, "\n");
+    }
+}
+
+int TPM2_Stats_Dump(const TPM2_STATS* stats, char* buf, word32 bufSz)
+{
+    StatsWriter w;
+    const TPM2_STATS_CC* cmd;
+    UINT64 cum;
+    int i, b;
+
+    if (stats == NULL || buf == NULL || bufSz == 0)
+        return BAD_FUNC_ARG;
+
+    w.buf = buf;
+    w.sz = bufSz;
+    w.pos = 0;
+    w.full = 0;
+    buf[0] = '\0';
+
+    /* the same fixed buckets are always written, including empty ones, so
+     * the series are the same from one scrape to the next */
+    StatsPut(&w, "# HELP wolftpm_command_latency_microseconds TPM command "
+        "time from marshalling to parsed response\n");
+    StatsPut(&w, "# TYPE wolftpm_command_latency_microseconds histogram\n");
+    for (i = 0; i < TPM2_STATS_MAX_CC; i++) {
+        cmd = &stats->cmd[i];
+        if (cmd->cc == 0)
+            continue;
+        cum = 0;
+        for (b = 0; b < TPM2_STATS_BUCKETS - 1; b++) {
+            cum += cmd->buckets[b];
+            StatsPutName(&w, "wolftpm_command_latency_microseconds_bucket",
+                cmd->cc);
+            StatsPut(&w, ",le=\"");
+            StatsPutU64(&w, StatsBucketEnd(b));
+            StatsPut(&w, "\"} ");
+            StatsPutU64(&w, cum);
+            StatsPut(&w, "\n");
+        }
+        cum += cmd->buckets[TPM2_STATS_BUCKETS - 1];
+        StatsPutName(&w, "wolftpm_command_latency_microseconds_bucket",
+            cmd->cc);
+        StatsPut(&w, ",le=\"+Inf\"} ");
+        StatsPutU64(&w, cum);
+        StatsPut(&w, "\n");
+        StatsPutName(&w, "wolftpm_command_latency_microseconds_sum", cmd->cc);
+        StatsPut(&w, "} ");
+        StatsPutUs(&w, cmd->totalNs);
+        StatsPut(&w, "\n");
+        StatsPutName(&w, "wolftpm_command_latency_microseconds_count",
+            cmd->cc);
+        StatsPut(&w, "} ");
+        StatsPutU64(&w, cum);
+        StatsPut(&w, "\n");
+    }
+
+    StatsPut(&w, "# HELP wolftpm_command_transport_microseconds_total Time "
+        "from giving the command to the transport to its response\n");
+    StatsPut(&w, "# TYPE wolftpm_command_transport_microseconds_total "
+        "counter\n");
+    for (i = 0; i < TPM2_STATS_MAX_CC; i++) {
+        cmd = &stats->cmd[i];
+        if (cmd->cc == 0)
+            continue;
+        StatsPutName(&w, "wolftpm_command_transport_microseconds_total",
+            cmd->cc);
+        StatsPut(&w, "} ");
+        StatsPutUs(&w, cmd->transportNs);
+        StatsPut(&w, "\n");
+    }
+
+    StatsPutCounter(&w, stats, "wolftpm_command_errors_total",
+        "Commands completed with a response code other than success", 0);
+    StatsPutCounter(&w, stats, "wolftpm_command_no_response_total",
+        "Commands failed in the transport or host without a response", 1);
+
+    StatsPut(&w, "# HELP wolftpm_commands_dropped_total Commands not "
+        "recorded, no free command code slot\n");
+    StatsPut(&w, "# TYPE wolftpm_commands_dropped_total counter\n");
+    StatsPut(&w, "wolftpm_commands_dropped_total ");
+    StatsPutU64(&w, stats->dropped);
+    StatsPut(&w, "\n");
+
+    if (w.full)
+        return BUFFER_E;
+    return (int)w.pos;
+}
+
+/******************************************************************************/
+/* --- END Text Output -- */
+/******************************************************************************/
+
+#endif /* WOLFTPM_HOOKS */
@@ -43,51 +43,103 @@
 #include <stdio.h>
 
 #include <wolftpm/tpm2_socket.h>
-
-#ifndef TPM2_SWTPM_HOST
-#define TPM2_SWTPM_HOST         "localhost"
-#endif
-#ifndef TPM2_SWTPM_PORT
-#define TPM2_SWTPM_PORT         "2321"
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/* avoid SIGPIPE when writing to a connection closed by the simulator */
+#ifdef MSG_NOSIGNAL
+    #define SWTPM_SEND_FLAGS MSG_NOSIGNAL
+#else
+    #define SWTPM_SEND_FLAGS 0
 #endif
 
-static TPM_RC SwTpmTransmit(TPM2_CTX* ctx, const void* buffer, ssize_t bufSz)
+/* Advance an iovec array past count bytes, returns new first entry */
+static struct iovec* SwTpmIovAdvance(struct iovec* iov, int* iovCnt,
+    size_t count)
+{
+    while (*iovCnt > 0 && count >= iov->iov_len) {
+        count -= iov->iov_len;
+        iov++;
+        (*iovCnt)--;
+    }
+    if (*iovCnt > 0) {
+        iov->iov_base = (char*)iov->iov_base + count;
+        iov->iov_len -= count;
+    }
+    return iov;
+}
+
+/* Send all iovec buffers with as few system calls as possible */
+static TPM_RC SwTpmTransmitV(struct wolfTPM_tcpContext* tcp,
+    struct iovec* iov, int iovCnt)
 {
     TPM_RC rc = TPM_RC_SUCCESS;
     ssize_t wrc = 0;
+    struct msghdr msg;
 
-    if (ctx == NULL || ctx->tcpCtx.fd < 0 || buffer == NULL) {
+    if (tcp == NULL || tcp->fd < 0 || iov == NULL) {
         return BAD_FUNC_ARG;
     }
 
-    wrc = write(ctx->tcpCtx.fd, buffer, bufSz);
-    if (bufSz != wrc) {
-        rc = SOCKET_ERROR_E;
+    while (iovCnt > 0) {
+        XMEMSET(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovCnt;
+        wrc = sendmsg(tcp->fd, &msg, SWTPM_SEND_FLAGS);
+        if (wrc < 0 && errno == EINTR) {
+            continue;
+        }
+        if (wrc <= 0) {
+            rc = SOCKET_ERROR_E;
+            break;
+        }
+        iov = SwTpmIovAdvance(iov, &iovCnt, (size_t)wrc);
     }
 
 #ifdef WOLFTPM_DEBUG_VERBOSE
     if (wrc < 0) {
         printf("Failed to send the TPM command to fd %d, got errno %d ="
-               "%s\n", ctx->tcpCtx.fd, errno, strerror(errno));
+               "%s\n", tcp->fd, errno, strerror(errno));
     }
 #endif
 
     return rc;
 }
 
-static TPM_RC SwTpmReceive(TPM2_CTX* ctx, void* buffer, size_t rxSz)
+static TPM_RC SwTpmTransmit(struct wolfTPM_tcpContext* tcp,
+    const void* buffer, size_t bufSz)
+{
+    struct iovec iov;
+
+    if (buffer == NULL) {
+        return BAD_FUNC_ARG;
+    }
+
+    iov.iov_base = (void*)buffer;
+    iov.iov_len = bufSz;
+    return SwTpmTransmitV(tcp, &iov, 1);
+}
+
+/* Read into the iovec buffers until at least minSz bytes have been received.
+ * The total received is returned in rxSz */
+static TPM_RC SwTpmReceiveV(struct wolfTPM_tcpContext* tcp,
+    struct iovec* iov, int iovCnt, size_t minSz, size_t* rxSz)
 {
     TPM_RC rc = TPM_RC_SUCCESS;
     ssize_t wrc = 0;
-    size_t bytes_remaining = rxSz;
-    char* ptr = (char*)buffer;
 
-    if (ctx == NULL || ctx->tcpCtx.fd < 0 || buffer == NULL) {
+    if (tcp == NULL || tcp->fd < 0 || iov == NULL || rxSz == NULL) {
         return BAD_FUNC_ARG;
     }
 
-    while (bytes_remaining > 0) {
-        wrc = read(ctx->tcpCtx.fd, ptr, bytes_remaining);
+    *rxSz = 0;
+    while (*rxSz < minSz && iovCnt > 0) {
+        wrc = readv(tcp->fd, iov, iovCnt);
+        if (wrc < 0 && errno == EINTR) {
+            continue;
+        }
         if (wrc <= 0) {
             #ifdef DEBUG_WOLFTPM
             if (wrc == 0) {
@@ -95,37 +147,83 @@ static TPM_RC SwTpmReceive(TPM2_CTX* ctx, void* buffer, size_t rxSz)
             }
             else {
                 printf("Failed to read from TPM socket %d, got errno %d"
-                       " = %s\n", ctx->tcpCtx.fd, errno, strerror(errno));
+                       " = %s\n", tcp->fd, errno, strerror(errno));
             }
             #endif
             rc = SOCKET_ERROR_E;
             break;
         }
 
-        bytes_remaining -= wrc;
-        ptr += wrc;
+        *rxSz += wrc;
+        iov = SwTpmIovAdvance(iov, &iovCnt, (size_t)wrc);
 
         #ifdef WOLFTPM_DEBUG_VERBOSE
         printf("TPM socket received %zd waiting for %zu more\n",
-               wrc, bytes_remaining);
+               wrc, (*rxSz < minSz) ? minSz - *rxSz : 0);
         #endif
     }
+    if (rc == TPM_RC_SUCCESS && *rxSz < minSz) {
+        rc = SOCKET_ERROR_E;
+    }
+
+    return rc;
+}
+
+static TPM_RC SwTpmConnectUnix(struct wolfTPM_tcpContext* tcp,
+    const char* path)
+{
+    TPM_RC rc = SOCKET_ERROR_E;
+    struct sockaddr_un addr;
+    int fd;
+
+    if (tcp == NULL || path == NULL) {
+        return BAD_FUNC_ARG;
+    }
+    if (XSTRLEN(path) >= sizeof(addr.sun_path)) {
+        return BAD_FUNC_ARG;
+    }
+
+    XMEMSET(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    XMEMCPY(addr.sun_path, path, XSTRLEN(path));
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd != -1) {
+        if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            close(fd);
+        }
+        else {
+            tcp->fd = fd;
+            rc = TPM_RC_SUCCESS;
+        }
+    }
+    #ifdef DEBUG_WOLFTPM
+    if (rc != TPM_RC_SUCCESS) {
+        printf("Failed to connect to %s\n", path);
+    }
+    #endif
 
     return rc;
 }
 
-static TPM_RC SwTpmConnect(TPM2_CTX* ctx, const char* host, const char* port)
+static TPM_RC SwTpmConnect(struct wolfTPM_tcpContext* tcp, const char* host,
+    const char* port)
 {
     TPM_RC rc = SOCKET_ERROR_E;
     struct addrinfo hints;
     struct addrinfo *result, *rp;
     int s;
-    int fd;
+    int fd = -1;
+    int on = 1;
 
-    if (ctx == NULL) {
+    if (tcp == NULL) {
         return BAD_FUNC_ARG;
     }
 
+    if (tcp->isUnix) {
+        return SwTpmConnectUnix(tcp, host);
+    }
+
     XMEMSET(&hints, 0, sizeof(struct addrinfo));
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
@@ -133,6 +231,7 @@ static TPM_RC SwTpmConnect(TPM2_CTX* ctx, const char* host, const char* port)
     s = getaddrinfo(host, port, &hints, &result);
     if (s != 0) {
         fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(s));
+        return rc;
     }
 
     for (rp = result; rp != NULL; rp = rp->ai_next) {
@@ -144,13 +243,16 @@ static TPM_RC SwTpmConnect(TPM2_CTX* ctx, const char* host, const char* port)
             close(fd);
         }
         else {
+            /* commands are small request / response exchanges, so don't
+             * let Nagle's algorithm hold them back */
+            (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
             break;
         }
     }
     freeaddrinfo(result);
 
     if (rp != NULL) {
-        ctx->tcpCtx.fd = fd;
+        tcp->fd = fd;
         rc = TPM_RC_SUCCESS;
     }
     #ifdef DEBUG_WOLFTPM
@@ -162,107 +264,136 @@ static TPM_RC SwTpmConnect(TPM2_CTX* ctx, const char* host, const char* port)
     return rc;
 }
 
-static TPM_RC SwTpmDisconnect(TPM2_CTX* ctx)
+static TPM_RC SwTpmDisconnect(struct wolfTPM_tcpContext* tcp)
 {
     TPM_RC rc = TPM_RC_SUCCESS;
-    uint32_t tss_cmd;
+    UINT32 tss_cmd;
 
-    if (ctx == NULL || ctx->tcpCtx.fd < 0) {
+    if (tcp == NULL || tcp->fd < 0) {
         return BAD_FUNC_ARG;
     }
 
     /* end swtpm session */
     tss_cmd = TPM2_Packet_SwapU32(TPM_SESSION_END);
-    rc = SwTpmTransmit(ctx, &tss_cmd, sizeof(uint32_t));
+    rc = SwTpmTransmit(tcp, &tss_cmd, sizeof(UINT32));
     #ifdef WOLFTPM_DEBUG_VERBOSE
     if (rc != TPM_RC_SUCCESS) {
         printf("Failed to transmit SESSION_END\n");
     }
     #endif
 
-    if (0 != close(ctx->tcpCtx.fd)) {
+    if (0 != close(tcp->fd)) {
         rc = SOCKET_ERROR_E;
 
         #ifdef WOLFTPM_DEBUG_VERBOSE
         printf("Failed to close fd %d, got errno %d ="
-               "%s\n", ctx->tcpCtx.fd, errno, strerror(errno));
+               "%s\n", tcp->fd, errno, strerror(errno));
         #endif
     }
 
-    ctx->tcpCtx.fd = -1;
+    tcp->fd = -1;
 
     return rc;
 }
 
-/* Talk to a TPM through socket
- * return TPM_RC_SUCCESS on success,
- *        SOCKET_ERROR_E on socket errors,
- *        TPM_RC_FAILURE on other errors
- */
-int TPM2_SWTPM_SendCommand(TPM2_CTX* ctx, TPM2_Packet* packet)
+/* Send the command frame (TPM_SEND_COMMAND, locality, size, command) with a
+ * single gathered write */
+static TPM_RC SwTpmSendFrame(struct wolfTPM_tcpContext* tcp, int locality,
+    byte* cmd, int cmdSz)
 {
-    int rc = TPM_RC_FAILURE;
-    int rspSz = 0;
-    uint32_t tss_word;
-
-    if (ctx == NULL) {
-        return BAD_FUNC_ARG;
-    }
-
-    if (ctx->tcpCtx.fd < 0) {
-        rc = SwTpmConnect(ctx, TPM2_SWTPM_HOST, TPM2_SWTPM_PORT);
-    }
+    byte hdr[sizeof(UINT32) + sizeof(BYTE) + sizeof(UINT32)];
+    UINT32 tss_word;
+    struct iovec iov[2];
 
 #ifdef WOLFTPM_DEBUG_VERBOSE
-    printf("Command size: %d\n", packet->pos);
-    TPM2_PrintBin(packet->buf, packet->pos);
+    printf("Command size: %d\n", cmdSz);
+    TPM2_PrintBin(cmd, cmdSz);
 #endif
 
-    /* send start */
     tss_word = TPM2_Packet_SwapU32(TPM_SEND_COMMAND);
-    if (rc == TPM_RC_SUCCESS) {
-        rc = SwTpmTransmit(ctx, &tss_word, sizeof(uint32_t));
-    }
+    XMEMCPY(&hdr[0], &tss_word, sizeof(UINT32));
+    hdr[sizeof(UINT32)] = (BYTE)locality;
+    tss_word = TPM2_Packet_SwapU32(cmdSz);
+    XMEMCPY(&hdr[sizeof(UINT32) + sizeof(BYTE)], &tss_word, sizeof(UINT32));
+
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = cmd;
+    iov[1].iov_len = cmdSz;
+    return SwTpmTransmitV(tcp, iov, 2);
+}
 
-    /* locality */
-    if (rc == TPM_RC_SUCCESS) {
-        rc = SwTpmTransmit(ctx, &ctx->locality, sizeof(uint8_t));
-    }
+/* Send one command and receive its response on the open connection.
+ * rxStarted is set once any part of the response has been received.
+ *
+ * The response frame (size, response, ack) normally arrives together and is
+ * read with one call straight into the packet buffer. */
+static int SwTpmExchange(struct wolfTPM_tcpContext* tcp, int locality,
+    TPM2_Packet* packet, int* rxStarted)
+{
+    int rc;
+    size_t rspSz = 0, rxSz = 0, bodySz, ackSz = 0;
+    UINT32 tss_word;
+    byte ack[sizeof(UINT32)];
+    struct iovec iov[2];
 
-    /* buffer size */
-    tss_word = TPM2_Packet_SwapU32(packet->pos);
-    if (rc == TPM_RC_SUCCESS) {
-        rc = SwTpmTransmit(ctx, &tss_word, sizeof(uint32_t));
-    }
+    rc = SwTpmSendFrame(tcp, locality, packet->buf, packet->pos);
 
-    /* Send the TPM command buffer */
+    /* receive response size and as much of the response as is available */
     if (rc == TPM_RC_SUCCESS) {
-        rc = SwTpmTransmit(ctx, packet->buf, packet->pos);
+        iov[0].iov_base = &tss_word;
+        iov[0].iov_len = sizeof(UINT32);
+        iov[1].iov_base = packet->buf;
+        iov[1].iov_len = packet->size;
+        rc = SwTpmReceiveV(tcp, iov, 2, sizeof(UINT32), &rxSz);
     }
-
-    /* receive response */
     if (rc == TPM_RC_SUCCESS) {
-        rc = SwTpmReceive(ctx, &tss_word, sizeof(uint32_t));
+        *rxStarted = 1;
         rspSz = TPM2_Packet_SwapU32(tss_word);
-        if (rspSz > packet->size) {
+        if (rspSz > (size_t)packet->size) {
             #ifdef WOLFTPM_DEBUG_VERBOSE
             printf("Response size(%d) larger than command buffer(%d)\n",
-                   rspSz, packet->pos);
+                   (int)rspSz, packet->size);
             #endif
             rc = SOCKET_ERROR_E;
         }
     }
 
+    /* any bytes past the response are the start of the ack */
+    if (rc == TPM_RC_SUCCESS) {
+        bodySz = rxSz - sizeof(UINT32);
+        if (bodySz > rspSz) {
+            ackSz = bodySz - rspSz;
+            if (ackSz > sizeof(ack)) {
+                rc = SOCKET_ERROR_E;
+            }
+            else {
+                XMEMCPY(ack, &packet->buf[rspSz], ackSz);
+                bodySz = rspSz;
+            }
+        }
+    }
+
     /* This performs a blocking read and could hang. This means a
      * misbehaving actor on the other end of the socket
      */
-    if (rc == TPM_RC_SUCCESS) {
-        rc = SwTpmReceive(ctx, packet->buf, rspSz);
+    if (rc == TPM_RC_SUCCESS && (bodySz < rspSz || ackSz < sizeof(ack))) {
+        int iovCnt = 0;
+        if (bodySz < rspSz) {
+            iov[iovCnt].iov_base = &packet->buf[bodySz];
+            iov[iovCnt].iov_len = rspSz - bodySz;
+            iovCnt++;
+        }
+        iov[iovCnt].iov_base = &ack[ackSz];
+        iov[iovCnt].iov_len = sizeof(ack) - ackSz;
+        iovCnt++;
+        rc = SwTpmReceiveV(tcp, iov, iovCnt,
+            (rspSz - bodySz) + (sizeof(ack) - ackSz), &rxSz);
     }
 
-    /* receive ack */
+    /* check ack */
     if (rc == TPM_RC_SUCCESS) {
-        rc = SwTpmReceive(ctx, &tss_word, sizeof(uint32_t));
+        XMEMCPY(&tss_word, ack, sizeof(UINT32));
         tss_word = TPM2_Packet_SwapU32(tss_word);
         #ifdef WOLFTPM_DEBUG
         if (tss_word != 0) {
@@ -271,16 +402,73 @@ int TPM2_SWTPM_SendCommand(TPM2_CTX* ctx, TPM2_Packet* packet)
         #endif
     }
 
-
 #ifdef WOLFTPM_DEBUG_VERBOSE
     if (rspSz > 0) {
-        printf("Response size: %d\n", rspSz);
+        printf("Response size: %d\n", (int)rspSz);
         TPM2_PrintBin(packet->buf, rspSz);
     }
 #endif
 
-    if (ctx->tcpCtx.fd >= 0) {
-        TPM_RC rc_disconnect = SwTpmDisconnect(ctx);
+    return rc;
+}
+
+/* Connection of the transport, the context's own unless one is given */
+static struct wolfTPM_tcpContext* TPM2_SWTPM_GetTcp(TPM2_CTX* ctx,
+    void* transportCtx)
+{
+    if (transportCtx != NULL)
+        return (struct wolfTPM_tcpContext*)transportCtx;
+    return &ctx->tcpCtx;
+}
+
+/* Talk to a TPM through socket
+ * return TPM_RC_SUCCESS on success,
+ *        SOCKET_ERROR_E on socket errors,
+ *        TPM_RC_FAILURE on other errors
+ */
+static int TPM2_SWTPM_SendCommand(TPM2_CTX* ctx, byte* buf, int cmdSz,
+    int bufSz, void* transportCtx)
+{
+    struct wolfTPM_tcpContext* tcp = TPM2_SWTPM_GetTcp(ctx, transportCtx);
+    int rc = TPM_RC_SUCCESS;
+    int reused = 0, rxStarted = 0;
+    TPM2_Packet packet;
+
+    packet.buf = buf;
+    packet.pos = cmdSz;
+    packet.size = bufSz;
+
+    if (tcp->fd < 0) {
+        rc = SwTpmConnect(tcp, tcp->host, tcp->port);
+    }
+    else {
+        reused = 1;
+    }
+
+    if (rc == TPM_RC_SUCCESS) {
+        rc = SwTpmExchange(tcp, ctx->locality, &packet, &rxStarted);
+    }
+
+    /* A kept alive connection may have been closed by the simulator while
+     * idle. Nothing was received, so the command was not processed and is
+     * safe to send again on a new connection. */
+    if (rc == SOCKET_ERROR_E && reused && !rxStarted) {
+    #ifdef DEBUG_WOLFTPM
+        printf("SWTPM connection lost, reconnecting\n");
+    #endif
+        close(tcp->fd);
+        tcp->fd = -1;
+        rc = SwTpmConnect(tcp, tcp->host, tcp->port);
+        if (rc == TPM_RC_SUCCESS) {
+            rc = SwTpmExchange(tcp, ctx->locality, &packet, &rxStarted);
+        }
+    }
+
+    /* disconnect when not kept alive or on error, so the next command
+     * starts from a clean connection */
+    if (tcp->fd >= 0 && (!tcp->keepAlive ||
+                                rc != TPM_RC_SUCCESS)) {
+        TPM_RC rc_disconnect = SwTpmDisconnect(tcp);
         if (rc == TPM_RC_SUCCESS) {
             rc = rc_disconnect;
         }
@@ -288,4 +476,272 @@ int TPM2_SWTPM_SendCommand(TPM2_CTX* ctx, TPM2_Packet* packet)
 
     return rc;
 }
+
+/* A kept alive connection closed by the simulator while idle reads as EOF */
+static int SwTpmPeerClosed(struct wolfTPM_tcpContext* tcp)
+{
+    byte peek;
+    ssize_t wrc;
+
+    do {
+        wrc = recv(tcp->fd, &peek, sizeof(peek),
+            MSG_PEEK | MSG_DONTWAIT);
+    } while (wrc < 0 && errno == EINTR);
+
+    return (wrc == 0 ||
+           (wrc < 0 && errno != EAGAIN && errno != EWOULDBLOCK));
+}
+
+/* Send the command frame and leave the response to TPM2_SWTPM_AsyncRecv */
+static int TPM2_SWTPM_AsyncSend(TPM2_CTX* ctx, TPM2_ASYNC* req,
+    void* transportCtx)
+{
+    struct wolfTPM_tcpContext* tcp = TPM2_SWTPM_GetTcp(ctx, transportCtx);
+    int rc = TPM_RC_SUCCESS;
+
+    if (tcp->fd >= 0 && SwTpmPeerClosed(tcp)) {
+    #ifdef DEBUG_WOLFTPM
+        printf("SWTPM connection lost, reconnecting\n");
+    #endif
+        close(tcp->fd);
+        tcp->fd = -1;
+    }
+    req->reused = (tcp->fd >= 0);
+    if (tcp->fd < 0) {
+        rc = SwTpmConnect(tcp, tcp->host, tcp->port);
+    }
+    if (rc == TPM_RC_SUCCESS) {
+        rc = SwTpmSendFrame(tcp, ctx->locality, req->buf, req->cmdSz);
+    }
+
+    if (rc == TPM_RC_SUCCESS) {
+        req->fd = tcp->fd;
+        req->rxSz = 0;
+    }
+    else if (tcp->fd >= 0) {
+        close(tcp->fd);
+        tcp->fd = -1;
+    }
+
+    return rc;
+}
+
+/* Receive as much of the response frame (size, response, ack) as is
+ * available without blocking. Returns TPM_RC_YIELDED until complete. */
+static int TPM2_SWTPM_AsyncRecv(TPM2_CTX* ctx, TPM2_ASYNC* req,
+    void* transportCtx)
+{
+    struct wolfTPM_tcpContext* tcp = TPM2_SWTPM_GetTcp(ctx, transportCtx);
+    int rc = TPM_RC_YIELDED;
+    const size_t hdrSz = sizeof(UINT32), ackSz = sizeof(UINT32);
+    size_t rxSz, bodySz, ackRx;
+    UINT32 tss_word;
+    ssize_t wrc;
+    struct iovec iov[2];
+    int iovCnt;
+    struct msghdr msg;
+
+    while (rc == TPM_RC_YIELDED) {
+        rxSz = (size_t)req->rxSz;
+        iovCnt = 0;
+        if (rxSz < hdrSz) {
+            /* response size, then as much of the response as fits */
+            iov[iovCnt].iov_base = &req->rxFrame[rxSz];
+            iov[iovCnt].iov_len = hdrSz - rxSz;
+            iovCnt++;
+            iov[iovCnt].iov_base = req->buf;
+            iov[iovCnt].iov_len = req->bufSz;
+            iovCnt++;
+        }
+        else {
+            bodySz = rxSz - hdrSz;
+            ackRx = 0;
+            if (bodySz < (size_t)req->rspSz) {
+                iov[iovCnt].iov_base = &req->buf[bodySz];
+                iov[iovCnt].iov_len = req->rspSz - bodySz;
+                iovCnt++;
+            }
+            else {
+                ackRx = bodySz - req->rspSz;
+            }
+            iov[iovCnt].iov_base = &req->rxFrame[hdrSz + ackRx];
+            iov[iovCnt].iov_len = ackSz - ackRx;
+            iovCnt++;
+        }
+
+        XMEMSET(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovCnt;
+        wrc = recvmsg(tcp->fd, &msg, MSG_DONTWAIT);
+        if (wrc < 0 && errno == EINTR) {
+            continue;
+        }
+        if (wrc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (wrc <= 0 && req->reused && req->rxSz == 0) {
+            /* the simulator closed the kept alive connection before taking
+             * the command, send it again on a new connection */
+            close(tcp->fd);
+            tcp->fd = -1;
+            rc = TPM2_SWTPM_AsyncSend(ctx, req, transportCtx);
+            req->reused = 0;
+            if (rc == TPM_RC_SUCCESS) {
+                rc = TPM_RC_YIELDED;
+            }
+            continue;
+        }
+        if (wrc <= 0) {
+            #ifdef DEBUG_WOLFTPM
+            printf("Failed to read from TPM socket %d, got errno %d"
+                   " = %s\n", tcp->fd, errno,
+                   (wrc == 0) ? "EOF" : strerror(errno));
+            #endif
+            rc = SOCKET_ERROR_E;
+            break;
+        }
+        req->rxSz += (int)wrc;
+
+        /* response size received, any bytes past the response in the buffer
+         * are the start of the ack */
+        if (rxSz < hdrSz && (size_t)req->rxSz >= hdrSz) {
+            XMEMCPY(&tss_word, req->rxFrame, sizeof(UINT32));
+            req->rspSz = (int)TPM2_Packet_SwapU32(tss_word);
+            bodySz = req->rxSz - hdrSz;
+            if (req->rspSz < 0 || req->rspSz > req->bufSz) {
+                #ifdef WOLFTPM_DEBUG_VERBOSE
+                printf("Response size(%d) larger than command buffer(%d)\n",
+                       req->rspSz, req->bufSz);
+                #endif
+                rc = SOCKET_ERROR_E;
+            }
+            else if (bodySz > (size_t)req->rspSz) {
+                ackRx = bodySz - req->rspSz;
+                if (ackRx > ackSz) {
+                    rc = SOCKET_ERROR_E;
+                }
+                else {
+                    XMEMCPY(&req->rxFrame[hdrSz], &req->buf[req->rspSz],
+                        ackRx);
+                }
+            }
+        }
+        if (rc == TPM_RC_YIELDED && (size_t)req->rxSz >= hdrSz &&
+                (size_t)req->rxSz == hdrSz + req->rspSz + ackSz) {
+            rc = TPM_RC_SUCCESS;
+        }
+    }
+
+    if (rc == TPM_RC_YIELDED) {
+        return rc;
+    }
+
+    #ifdef WOLFTPM_DEBUG
+    if (rc == TPM_RC_SUCCESS) {
+        XMEMCPY(&tss_word, &req->rxFrame[hdrSz], sizeof(UINT32));
+        tss_word = TPM2_Packet_SwapU32(tss_word);
+        if (tss_word != 0) {
+            printf("SWTPM ack %d\n", tss_word);
+        }
+    }
+    #endif
+    #ifdef WOLFTPM_DEBUG_VERBOSE
+    if (rc == TPM_RC_SUCCESS) {
+        printf("Response size: %d\n", req->rspSz);
+        TPM2_PrintBin(req->buf, req->rspSz);
+    }
+    #endif
+
+    req->fd = -1;
+    if (tcp->fd >= 0 && (!tcp->keepAlive ||
+                                rc != TPM_RC_SUCCESS)) {
+        TPM_RC rc_disconnect = SwTpmDisconnect(tcp);
+        if (rc == TPM_RC_SUCCESS) {
+            rc = rc_disconnect;
+        }
+    }
+
+    return rc;
+}
+
+/* Close the connection mid exchange, the simulator drops the response */
+static int TPM2_SWTPM_AsyncCancel(TPM2_CTX* ctx, TPM2_ASYNC* req,
+    void* transportCtx)
+{
+    struct wolfTPM_tcpContext* tcp = TPM2_SWTPM_GetTcp(ctx, transportCtx);
+
+    if (tcp->fd >= 0) {
+        close(tcp->fd);
+        tcp->fd = -1;
+    }
+    req->fd = -1;
+    return TPM_RC_SUCCESS;
+}
+
+static void TPM2_SWTPM_Cleanup(TPM2_CTX* ctx, void* transportCtx)
+{
+    struct wolfTPM_tcpContext* tcp = TPM2_SWTPM_GetTcp(ctx, transportCtx);
+
+    if (tcp->fd >= 0) {
+        (void)SwTpmDisconnect(tcp);
+    }
+}
+
+static const TPM2_TRANSPORT gSwTpmTransport = {
+    "swtpm",
+    0,
+    TPM2_SWTPM_SendCommand,
+    TPM2_SWTPM_AsyncSend,
+    TPM2_SWTPM_AsyncRecv,
+    TPM2_SWTPM_AsyncCancel,
+    TPM2_SWTPM_Cleanup
+};
+
+const TPM2_TRANSPORT* TPM2_SWTPM_GetTransport(void)
+{
+    return &gSwTpmTransport;
+}
+
+int TPM2_SWTPM_InitTcp(struct wolfTPM_tcpContext* tcp, const char* host,
+    const char* port, int keepAlive)
+{
+    if (tcp == NULL) {
+        return BAD_FUNC_ARG;
+    }
+
+    XMEMSET(tcp, 0, sizeof(*tcp));
+    tcp->fd = -1;
+    tcp->host = (host != NULL) ? host : TPM2_SWTPM_HOST;
+    tcp->port = (port != NULL) ? port : TPM2_SWTPM_PORT;
+    tcp->keepAlive = keepAlive;
+
+    return TPM_RC_SUCCESS;
+}
+
+int TPM2_SWTPM_SetServer(TPM2_CTX* ctx, const char* host, const char* port,
+    int keepAlive)
+{
+    if (ctx == NULL) {
+        return BAD_FUNC_ARG;
+    }
+
+    TPM2_SWTPM_Cleanup(ctx, NULL);
+    return TPM2_SWTPM_InitTcp(&ctx->tcpCtx, host, port, keepAlive);
+}
+
+int TPM2_SWTPM_SetUnixSocket(TPM2_CTX* ctx, const char* path, int keepAlive)
+{
+    if (ctx == NULL || path == NULL) {
+        return BAD_FUNC_ARG;
+    }
+
+    TPM2_SWTPM_Cleanup(ctx, NULL);
+
+    ctx->tcpCtx.host = path;
+    ctx->tcpCtx.port = NULL;
+    ctx->tcpCtx.keepAlive = keepAlive;
+    ctx->tcpCtx.isUnix = 1;
+
+    return TPM_RC_SUCCESS;
+}
 #endif /* WOLFTPM_SWTPM */
@@ -22,171 +22,239 @@
 
 #include <wolftpm/tpm2_tis.h>
 
+#if defined(WOLFTPM_TIMED_POLL) && defined(__linux__)
+    #include <time.h>
+#endif
+
 
 /******************************************************************************/
 /* --- BEGIN TPM Interface Specification (TIS) Layer */
 /******************************************************************************/
 
-enum tpm_tis_access {
-    TPM_ACCESS_VALID            = 0x80,
-    TPM_ACCESS_ACTIVE_LOCALITY  = 0x20,
-    TPM_ACCESS_REQUEST_PENDING  = 0x04,
-    TPM_ACCESS_REQUEST_USE      = 0x02,
-};
-
-enum tpm_tis_status {
-    TPM_STS_VALID               = 0x80,
-    TPM_STS_COMMAND_READY       = 0x40,
-    TPM_STS_GO                  = 0x20,
-    TPM_STS_DATA_AVAIL          = 0x10,
-    TPM_STS_DATA_EXPECT         = 0x08,
-    TPM_STS_SELF_TEST_DONE      = 0x04,
-    TPM_STS_RESP_RETRY          = 0x02,
-};
-
-enum tpm_tis_int_flags {
-    TPM_GLOBAL_INT_ENABLE       = 0x80000000,
-    TPM_INTF_BURST_COUNT_STATIC = 0x100,
-    TPM_INTF_CMD_READY_INT      = 0x080,
-    TPM_INTF_INT_EDGE_FALLING   = 0x040,
-    TPM_INTF_INT_EDGE_RISING    = 0x020,
-    TPM_INTF_INT_LEVEL_LOW      = 0x010,
-    TPM_INTF_INT_LEVEL_HIGH     = 0x008,
-    TPM_INTF_LOC_CHANGE_INT     = 0x004,
-    TPM_INTF_STS_VALID_INT      = 0x002,
-    TPM_INTF_DATA_AVAIL_INT     = 0x001,
-};
-
-
-#define TPM_BASE_ADDRESS (0xD40000u)
-
-#ifdef WOLFTPM_I2C
-/* For I2C only the lower 8-bits of the address are used */
-#define TPM_ACCESS(l)           (TPM_BASE_ADDRESS | 0x0004u | ((l) << 12u))
-#define TPM_INTF_CAPS(l)        (TPM_BASE_ADDRESS | 0x0030u | ((l) << 12u))
-#define TPM_DID_VID(l)          (TPM_BASE_ADDRESS | 0x0048u | ((l) << 12u))
-#define TPM_RID(l)              (TPM_BASE_ADDRESS | 0x004Cu | ((l) << 12u))
-#define TPM_I2C_DEVICE_ADDR(l)  (TPM_BASE_ADDRESS | 0x0038u | ((l) << 12u))
-#define TPM_DATA_CSUM_ENABLE(l) (TPM_BASE_ADDRESS | 0x0040u | ((l) << 12u))
-#define TPM_DATA_CSUM(l)        (TPM_BASE_ADDRESS | 0x0044u | ((l) << 12u))
-#else
-#define TPM_ACCESS(l)           (TPM_BASE_ADDRESS | 0x0000u | ((l) << 12u))
-#define TPM_INTF_CAPS(l)        (TPM_BASE_ADDRESS | 0x0014u | ((l) << 12u))
-#define TPM_DID_VID(l)          (TPM_BASE_ADDRESS | 0x0F00u | ((l) << 12u))
-#define TPM_RID(l)              (TPM_BASE_ADDRESS | 0x0F04u | ((l) << 12u))
-#endif
-
-#define TPM_INT_ENABLE(l)       (TPM_BASE_ADDRESS | 0x0008u | ((l) << 12u))
-#define TPM_INT_VECTOR(l)       (TPM_BASE_ADDRESS | 0x000Cu | ((l) << 12u))
-#define TPM_INT_STATUS(l)       (TPM_BASE_ADDRESS | 0x0010u | ((l) << 12u))
-#define TPM_STS(l)              (TPM_BASE_ADDRESS | 0x0018u | ((l) << 12u))
-#define TPM_BURST_COUNT(l)      (TPM_BASE_ADDRESS | 0x0019u | ((l) << 12u))
-#define TPM_DATA_FIFO(l)        (TPM_BASE_ADDRESS | 0x0024u | ((l) << 12u))
-#define TPM_XDATA_FIFO(l)       (TPM_BASE_ADDRESS | 0x0083u | ((l) << 12u))
-
-
-/* this option enables named semaphore protection on TIS commands for protected
-    concurrent process access */
-#ifdef WOLFTPM_TIS_LOCK
+/* this option enables lock file protection on TIS commands for protected
+    concurrent process access. The lock is an flock() on a file kept open in
+    the context, taken once for a whole command (nested register accesses
+    only count) and released by the kernel if the holder exits. */
+#if defined(WOLFTPM_TIS_LOCK) && defined(WOLFTPM_TIS)
     #ifdef __linux__
-        #include <semaphore.h>
         #include <fcntl.h>
+        #include <unistd.h>
+        #include <sys/file.h>
         #include <sys/stat.h>
         #include <errno.h>
 
-        #define SEM_NAME "/wolftpm"
-        #define SEM_PERMS (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP)
-        #define INITIAL_VALUE 1
+        #define LOCK_PERMS (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP)
         #define TIMEOUT_SECONDS 10
-        static int gLockCount = 0;
+        #define LOCK_RETRY_US 1000
 
-        static int TPM2_TIS_Lock(void)
+        static int TPM2_TIS_Lock(TPM2_CTX* ctx)
         {
-            int ret = 0;
-            sem_t *sem;
-            struct timespec timeoutTime;
+            struct wolfTPM_tisContext* tis = &ctx->tisCtx;
+            int tries = (TIMEOUT_SECONDS * 1000000) / LOCK_RETRY_US;
+            struct stat st;
 
-            if (gLockCount == 0) {
-                clock_gettime(CLOCK_REALTIME, &timeoutTime);
-                timeoutTime.tv_sec += TIMEOUT_SECONDS;
+            if (tis->lockCount > 0) {
+                tis->lockCount++;
+                return 0;
+            }
 
-                /* open semaphore and create if not found */
-                sem = sem_open(SEM_NAME, O_CREAT | O_RDWR, SEM_PERMS, INITIAL_VALUE);
-                if (sem == SEM_FAILED) {
+            if (tis->lockFd < 0) {
+                /* open lock file and create if not found. A symlink, or a
+                 * file another user created to hold the lock, is refused. */
+                tis->lockFd = open(WOLFTPM_TIS_LOCK_FILE,
+                    O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, LOCK_PERMS);
+                if (tis->lockFd >= 0 && (fstat(tis->lockFd, &st) != 0 ||
+                        !S_ISREG(st.st_mode) ||
+                        (st.st_uid != geteuid() && st.st_uid != 0))) {
+                    close(tis->lockFd);
+                    tis->lockFd = -1;
+                }
+                if (tis->lockFd < 0) {
                 #ifdef DEBUG_WOLFTPM
-                    printf("TPM2_TIS_Lock: Semaphore %s open failed! %d\n",
-                        SEM_NAME, errno);
+                    printf("TPM2_TIS_Lock: Lock file %s open failed! %d\n",
+                        WOLFTPM_TIS_LOCK_FILE, errno);
                 #endif
                     return BAD_MUTEX_E;
                 }
+            }
 
-                /* Try and decrement semaphore */
-                if (sem_timedwait(sem, &timeoutTime) != 0) {
+            while (flock(tis->lockFd, LOCK_EX | LOCK_NB) != 0) {
+                if ((errno != EWOULDBLOCK && errno != EINTR) || --tries <= 0) {
                 #ifdef DEBUG_WOLFTPM
-                    printf("TPM2_TIS_Lock: Semaphore %s timeout! %d\n",
-                        SEM_NAME, errno);
+                    printf("TPM2_TIS_Lock: Lock file %s timeout! %d\n",
+                        WOLFTPM_TIS_LOCK_FILE, errno);
                 #endif
-                    ret = WC_TIMEOUT_E;
+                    return WC_TIMEOUT_E;
                 }
-
-                sem_close(sem);
-            }
-            if (ret == 0) {
-                gLockCount++;
+                usleep(LOCK_RETRY_US);
             }
+            tis->lockCount = 1;
 
-            return ret;
+            return 0;
         }
 
-        static void TPM2_TIS_Unlock(void)
+        static void TPM2_TIS_Unlock(TPM2_CTX* ctx)
         {
-            if (gLockCount > 0) {
-                gLockCount--;
+            struct wolfTPM_tisContext* tis = &ctx->tisCtx;
+
+            if (tis->lockCount > 0) {
+                tis->lockCount--;
+                if (tis->lockCount == 0)
+                    flock(tis->lockFd, LOCK_UN);
             }
-            if (gLockCount == 0) {
-                sem_t *sem = sem_open(SEM_NAME, O_RDWR);
-                if (sem == SEM_FAILED) {
-                #ifdef DEBUG_WOLFTPM
-                    printf("TPM2_TIS_Unlock: Semaphore %s open failed! %d\n",
-                        SEM_NAME, errno);
-                #endif
-                    return;
-                }
+        }
+
+        static void TPM2_TIS_LockCleanup(TPM2_CTX* ctx)
+        {
+            struct wolfTPM_tisContext* tis = &ctx->tisCtx;
 
-                sem_post(sem); /* increment semaphore */
-                sem_close(sem);
+            if (tis->lockFd >= 0) {
+                close(tis->lockFd); /* also releases the lock */
+                tis->lockFd = -1;
             }
+            tis->lockCount = 0;
         }
-        #define TPM2_TIS_LOCK()   TPM2_TIS_Lock()
-        #define TPM2_TIS_UNLOCK() TPM2_TIS_Unlock()
+        #define TPM2_TIS_LOCK(ctx)   TPM2_TIS_Lock(ctx)
+        #define TPM2_TIS_UNLOCK(ctx) TPM2_TIS_Unlock(ctx)
+        #define TPM2_TIS_LOCK_CLEANUP(ctx) TPM2_TIS_LockCleanup(ctx)
     #else
         #error TPM TIS Locking not supported on this platform
     #endif /* __linux__ */
 #endif /* WOLFTPM_TIS_LOCK */
 #ifndef TPM2_TIS_LOCK
-#define TPM2_TIS_LOCK() 0
+#define TPM2_TIS_LOCK(ctx) 0
 #endif
 #ifndef TPM2_TIS_UNLOCK
-#define TPM2_TIS_UNLOCK()
+#define TPM2_TIS_UNLOCK(ctx)
+#endif
+
+
+#ifdef WOLFTPM_TIS
+static void TPM2_TIS_CountAccess(TPM2_CTX* ctx, word32 addr, int isRead)
+{
+    TPM2_TIS_STATS* stats = &ctx->tisCtx.stats;
+    if (addr == TPM_DATA_FIFO(ctx->locality)) {
+        if (isRead)
+            stats->fifoReads++;
+        else
+            stats->fifoWrites++;
+    }
+    else if (isRead) {
+        stats->regReads++;
+    }
+    else {
+        stats->regWrites++;
+    }
+}
+#define TPM2_TIS_COUNT_ACCESS(ctx, addr, isRead) \
+    TPM2_TIS_CountAccess(ctx, addr, isRead)
+#define TPM2_TIS_COUNT_POLL(ctx) (ctx)->tisCtx.stats.polls++
+#else
+#define TPM2_TIS_COUNT_ACCESS(ctx, addr, isRead)
+#define TPM2_TIS_COUNT_POLL(ctx)
+#endif
+
+#ifdef WOLFTPM_TIS_PROFILE
+/* Profile entry of a command code, claimed on first use. Commands with no
+ * free entry are counted in entry 0. */
+static TPM2_TIS_PROFILE_CC* TPM2_TIS_ProfileEntry(TPM2_TIS_PROFILE* profile,
+    UINT32 cc)
+{
+    int i;
+
+    for (i = 1; i < TPM2_TIS_PROFILE_MAX_CC && cc != 0; i++) {
+        if (profile->cmd[i].cc == cc)
+            return &profile->cmd[i];
+        if (profile->cmd[i].cc == 0) {
+            profile->cmd[i].cc = cc;
+            return &profile->cmd[i];
+        }
+    }
+    profile->dropped++;
+    return &profile->cmd[0];
+}
+
+/* Attribute a register or FIFO access to the command in progress */
+static void TPM2_TIS_ProfileAccess(TPM2_CTX* ctx, word32 addr, word32 len,
+    int isRead, int rc, UINT64 startNs)
+{
+    TPM2_TIS_PROFILE_CC* cmd = ctx->tisCtx.profileCmd;
+
+    cmd->busNs += XTPM_TIME_NS() - startNs;
+#ifdef WOLFTPM_I2C
+    cmd->bytes += len + 1; /* register address */
+#else
+    cmd->bytes += len + TPM_TIS_HEADER_SZ;
 #endif
+    if (rc != TPM_RC_SUCCESS)
+        cmd->ioErrors++;
 
+    if (addr == TPM_DATA_FIFO(ctx->locality)) {
+        if (isRead)
+            cmd->fifoReads++;
+        else
+            cmd->fifoWrites++;
+    }
+    else if (isRead && addr == TPM_STS(ctx->locality)) {
+        cmd->stsReads++;
+        if (len >= 3) /* burst count is in bytes 1 and 2 */
+            cmd->burstReads++;
+    }
+    else if (isRead && addr == TPM_BURST_COUNT(ctx->locality)) {
+        cmd->burstReads++;
+    }
+    else {
+        cmd->regAccesses++;
+    }
+}
+
+/* The command in progress is done, later accesses go to entry 0 */
+static void TPM2_TIS_ProfileDone(struct wolfTPM_tisContext* tis)
+{
+    if (tis->profileCmd != NULL) {
+        tis->profileCmd->commands++;
+        tis->profileCmd = &tis->profile->cmd[0];
+    }
+}
+#define TPM2_TIS_PROFILE_START(ctx) \
+    (((ctx)->tisCtx.profileCmd != NULL) ? XTPM_TIME_NS() : 0)
+#define TPM2_TIS_PROFILE_ACCESS(ctx, addr, len, isRead, rc, startNs) \
+    if ((ctx)->tisCtx.profileCmd != NULL) \
+        TPM2_TIS_ProfileAccess(ctx, addr, len, isRead, rc, startNs)
+#define TPM2_TIS_PROFILE_POLL(tis) \
+    if ((tis)->profileCmd != NULL) (tis)->profileCmd->polls++
+#else
+#define TPM2_TIS_PROFILE_START(ctx) 0
+#define TPM2_TIS_PROFILE_ACCESS(ctx, addr, len, isRead, rc, startNs) \
+    (void)startNs
+#define TPM2_TIS_PROFILE_POLL(tis)
+#endif /* WOLFTPM_TIS_PROFILE */
 
 int TPM2_TIS_Read(TPM2_CTX* ctx, word32 addr, byte* result,
     word32 len)
 {
     int rc;
+    UINT64 startNs;
 #ifndef WOLFTPM_ADV_IO
     byte txBuf[MAX_SPI_FRAMESIZE+TPM_TIS_HEADER_SZ];
     byte rxBuf[MAX_SPI_FRAMESIZE+TPM_TIS_HEADER_SZ];
 #endif
 
-    if (ctx == NULL || result == NULL || len == 0 || len > MAX_SPI_FRAMESIZE)
+    if (ctx == NULL || result == NULL || len == 0)
+        return BAD_FUNC_ARG;
+#ifdef WOLFTPM_ADV_IO
+    if (len > MAX_TIS_FRAMESIZE)
+#else
+    if (len > MAX_SPI_FRAMESIZE)
+#endif
         return BAD_FUNC_ARG;
 
-    rc = TPM2_TIS_LOCK();
+    rc = TPM2_TIS_LOCK(ctx);
     if (rc != 0)
         return rc;
 
+    TPM2_TIS_COUNT_ACCESS(ctx, addr, 1);
+    startNs = TPM2_TIS_PROFILE_START(ctx);
 #ifdef WOLFTPM_ADV_IO
     rc = ctx->ioCb(ctx, TPM_TIS_READ, addr, result, len, ctx->userCtx);
 #else
@@ -202,7 +270,8 @@ int TPM2_TIS_Read(TPM2_CTX* ctx, word32 addr, byte* result,
 
     XMEMCPY(result, &rxBuf[TPM_TIS_HEADER_SZ], len);
 #endif
-    TPM2_TIS_UNLOCK();
+    TPM2_TIS_PROFILE_ACCESS(ctx, addr, len, 1, rc, startNs);
+    TPM2_TIS_UNLOCK(ctx);
 
     return rc;
 }
@@ -211,18 +280,27 @@ int TPM2_TIS_Write(TPM2_CTX* ctx, word32 addr, const byte* value,
     word32 len)
 {
     int rc;
+    UINT64 startNs;
 #ifndef WOLFTPM_ADV_IO
     byte txBuf[MAX_SPI_FRAMESIZE+TPM_TIS_HEADER_SZ];
     byte rxBuf[MAX_SPI_FRAMESIZE+TPM_TIS_HEADER_SZ];
 #endif
 
-    if (ctx == NULL || value == NULL || len == 0 || len > MAX_SPI_FRAMESIZE)
+    if (ctx == NULL || value == NULL || len == 0)
+        return BAD_FUNC_ARG;
+#ifdef WOLFTPM_ADV_IO
+    if (len > MAX_TIS_FRAMESIZE)
+#else
+    if (len > MAX_SPI_FRAMESIZE)
+#endif
         return BAD_FUNC_ARG;
 
-    rc = TPM2_TIS_LOCK();
+    rc = TPM2_TIS_LOCK(ctx);
     if (rc != 0)
         return rc;
 
+    TPM2_TIS_COUNT_ACCESS(ctx, addr, 0);
+    startNs = TPM2_TIS_PROFILE_START(ctx);
 #ifdef WOLFTPM_ADV_IO
     rc = ctx->ioCb(ctx, TPM_TIS_WRITE, addr, (byte*)value, len, ctx->userCtx);
 #else
@@ -236,16 +314,82 @@ int TPM2_TIS_Write(TPM2_CTX* ctx, word32 addr, const byte* value,
 
     rc = ctx->ioCb(ctx, txBuf, rxBuf, len + TPM_TIS_HEADER_SZ, ctx->userCtx);
 #endif
-    TPM2_TIS_UNLOCK();
+    TPM2_TIS_PROFILE_ACCESS(ctx, addr, len, 0, rc, startNs);
+    TPM2_TIS_UNLOCK(ctx);
 
     return rc;
 }
 
+#if defined(WOLFTPM_TIMED_POLL) && defined(__linux__)
+UINT64 TPM2_TIS_TimeUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (UINT64)now.tv_sec * 1000000 + (UINT64)(now.tv_nsec / 1000);
+}
+#endif
+
+/* Blocking wait for the TPM. Times out after the number of polls and, with
+ * WOLFTPM_TIMED_POLL, at the deadline with backoff between polls */
+typedef struct TPM2_TIS_WAIT {
+    int    tries;
+    int    polls;
+#ifdef WOLFTPM_TIMED_POLL
+    UINT64 deadline;
+    word32 pollUs;
+#endif
+} TPM2_TIS_WAIT;
+
+static void TPM2_TIS_WaitInit(TPM2_TIS_WAIT* wait, word32 timeoutUs,
+    int tries)
+{
+    wait->tries = tries;
+    wait->polls = 0;
+#ifdef WOLFTPM_TIMED_POLL
+    wait->deadline = XTPM_TIME_US() + timeoutUs;
+    wait->pollUs = TPM_TIS_POLL_MIN_US;
+#else
+    (void)timeoutUs;
+#endif
+}
+
+/* The TPM was not ready, wait before the next poll */
+static int TPM2_TIS_WaitNext(TPM2_CTX* ctx, TPM2_TIS_WAIT* wait)
+{
+#ifdef WOLFTPM_TIMED_POLL
+    UINT64 now;
+#endif
+
+    TPM2_TIS_COUNT_POLL(ctx);
+    TPM2_TIS_PROFILE_POLL(&ctx->tisCtx);
+    (void)ctx;
+    wait->polls++;
+    if (--wait->tries <= 0)
+        return TPM_RC_TIMEOUT;
+
+#ifdef WOLFTPM_TIMED_POLL
+    now = XTPM_TIME_US();
+    if (now >= wait->deadline)
+        return TPM_RC_TIMEOUT;
+    if (now + wait->pollUs > wait->deadline)
+        wait->pollUs = (word32)(wait->deadline - now);
+    XTPM_SLEEP_US(wait->pollUs);
+    wait->pollUs *= 2;
+    if (wait->pollUs > TPM_TIS_POLL_MAX_US)
+        wait->pollUs = TPM_TIS_POLL_MAX_US;
+#else
+    XTPM_WAIT();
+#endif
+    return TPM_RC_SUCCESS;
+}
+
 int TPM2_TIS_StartupWait(TPM2_CTX* ctx, int timeout)
 {
     int rc;
     byte access = 0;
+    TPM2_TIS_WAIT wait;
 
+    TPM2_TIS_WaitInit(&wait, TPM_TIS_TIMEOUT_B_US, timeout);
     do {
         rc = TPM2_TIS_Read(ctx, TPM_ACCESS(0), &access, sizeof(access));
         /* if chip isn't present MISO will be high and return 0xFF */
@@ -253,13 +397,12 @@ int TPM2_TIS_StartupWait(TPM2_CTX* ctx, int timeout)
                 (access != 0xFF)) {
             return TPM_RC_SUCCESS;
         }
-        XTPM_WAIT();
-    } while (rc == TPM_RC_SUCCESS && --timeout > 0);
+        if (rc == TPM_RC_SUCCESS)
+            rc = TPM2_TIS_WaitNext(ctx, &wait);
+    } while (rc == TPM_RC_SUCCESS);
 #ifdef WOLFTPM_DEBUG_TIMEOUT
-    printf("TIS_StartupWait: Timeout %d\n", TPM_TIMEOUT_TRIES - timeout);
+    printf("TIS_StartupWait: Timeout %d\n", wait.polls);
 #endif
-    if (timeout <= 0)
-        return TPM_RC_TIMEOUT;
     return rc;
 }
 
@@ -284,6 +427,7 @@ int TPM2_TIS_RequestLocality(TPM2_CTX* ctx, int timeout)
     int rc;
     int locality = WOLFTPM_LOCALITY_DEFAULT;
     byte access = 0;
+    TPM2_TIS_WAIT wait;
 
     rc = TPM2_TIS_CheckLocality(ctx, locality, &access);
     if (rc == TPM_RC_SUCCESS) {
@@ -295,6 +439,7 @@ int TPM2_TIS_RequestLocality(TPM2_CTX* ctx, int timeout)
     access = TPM_ACCESS_REQUEST_USE;
     rc = TPM2_TIS_Write(ctx, TPM_ACCESS(locality), &access, sizeof(access));
     if (rc == TPM_RC_SUCCESS) {
+        TPM2_TIS_WaitInit(&wait, TPM_TIS_TIMEOUT_A_US, timeout);
         do {
             access = 0;
             rc = TPM2_TIS_CheckLocality(ctx, locality, &access);
@@ -303,13 +448,13 @@ int TPM2_TIS_RequestLocality(TPM2_CTX* ctx, int timeout)
                 if (rc >= 0)
                     return rc;
             }
-            XTPM_WAIT();
-        } while (rc < 0 && --timeout > 0);
-#ifdef WOLFTPM_DEBUG_TIMEOUT
-        printf("TIS_RequestLocality: Timeout %d\n", TPM_TIMEOUT_TRIES - timeout);
-#endif
-        if (timeout <= 0)
-            return TPM_RC_TIMEOUT;
+            if (TPM2_TIS_WaitNext(ctx, &wait) != TPM_RC_SUCCESS) {
+            #ifdef WOLFTPM_DEBUG_TIMEOUT
+                printf("TIS_RequestLocality: Timeout %d\n", wait.polls);
+            #endif
+                return TPM_RC_TIMEOUT;
+            }
+        } while (rc < 0);
     }
 
     return rc;
@@ -350,20 +495,20 @@ int TPM2_TIS_Status(TPM2_CTX* ctx, byte* status)
 int TPM2_TIS_WaitForStatus(TPM2_CTX* ctx, byte status, byte status_mask)
 {
     int rc;
-    int timeout = TPM_TIMEOUT_TRIES;
     byte reg = 0;
+    TPM2_TIS_WAIT wait;
 
+    TPM2_TIS_WaitInit(&wait, TPM_TIS_TIMEOUT_B_US, TPM_TIMEOUT_TRIES);
     do {
         rc = TPM2_TIS_Status(ctx, &reg);
         if (rc == TPM_RC_SUCCESS && (reg & status) == status_mask)
             break;
-        XTPM_WAIT();
-    } while (rc == TPM_RC_SUCCESS && --timeout > 0);
+        if (rc == TPM_RC_SUCCESS)
+            rc = TPM2_TIS_WaitNext(ctx, &wait);
+    } while (rc == TPM_RC_SUCCESS);
 #ifdef WOLFTPM_DEBUG_TIMEOUT
-    printf("TIS_WaitForStatus: Timeout %d\n", TPM_TIMEOUT_TRIES - timeout);
+    printf("TIS_WaitForStatus: Timeout %d\n", wait.polls);
 #endif
-    if (timeout <= 0)
-        return TPM_RC_TIMEOUT;
     return rc;
 }
 
@@ -373,13 +518,11 @@ int TPM2_TIS_Ready(TPM2_CTX* ctx)
     return TPM2_TIS_Write(ctx, TPM_STS(ctx->locality), &status, sizeof(status));
 }
 
-int TPM2_TIS_GetBurstCount(TPM2_CTX* ctx, word16* burstCount)
+/* Read the burst count once, 0 when the FIFO is not ready */
+static int TPM2_TIS_ReadBurstCount(TPM2_CTX* ctx, word16* burstCount)
 {
     int rc = TPM_RC_SUCCESS;
 
-    if (burstCount == NULL)
-        return BAD_FUNC_ARG;
-
 #if defined(WOLFTPM_ST33) || defined(WOLFTPM_AUTODETECT)
     if (TPM2_GetVendorID() == TPM_VENDOR_STM) {
         *burstCount = 32; /* fixed value */
@@ -387,178 +530,630 @@ int TPM2_TIS_GetBurstCount(TPM2_CTX* ctx, word16* burstCount)
     else
 #endif
     {
-        int timeout = TPM_TIMEOUT_TRIES;
         *burstCount = 0;
-        do {
-            rc = TPM2_TIS_Read(ctx, TPM_BURST_COUNT(ctx->locality),
-                (byte*)burstCount, sizeof(*burstCount));
-            if (rc == TPM_RC_SUCCESS && *burstCount > 0)
-                break;
-            XTPM_WAIT();
-        } while (rc == TPM_RC_SUCCESS && --timeout > 0);
+        rc = TPM2_TIS_Read(ctx, TPM_BURST_COUNT(ctx->locality),
+            (byte*)burstCount, sizeof(*burstCount));
+        if (*burstCount > MAX_TIS_FRAMESIZE)
+            *burstCount = MAX_TIS_FRAMESIZE;
+    }
 
-    #ifdef WOLFTPM_DEBUG_TIMEOUT
-        printf("TIS_GetBurstCount: Timeout %d\n", TPM_TIMEOUT_TRIES - timeout);
-    #endif
+    return rc;
+}
+
+int TPM2_TIS_GetBurstCount(TPM2_CTX* ctx, word16* burstCount)
+{
+    int rc;
+    TPM2_TIS_WAIT wait;
+
+    if (burstCount == NULL)
+        return BAD_FUNC_ARG;
+
+    TPM2_TIS_WaitInit(&wait, TPM_TIS_TIMEOUT_D_US, TPM_TIMEOUT_TRIES);
+    do {
+        rc = TPM2_TIS_ReadBurstCount(ctx, burstCount);
+        if (rc == TPM_RC_SUCCESS && *burstCount > 0)
+            break;
+        if (rc == TPM_RC_SUCCESS)
+            rc = TPM2_TIS_WaitNext(ctx, &wait);
+    } while (rc == TPM_RC_SUCCESS);
+
+#ifdef WOLFTPM_DEBUG_TIMEOUT
+    printf("TIS_GetBurstCount: Timeout %d\n", wait.polls);
+#endif
+
+    return rc;
+}
 
-        if (*burstCount > MAX_SPI_FRAMESIZE)
-            *burstCount = MAX_SPI_FRAMESIZE;
+#ifdef WOLFTPM_TIS
+/* TIS command states, see TPM2_TIS_SendCommandStep */
+enum tpm_tis_cmd_state {
+    TIS_CMD_IDLE = 0,
+    TIS_CMD_START,        /* check the TPM is ready for a command */
+    TIS_CMD_READY,        /* wait for TPM_STS_COMMAND_READY */
+    TIS_CMD_WRITE,        /* write the next burst of the command */
+    TIS_CMD_WRITE_EXPECT, /* wait for TPM_STS_DATA_EXPECT */
+    TIS_CMD_WRITE_VALID,  /* wait for TPM_STS_VALID and no DATA_EXPECT */
+    TIS_CMD_EXECUTE,      /* set TPM_STS_GO */
+    TIS_CMD_READ,         /* wait for TPM_STS_DATA_AVAIL, read a burst */
+    TIS_CMD_DONE,
+};
+
+#ifdef WOLFTPM_TIMED_POLL
+/* Longest wait in a state: the TCG PTP timeout for the condition, or the
+ * command duration while waiting for the response */
+static word32 TPM2_TIS_StateTimeoutUs(struct wolfTPM_tisContext* tis,
+    int state)
+{
+    switch (state) {
+        case TIS_CMD_START:
+        case TIS_CMD_READY:
+            return TPM_TIS_TIMEOUT_B_US;
+        case TIS_CMD_WRITE:
+            return TPM_TIS_TIMEOUT_D_US;
+        case TIS_CMD_READ:
+            if (tis->pos == 0) {
+                return (tis->cmdTimeoutUs > 0) ? tis->cmdTimeoutUs :
+                    TPM_TIS_DURATION_US;
+            }
+            return TPM_TIS_TIMEOUT_C_US;
+        default:
+            return TPM_TIS_TIMEOUT_C_US;
+    }
+}
 
-        if (timeout <= 0)
-            return TPM_RC_TIMEOUT;
+/* Update the running average execution time of the command code */
+static void TPM2_TIS_LearnDuration(struct wolfTPM_tisContext* tis,
+    word32 us)
+{
+    int idx = (int)(tis->cc % TPM_TIS_CC_HISTORY);
+    if (tis->ccHistory[idx].cc != tis->cc || tis->ccHistory[idx].us == 0) {
+        tis->ccHistory[idx].cc = tis->cc;
+        tis->ccHistory[idx].us = us;
+    }
+    else {
+        /* weight 1/4 to the new sample */
+        tis->ccHistory[idx].us = tis->ccHistory[idx].us -
+            tis->ccHistory[idx].us / 4 + us / 4;
     }
+}
+
+static word32 TPM2_TIS_ExpectedDuration(struct wolfTPM_tisContext* tis)
+{
+    int idx = (int)(tis->cc % TPM_TIS_CC_HISTORY);
+    if (tis->ccHistory[idx].cc == tis->cc)
+        return tis->ccHistory[idx].us;
+    return 0;
+}
+#endif /* WOLFTPM_TIMED_POLL */
 
+static void TPM2_TIS_SetCmdState(struct wolfTPM_tisContext* tis, int state)
+{
+    tis->state = state;
+    tis->tries = TPM_TIMEOUT_TRIES;
+#ifdef WOLFTPM_TIMED_POLL
+    tis->nextPoll = XTPM_TIME_US();
+    tis->deadline = tis->nextPoll + TPM2_TIS_StateTimeoutUs(tis, state);
+    tis->pollUs = TPM_TIS_POLL_MIN_US;
+#endif
+}
+
+/* Nothing to do until the TPM changes state. Times out after
+ * TPM_TIMEOUT_TRIES polls in one state or, with WOLFTPM_TIMED_POLL, at the
+ * state deadline. The next poll is backed off exponentially. */
+static int TPM2_TIS_CmdYield(struct wolfTPM_tisContext* tis)
+{
+#ifdef WOLFTPM_TIMED_POLL
+    UINT64 now = XTPM_TIME_US();
+#endif
+
+    tis->stats.polls++;
+    TPM2_TIS_PROFILE_POLL(tis);
+#ifdef WOLFTPM_TIMED_POLL
+    if (--tis->tries > 0 && now < tis->deadline) {
+        tis->nextPoll = now + tis->pollUs;
+        tis->pollUs *= 2;
+        if (tis->pollUs > TPM_TIS_POLL_MAX_US)
+            tis->pollUs = TPM_TIS_POLL_MAX_US;
+        return TPM_RC_YIELDED;
+    }
+#else
+    if (--tis->tries > 0)
+        return TPM_RC_YIELDED;
+#endif
+#ifdef WOLFTPM_DEBUG_TIMEOUT
+    printf("TIS_SendCommand: Timeout in state %d\n", tis->state);
+#endif
+    return TPM_RC_TIMEOUT;
+}
+
+/* Read status and burst count with one 4-byte access of the STS register */
+static int TPM2_TIS_StatusBurst(TPM2_CTX* ctx, byte* status,
+    word16* burstCount)
+{
+    int rc;
+    byte reg[4];
+
+    rc = TPM2_TIS_Read(ctx, TPM_STS(ctx->locality), reg, sizeof(reg));
+    if (rc == TPM_RC_SUCCESS) {
+        *status = reg[0];
+    #if defined(WOLFTPM_ST33) || defined(WOLFTPM_AUTODETECT)
+        if (TPM2_GetVendorID() == TPM_VENDOR_STM) {
+            *burstCount = 32; /* fixed value */
+        }
+        else
+    #endif
+        {
+            *burstCount = (word16)(reg[1] | (reg[2] << 8));
+        }
+    }
     return rc;
 }
 
-int TPM2_TIS_SendCommand(TPM2_CTX* ctx, TPM2_Packet* packet)
+int TPM2_TIS_SendCommandStart(TPM2_CTX* ctx, byte* buf, int cmdSz,
+    int bufSz)
 {
     int rc;
-    int xferSz, pos, rspSz;
-    byte access, status = 0;
-    word16 burstCount;
+    struct wolfTPM_tisContext* tis;
 
-    rc = TPM2_TIS_LOCK();
+    if (ctx == NULL || buf == NULL || cmdSz <= 0 || bufSz < cmdSz)
+        return BAD_FUNC_ARG;
+    tis = &ctx->tisCtx;
+    if (tis->state != TIS_CMD_IDLE)
+        return TPM_RC_RETRY;
+
+    rc = TPM2_TIS_LOCK(ctx);
     if (rc != 0)
         return rc;
 
 #ifdef WOLFTPM_DEBUG_VERBOSE
-    printf("Command: %d\n", packet->pos);
-    TPM2_PrintBin(packet->buf, packet->pos);
+    printf("Command: %d\n", cmdSz);
+    TPM2_PrintBin(buf, cmdSz);
 #endif
 
-    /* Make sure TPM is ready for command */
-    rc = TPM2_TIS_Status(ctx, &status);
-    if (rc != TPM_RC_SUCCESS)
-        goto exit;
-    if ((status & TPM_STS_COMMAND_READY) == 0) {
-        /* Tell TPM chip to expect a command */
-        rc = TPM2_TIS_Ready(ctx);
-        if (rc != TPM_RC_SUCCESS)
-            goto exit;
-
-        /* Wait for command ready (TPM_STS_COMMAND_READY = 1) */
-        rc = TPM2_TIS_WaitForStatus(ctx, TPM_STS_COMMAND_READY,
-                                         TPM_STS_COMMAND_READY);
-        if (rc != TPM_RC_SUCCESS)
-            goto exit;
+    tis->buf = buf;
+    tis->cmdSz = cmdSz;
+    tis->bufSz = bufSz;
+    tis->pos = 0;
+    tis->rspSz = 0;
+    tis->burstCount = 0;
+    tis->cmdStartAccesses = tis->stats.regReads + tis->stats.regWrites +
+        tis->stats.fifoReads + tis->stats.fifoWrites;
+    tis->cmdStartPolls = tis->stats.polls;
+#if defined(WOLFTPM_TIMED_POLL) || defined(WOLFTPM_TIS_PROFILE)
+    tis->cc = 0;
+    if (cmdSz >= TPM2_HEADER_SIZE) {
+        UINT32 cc;
+        XMEMCPY(&cc, &buf[6], sizeof(UINT32));
+        tis->cc = TPM2_Packet_SwapU32(cc);
     }
+#endif
+#ifdef WOLFTPM_TIS_PROFILE
+    if (tis->profile != NULL)
+        tis->profileCmd = TPM2_TIS_ProfileEntry(tis->profile, tis->cc);
+#endif
+    TPM2_TIS_SetCmdState(tis, TIS_CMD_START);
 
-    /* Write Command */
-    pos = 0;
-    while (pos < packet->pos) {
-        rc = TPM2_TIS_GetBurstCount(ctx, &burstCount);
-        if (rc < 0)
-            goto exit;
+    return TPM_RC_SUCCESS;
+}
 
-        xferSz = packet->pos - pos;
-        if (xferSz > burstCount)
-            xferSz = burstCount;
+/* Advance the command until it has to wait on the TPM. Returns
+ * TPM_RC_YIELDED while in progress, then the result of the exchange.
+ *
+ * Status polls read the burst count in the same access. The burst count is
+ * the number of FIFO bytes the TPM accepts or provides without wait states,
+ * so while any is left the next transfer goes ahead without polling. */
+int TPM2_TIS_SendCommandStep(TPM2_CTX* ctx)
+{
+    int rc = TPM_RC_SUCCESS;
+    int xferSz;
+    byte status = 0;
+    struct wolfTPM_tisContext* tis;
+#ifdef WOLFTPM_TIMED_POLL
+    word32 expectUs;
+#endif
 
-        rc = TPM2_TIS_Write(ctx, TPM_DATA_FIFO(ctx->locality), &packet->buf[pos],
-                               xferSz);
-        if (rc != TPM_RC_SUCCESS)
-            goto exit;
-        pos += xferSz;
+    if (ctx == NULL)
+        return BAD_FUNC_ARG;
+    tis = &ctx->tisCtx;
+    if (tis->state == TIS_CMD_IDLE)
+        return BAD_FUNC_ARG;
 
-        if (pos < packet->pos) {
+    while (rc == TPM_RC_SUCCESS && tis->state != TIS_CMD_DONE) {
+    #ifdef WOLFTPM_TIMED_POLL
+        /* backing off, don't poll the TPM yet */
+        if (XTPM_TIME_US() < tis->nextPoll) {
+            rc = TPM_RC_YIELDED;
+            break;
+        }
+    #endif
+        switch (tis->state) {
+        case TIS_CMD_START:
+        case TIS_CMD_READY:
+            /* Make sure TPM is ready for command */
+            rc = TPM2_TIS_StatusBurst(ctx, &status, &tis->burstCount);
+            if (rc != TPM_RC_SUCCESS)
+                break;
+            if (status & TPM_STS_COMMAND_READY) {
+                TPM2_TIS_SetCmdState(tis, TIS_CMD_WRITE);
+            }
+            else if (tis->state == TIS_CMD_START) {
+                /* Tell TPM chip to expect a command */
+                rc = TPM2_TIS_Ready(ctx);
+                TPM2_TIS_SetCmdState(tis, TIS_CMD_READY);
+            }
+            else {
+                rc = TPM2_TIS_CmdYield(tis);
+            }
+            break;
+
+        case TIS_CMD_WRITE:
+            if (tis->burstCount == 0) {
+                rc = TPM2_TIS_StatusBurst(ctx, &status, &tis->burstCount);
+                if (rc != TPM_RC_SUCCESS)
+                    break;
+                if (tis->burstCount == 0) {
+                    rc = TPM2_TIS_CmdYield(tis);
+                    break;
+                }
+            }
+
+            xferSz = tis->cmdSz - tis->pos;
+            if (xferSz > tis->burstCount)
+                xferSz = tis->burstCount;
+            if (xferSz > MAX_TIS_FRAMESIZE)
+                xferSz = MAX_TIS_FRAMESIZE;
+
+            rc = TPM2_TIS_Write(ctx, TPM_DATA_FIFO(ctx->locality),
+                &tis->buf[tis->pos], xferSz);
+            if (rc != TPM_RC_SUCCESS)
+                break;
+            tis->pos += xferSz;
+            tis->burstCount -= xferSz;
+
+            if (tis->pos < tis->cmdSz) {
+                /* burst used up, wait for TPM_STS_DATA_EXPECT */
+                if (tis->burstCount == 0)
+                    TPM2_TIS_SetCmdState(tis, TIS_CMD_WRITE_EXPECT);
+            }
+        #if defined(WOLFTPM_ST33) || defined(WOLFTPM_AUTODETECT)
+            else if (TPM2_GetVendorID() == TPM_VENDOR_STM) {
+                TPM2_TIS_SetCmdState(tis, TIS_CMD_EXECUTE);
+            }
+        #endif
+            else {
+                TPM2_TIS_SetCmdState(tis, TIS_CMD_WRITE_VALID);
+            }
+            break;
+
+        case TIS_CMD_WRITE_EXPECT:
             /* Wait for expect more data (TPM_STS_DATA_EXPECT = 1) */
-            rc = TPM2_TIS_WaitForStatus(ctx, TPM_STS_DATA_EXPECT,
-                                             TPM_STS_DATA_EXPECT);
-            if (rc != TPM_RC_SUCCESS) {
+            rc = TPM2_TIS_StatusBurst(ctx, &status, &tis->burstCount);
+            if (rc != TPM_RC_SUCCESS)
+                break;
+            if (status & TPM_STS_DATA_EXPECT) {
+                TPM2_TIS_SetCmdState(tis, TIS_CMD_WRITE);
+            }
+            else {
+                rc = TPM2_TIS_CmdYield(tis);
             #ifdef DEBUG_WOLFTPM
-                printf("TPM2_TIS_SendCommand write expected more data!\n");
+                if (rc == TPM_RC_TIMEOUT)
+                    printf("TPM2_TIS_SendCommand write expected more data!\n");
             #endif
-                goto exit;
             }
-        }
-    }
+            break;
 
-#if defined(WOLFTPM_ST33) || defined(WOLFTPM_AUTODETECT)
-    if (TPM2_GetVendorID() != TPM_VENDOR_STM)
-#endif
-    {
-        /* Wait for TPM_STS_DATA_EXPECT = 0 and TPM_STS_VALID = 1 */
-        rc = TPM2_TIS_WaitForStatus(ctx, TPM_STS_DATA_EXPECT | TPM_STS_VALID,
-                                        TPM_STS_VALID);
-        if (rc != TPM_RC_SUCCESS) {
-        #ifdef DEBUG_WOLFTPM
-            printf("TPM2_TIS_SendCommand status valid timeout!\n");
-        #endif
-            goto exit;
-        }
-    }
+        case TIS_CMD_WRITE_VALID:
+            /* Wait for TPM_STS_DATA_EXPECT = 0 and TPM_STS_VALID = 1 */
+            rc = TPM2_TIS_Status(ctx, &status);
+            if (rc != TPM_RC_SUCCESS)
+                break;
+            if ((status & (TPM_STS_DATA_EXPECT | TPM_STS_VALID)) ==
+                    TPM_STS_VALID) {
+                TPM2_TIS_SetCmdState(tis, TIS_CMD_EXECUTE);
+            }
+            else {
+                rc = TPM2_TIS_CmdYield(tis);
+            #ifdef DEBUG_WOLFTPM
+                if (rc == TPM_RC_TIMEOUT)
+                    printf("TPM2_TIS_SendCommand status valid timeout!\n");
+            #endif
+            }
+            break;
 
-    /* Execute Command */
-    access = TPM_STS_GO;
-    rc = TPM2_TIS_Write(ctx, TPM_STS(ctx->locality), &access,
-                           sizeof(access));
-    if (rc != TPM_RC_SUCCESS)
-        goto exit;
-
-    /* Read response */
-    pos = 0;
-    rspSz = TPM2_HEADER_SIZE; /* Read at least TPM header */
-    while (pos < rspSz) {
-        /* Wait for data to be available (TPM_STS_DATA_AVAIL = 1) */
-        rc = TPM2_TIS_WaitForStatus(ctx, TPM_STS_DATA_AVAIL,
-                                         TPM_STS_DATA_AVAIL);
-        if (rc != TPM_RC_SUCCESS) {
-        #ifdef DEBUG_WOLFTPM
-            printf("TPM2_TIS_SendCommand read no data available!\n");
+        case TIS_CMD_EXECUTE:
+            status = TPM_STS_GO;
+            rc = TPM2_TIS_Write(ctx, TPM_STS(ctx->locality), &status,
+                sizeof(status));
+            tis->pos = 0;
+            tis->rspSz = TPM2_HEADER_SIZE; /* Read at least TPM header */
+            tis->burstCount = 0;
+            TPM2_TIS_SetCmdState(tis, TIS_CMD_READ);
+        #ifdef WOLFTPM_TIMED_POLL
+            /* first poll shortly before the usual completion time */
+            tis->goTime = tis->nextPoll;
+            tis->goPolls = tis->stats.polls;
+            expectUs = TPM2_TIS_ExpectedDuration(tis);
+            tis->nextPoll += expectUs - expectUs / 8;
         #endif
-            goto exit;
-        }
-
-        rc = TPM2_TIS_GetBurstCount(ctx, &burstCount);
-        if (rc < 0)
-            goto exit;
+            break;
 
-        xferSz = rspSz - pos;
-        if (xferSz > burstCount)
-            xferSz = burstCount;
+        case TIS_CMD_READ:
+            if (tis->burstCount == 0) {
+                /* Wait for data to be available (TPM_STS_DATA_AVAIL = 1) */
+                rc = TPM2_TIS_StatusBurst(ctx, &status, &tis->burstCount);
+                if (rc != TPM_RC_SUCCESS)
+                    break;
+                if ((status & TPM_STS_DATA_AVAIL) == 0 ||
+                        tis->burstCount == 0) {
+                    tis->burstCount = 0;
+                    rc = TPM2_TIS_CmdYield(tis);
+                #ifdef DEBUG_WOLFTPM
+                    if (rc == TPM_RC_TIMEOUT)
+                        printf("TPM2_TIS_SendCommand read no data available!\n");
+                #endif
+                    break;
+                }
+            #ifdef WOLFTPM_TIMED_POLL
+                if (tis->pos == 0) {
+                    word32 us = (word32)(XTPM_TIME_US() - tis->goTime);
+                    /* ready at the first poll, the estimate may be high */
+                    if (tis->stats.polls == tis->goPolls)
+                        us /= 2;
+                    TPM2_TIS_LearnDuration(tis, us);
+                }
+            #endif
+            }
 
-        rc = TPM2_TIS_Read(ctx, TPM_DATA_FIFO(ctx->locality), &packet->buf[pos],
-                              xferSz);
-        if (rc != TPM_RC_SUCCESS)
-            goto exit;
+            xferSz = tis->rspSz - tis->pos;
+            if (xferSz > tis->burstCount)
+                xferSz = tis->burstCount;
+            if (xferSz > MAX_TIS_FRAMESIZE)
+                xferSz = MAX_TIS_FRAMESIZE;
 
-        pos += xferSz;
+            rc = TPM2_TIS_Read(ctx, TPM_DATA_FIFO(ctx->locality),
+                &tis->buf[tis->pos], xferSz);
+            if (rc != TPM_RC_SUCCESS)
+                break;
+            tis->pos += xferSz;
+            tis->burstCount -= xferSz;
+
+            /* Get real response size */
+            if (tis->pos == TPM2_HEADER_SIZE) {
+                /* Extract size from header */
+                UINT32 tmpSz;
+                XMEMCPY(&tmpSz, &tis->buf[2], sizeof(UINT32));
+                tis->rspSz = (int)TPM2_Packet_SwapU32(tmpSz);
+
+                /* safety check for stuck FFFF case */
+                if (tis->rspSz < TPM2_HEADER_SIZE ||
+                        tis->rspSz >= MAX_RESPONSE_SIZE ||
+                        tis->rspSz > tis->bufSz) {
+                    rc = TPM_RC_FAILURE;
+                    break;
+                }
+            }
 
-        /* Get real response size */
-        if (pos == TPM2_HEADER_SIZE) {
-            /* Extract size from header */
-            UINT32 tmpSz;
-            XMEMCPY(&tmpSz, &packet->buf[2], sizeof(UINT32));
-            rspSz = TPM2_Packet_SwapU32(tmpSz);
+            if (tis->pos >= tis->rspSz)
+                tis->state = TIS_CMD_DONE;
+            else
+                TPM2_TIS_SetCmdState(tis, TIS_CMD_READ);
+            break;
 
-            /* safety check for stuck FFFF case */
-            if (rspSz < 0 || rspSz >= MAX_RESPONSE_SIZE || rspSz > packet->size) {
-                rc = TPM_RC_FAILURE;
-                goto exit;
-            }
+        default:
+            rc = TPM_RC_FAILURE;
+            break;
         }
     }
 
+    if (rc == TPM_RC_YIELDED)
+        return rc;
+
 #ifdef WOLFTPM_DEBUG_VERBOSE
-    if (rspSz > 0) {
-        printf("Response: %d\n", rspSz);
-        TPM2_PrintBin(packet->buf, rspSz);
+    if (rc == TPM_RC_SUCCESS) {
+        printf("Response: %d\n", tis->rspSz);
+        TPM2_PrintBin(tis->buf, tis->rspSz);
     }
 #endif
 
-    rc = TPM_RC_SUCCESS;
-
-exit:
-
     /* Tell TPM we are done */
     if (rc == TPM_RC_SUCCESS)
         rc = TPM2_TIS_Ready(ctx);
 
-    TPM2_TIS_UNLOCK();
+    tis->stats.commands++;
+    tis->stats.lastCmdAccesses = tis->stats.regReads + tis->stats.regWrites +
+        tis->stats.fifoReads + tis->stats.fifoWrites - tis->cmdStartAccesses;
+    tis->stats.lastCmdPolls = tis->stats.polls - tis->cmdStartPolls;
+#ifdef WOLFTPM_TIS_PROFILE
+    TPM2_TIS_ProfileDone(tis);
+#endif
+
+    tis->state = TIS_CMD_IDLE;
+    TPM2_TIS_UNLOCK(ctx);
 
     return rc;
 }
+
+/* Abandon a started command. Setting command ready aborts it on the TPM */
+int TPM2_TIS_SendCommandAbort(TPM2_CTX* ctx)
+{
+    int rc = TPM_RC_SUCCESS;
+
+    if (ctx == NULL)
+        return BAD_FUNC_ARG;
+
+    if (ctx->tisCtx.state != TIS_CMD_IDLE) {
+        rc = TPM2_TIS_Ready(ctx);
+    #ifdef WOLFTPM_TIS_PROFILE
+        TPM2_TIS_ProfileDone(&ctx->tisCtx);
+    #endif
+        ctx->tisCtx.state = TIS_CMD_IDLE;
+        TPM2_TIS_UNLOCK(ctx);
+    }
+    return rc;
+}
+
+void TPM2_TIS_Cleanup(TPM2_CTX* ctx)
+{
+    if (ctx == NULL)
+        return;
+#ifdef TPM2_TIS_LOCK_CLEANUP
+    TPM2_TIS_LOCK_CLEANUP(ctx);
+#endif
+}
+
+int TPM2_TIS_GetStats(TPM2_CTX* ctx, TPM2_TIS_STATS* stats)
+{
+    if (ctx == NULL || stats == NULL)
+        return BAD_FUNC_ARG;
+    XMEMCPY(stats, &ctx->tisCtx.stats, sizeof(TPM2_TIS_STATS));
+    return TPM_RC_SUCCESS;
+}
+
+int TPM2_TIS_ResetStats(TPM2_CTX* ctx)
+{
+    if (ctx == NULL)
+        return BAD_FUNC_ARG;
+    XMEMSET(&ctx->tisCtx.stats, 0, sizeof(TPM2_TIS_STATS));
+    ctx->tisCtx.cmdStartAccesses = 0;
+    ctx->tisCtx.cmdStartPolls = 0;
+    return TPM_RC_SUCCESS;
+}
+
+#ifdef WOLFTPM_TIS_PROFILE
+int TPM2_TIS_SetProfile(TPM2_CTX* ctx, TPM2_TIS_PROFILE* profile)
+{
+    if (ctx == NULL)
+        return BAD_FUNC_ARG;
+    if (ctx->tisCtx.state != TIS_CMD_IDLE)
+        return TPM_RC_RETRY;
+
+    if (profile != NULL)
+        XMEMSET(profile, 0, sizeof(TPM2_TIS_PROFILE));
+    ctx->tisCtx.profile = profile;
+    ctx->tisCtx.profileCmd = (profile != NULL) ? &profile->cmd[0] : NULL;
+    return TPM_RC_SUCCESS;
+}
+
+const TPM2_TIS_PROFILE_CC* TPM2_TIS_GetProfile(
+    const TPM2_TIS_PROFILE* profile, UINT32 cc)
+{
+    int i;
+
+    if (profile == NULL)
+        return NULL;
+    for (i = 0; i < TPM2_TIS_PROFILE_MAX_CC; i++) {
+        if (profile->cmd[i].cc == cc && (i == 0 || cc != 0))
+            return &profile->cmd[i];
+    }
+    return NULL;
+}
+
+void TPM2_TIS_ProfileWaitStates(TPM2_CTX* ctx, word32 count)
+{
+    if (ctx != NULL && ctx->tisCtx.profileCmd != NULL) {
+        ctx->tisCtx.profileCmd->waitStates += count;
+        ctx->tisCtx.profileCmd->bytes += count;
+    }
+}
+#endif /* WOLFTPM_TIS_PROFILE */
+
+#ifdef WOLFTPM_TIMED_POLL
+int TPM2_TIS_SetCommandTimeout(TPM2_CTX* ctx, word32 timeoutUs)
+{
+    if (ctx == NULL)
+        return BAD_FUNC_ARG;
+    ctx->tisCtx.cmdTimeoutUs = timeoutUs;
+    return TPM_RC_SUCCESS;
+}
+
+word32 TPM2_TIS_PollDelayUs(TPM2_CTX* ctx)
+{
+    UINT64 now = XTPM_TIME_US();
+    if (ctx->tisCtx.state == TIS_CMD_IDLE || ctx->tisCtx.nextPoll <= now)
+        return 0;
+    return (word32)(ctx->tisCtx.nextPoll - now);
+}
+#endif
+
+int TPM2_TIS_SendCommand(TPM2_CTX* ctx, TPM2_Packet* packet)
+{
+    int rc;
+
+    rc = TPM2_TIS_SendCommandStart(ctx, packet->buf, packet->pos,
+        packet->size);
+    if (rc == TPM_RC_SUCCESS) {
+        while ((rc = TPM2_TIS_SendCommandStep(ctx)) == TPM_RC_YIELDED) {
+        #ifdef WOLFTPM_TIMED_POLL
+            word32 delayUs = TPM2_TIS_PollDelayUs(ctx);
+            if (delayUs > 0)
+                XTPM_SLEEP_US(delayUs);
+        #else
+            XTPM_WAIT();
+        #endif
+        }
+    }
+
+    return rc;
+}
+
+static int TPM2_TIS_TransportSend(TPM2_CTX* ctx, byte* buf, int cmdSz,
+    int bufSz, void* transportCtx)
+{
+    TPM2_Packet packet;
+
+    packet.buf = buf;
+    packet.pos = cmdSz;
+    packet.size = bufSz;
+    (void)transportCtx;
+    return TPM2_TIS_SendCommand(ctx, &packet);
+}
+
+static int TPM2_TIS_AsyncSend(TPM2_CTX* ctx, TPM2_ASYNC* req,
+    void* transportCtx)
+{
+    (void)transportCtx;
+    return TPM2_TIS_SendCommandStart(ctx, req->buf, req->cmdSz, req->bufSz);
+}
+
+static int TPM2_TIS_AsyncRecv(TPM2_CTX* ctx, TPM2_ASYNC* req,
+    void* transportCtx)
+{
+    (void)transportCtx;
+    (void)req;
+    return TPM2_TIS_SendCommandStep(ctx);
+}
+
+static int TPM2_TIS_AsyncCancel(TPM2_CTX* ctx, TPM2_ASYNC* req,
+    void* transportCtx)
+{
+    (void)transportCtx;
+    (void)req;
+    return TPM2_TIS_SendCommandAbort(ctx);
+}
+
+static void TPM2_TIS_TransportCleanup(TPM2_CTX* ctx, void* transportCtx)
+{
+    (void)transportCtx;
+    TPM2_TIS_Cleanup(ctx);
+}
+
+/* A pending TIS command owns the bus until it completes */
+static const TPM2_TRANSPORT gTisTransport = {
+    "tis",
+    TPM2_TRANSPORT_FLAG_SHARED_BUS,
+    TPM2_TIS_TransportSend,
+    TPM2_TIS_AsyncSend,
+    TPM2_TIS_AsyncRecv,
+    TPM2_TIS_AsyncCancel,
+    TPM2_TIS_TransportCleanup
+};
+
+const TPM2_TRANSPORT* TPM2_TIS_GetTransport(void)
+{
+    return &gTisTransport;
+}
+#endif /* WOLFTPM_TIS */
+
 /******************************************************************************/
 /* --- END TPM Interface Layer -- */
 /******************************************************************************/
@@ -0,0 +1,565 @@
+/* tpm2_tis_sim.c
+ *
+ * Copyright (C) 2006-2020 wolfSSL Inc.
+ *
+ * This file is part of wolfTPM.
+ *
+ * wolfTPM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfTPM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+
+
+/**
+ * Register level TIS simulator. This is a HAL IO callback that emulates the
+ * TIS register map (ACCESS, STS, BURST_COUNT, DATA_FIFO, DID_VID) so the
+ * SPI / I2C TIS layer in tpm2_tis.c can be exercised and benchmarked without
+ * hardware. Commands are executed by a TPM simulator using the same TCP
+ * protocol as tpm2_swtpm.c, or by the execute callback set in TPM2_TIS_SIM.
+ *
+ * Build with --enable-tissim and see docs/SWTPM.md to run a simulator
+ */
+
+#ifdef WOLFTPM_TIS_SIM
+#include <wolftpm/tpm2.h>
+#include <wolftpm/tpm2_tis.h>
+#include <wolftpm/tpm2_tis_sim.h>
+#include <wolftpm/tpm2_swtpm.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <wolftpm/tpm2_socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#ifdef MSG_NOSIGNAL
+    #define TIS_SIM_SEND_FLAGS MSG_NOSIGNAL
+#else
+    #define TIS_SIM_SEND_FLAGS 0
+#endif
+
+/* TIS states (TCG PC Client Platform TPM Profile, 5.6.3) */
+enum tis_sim_state {
+    TIS_SIM_IDLE,
+    TIS_SIM_READY,
+    TIS_SIM_RECEPTION,
+    TIS_SIM_EXECUTION,
+    TIS_SIM_COMPLETION,
+};
+
+#define TIS_SIM_NO_LOCALITY 0xFF
+#define TIS_SIM_INTF_CAPS   0x30000697
+#define TIS_SIM_DID_VID     0x00011014 /* IBM vendor ID, software TPM */
+#define TIS_SIM_RID         0x01
+
+/* register offset within a locality */
+#define TIS_SIM_REG(a)      ((a) & 0xFFFu)
+
+
+/* big endian, as on the simulator socket and in the command header. Library
+ * internal helpers are not used so the tests can build this file. */
+static UINT32 TisSimGetU32(const byte* b)
+{
+    return ((UINT32)b[0] << 24) | ((UINT32)b[1] << 16) |
+           ((UINT32)b[2] << 8) | b[3];
+}
+
+static void TisSimPutU32(byte* b, UINT32 v)
+{
+    b[0] = (byte)(v >> 24); b[1] = (byte)(v >> 16);
+    b[2] = (byte)(v >> 8);  b[3] = (byte)v;
+}
+
+static UINT64 TisSimNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (UINT64)now.tv_sec * 1000000000ULL + (UINT64)now.tv_nsec;
+}
+
+/* Spin until the modeled time for this transaction has passed. Sleeping
+ * is far too coarse for sub-microsecond bus timings. */
+static void TisSimBusDelay(TPM2_TIS_SIM* sim, UINT64 start, int size)
+{
+    UINT64 cost;
+#ifdef WOLFTPM_I2C
+    int hdrSz = 1; /* register address */
+#else
+    int hdrSz = TPM_TIS_HEADER_SZ;
+#endif
+
+    cost = sim->accessNs +
+        (UINT64)(hdrSz + sim->waitStates + size) * sim->byteNs;
+    sim->transactions++;
+    sim->busNs += cost;
+    if (cost > 0) {
+        while (TisSimNow() - start < cost) {
+            /* busy wait */
+        }
+    }
+}
+
+/******************************************************************************/
+/* --- TPM simulator connection -- */
+/******************************************************************************/
+
+static int TisSimConnect(TPM2_TIS_SIM* sim)
+{
+    int rc = SOCKET_ERROR_E;
+    struct addrinfo hints;
+    struct addrinfo *result, *rp;
+    int fd = -1;
+    int on = 1;
+
+    XMEMSET(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(sim->host, sim->port, &hints, &result) != 0) {
+    #ifdef DEBUG_WOLFTPM
+        printf("TIS Sim: Unable to resolve %s\n", sim->host);
+    #endif
+        return rc;
+    }
+
+    for (rp = result; rp != NULL; rp = rp->ai_next) {
+        fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (fd == -1)
+            continue;
+
+        if (connect(fd, rp->ai_addr, rp->ai_addrlen) == -1) {
+            close(fd);
+        }
+        else {
+            (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            break;
+        }
+    }
+    freeaddrinfo(result);
+
+    if (rp != NULL) {
+        sim->fd = fd;
+        rc = TPM_RC_SUCCESS;
+    }
+#ifdef DEBUG_WOLFTPM
+    else {
+        printf("TIS Sim: Failed to connect to %s %s\n", sim->host, sim->port);
+    }
+#endif
+
+    return rc;
+}
+
+static int TisSimSend(TPM2_TIS_SIM* sim, const byte* buf, int sz)
+{
+    ssize_t wrc;
+
+    while (sz > 0) {
+        wrc = send(sim->fd, buf, sz, TIS_SIM_SEND_FLAGS);
+        if (wrc < 0 && errno == EINTR)
+            continue;
+        if (wrc <= 0)
+            return SOCKET_ERROR_E;
+        buf += wrc;
+        sz -= (int)wrc;
+    }
+    return TPM_RC_SUCCESS;
+}
+
+static int TisSimRecv(TPM2_TIS_SIM* sim, byte* buf, int sz)
+{
+    ssize_t rrc;
+
+    while (sz > 0) {
+        rrc = recv(sim->fd, buf, sz, 0);
+        if (rrc < 0 && errno == EINTR)
+            continue;
+        if (rrc <= 0)
+            return SOCKET_ERROR_E;
+        buf += rrc;
+        sz -= (int)rrc;
+    }
+    return TPM_RC_SUCCESS;
+}
+
+static void TisSimDisconnect(TPM2_TIS_SIM* sim)
+{
+    if (sim->fd >= 0) {
+        CloseSocket(sim->fd);
+        sim->fd = -1;
+    }
+}
+
+/* Run the received command on the TPM simulator */
+static int TisSimExchange(TPM2_TIS_SIM* sim)
+{
+    int rc;
+    byte hdr[sizeof(UINT32) + sizeof(BYTE) + sizeof(UINT32)];
+    byte tss_word[sizeof(UINT32)];
+    int rspSz;
+
+    /* TPM_SEND_COMMAND, locality, size, command */
+    TisSimPutU32(hdr, TPM_SEND_COMMAND);
+    hdr[sizeof(UINT32)] = sim->locality;
+    TisSimPutU32(&hdr[sizeof(UINT32) + sizeof(BYTE)], (UINT32)sim->cmdSz);
+
+    rc = TisSimSend(sim, hdr, sizeof(hdr));
+    if (rc == TPM_RC_SUCCESS)
+        rc = TisSimSend(sim, sim->cmd, sim->cmdSz);
+
+    /* response size, response, then trailing acknowledgement */
+    if (rc == TPM_RC_SUCCESS)
+        rc = TisSimRecv(sim, tss_word, sizeof(tss_word));
+    if (rc == TPM_RC_SUCCESS) {
+        rspSz = (int)TisSimGetU32(tss_word);
+        if (rspSz < TPM2_HEADER_SIZE || rspSz > (int)sizeof(sim->rsp))
+            rc = TPM_RC_FAILURE;
+    }
+    if (rc == TPM_RC_SUCCESS)
+        rc = TisSimRecv(sim, sim->rsp, rspSz);
+    if (rc == TPM_RC_SUCCESS)
+        rc = TisSimRecv(sim, tss_word, sizeof(tss_word));
+    if (rc == TPM_RC_SUCCESS)
+        sim->rspSz = rspSz;
+
+    return rc;
+}
+
+static int TisSimExecute(TPM2_TIS_SIM* sim)
+{
+    int rc = TPM_RC_SUCCESS;
+    int reused = (sim->fd >= 0);
+
+    if (!reused)
+        rc = TisSimConnect(sim);
+    if (rc == TPM_RC_SUCCESS) {
+        rc = TisSimExchange(sim);
+        if (rc == SOCKET_ERROR_E && reused) {
+            /* the simulator may have closed an idle connection */
+            TisSimDisconnect(sim);
+            rc = TisSimConnect(sim);
+            if (rc == TPM_RC_SUCCESS)
+                rc = TisSimExchange(sim);
+        }
+    }
+    if (rc != TPM_RC_SUCCESS) {
+        TisSimDisconnect(sim);
+    #ifdef DEBUG_WOLFTPM
+        printf("TIS Sim: Command exchange failed %d\n", rc);
+    #endif
+    }
+    return rc;
+}
+
+/******************************************************************************/
+/* --- TIS registers -- */
+/******************************************************************************/
+
+static int TisSimCmdExpected(TPM2_TIS_SIM* sim)
+{
+    if (sim->cmdSz < TPM2_HEADER_SIZE)
+        return TPM2_HEADER_SIZE;
+    return (int)TisSimGetU32(&sim->cmd[2]);
+}
+
+static byte TisSimStatus(TPM2_TIS_SIM* sim)
+{
+    byte sts = TPM_STS_VALID;
+
+    switch (sim->state) {
+        case TIS_SIM_READY:
+            sts |= TPM_STS_COMMAND_READY;
+            break;
+        case TIS_SIM_RECEPTION:
+            if (sim->cmdSz < TisSimCmdExpected(sim))
+                sts |= TPM_STS_DATA_EXPECT;
+            break;
+        case TIS_SIM_EXECUTION:
+            if (sim->execLeft > 0) {
+                sim->execLeft--;
+            }
+            else if (TisSimNow() >= sim->readyNs) {
+                sim->state = TIS_SIM_COMPLETION;
+                sts |= TPM_STS_DATA_AVAIL;
+            }
+            break;
+        case TIS_SIM_COMPLETION:
+            if (sim->rspPos < sim->rspSz)
+                sts |= TPM_STS_DATA_AVAIL;
+            break;
+        default:
+            break;
+    }
+    return sts;
+}
+
+static word16 TisSimBurst(TPM2_TIS_SIM* sim)
+{
+    int avail;
+
+    sim->burstReads++;
+    if (sim->stallEvery > 0 && (sim->burstReads % sim->stallEvery) == 0)
+        return 0; /* FIFO stalled */
+
+    switch (sim->state) {
+        case TIS_SIM_READY:
+        case TIS_SIM_RECEPTION:
+            avail = (int)sizeof(sim->cmd) - sim->cmdSz;
+            break;
+        case TIS_SIM_COMPLETION:
+            avail = sim->rspSz - sim->rspPos;
+            break;
+        default:
+            avail = 0;
+            break;
+    }
+    return (word16)((avail < sim->burstCount) ? avail : sim->burstCount);
+}
+
+static void TisSimRead(TPM2_TIS_SIM* sim, word32 addr, byte* buf, int len)
+{
+    byte loc = (byte)((addr >> 12) & 0xF);
+    word32 val = 0;
+    word16 burst;
+    int i;
+
+    XMEMSET(buf, 0, len);
+    switch (TIS_SIM_REG(addr)) {
+        case TIS_SIM_REG(TPM_ACCESS(0)):
+            buf[0] = TPM_ACCESS_VALID;
+            if (sim->locality == loc)
+                buf[0] |= TPM_ACCESS_ACTIVE_LOCALITY;
+            break;
+        case TIS_SIM_REG(TPM_INTF_CAPS(0)):
+            val = TIS_SIM_INTF_CAPS;
+            break;
+        case TIS_SIM_REG(TPM_DID_VID(0)):
+            val = TIS_SIM_DID_VID;
+            break;
+        case TIS_SIM_REG(TPM_RID(0)):
+            val = TIS_SIM_RID;
+            break;
+        case TIS_SIM_REG(TPM_STS(0)):
+            buf[0] = TisSimStatus(sim);
+            if (len >= 3) {
+                burst = TisSimBurst(sim);
+                buf[1] = (byte)burst;
+                buf[2] = (byte)(burst >> 8);
+            }
+            break;
+        case TIS_SIM_REG(TPM_BURST_COUNT(0)):
+            burst = TisSimBurst(sim);
+            buf[0] = (byte)burst;
+            if (len > 1)
+                buf[1] = (byte)(burst >> 8);
+            break;
+        case TIS_SIM_REG(TPM_DATA_FIFO(0)):
+            if (sim->state == TIS_SIM_EXECUTION)
+                (void)TisSimStatus(sim);
+            if (sim->state != TIS_SIM_COMPLETION)
+                break;
+            for (i = 0; i < len && sim->rspPos < sim->rspSz; i++)
+                buf[i] = sim->rsp[sim->rspPos++];
+            break;
+        default:
+            break;
+    }
+    if (val != 0) {
+        /* registers are little endian */
+        for (i = 0; i < len && i < (int)sizeof(val); i++)
+            buf[i] = (byte)(val >> (8 * i));
+    }
+}
+
+static int TisSimWrite(TPM2_TIS_SIM* sim, word32 addr, const byte* buf,
+    int len)
+{
+    int rc = TPM_RC_SUCCESS;
+    byte loc = (byte)((addr >> 12) & 0xF);
+    UINT64 goNs;
+    int i;
+
+    switch (TIS_SIM_REG(addr)) {
+        case TIS_SIM_REG(TPM_ACCESS(0)):
+            if (buf[0] & TPM_ACCESS_REQUEST_USE) {
+                if (sim->locality == TIS_SIM_NO_LOCALITY)
+                    sim->locality = loc;
+            }
+            else if ((buf[0] & TPM_ACCESS_ACTIVE_LOCALITY) &&
+                    sim->locality == loc) {
+                /* relinquish */
+                sim->locality = TIS_SIM_NO_LOCALITY;
+                sim->state = TIS_SIM_IDLE;
+            }
+            break;
+        case TIS_SIM_REG(TPM_STS(0)):
+            if (sim->locality != loc)
+                break;
+            if (buf[0] & TPM_STS_COMMAND_READY) {
+                /* also aborts a command in progress */
+                if (sim->state == TIS_SIM_RECEPTION ||
+                        sim->state == TIS_SIM_EXECUTION)
+                    sim->aborts++;
+                sim->state = TIS_SIM_READY;
+                sim->cmdSz = 0;
+                sim->rspSz = sim->rspPos = 0;
+            }
+            else if ((buf[0] & TPM_STS_GO) &&
+                    sim->state == TIS_SIM_RECEPTION &&
+                    sim->cmdSz == TisSimCmdExpected(sim)) {
+                goNs = TisSimNow();
+                if (sim->execCb != NULL)
+                    rc = sim->execCb(sim, sim->execCtx);
+                else
+                    rc = TisSimExecute(sim);
+                if (rc == TPM_RC_SUCCESS &&
+                        (sim->rspSz < TPM2_HEADER_SIZE ||
+                         sim->rspSz > (int)sizeof(sim->rsp)))
+                    rc = TPM_RC_FAILURE;
+                if (rc == TPM_RC_SUCCESS) {
+                    sim->rspPos = 0;
+                    sim->execLeft = sim->execPolls;
+                    sim->readyNs = goNs + (UINT64)sim->execUs * 1000;
+                    sim->state = TIS_SIM_EXECUTION;
+                }
+                else {
+                    sim->state = TIS_SIM_IDLE;
+                }
+            }
+            break;
+        case TIS_SIM_REG(TPM_DATA_FIFO(0)):
+            if (sim->locality != loc)
+                break;
+            if (sim->state == TIS_SIM_READY)
+                sim->state = TIS_SIM_RECEPTION;
+            if (sim->state != TIS_SIM_RECEPTION)
+                break;
+            for (i = 0; i < len && sim->cmdSz < (int)sizeof(sim->cmd); i++)
+                sim->cmd[sim->cmdSz++] = buf[i];
+            break;
+        default:
+            break;
+    }
+    return rc;
+}
+
+/******************************************************************************/
+/* --- Public Functions -- */
+/******************************************************************************/
+
+int TPM2_TisSim_Init(TPM2_TIS_SIM* sim)
+{
+    if (sim == NULL)
+        return BAD_FUNC_ARG;
+
+    XMEMSET(sim, 0, sizeof(TPM2_TIS_SIM));
+    sim->host = TPM2_TIS_SIM_HOST;
+    sim->port = TPM2_TIS_SIM_PORT;
+    sim->burstCount = TPM2_TIS_SIM_BURST;
+    sim->waitStates = TPM2_TIS_SIM_WAIT_STATES;
+    sim->accessNs = TPM2_TIS_SIM_ACCESS_NS;
+    sim->byteNs = TPM2_TIS_SIM_BYTE_NS;
+    sim->execUs = TPM2_TIS_SIM_EXEC_US;
+    sim->fd = -1;
+    sim->state = TIS_SIM_IDLE;
+    sim->locality = TIS_SIM_NO_LOCALITY;
+
+    return TPM_RC_SUCCESS;
+}
+
+int TPM2_TisSim_Cleanup(TPM2_TIS_SIM* sim)
+{
+    byte tss_cmd[sizeof(UINT32)];
+
+    if (sim == NULL)
+        return BAD_FUNC_ARG;
+
+    if (sim->fd >= 0) {
+        /* end simulator session */
+        TisSimPutU32(tss_cmd, TPM_SESSION_END);
+        (void)TisSimSend(sim, tss_cmd, sizeof(tss_cmd));
+        TisSimDisconnect(sim);
+    }
+    sim->state = TIS_SIM_IDLE;
+    sim->locality = TIS_SIM_NO_LOCALITY;
+
+    return TPM_RC_SUCCESS;
+}
+
+#ifdef WOLFTPM_ADV_IO
+int TPM2_TisSim_IoCb(TPM2_CTX* ctx, int isRead, word32 addr, byte* buf,
+    word16 size, void* userCtx)
+{
+    int rc = TPM_RC_SUCCESS;
+    TPM2_TIS_SIM* sim = (TPM2_TIS_SIM*)userCtx;
+    UINT64 start;
+
+    if (sim == NULL || buf == NULL || size == 0)
+        return BAD_FUNC_ARG;
+
+    start = TisSimNow();
+    if (isRead)
+        TisSimRead(sim, addr, buf, size);
+    else
+        rc = TisSimWrite(sim, addr, buf, size);
+    TisSimBusDelay(sim, start, size);
+
+    (void)ctx;
+
+    return rc;
+}
+#else
+/* SPI frame: read/write flag and size, 24-bit address, then data */
+int TPM2_TisSim_IoCb(TPM2_CTX* ctx, const byte* txBuf, byte* rxBuf,
+    word16 xferSz, void* userCtx)
+{
+    int rc = TPM_RC_SUCCESS;
+    TPM2_TIS_SIM* sim = (TPM2_TIS_SIM*)userCtx;
+    word32 addr;
+    int len;
+    UINT64 start;
+
+    if (sim == NULL || txBuf == NULL || rxBuf == NULL ||
+            xferSz <= TPM_TIS_HEADER_SZ)
+        return BAD_FUNC_ARG;
+
+    addr = ((word32)txBuf[1] << 16) | ((word32)txBuf[2] << 8) | txBuf[3];
+    len = (txBuf[0] & 0x3F) + 1;
+    if (len != xferSz - TPM_TIS_HEADER_SZ)
+        return BAD_FUNC_ARG;
+
+    start = TisSimNow();
+    XMEMSET(rxBuf, 0, TPM_TIS_HEADER_SZ);
+    rxBuf[TPM_TIS_HEADER_SZ-1] = TPM_TIS_READY_MASK; /* no wait states left */
+    if (txBuf[0] & TPM_TIS_READ)
+        TisSimRead(sim, addr, &rxBuf[TPM_TIS_HEADER_SZ], len);
+    else
+        rc = TisSimWrite(sim, addr, &txBuf[TPM_TIS_HEADER_SZ], len);
+    TisSimBusDelay(sim, start, len);
+#ifdef WOLFTPM_TIS_PROFILE
+    if (sim->waitStates > 0)
+        TPM2_TIS_ProfileWaitStates(ctx, sim->waitStates);
+#endif
+
+    (void)ctx;
+
+    return rc;
+}
+#endif /* WOLFTPM_ADV_IO */
+
+#endif /* WOLFTPM_TIS_SIM */
@@ -57,9 +57,20 @@ typedef const TBS_CONTEXT_PARAMS2 *PCTBS_CONTEXT_PARAMS2;
 #endif /* ! TBS_CONTEXT_VERSION_TWO */
 
 
+/* TBS context of the transport, the context's own unless one is given */
+static struct wolfTPM_winContext* TPM2_WinApi_GetWin(TPM2_CTX* ctx,
+    void* transportCtx)
+{
+    if (transportCtx != NULL)
+        return (struct wolfTPM_winContext*)transportCtx;
+    return &ctx->winCtx;
+}
+
 /* Talk to a TPM device using Windows TBS */
-int TPM2_WinApi_SendCommand(TPM2_CTX* ctx, TPM2_Packet* packet)
+static int TPM2_WinApi_SendCommand(TPM2_CTX* ctx, byte* buf, int cmdSz,
+    int bufSz, void* transportCtx)
 {
+    struct wolfTPM_winContext* win = TPM2_WinApi_GetWin(ctx, transportCtx);
     int rc = 0;
     TBS_CONTEXT_PARAMS2 tbs_params;
     tbs_params.version = TBS_CONTEXT_VERSION_TWO;
@@ -68,36 +79,50 @@ int TPM2_WinApi_SendCommand(TPM2_CTX* ctx, TPM2_Packet* packet)
 
 
     /* open, if not already open */
-    if (ctx->winCtx.tbs_context == NULL) {
+    if (win->tbs_context == NULL) {
         rc = Tbsi_Context_Create((TBS_CONTEXT_PARAMS*)&tbs_params,
-                                 &ctx->winCtx.tbs_context);
+                                 &win->tbs_context);
     }
 
     /* send the command to the device.  Error if the device send fails. */
     if (rc == 0) {
-        uint32_t tmp = packet->size;
-        rc = Tbsip_Submit_Command(ctx->winCtx.tbs_context,
+        uint32_t tmp = bufSz;
+        rc = Tbsip_Submit_Command(win->tbs_context,
                                   TBS_COMMAND_LOCALITY_ZERO,
                                   TBS_COMMAND_PRIORITY_NORMAL,
-                                  packet->buf,
-                                  packet->pos,
-                                  packet->buf,
+                                  buf,
+                                  cmdSz,
+                                  buf,
                                   (UINT32*)&tmp);
-        packet->pos = tmp;
     }
 
     return rc;
 }
 
-int TPM2_WinApi_Cleanup(TPM2_CTX* ctx)
+static void TPM2_WinApi_Cleanup(TPM2_CTX* ctx, void* transportCtx)
 {
-    int rc = TPM_RC_SUCCESS;
-    if (ctx->winCtx.tbs_context != NULL) {
-        rc = Tbsip_Context_Close(ctx->winCtx.tbs_context);
-        ctx->winCtx.tbs_context = NULL;
+    struct wolfTPM_winContext* win = TPM2_WinApi_GetWin(ctx, transportCtx);
+
+    if (win->tbs_context != NULL) {
+        (void)Tbsip_Context_Close(win->tbs_context);
+        win->tbs_context = NULL;
     }
+}
 
-    return rc;
+/* TBS starts the TPM */
+static const TPM2_TRANSPORT gWinApiTransport = {
+    "tbs",
+    TPM2_TRANSPORT_FLAG_STARTED,
+    TPM2_WinApi_SendCommand,
+    NULL,
+    NULL,
+    NULL,
+    TPM2_WinApi_Cleanup
+};
+
+const TPM2_TRANSPORT* TPM2_WinApi_GetTransport(void)
+{
+    return &gWinApiTransport;
 }
 
 #endif
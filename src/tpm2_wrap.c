@@ -26,11 +26,20 @@
 
 /* For some struct to buffer conversions */
 #include <wolftpm/tpm2_packet.h>
+#include <wolftpm/tpm2_linux.h>
+#include <wolftpm/tpm2_winapi.h>
 
 
 /* Local Functions */
 static int wolfTPM2_GetCapabilities_NoDev(WOLFTPM2_CAPS* cap);
 
+/* The TPM2_* commands run on the active context, so every wrapper selects
+ * the context of its device before issuing one */
+static void wolfTPM2_SelectDev(WOLFTPM2_DEV* dev)
+{
+    TPM2_SetActiveCtx(&dev->ctx);
+}
+
 
 /******************************************************************************/
 /* --- BEGIN Wrapper Device Functions -- */
@@ -40,26 +49,16 @@ static int wolfTPM2_Init_ex(TPM2_CTX* ctx, TPM2HalIoCb ioCb, void* userCtx,
     int timeoutTries)
 {
     int rc;
-
-#if !defined(WOLFTPM_LINUX_DEV) && !defined(WOLFTPM_WINAPI)
     Startup_In startupIn;
 #if defined(WOLFTPM_MCHP) || defined(WOLFTPM_PERFORM_SELFTEST)
     SelfTest_In selfTest;
 #endif
-#endif /* ! WOLFTPM_LINUX_DEV */
 
     if (ctx == NULL)
         return BAD_FUNC_ARG;
 
-#if defined(WOLFTPM_LINUX_DEV) || defined(WOLFTPM_SWTPM) || defined(WOLFTPM_WINAPI)
-    rc = TPM2_Init_minimal(ctx);
-    /* Using standard file I/O for the Linux TPM device */
-    (void)ioCb;
-    (void)userCtx;
-    (void)timeoutTries;
-#else
+    /* TIS with an ioCb, otherwise the built-in devtpm, swtpm or TBS */
     rc = TPM2_Init_ex(ctx, ioCb, userCtx, timeoutTries);
-#endif
     if (rc != TPM_RC_SUCCESS) {
     #ifdef DEBUG_WOLFTPM
         printf("TPM2_Init failed %d: %s\n", rc, wolfTPM2_GetRCString(rc));
@@ -74,7 +73,10 @@ static int wolfTPM2_Init_ex(TPM2_CTX* ctx, TPM2HalIoCb ioCb, void* userCtx,
         ctx->rid);
 #endif
 
-#if !defined(WOLFTPM_LINUX_DEV) && !defined(WOLFTPM_WINAPI)
+    /* the kernel driver and TBS start the TPM */
+    if (ctx->transport->flags & TPM2_TRANSPORT_FLAG_STARTED)
+        return TPM_RC_SUCCESS;
+
     /* startup */
     XMEMSET(&startupIn, 0, sizeof(Startup_In));
     startupIn.startupType = TPM_SU_CLEAR;
@@ -107,7 +109,6 @@ static int wolfTPM2_Init_ex(TPM2_CTX* ctx, TPM2HalIoCb ioCb, void* userCtx,
 #else
     rc = TPM_RC_SUCCESS;
 #endif /* WOLFTPM_MCHP || WOLFTPM_PERFORM_SELFTEST */
-#endif /* !defined(WOLFTPM_LINUX_DEV) && !defined(WOLFTPM_WINAPI) */
 
     return rc;
 }
@@ -206,6 +207,7 @@ int wolfTPM2_SelfTest(WOLFTPM2_DEV* dev)
 
     if (dev == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     /* Full self test */
     XMEMSET(&selfTest, 0, sizeof(selfTest));
@@ -366,6 +368,7 @@ int wolfTPM2_GetCapabilities(WOLFTPM2_DEV* dev, WOLFTPM2_CAPS* cap)
 {
     if (dev == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     return wolfTPM2_GetCapabilities_NoDev(cap);
 }
@@ -377,6 +380,7 @@ int wolfTPM2_UnsetAuth(WOLFTPM2_DEV* dev, int index)
     if (dev == NULL || index >= MAX_SESSION_NUM || index < 0) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     session = &dev->session[index];
     XMEMSET(session, 0, sizeof(TPM2_AUTH_SESSION));
@@ -393,6 +397,7 @@ int wolfTPM2_SetAuth(WOLFTPM2_DEV* dev, int index,
     if (dev == NULL || index >= MAX_SESSION_NUM || index < 0) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     session = &dev->session[index];
     XMEMSET(session, 0, sizeof(TPM2_AUTH_SESSION));
@@ -439,6 +444,7 @@ int wolfTPM2_SetAuthHandleName(WOLFTPM2_DEV* dev, int index,
     if (dev == NULL || handle == NULL || index >= MAX_SESSION_NUM) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     name = &handle->name;
     session = &dev->session[index];
@@ -456,6 +462,7 @@ int wolfTPM2_SetAuthSession(WOLFTPM2_DEV* dev, int index,
     if (dev == NULL || index >= MAX_SESSION_NUM) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     if (tpmSession == NULL) {
         /* clearing auth session */
@@ -499,6 +506,7 @@ int wolfTPM2_Cleanup_ex(WOLFTPM2_DEV* dev, int doShutdown)
     if (dev == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
 #if !defined(WOLFTPM2_NO_WOLFCRYPT) && (defined(WOLF_CRYPTO_DEV) || defined(WOLF_CRYPTO_CB))
     /* make sure crypto dev callback is unregistered */
@@ -549,6 +557,7 @@ int wolfTPM2_RSA_Salt(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* tpmKey,
     if (dev == NULL || salt == NULL || encSalt == NULL || publicArea == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     if (publicArea->nameAlg == TPM_ALG_SHA1) {
         hashType = WC_HASH_TYPE_SHA;
@@ -607,10 +616,19 @@ int wolfTPM2_EncryptSalt(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* tpmKey,
 {
     int rc;
 
+    if (dev == NULL) {
+        return BAD_FUNC_ARG;
+    }
+
     /* if a tpmKey is not present then we are using an unsalted session */
     if (tpmKey == NULL) {
         return TPM_RC_SUCCESS;
     }
+    if (in == NULL || salt == NULL) {
+        return BAD_FUNC_ARG;
+    }
+    /* the salt is taken from the TPM of dev */
+    wolfTPM2_SelectDev(dev);
 
 #ifndef WOLFTPM2_NO_WOLFCRYPT
     /* generate a salt */
@@ -657,9 +675,13 @@ int wolfTPM2_EncryptSalt(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* tpmKey,
     return rc;
 }
 
-int wolfTPM2_StartSession(WOLFTPM2_DEV* dev, WOLFTPM2_SESSION* session,
-    WOLFTPM2_KEY* tpmKey, WOLFTPM2_HANDLE* bind, TPM_SE sesType,
-    int encDecAlg)
+/* TPM2_StartAuthSession has no authorization area. With setAuth the auth
+ * session 0 of dev is set for the tpmKey (or a blank password), as callers
+ * of wolfTPM2_StartSession expect; the session pool passes 0 so the auth
+ * sessions of a device in use by another thread are left alone. */
+static int wolfTPM2_StartSession_ex(WOLFTPM2_DEV* dev,
+    WOLFTPM2_SESSION* session, WOLFTPM2_KEY* tpmKey, WOLFTPM2_HANDLE* bind,
+    TPM_SE sesType, int encDecAlg, int setAuth)
 {
     int rc;
     StartAuthSession_In  authSesIn;
@@ -671,6 +693,7 @@ int wolfTPM2_StartSession(WOLFTPM2_DEV* dev, WOLFTPM2_SESSION* session,
 
     if (dev == NULL || session == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     XMEMSET(session, 0, sizeof(WOLFTPM2_SESSION));
     XMEMSET(&authSesIn, 0, sizeof(authSesIn));
@@ -683,11 +706,13 @@ int wolfTPM2_StartSession(WOLFTPM2_DEV* dev, WOLFTPM2_SESSION* session,
 
     /* set session auth for key */
     if (tpmKey) {
-        wolfTPM2_SetAuthHandle(dev, 0, &tpmKey->handle);
+        if (setAuth)
+            wolfTPM2_SetAuthHandle(dev, 0, &tpmKey->handle);
         authSesIn.tpmKey = tpmKey->handle.hndl;
     }
     else {
-        wolfTPM2_SetAuthPassword(dev, 0, NULL);
+        if (setAuth)
+            wolfTPM2_SetAuthPassword(dev, 0, NULL);
         authSesIn.tpmKey = (TPMI_DH_OBJECT)TPM_RH_NULL;
     }
     /* setup bind key */
@@ -791,6 +816,406 @@ int wolfTPM2_StartSession(WOLFTPM2_DEV* dev, WOLFTPM2_SESSION* session,
     return rc;
 }
 
+int wolfTPM2_StartSession(WOLFTPM2_DEV* dev, WOLFTPM2_SESSION* session,
+    WOLFTPM2_KEY* tpmKey, WOLFTPM2_HANDLE* bind, TPM_SE sesType,
+    int encDecAlg)
+{
+    return wolfTPM2_StartSession_ex(dev, session, tpmKey, bind, sesType,
+        encDecAlg, 1);
+}
+
+
+static int wolfTPM2_SessionPool_Lock(WOLFTPM2_SESSION_POOL* pool)
+{
+#if !defined(WOLFTPM2_NO_WOLFCRYPT) && !defined(SINGLE_THREADED)
+    if (wc_LockMutex(&pool->lock) != 0)
+        return TPM_RC_FAILURE;
+#else
+    (void)pool;
+#endif
+    return TPM_RC_SUCCESS;
+}
+
+static void wolfTPM2_SessionPool_Unlock(WOLFTPM2_SESSION_POOL* pool)
+{
+#if !defined(WOLFTPM2_NO_WOLFCRYPT) && !defined(SINGLE_THREADED)
+    wc_UnLockMutex(&pool->lock);
+#else
+    (void)pool;
+#endif
+}
+
+/* Flush a pool session, loaded or saved. It is started again when needed. */
+static void wolfTPM2_SessionPool_Flush(WOLFTPM2_SESSION_POOL* pool,
+    WOLFTPM2_POOL_SESSION* slot)
+{
+    FlushContext_In in;
+
+    XMEMSET(&in, 0, sizeof(in));
+    in.flushHandle = slot->session.handle.hndl;
+    (void)TPM2_FlushContext(&in);
+    if (slot->started && !slot->saved)
+        pool->loaded--;
+    slot->started = 0;
+    slot->saved = 0;
+}
+
+/* Saved session with the oldest context, other than exclude */
+static WOLFTPM2_POOL_SESSION* wolfTPM2_SessionPool_Oldest(
+    WOLFTPM2_SESSION_POOL* pool, const WOLFTPM2_POOL_SESSION* exclude)
+{
+    word32 i;
+    WOLFTPM2_POOL_SESSION* oldest = NULL;
+
+    for (i = 0; i < pool->count; i++) {
+        WOLFTPM2_POOL_SESSION* slot = &pool->slot[i];
+        if (slot == exclude || !slot->started || !slot->saved)
+            continue;
+        if (oldest == NULL ||
+                slot->context.sequence < oldest->context.sequence) {
+            oldest = slot;
+        }
+    }
+    return oldest;
+}
+
+static int wolfTPM2_SessionPool_Save(WOLFTPM2_SESSION_POOL* pool,
+    WOLFTPM2_POOL_SESSION* slot)
+{
+    int rc;
+    ContextSave_In  in;
+    ContextSave_Out out;
+    WOLFTPM2_POOL_SESSION* oldest;
+
+    XMEMSET(&in, 0, sizeof(in));
+    in.saveHandle = slot->session.handle.hndl;
+    rc = TPM2_ContextSave(&in, &out);
+    if (rc == TPM_RC_CONTEXT_GAP) {
+        /* give up the oldest saved session rather than this one */
+        oldest = wolfTPM2_SessionPool_Oldest(pool, slot);
+        if (oldest != NULL) {
+            wolfTPM2_SessionPool_Flush(pool, oldest);
+            rc = TPM2_ContextSave(&in, &out);
+        }
+    }
+    if (rc != TPM_RC_SUCCESS) {
+    #ifdef DEBUG_WOLFTPM
+        printf("TPM2_ContextSave session failed %d: %s\n", rc,
+            wolfTPM2_GetRCString(rc));
+    #endif
+        return rc;
+    }
+
+    slot->context = out.context;
+    slot->saved = 1;
+    pool->loaded--;
+    pool->saves++;
+    return TPM_RC_SUCCESS;
+}
+
+static int wolfTPM2_SessionPool_Load(WOLFTPM2_SESSION_POOL* pool,
+    WOLFTPM2_POOL_SESSION* slot)
+{
+    int rc;
+    ContextLoad_In  in;
+    ContextLoad_Out out;
+
+    in.context = slot->context;
+    rc = TPM2_ContextLoad(&in, &out);
+    if (rc == TPM_RC_SUCCESS) {
+        slot->saved = 0;
+        pool->loaded++;
+        pool->loads++;
+    }
+    return rc;
+}
+
+/* Swap out the least recently released idle session */
+static int wolfTPM2_SessionPool_Evict(WOLFTPM2_SESSION_POOL* pool)
+{
+    int rc;
+    word32 i;
+    WOLFTPM2_POOL_SESSION* lru = NULL;
+    WOLFTPM2_POOL_SESSION* oldest;
+
+    for (i = 0; i < pool->count; i++) {
+        WOLFTPM2_POOL_SESSION* slot = &pool->slot[i];
+        if (!slot->started || slot->saved || slot->inUse)
+            continue;
+        if (lru == NULL || (int)(slot->lastUse - lru->lastUse) < 0)
+            lru = slot;
+    }
+    if (lru == NULL)
+        return TPM_RC_SESSION_MEMORY;
+
+    rc = wolfTPM2_SessionPool_Save(pool, lru);
+    if (rc != TPM_RC_SUCCESS)
+        return rc;
+
+    /* keep the oldest saved context within half the context gap, saving it
+     * again in the slot just freed */
+    oldest = wolfTPM2_SessionPool_Oldest(pool, lru);
+    if (oldest != NULL && lru->context.sequence - oldest->context.sequence >=
+            (UINT64)(pool->gapMax / 2)) {
+        rc = wolfTPM2_SessionPool_Load(pool, oldest);
+        if (rc == TPM_RC_SUCCESS)
+            rc = wolfTPM2_SessionPool_Save(pool, oldest);
+        if (rc == TPM_RC_SUCCESS) {
+            pool->refreshes++;
+        }
+        else {
+            wolfTPM2_SessionPool_Flush(pool, oldest);
+        }
+    }
+    return TPM_RC_SUCCESS;
+}
+
+int wolfTPM2_SessionPool_Init(WOLFTPM2_DEV* dev, WOLFTPM2_SESSION_POOL* pool,
+    word32 count, WOLFTPM2_KEY* tpmKey, WOLFTPM2_HANDLE* bind, TPM_SE sesType,
+    int encDecAlg, word32 maxLoaded)
+{
+    int rc;
+    GetCapability_In  in;
+    GetCapability_Out out;
+    TPML_TAGGED_TPM_PROPERTY* props = &out.capabilityData.data.tpmProperties;
+
+    if (dev == NULL || pool == NULL || count == 0 ||
+            count > WOLFTPM2_SESSION_POOL_MAX) {
+        return BAD_FUNC_ARG;
+    }
+    wolfTPM2_SelectDev(dev);
+
+    XMEMSET(pool, 0, sizeof(WOLFTPM2_SESSION_POOL));
+    pool->dev = dev;
+    pool->tpmKey = tpmKey;
+    pool->bind = bind;
+    pool->sesType = sesType;
+    pool->encDecAlg = encDecAlg;
+    pool->count = count;
+    pool->maxLoaded = maxLoaded;
+
+    /* context gap, the minimum of 8 bits if the TPM doesn't report it */
+    pool->gapMax = 0xFF;
+    XMEMSET(&in, 0, sizeof(in));
+    in.capability = TPM_CAP_TPM_PROPERTIES;
+    in.property = TPM_PT_CONTEXT_GAP_MAX;
+    in.propertyCount = 1;
+    rc = TPM2_GetCapability(&in, &out);
+    if (rc == TPM_RC_SUCCESS && props->count > 0 &&
+            props->tpmProperty[0].property == TPM_PT_CONTEXT_GAP_MAX &&
+            props->tpmProperty[0].value > 1) {
+        pool->gapMax = props->tpmProperty[0].value;
+    }
+
+#if !defined(WOLFTPM2_NO_WOLFCRYPT) && !defined(SINGLE_THREADED)
+    if (wc_InitMutex(&pool->lock) != 0)
+        return TPM_RC_FAILURE;
+#endif
+    return TPM_RC_SUCCESS;
+}
+
+/* The pool sessions are started on pool->dev. With a resource manager
+ * (Linux /dev/tpmrm0, Windows TBS) each connection has its own session
+ * handles, so they are only valid on pool->dev. */
+#ifdef WOLFTPM_LINUX_DEV
+/* The context uses the devtpm transport on a tpmrm device */
+static int wolfTPM2_OnResourceManager(TPM2_CTX* ctx)
+{
+    void* transportCtx = NULL;
+    struct wolfTPM_devContext* devCtx;
+
+    if (TPM2_GetTransport(ctx, &transportCtx) != TPM2_LINUX_GetTransport())
+        return 0;
+    devCtx = (transportCtx != NULL) ?
+        (struct wolfTPM_devContext*)transportCtx : &ctx->devCtx;
+    return (devCtx->path != NULL && strstr(devCtx->path, "tpmrm") != NULL);
+}
+#endif
+#ifdef WOLFTPM_WINAPI
+/* The TBS connection of a context on the TBS transport, NULL otherwise */
+static struct wolfTPM_winContext* wolfTPM2_GetWinCtx(TPM2_CTX* ctx)
+{
+    void* transportCtx = NULL;
+
+    if (TPM2_GetTransport(ctx, &transportCtx) != TPM2_WinApi_GetTransport())
+        return NULL;
+    return (transportCtx != NULL) ?
+        (struct wolfTPM_winContext*)transportCtx : &ctx->winCtx;
+}
+#endif
+
+static int wolfTPM2_SessionPool_SameTpm(WOLFTPM2_SESSION_POOL* pool,
+    WOLFTPM2_DEV* dev)
+{
+#ifdef WOLFTPM_WINAPI
+    struct wolfTPM_winContext* win;
+    struct wolfTPM_winContext* poolWin;
+#endif
+
+    if (dev == pool->dev)
+        return 1;
+#ifdef WOLFTPM_LINUX_DEV
+    if (wolfTPM2_OnResourceManager(&pool->dev->ctx) ||
+            wolfTPM2_OnResourceManager(&dev->ctx)) {
+        return 0;
+    }
+#endif
+#ifdef WOLFTPM_WINAPI
+    win = wolfTPM2_GetWinCtx(&dev->ctx);
+    poolWin = wolfTPM2_GetWinCtx(&pool->dev->ctx);
+    if ((win != NULL || poolWin != NULL) && (win == NULL || poolWin == NULL ||
+            win->tbs_context != poolWin->tbs_context)) {
+        return 0;
+    }
+#endif
+    return 1;
+}
+
+int wolfTPM2_SessionPool_Acquire(WOLFTPM2_SESSION_POOL* pool,
+    WOLFTPM2_DEV* dev, int index, TPMA_SESSION sessionAttributes,
+    WOLFTPM2_SESSION** session)
+{
+    int rc;
+    word32 i;
+    WOLFTPM2_POOL_SESSION* slot = NULL;
+
+    if (pool == NULL || pool->dev == NULL || dev == NULL || index < 0 ||
+            index >= MAX_SESSION_NUM || !wolfTPM2_SessionPool_SameTpm(pool, dev)) {
+        return BAD_FUNC_ARG;
+    }
+    rc = wolfTPM2_SessionPool_Lock(pool);
+    if (rc != TPM_RC_SUCCESS)
+        return rc;
+    wolfTPM2_SelectDev(pool->dev);
+
+    /* a loaded session, then the oldest saved one, then a new one */
+    for (i = 0; i < pool->count; i++) {
+        WOLFTPM2_POOL_SESSION* cur = &pool->slot[i];
+        if (cur->inUse)
+            continue;
+        if (cur->started && !cur->saved) {
+            slot = cur;
+            break;
+        }
+        if (slot == NULL || (cur->started && (!slot->started ||
+                cur->context.sequence < slot->context.sequence))) {
+            slot = cur;
+        }
+    }
+
+    if (slot == NULL) {
+        rc = TPM_RC_RETRY;
+    }
+    else if (slot->started && slot->saved) {
+        rc = wolfTPM2_SessionPool_Load(pool, slot);
+    }
+    else if (!slot->started) {
+        rc = wolfTPM2_StartSession_ex(pool->dev, &slot->session,
+            pool->tpmKey, pool->bind, pool->sesType, pool->encDecAlg, 0);
+        if (rc == TPM_RC_SUCCESS) {
+            slot->started = 1;
+            pool->loaded++;
+            pool->starts++;
+        }
+    }
+    if (rc == TPM_RC_SUCCESS)
+        slot->inUse = 1;
+    wolfTPM2_SessionPool_Unlock(pool);
+
+    /* the session is used by the commands of dev */
+    wolfTPM2_SelectDev(dev);
+    if (rc == TPM_RC_SUCCESS) {
+        rc = wolfTPM2_SetAuthSession(dev, index, &slot->session,
+            sessionAttributes | TPMA_SESSION_continueSession);
+        if (session != NULL)
+            *session = &slot->session;
+    }
+    return rc;
+}
+
+int wolfTPM2_SessionPool_Release(WOLFTPM2_SESSION_POOL* pool,
+    WOLFTPM2_DEV* dev, int index, int flush)
+{
+    int rc;
+    word32 i;
+    TPM2_AUTH_SESSION* ses;
+    WOLFTPM2_POOL_SESSION* slot = NULL;
+    PolicyRestart_In policyIn;
+
+    if (pool == NULL || pool->dev == NULL || dev == NULL || index < 0 ||
+            index >= MAX_SESSION_NUM) {
+        return BAD_FUNC_ARG;
+    }
+    ses = &dev->session[index];
+
+    rc = wolfTPM2_SessionPool_Lock(pool);
+    if (rc != TPM_RC_SUCCESS)
+        return rc;
+    for (i = 0; i < pool->count; i++) {
+        if (pool->slot[i].inUse && pool->slot[i].started &&
+                pool->slot[i].session.handle.hndl == ses->sessionHandle) {
+            slot = &pool->slot[i];
+            break;
+        }
+    }
+    if (slot == NULL) {
+        wolfTPM2_SessionPool_Unlock(pool);
+        return BAD_FUNC_ARG;
+    }
+    wolfTPM2_SelectDev(pool->dev);
+
+    if (!flush) {
+        /* the nonces of the last command are needed for the next */
+        slot->session.nonceTPM = ses->nonceTPM;
+        slot->session.nonceCaller = ses->nonceCaller;
+        if (slot->session.type == TPM_SE_POLICY) {
+            policyIn.sessionHandle = slot->session.handle.hndl;
+            if (TPM2_PolicyRestart(&policyIn) != TPM_RC_SUCCESS)
+                flush = 1;
+        }
+    }
+    if (flush)
+        wolfTPM2_SessionPool_Flush(pool, slot);
+    slot->inUse = 0;
+    slot->lastUse = ++pool->clock;
+
+    /* free TPM session slots held by idle sessions */
+    while (pool->maxLoaded > 0 && pool->loaded > pool->maxLoaded) {
+        if (wolfTPM2_SessionPool_Evict(pool) != TPM_RC_SUCCESS)
+            break;
+    }
+    wolfTPM2_SessionPool_Unlock(pool);
+
+    wolfTPM2_SelectDev(dev);
+    return wolfTPM2_UnsetAuth(dev, index);
+}
+
+int wolfTPM2_SessionPool_Free(WOLFTPM2_SESSION_POOL* pool)
+{
+    int rc;
+    word32 i;
+
+    if (pool == NULL || pool->dev == NULL)
+        return BAD_FUNC_ARG;
+
+    rc = wolfTPM2_SessionPool_Lock(pool);
+    if (rc != TPM_RC_SUCCESS)
+        return rc;
+    wolfTPM2_SelectDev(pool->dev);
+    for (i = 0; i < pool->count; i++) {
+        if (pool->slot[i].started)
+            wolfTPM2_SessionPool_Flush(pool, &pool->slot[i]);
+        pool->slot[i].inUse = 0;
+    }
+    wolfTPM2_SessionPool_Unlock(pool);
+
+#if !defined(WOLFTPM2_NO_WOLFCRYPT) && !defined(SINGLE_THREADED)
+    wc_FreeMutex(&pool->lock);
+#endif
+    pool->dev = NULL;
+    return TPM_RC_SUCCESS;
+}
+
 
 int wolfTPM2_CreatePrimaryKey(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* key,
     TPM_HANDLE primaryHandle, TPMT_PUBLIC* publicTemplate,
@@ -802,6 +1227,7 @@ int wolfTPM2_CreatePrimaryKey(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* key,
 
     if (dev == NULL || key == NULL || publicTemplate == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     /* set session auth to blank */
     wolfTPM2_SetAuthPassword(dev, 0, NULL);
@@ -860,6 +1286,7 @@ int wolfTPM2_ChangeAuthKey(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* key,
 
     if (dev == NULL || key == NULL || parent == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     /* set session auth for key */
     wolfTPM2_SetAuthHandle(dev, 0, &key->handle);
@@ -922,6 +1349,7 @@ int wolfTPM2_CreateKey(WOLFTPM2_DEV* dev, WOLFTPM2_KEYBLOB* keyBlob,
 
     if (dev == NULL || keyBlob == NULL || parent == NULL || publicTemplate == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     /* clear output key buffer */
     XMEMSET(keyBlob, 0, sizeof(WOLFTPM2_KEYBLOB));
@@ -977,6 +1405,7 @@ int wolfTPM2_LoadKey(WOLFTPM2_DEV* dev, WOLFTPM2_KEYBLOB* keyBlob,
 
     if (dev == NULL || keyBlob == NULL || parent == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     /* set session auth for parent key */
     if (dev->ctx.session) {
@@ -1005,19 +1434,117 @@ int wolfTPM2_LoadKey(WOLFTPM2_DEV* dev, WOLFTPM2_KEYBLOB* keyBlob,
     return rc;
 }
 
-int wolfTPM2_CreateAndLoadKey(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* key,
+int wolfTPM2_CreateLoadedKey(WOLFTPM2_DEV* dev, WOLFTPM2_KEYBLOB* keyBlob,
     WOLFTPM2_HANDLE* parent, TPMT_PUBLIC* publicTemplate,
     const byte* auth, int authSz)
 {
     int rc;
+    CreateLoaded_In  createIn;
+    CreateLoaded_Out createOut;
+
+    if (dev == NULL || keyBlob == NULL || parent == NULL || publicTemplate == NULL)
+        return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
+
+    /* clear output key buffer */
+    XMEMSET(keyBlob, 0, sizeof(WOLFTPM2_KEYBLOB));
+
+    /* set session auth for parent key */
+    wolfTPM2_SetAuthHandle(dev, 0, parent);
+
+    XMEMSET(&createIn, 0, sizeof(createIn));
+    createIn.parentHandle = parent->hndl;
+    if (auth) {
+        createIn.inSensitive.sensitive.userAuth.size = authSz;
+        XMEMCPY(createIn.inSensitive.sensitive.userAuth.buffer, auth,
+            createIn.inSensitive.sensitive.userAuth.size);
+    }
+    XMEMCPY(&createIn.inPublic.publicArea, publicTemplate, sizeof(TPMT_PUBLIC));
+
+    rc = TPM2_CreateLoaded(&createIn, &createOut);
+    if (rc != TPM_RC_SUCCESS) {
+    #ifdef DEBUG_WOLFTPM
+        printf("TPM2_CreateLoaded key failed %d: %s\n", rc,
+            wolfTPM2_GetRCString(rc));
+    #endif
+        return rc;
+    }
+
+    keyBlob->handle.hndl = createOut.objectHandle;
+    keyBlob->handle.name = createOut.name;
+    keyBlob->handle.auth = createIn.inSensitive.sensitive.userAuth;
+    keyBlob->handle.symmetric = createOut.outPublic.publicArea.parameters.asymDetail.symmetric;
+
+    keyBlob->pub = createOut.outPublic;
+    keyBlob->priv = createOut.outPrivate;
+
+#ifdef DEBUG_WOLFTPM
+    printf("TPM2_CreateLoaded Key Handle 0x%x: pub %d, priv %d\n",
+        (word32)keyBlob->handle.hndl, createOut.outPublic.size,
+        createOut.outPrivate.size);
+#endif
+
+    return rc;
+}
+
+/* Check once if the TPM lists TPM2_CreateLoaded in TPM_CAP_COMMANDS */
+static int wolfTPM2_HasCreateLoaded(WOLFTPM2_DEV* dev)
+{
+    int rc;
+    GetCapability_In  in;
+    GetCapability_Out out;
+
+    if (dev->createLoaded == WOLFTPM2_CMD_UNKNOWN) {
+        dev->createLoaded = WOLFTPM2_CMD_UNSUPPORTED;
+
+        XMEMSET(&in, 0, sizeof(in));
+        XMEMSET(&out, 0, sizeof(out));
+        in.capability = TPM_CAP_COMMANDS;
+        in.property = TPM_CC_CreateLoaded;
+        in.propertyCount = 1;
+        rc = TPM2_GetCapability(&in, &out);
+        if (rc == TPM_RC_SUCCESS &&
+                out.capabilityData.capability == TPM_CAP_COMMANDS &&
+                out.capabilityData.data.command.count > 0 &&
+                (out.capabilityData.data.command.commandAttributes[0] &
+                    TPMA_CC_commandIndex) == TPM_CC_CreateLoaded) {
+            dev->createLoaded = WOLFTPM2_CMD_SUPPORTED;
+        }
+    #ifdef DEBUG_WOLFTPM
+        printf("TPM2_CreateLoaded: %s\n",
+            dev->createLoaded == WOLFTPM2_CMD_SUPPORTED ?
+                "supported" : "not supported");
+    #endif
+    }
+    return dev->createLoaded == WOLFTPM2_CMD_SUPPORTED;
+}
+
+int wolfTPM2_CreateAndLoadKey(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* key,
+    WOLFTPM2_HANDLE* parent, TPMT_PUBLIC* publicTemplate,
+    const byte* auth, int authSz)
+{
+    int rc = TPM_RC_COMMAND_CODE;
     WOLFTPM2_KEYBLOB keyBlob;
 
     if (dev == NULL || key == NULL)
         return BAD_FUNC_ARG;
-
-    rc = wolfTPM2_CreateKey(dev, &keyBlob, parent, publicTemplate, auth, authSz);
-    if (rc == TPM_RC_SUCCESS) {
-        rc = wolfTPM2_LoadKey(dev, &keyBlob, parent);
+    wolfTPM2_SelectDev(dev);
+
+    /* one round trip when the TPM has TPM2_CreateLoaded */
+    if (parent != NULL && publicTemplate != NULL &&
+            wolfTPM2_HasCreateLoaded(dev)) {
+        rc = wolfTPM2_CreateLoadedKey(dev, &keyBlob, parent, publicTemplate,
+            auth, authSz);
+        if (rc == TPM_RC_COMMAND_CODE) {
+            dev->createLoaded = WOLFTPM2_CMD_UNSUPPORTED;
+        }
+    }
+    if (rc == TPM_RC_COMMAND_CODE) {
+        rc = wolfTPM2_CreateKey(dev, &keyBlob, parent, publicTemplate,
+            auth, authSz);
+        if (rc == TPM_RC_SUCCESS) {
+            rc = wolfTPM2_LoadKey(dev, &keyBlob, parent);
+        }
     }
 
     /* return loaded key */
@@ -1035,6 +1562,7 @@ int wolfTPM2_LoadPublicKey(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* key,
 
     if (dev == NULL || key == NULL || pub == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     /* Loading public key */
     XMEMSET(&loadExtIn, 0, sizeof(loadExtIn));
@@ -1272,6 +1800,7 @@ int wolfTPM2_ImportPrivateKey(WOLFTPM2_DEV* dev, const WOLFTPM2_KEY* parentKey,
             sens == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     /* set session auth for key */
     if (parentKey != NULL) {
@@ -1332,6 +1861,7 @@ int wolfTPM2_LoadPrivateKey(WOLFTPM2_DEV* dev, const WOLFTPM2_KEY* parentKey,
     if (dev == NULL || key == NULL || pub == NULL || sens == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     XMEMCPY(&keyBlob, key, sizeof(WOLFTPM2_KEY));
     rc = wolfTPM2_ImportPrivateKey(dev, parentKey, &keyBlob, pub, sens);
@@ -1363,6 +1893,7 @@ int wolfTPM2_LoadRsaPublicKey_ex(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* key,
 
     if (dev == NULL || key == NULL || rsaPub == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
     if (rsaPubSz > sizeof(pub.publicArea.unique.rsa.buffer))
         return BUFFER_E;
 
@@ -1414,6 +1945,7 @@ int wolfTPM2_ImportRsaPrivateKey(WOLFTPM2_DEV* dev, const WOLFTPM2_KEY* parentKe
 
     if (dev == NULL || keyBlob == NULL || rsaPub == NULL || rsaPriv == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
     if (rsaPubSz > sizeof(pub.publicArea.unique.rsa.buffer))
         return BUFFER_E;
     if (rsaPrivSz > sizeof(sens.sensitiveArea.sensitive.rsa.buffer))
@@ -1457,6 +1989,7 @@ int wolfTPM2_LoadRsaPrivateKey_ex(WOLFTPM2_DEV* dev, const WOLFTPM2_KEY* parentK
 
     if (dev == NULL || key == NULL || rsaPub == NULL || rsaPriv == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     XMEMCPY(&keyBlob, key, sizeof(WOLFTPM2_KEY));
     rc = wolfTPM2_ImportRsaPrivateKey(dev, parentKey, &keyBlob, rsaPub, rsaPubSz,
@@ -1485,6 +2018,7 @@ int wolfTPM2_LoadEccPublicKey(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* key, int curveId,
 
     if (dev == NULL || key == NULL || eccPubX == NULL || eccPubY == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
     if (eccPubXSz > sizeof(pub.publicArea.unique.ecc.x.buffer))
         return BUFFER_E;
     if (eccPubYSz > sizeof(pub.publicArea.unique.ecc.y.buffer))
@@ -1521,6 +2055,7 @@ int wolfTPM2_ImportEccPrivateKey(WOLFTPM2_DEV* dev, const WOLFTPM2_KEY* parentKe
         eccPriv == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
     if (eccPubXSz > sizeof(pub.publicArea.unique.ecc.x.buffer))
         return BUFFER_E;
     if (eccPubYSz > sizeof(pub.publicArea.unique.ecc.y.buffer))
@@ -1572,6 +2107,7 @@ int wolfTPM2_LoadEccPrivateKey(WOLFTPM2_DEV* dev, const WOLFTPM2_KEY* parentKey,
         eccPriv == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     XMEMCPY(&keyBlob, key, sizeof(WOLFTPM2_KEY));
     rc = wolfTPM2_ImportEccPrivateKey(dev, parentKey, &keyBlob, curveId,
@@ -1595,6 +2131,7 @@ int wolfTPM2_ReadPublicKey(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* key,
 
     if (dev == NULL || key == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     /* Read public key */
     XMEMSET(&readPubIn, 0, sizeof(readPubIn));
@@ -1636,6 +2173,7 @@ int wolfTPM2_RsaKey_TpmToWolf(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* tpmKey,
 
     if (dev == NULL || tpmKey == NULL || wolfKey == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     XMEMSET(e, 0, sizeof(e));
     XMEMSET(n, 0, sizeof(n));
@@ -1681,6 +2219,7 @@ int wolfTPM2_RsaKey_WolfToTpm_ex(WOLFTPM2_DEV* dev, const WOLFTPM2_KEY* parentKe
 
     if (dev == NULL || tpmKey == NULL || wolfKey == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     XMEMSET(e, 0, sizeof(e));
     XMEMSET(n, 0, sizeof(n));
@@ -1740,6 +2279,7 @@ int wolfTPM2_EccKey_TpmToWolf(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* tpmKey,
 
     if (dev == NULL || tpmKey == NULL || wolfKey == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     XMEMSET(qx, 0, sizeof(qx));
     XMEMSET(qy, 0, sizeof(qy));
@@ -1775,6 +2315,7 @@ int wolfTPM2_EccKey_WolfToTpm_ex(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* parentKey,
 
     if (dev == NULL || tpmKey == NULL || wolfKey == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     XMEMSET(tpmKey, 0, sizeof(*tpmKey));
     XMEMSET(qx, 0, sizeof(qx));
@@ -1825,6 +2366,7 @@ int wolfTPM2_EccKey_WolfToPubPoint(WOLFTPM2_DEV* dev, ecc_key* wolfKey,
 
     if (dev == NULL || wolfKey == NULL || pubPoint == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     xSz = sizeof(pubPoint->point.x.buffer);;
     ySz = sizeof(pubPoint->point.y.buffer);;
@@ -1860,6 +2402,7 @@ int wolfTPM2_NVStoreKey(WOLFTPM2_DEV* dev, TPM_HANDLE primaryHandle,
         persistentHandle > PERSISTENT_LAST) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     /* if key is already persistent then just return success */
     if (key->handle.hndl == persistentHandle)
@@ -1906,6 +2449,7 @@ int wolfTPM2_NVDeleteKey(WOLFTPM2_DEV* dev, TPM_HANDLE primaryHandle,
     if (dev == NULL || key == NULL || primaryHandle == 0) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     /* if key is not persistent then just return success */
     if (key->handle.hndl < PERSISTENT_FIRST ||
@@ -1953,6 +2497,7 @@ int wolfTPM2_SignHashScheme(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* key,
                                                             sigSz == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     if (key->pub.publicArea.type == TPM_ALG_ECC) {
         /* get curve size */
@@ -2022,6 +2567,7 @@ int wolfTPM2_SignHash(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* key,
     if (dev == NULL || key == NULL || digest == NULL || sig == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     if (key->pub.publicArea.type == TPM_ALG_ECC) {
         sigAlg = key->pub.publicArea.parameters.eccDetail.scheme.scheme;
@@ -2048,6 +2594,7 @@ int wolfTPM2_VerifyHashScheme(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* key,
     if (dev == NULL || key == NULL || digest == NULL || sig == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     if (key->pub.publicArea.type == TPM_ALG_ECC) {
         /* get curve size */
@@ -2120,6 +2667,7 @@ int wolfTPM2_VerifyHash_ex(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* key,
     if (dev == NULL || key == NULL || digest == NULL || sig == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     if (key->pub.publicArea.type == TPM_ALG_ECC) {
         sigAlg = key->pub.publicArea.parameters.eccDetail.scheme.scheme;
@@ -2149,6 +2697,7 @@ int wolfTPM2_ECDHGenKey(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* ecdhKey, int curve_id,
     if (dev == NULL || ecdhKey == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     XMEMSET(&nullParent, 0, sizeof(nullParent));
     nullParent.hndl = TPM_RH_NULL;
@@ -2181,6 +2730,7 @@ int wolfTPM2_ECDHGen(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* privKey,
                                                                 outSz == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     /* get curve size to verify output is large enough */
     curveSize = wolfTPM2_GetCurveSize(
@@ -2229,6 +2779,7 @@ int wolfTPM2_ECDHGenZ(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* privKey,
                                                                 outSz == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     /* get curve size to verify output is large enough */
     curveSize = wolfTPM2_GetCurveSize(
@@ -2277,6 +2828,7 @@ int wolfTPM2_ECDHEGenKey(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* ecdhKey, int curve_id)
     if (dev == NULL || ecdhKey == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     XMEMSET(&in, 0, sizeof(in));
     in.curveID = curve_id;
@@ -2311,6 +2863,7 @@ int wolfTPM2_ECDHEGenZ(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* parentKey,
         pubPoint == NULL || out == NULL || outSz == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     /* get curve size to verify output is large enough */
     curveSize = wolfTPM2_GetCurveSize(
@@ -2364,6 +2917,7 @@ int wolfTPM2_RsaEncrypt(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* key,
                                                                 outSz == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     /* set session auth for key */
     if (dev->ctx.session) {
@@ -2415,6 +2969,7 @@ int wolfTPM2_RsaDecrypt(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* key,
                                                                 msgSz == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     /* set session auth and name for key */
     if (dev->ctx.session) {
@@ -2466,6 +3021,7 @@ int wolfTPM2_ReadPCR(WOLFTPM2_DEV* dev, int pcrIndex, int hashAlg, byte* digest,
 
     if (dev == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     /* set session auth to blank */
     if (dev->ctx.session) {
@@ -2506,6 +3062,7 @@ int wolfTPM2_ExtendPCR(WOLFTPM2_DEV* dev, int pcrIndex, int hashAlg,
     if (dev == NULL || digestLen > TPM_MAX_DIGEST_SIZE) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     XMEMSET(&pcrExtend, 0, sizeof(pcrExtend));
     pcrExtend.pcrHandle = pcrIndex;
@@ -2533,6 +3090,7 @@ int wolfTPM2_UnloadHandle(WOLFTPM2_DEV* dev, WOLFTPM2_HANDLE* handle)
 
     if (dev == NULL || handle == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     /* don't try and unload null or persistent handles */
     if (handle->hndl == 0 || handle->hndl == TPM_RH_NULL ||
@@ -2571,6 +3129,7 @@ int wolfTPM2_NVCreateAuth(WOLFTPM2_DEV* dev, WOLFTPM2_HANDLE* parent,
 
     if (dev == NULL || nv == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     /* set session auth for key */
     if (dev->ctx.session) {
@@ -2654,6 +3213,7 @@ int wolfTPM2_NVWriteAuth(WOLFTPM2_DEV* dev, WOLFTPM2_NV* nv,
 
     if (dev == NULL || nv == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     /* set session auth for key */
     if (dev->ctx.session) {
@@ -2741,6 +3301,7 @@ int wolfTPM2_NVReadAuth(WOLFTPM2_DEV* dev, WOLFTPM2_NV* nv,
 
     if (dev == NULL || nv == NULL || pDataSz == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     /* set session auth for key */
     if (dev->ctx.session) {
@@ -2834,6 +3395,7 @@ int wolfTPM2_NVReadPublic(WOLFTPM2_DEV* dev, word32 nvIndex,
 
     if (dev == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     XMEMSET(&in, 0, sizeof(in));
     in.nvIndex = nvIndex;
@@ -2874,6 +3436,7 @@ int wolfTPM2_NVDeleteAuth(WOLFTPM2_DEV* dev, WOLFTPM2_HANDLE* parent,
 
     if (dev == NULL || parent == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     /* set session auth for key */
     if (dev->ctx.session) {
@@ -2935,6 +3498,7 @@ int wolfTPM2_GetRandom(WOLFTPM2_DEV* dev, byte* buf, word32 len)
 
     if (dev == NULL || buf == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     while (pos < len) {
         /* caclulate size to get */
@@ -2975,6 +3539,7 @@ int wolfTPM2_Clear(WOLFTPM2_DEV* dev)
 
     if (dev == NULL)
         return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
 
     XMEMSET(&in, 0, sizeof(in));
     in.authHandle = TPM_RH_LOCKOUT;
@@ -3007,6 +3572,7 @@ int wolfTPM2_HashStart(WOLFTPM2_DEV* dev, WOLFTPM2_HASH* hash,
     if (dev == NULL || hash == NULL || hashAlg == TPM_ALG_NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     /* Capture usage auth */
     if (usageAuthSz > sizeof(hash->handle.auth.buffer))
@@ -3049,6 +3615,7 @@ int wolfTPM2_HashUpdate(WOLFTPM2_DEV* dev, WOLFTPM2_HASH* hash,
             hash->handle.hndl == 0) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     /* set session auth for hash handle */
     if (dev->ctx.session) {
@@ -3095,6 +3662,7 @@ int wolfTPM2_HashFinish(WOLFTPM2_DEV* dev, WOLFTPM2_HASH* hash,
             hash->handle.hndl == 0) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     /* set session auth for hash handle */
     if (dev->ctx.session) {
@@ -3147,6 +3715,7 @@ static int wolfTPM2_ComputeSymmetricUnique(WOLFTPM2_DEV* dev, int hashAlg,
     if (dev == NULL || sensitive == NULL || unique == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
 #ifdef WOLFTPM_USE_SYMMETRIC
     rc = wolfTPM2_HashStart(dev, &hash, hashAlg, NULL, 0);
@@ -3214,6 +3783,7 @@ int wolfTPM2_LoadSymmetricKey(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* key, int alg,
     if (dev == NULL || key == NULL || keyBuf == NULL || (keySz != 16 && keySz != 32)) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
     if (keySz > sizeof(loadExtIn.inPrivate.sensitiveArea.sensitive.sym.buffer)) {
         return BUFFER_E;
     }
@@ -3294,6 +3864,7 @@ int wolfTPM2_EncryptDecryptBlock(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* key,
     if (dev == NULL || key == NULL || in == NULL || out == NULL || inOutSz == 0) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     /* set session auth for key */
     if (dev->ctx.session) {
@@ -3386,6 +3957,8 @@ int wolfTPM2_SetCommand(WOLFTPM2_DEV* dev, TPM_CC commandCode, int enableFlag)
 {
     int rc = TPM_RC_COMMAND_CODE; /* not supported */
 #if defined(WOLFTPM_ST33) || defined(WOLFTPM_AUTODETECT)
+    if (dev != NULL)
+        wolfTPM2_SelectDev(dev);
     if (TPM2_GetVendorID() == TPM_VENDOR_STM) {
         SetCommandSet_In in;
 
@@ -3427,6 +4000,7 @@ int wolfTPM2_LoadKeyedHashKey(WOLFTPM2_DEV* dev, WOLFTPM2_KEY* key,
     if (dev == NULL || key == NULL || parent == NULL || keyBuf == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
     if (keySz == 0 || keySz > MAX_SYM_DATA) {
         return BUFFER_E;
     }
@@ -3509,6 +4083,7 @@ int wolfTPM2_HmacStart(WOLFTPM2_DEV* dev, WOLFTPM2_HMAC* hmac,
     if (dev == NULL || hmac == NULL || hashAlg == TPM_ALG_NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     /* Capture usage auth */
     if (usageAuthSz > sizeof(hmac->hash.handle.auth.buffer))
@@ -3562,6 +4137,7 @@ int wolfTPM2_HmacUpdate(WOLFTPM2_DEV* dev, WOLFTPM2_HMAC* hmac,
     if (dev == NULL || hmac == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     return wolfTPM2_HashUpdate(dev, &hmac->hash, data, dataSz);
 }
@@ -3574,6 +4150,7 @@ int wolfTPM2_HmacFinish(WOLFTPM2_DEV* dev, WOLFTPM2_HMAC* hmac,
     if (dev == NULL || hmac == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     rc = wolfTPM2_HashFinish(dev, &hmac->hash, digest, digestSz);
 
@@ -3596,6 +4173,7 @@ int wolfTPM2_Shutdown(WOLFTPM2_DEV* dev, int doStartup)
     if (dev == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     /* shutdown */
     XMEMSET(&shutdownIn, 0, sizeof(shutdownIn));
@@ -3635,6 +4213,7 @@ int wolfTPM2_UnloadHandles(WOLFTPM2_DEV* dev, word32 handleStart, word32 handleC
     if (dev == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
     XMEMSET(&handle, 0, sizeof(handle));
     handle.auth = dev->session[0].auth;
     for (hndl=handleStart; hndl < handleStart+handleCount; hndl++) {
@@ -3647,7 +4226,152 @@ int wolfTPM2_UnloadHandles(WOLFTPM2_DEV* dev, word32 handleStart, word32 handleC
 
 int wolfTPM2_UnloadHandles_AllTransient(WOLFTPM2_DEV* dev)
 {
-    return wolfTPM2_UnloadHandles(dev, TRANSIENT_FIRST, MAX_HANDLE_NUM);
+    int rc;
+    word32 failed = 0;
+
+    /* flush the loaded objects, or try each one if the TPM can't list them */
+    rc = wolfTPM2_UnloadHandles_Loaded(dev, WOLFTPM2_FLUSH_TRANSIENT, NULL,
+        &failed);
+    if (rc != TPM_RC_SUCCESS && rc != BAD_FUNC_ARG && failed == 0)
+        rc = wolfTPM2_UnloadHandles(dev, TRANSIENT_FIRST, MAX_HANDLE_NUM);
+    return rc;
+}
+
+int wolfTPM2_GetHandles(WOLFTPM2_DEV* dev, TPM_HANDLE handleStart,
+    TPM_HANDLE* handles, word32* count)
+{
+    int rc;
+    word32 i, found = 0;
+    int session;
+    GetCapability_In  in;
+    GetCapability_Out out;
+    TPML_HANDLE* list = &out.capabilityData.data.handles;
+
+    if (dev == NULL || handles == NULL || count == NULL)
+        return BAD_FUNC_ARG;
+    wolfTPM2_SelectDev(dev);
+
+    session = ((handleStart & ~HR_HANDLE_MASK) == HMAC_SESSION_FIRST ||
+        (handleStart & ~HR_HANDLE_MASK) == POLICY_SESSION_FIRST);
+
+    XMEMSET(&in, 0, sizeof(in));
+    in.capability = TPM_CAP_HANDLES;
+    in.property = handleStart;
+    do {
+        in.propertyCount = *count - found;
+        XMEMSET(&out, 0, sizeof(out));
+        rc = TPM2_GetCapability(&in, &out);
+        if (rc != TPM_RC_SUCCESS) {
+        #ifdef DEBUG_WOLFTPM
+            printf("TPM2_GetCapability handles failed 0x%x: %s\n", rc,
+                TPM2_GetRCString(rc));
+        #endif
+            return rc;
+        }
+        if (out.capabilityData.capability != TPM_CAP_HANDLES)
+            return TPM_RC_FAILURE;
+
+        for (i = 0; i < list->count && found < *count; i++) {
+            /* the TPM only returns the requested type, except that loaded
+             * and saved sessions are listed as HMAC or policy sessions */
+            if (session && (list->handle[i] & ~HR_HANDLE_MASK) !=
+                        HMAC_SESSION_FIRST &&
+                    (list->handle[i] & ~HR_HANDLE_MASK) !=
+                        POLICY_SESSION_FIRST) {
+                continue;
+            }
+            handles[found++] = list->handle[i];
+        }
+        if (list->count == 0)
+            break;
+        /* next query in the requested handle type */
+        in.property = (handleStart & ~HR_HANDLE_MASK) |
+            ((list->handle[list->count - 1] & HR_HANDLE_MASK) + 1);
+    } while (out.moreData == YES && found < *count);
+
+    *count = found;
+    return TPM_RC_SUCCESS;
+}
+
+/* Flush the handles in use of one handle type. The list is taken again,
+ * after the last handle, while the TPM reported more than fit. A failed
+ * flush (such as a handle another process flushed first) is counted and
+ * the others are still flushed. Returns the first error. */
+static int wolfTPM2_UnloadHandleType(WOLFTPM2_DEV* dev, TPM_HANDLE first,
+    word32* flushed, word32* failed)
+{
+    int rc, firstRc = TPM_RC_SUCCESS;
+    word32 i, count;
+    TPM_HANDLE handles[MAX_ACTIVE_SESSIONS];
+    FlushContext_In in;
+
+    do {
+        count = (word32)(sizeof(handles) / sizeof(handles[0]));
+        rc = wolfTPM2_GetHandles(dev, first, handles, &count);
+        if (rc != TPM_RC_SUCCESS)
+            return (firstRc != TPM_RC_SUCCESS) ? firstRc : rc;
+
+        for (i = 0; i < count; i++) {
+            XMEMSET(&in, 0, sizeof(in));
+            in.flushHandle = handles[i];
+            rc = TPM2_FlushContext(&in);
+            if (rc != TPM_RC_SUCCESS) {
+            #ifdef DEBUG_WOLFTPM
+                printf("TPM2_FlushContext 0x%x failed %d: %s\n",
+                    (word32)handles[i], rc, wolfTPM2_GetRCString(rc));
+            #endif
+                if (firstRc == TPM_RC_SUCCESS)
+                    firstRc = rc;
+                (*failed)++;
+                continue;
+            }
+            (*flushed)++;
+        }
+        /* handles that failed may still be listed */
+        if (count > 0) {
+            first = (first & ~HR_HANDLE_MASK) |
+                ((handles[count - 1] & HR_HANDLE_MASK) + 1);
+        }
+    } while (count == (word32)(sizeof(handles) / sizeof(handles[0])));
+
+    return firstRc;
+}
+
+int wolfTPM2_UnloadHandles_Loaded(WOLFTPM2_DEV* dev, int flags,
+    word32* flushed, word32* failed)
+{
+    int rc = TPM_RC_SUCCESS, typeRc;
+    word32 count = 0, errors = 0;
+
+    if (dev == NULL || (flags & WOLFTPM2_FLUSH_ALL) == 0)
+        return BAD_FUNC_ARG;
+
+    /* every type is flushed, even after an error in another */
+    if (flags & WOLFTPM2_FLUSH_TRANSIENT) {
+        rc = wolfTPM2_UnloadHandleType(dev, TRANSIENT_FIRST, &count, &errors);
+    }
+    if (flags & WOLFTPM2_FLUSH_LOADED_SESSIONS) {
+        typeRc = wolfTPM2_UnloadHandleType(dev, LOADED_SESSION_FIRST, &count,
+            &errors);
+        if (rc == TPM_RC_SUCCESS)
+            rc = typeRc;
+    }
+    if (flags & WOLFTPM2_FLUSH_SAVED_SESSIONS) {
+        typeRc = wolfTPM2_UnloadHandleType(dev, ACTIVE_SESSION_FIRST, &count,
+            &errors);
+        if (rc == TPM_RC_SUCCESS)
+            rc = typeRc;
+    }
+
+#ifdef DEBUG_WOLFTPM
+    printf("wolfTPM2_UnloadHandles_Loaded: flushed %d handles, %d failed\n",
+        (int)count, (int)errors);
+#endif
+    if (flushed != NULL)
+        *flushed = count;
+    if (failed != NULL)
+        *failed = errors;
+    return rc;
 }
 
 
@@ -4564,6 +5288,7 @@ int wolfTPM2_SetCryptoDevCb(WOLFTPM2_DEV* dev, CryptoDevCallbackFunc cb,
     if (dev == NULL || cb == NULL || tpmCtx == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     /* register a crypto device callback for TPM private key */
     rc = wolfTPM2_GetTpmDevId(dev);
@@ -4588,6 +5313,7 @@ int wolfTPM2_ClearCryptoDevCb(WOLFTPM2_DEV* dev, int devId)
     if (dev == NULL) {
         return BAD_FUNC_ARG;
     }
+    wolfTPM2_SelectDev(dev);
 
     /* get device Id */
     if (devId == INVALID_DEVID) {
@@ -0,0 +1,547 @@
+/* tis_sim_test.c
+ *
+ * Copyright (C) 2006-2020 wolfSSL Inc.
+ *
+ * This file is part of wolfTPM.
+ *
+ * wolfTPM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfTPM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+/* Tests the TIS command state machine against the TIS register simulator
+ * (tpm2_tis_sim.c), with commands executed in process, so it runs without
+ * TPM hardware or a SW TPM. */
+
+#include <wolftpm/tpm2.h>
+#include <wolftpm/tpm2_tis.h>
+#include <wolftpm/tpm2_tis_sim.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WOLFTPM_TIS_LOCK
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#endif
+
+#ifdef WOLFTPM_TIS
+
+#define Fail(description) do {                                                 \
+    printf("\nERROR - %s line %d failed: %s\n", __FILE__, __LINE__,           \
+        description);                                                          \
+    fflush(stdout);                                                            \
+    abort();                                                                   \
+} while(0)
+#define AssertTrue(x)     if (!(x)) Fail(#x)
+#define AssertIntEQ(x, y) if ((int)(x) != (int)(y)) Fail(#x " == " #y)
+
+static word32 SimGetU32(const byte* b)
+{
+    return ((word32)b[0] << 24) | ((word32)b[1] << 16) |
+           ((word32)b[2] << 8) | b[3];
+}
+
+static void SimPutU32(byte* b, word32 v)
+{
+    b[0] = (byte)(v >> 24); b[1] = (byte)(v >> 16);
+    b[2] = (byte)(v >> 8);  b[3] = (byte)v;
+}
+
+/* Execute callback of the TIS simulator. GetRandom returns bytes counting
+ * up from 0, all other commands succeed without parameters */
+static int SimExecute(TPM2_TIS_SIM* sim, void* execCtx)
+{
+    word32 cc = SimGetU32(&sim->cmd[6]);
+    int sz = TPM2_HEADER_SIZE, i, n;
+    (void)execCtx;
+
+    sim->rsp[0] = 0x80;
+    sim->rsp[1] = 0x01; /* TPM_ST_NO_SESSIONS */
+    SimPutU32(&sim->rsp[6], TPM_RC_SUCCESS);
+    if (cc == TPM_CC_GetRandom) {
+        n = (sim->cmd[10] << 8) | sim->cmd[11];
+        sim->rsp[sz++] = (byte)(n >> 8);
+        sim->rsp[sz++] = (byte)n;
+        for (i = 0; i < n; i++)
+            sim->rsp[sz++] = (byte)i;
+    }
+    SimPutU32(&sim->rsp[2], sz);
+    sim->rspSz = sz;
+    return TPM_RC_SUCCESS;
+}
+
+static int MakeGetRandom(byte* buf, int bytes)
+{
+    buf[0] = 0x80; buf[1] = 0x01;
+    SimPutU32(&buf[2], 12);
+    SimPutU32(&buf[6], TPM_CC_GetRandom);
+    buf[10] = (byte)(bytes >> 8);
+    buf[11] = (byte)bytes;
+    return 12;
+}
+
+static void CheckRandom(const byte* rnd, int sz)
+{
+    int i;
+    for (i = 0; i < sz; i++) {
+        AssertIntEQ(rnd[i], (byte)i);
+    }
+}
+
+static void test_TIS_Startup(TPM2_CTX* ctx, TPM2_TIS_SIM* sim)
+{
+    int rc;
+
+    rc = TPM2_Init(ctx, TPM2_TisSim_IoCb, sim);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertIntEQ(sim->locality, 0);
+    AssertIntEQ(ctx->did_vid, 0x00011014);
+
+    printf("Test TIS Sim:\tStartup:\tPassed\n");
+}
+
+static void test_TIS_Blocking(TPM2_TIS_SIM* sim)
+{
+    int rc;
+    GetRandom_In in;
+    GetRandom_Out out;
+
+    /* multiple bursts, with the FIFO stalling and a slow command */
+    sim->burstCount = 8;
+    sim->stallEvery = 3;
+    sim->execPolls = 50;
+
+    in.bytesRequested = 32;
+    rc = TPM2_GetRandom(&in, &out);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertIntEQ(out.randomBytes.size, 32);
+    CheckRandom(out.randomBytes.buffer, out.randomBytes.size);
+
+    printf("Test TIS Sim:\tBlocking:\tPassed\n");
+}
+
+static void test_TIS_Resumable(TPM2_CTX* ctx, TPM2_TIS_SIM* sim)
+{
+    int rc, yields = 0;
+    byte buf[MAX_RESPONSE_SIZE];
+    TPM2_ASYNC req;
+    GetRandom_In in;
+    GetRandom_Out out;
+
+    sim->execPolls = 20;
+
+    rc = TPM2_AsyncSubmit(ctx, &req, buf, MakeGetRandom(buf, 40),
+        sizeof(buf), NULL, NULL);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertIntEQ(TPM2_AsyncGetFd(&req), -1);
+
+    /* the context and bus are busy until the command completes */
+    in.bytesRequested = 8;
+    AssertIntEQ(TPM2_GetRandom(&in, &out), TPM_RC_RETRY);
+
+    while ((rc = TPM2_AsyncPoll(&req)) == TPM_RC_YIELDED) {
+        yields++;
+    }
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertTrue(yields >= (int)sim->execPolls);
+    AssertIntEQ(req.rspSz, TPM2_HEADER_SIZE + 2 + 40);
+    CheckRandom(&buf[TPM2_HEADER_SIZE + 2], 40);
+
+    printf("Test TIS Sim:\tResumable:\tPassed (%d yields)\n", yields);
+}
+
+#ifdef WOLFTPM_TIS_LOCK
+static void test_TIS_Lock(TPM2_CTX* ctx, TPM2_TIS_SIM* sim)
+{
+    int rc, fd;
+    byte buf[MAX_RESPONSE_SIZE];
+    TPM2_ASYNC req;
+
+    fd = open(WOLFTPM_TIS_LOCK_FILE, O_RDWR);
+    AssertTrue(fd >= 0);
+    sim->execPolls = 20;
+
+    /* another process is locked out for the whole command */
+    rc = TPM2_AsyncSubmit(ctx, &req, buf, MakeGetRandom(buf, 16),
+        sizeof(buf), NULL, NULL);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertIntEQ(flock(fd, LOCK_EX | LOCK_NB), -1);
+    AssertIntEQ(errno, EWOULDBLOCK);
+    AssertIntEQ(TPM2_AsyncPoll(&req), TPM_RC_YIELDED);
+    AssertIntEQ(flock(fd, LOCK_EX | LOCK_NB), -1);
+    AssertIntEQ(TPM2_AsyncWait(&req, -1), TPM_RC_SUCCESS);
+
+    AssertIntEQ(flock(fd, LOCK_EX | LOCK_NB), 0);
+    AssertIntEQ(flock(fd, LOCK_UN), 0);
+    close(fd);
+
+    printf("Test TIS Sim:\tLock:\t\tPassed\n");
+}
+#endif
+
+static void test_TIS_Cancel(TPM2_CTX* ctx, TPM2_TIS_SIM* sim)
+{
+    int rc;
+    word32 aborts = sim->aborts;
+    byte buf[MAX_RESPONSE_SIZE];
+    TPM2_ASYNC req;
+    GetRandom_In in;
+    GetRandom_Out out;
+
+    sim->execPolls = 1000;
+
+    rc = TPM2_AsyncSubmit(ctx, &req, buf, MakeGetRandom(buf, 16),
+        sizeof(buf), NULL, NULL);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertIntEQ(TPM2_AsyncPoll(&req), TPM_RC_YIELDED);
+    AssertIntEQ(TPM2_AsyncCancel(&req), TPM_RC_SUCCESS);
+    AssertIntEQ(TPM2_AsyncPoll(&req), TPM_RC_CANCELED);
+    AssertIntEQ(sim->aborts, aborts + 1);
+
+    /* next command runs normally */
+    sim->execPolls = 5;
+    in.bytesRequested = 16;
+    rc = TPM2_GetRandom(&in, &out);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    CheckRandom(out.randomBytes.buffer, out.randomBytes.size);
+
+    printf("Test TIS Sim:\tCancel:\t\tPassed\n");
+}
+
+static void test_TIS_Timeout(TPM2_CTX* ctx, TPM2_TIS_SIM* sim)
+{
+    int rc;
+    GetRandom_In in;
+    GetRandom_Out out;
+
+    (void)ctx;
+
+    /* the command never completes */
+    sim->execPolls = TPM_TIMEOUT_TRIES + 10;
+#ifdef WOLFTPM_TIMED_POLL
+    AssertIntEQ(TPM2_TIS_SetCommandTimeout(ctx, 50000), TPM_RC_SUCCESS);
+#endif
+    in.bytesRequested = 16;
+    rc = TPM2_GetRandom(&in, &out);
+    AssertIntEQ(rc, TPM_RC_TIMEOUT);
+#ifdef WOLFTPM_TIMED_POLL
+    AssertIntEQ(TPM2_TIS_SetCommandTimeout(ctx, 0), TPM_RC_SUCCESS);
+#endif
+
+    /* the next command aborts the stuck one and succeeds */
+    sim->execPolls = 0;
+    rc = TPM2_GetRandom(&in, &out);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+
+    printf("Test TIS Sim:\tTimeout:\tPassed\n");
+}
+
+static void test_TIS_Stats(TPM2_CTX* ctx, TPM2_TIS_SIM* sim)
+{
+    int rc;
+    GetRandom_In in;
+    GetRandom_Out out;
+    TPM2_TIS_STATS stats;
+
+    /* whole command and response fit in one burst */
+    sim->burstCount = 64;
+    sim->stallEvery = 0;
+    sim->execPolls = 0;
+
+    AssertIntEQ(TPM2_TIS_ResetStats(ctx), TPM_RC_SUCCESS);
+    in.bytesRequested = 32;
+    rc = TPM2_GetRandom(&in, &out);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    CheckRandom(out.randomBytes.buffer, out.randomBytes.size);
+
+    AssertIntEQ(TPM2_TIS_GetStats(ctx, &stats), TPM_RC_SUCCESS);
+    AssertIntEQ(stats.commands, 1);
+    AssertIntEQ(stats.fifoWrites, 1);
+    AssertIntEQ(stats.fifoReads, 2); /* header, then the rest */
+    AssertTrue(stats.lastCmdAccesses <= 10);
+    AssertIntEQ(stats.lastCmdAccesses, stats.regReads + stats.regWrites +
+        stats.fifoReads + stats.fifoWrites);
+
+#if MAX_TIS_FRAMESIZE > MAX_SPI_FRAMESIZE
+    {
+        /* I2C transfers are not limited to the SPI frame size */
+        byte buf[MAX_RESPONSE_SIZE];
+        TPM2_ASYNC req;
+
+        sim->burstCount = MAX_TIS_FRAMESIZE;
+        AssertIntEQ(TPM2_TIS_ResetStats(ctx), TPM_RC_SUCCESS);
+        rc = TPM2_AsyncSubmit(ctx, &req, buf, MakeGetRandom(buf, 128),
+            sizeof(buf), NULL, NULL);
+        AssertIntEQ(rc, TPM_RC_SUCCESS);
+        AssertIntEQ(TPM2_AsyncWait(&req, -1), TPM_RC_SUCCESS);
+        CheckRandom(&buf[TPM2_HEADER_SIZE + 2], 128);
+        AssertIntEQ(TPM2_TIS_GetStats(ctx, &stats), TPM_RC_SUCCESS);
+        AssertIntEQ(stats.fifoReads, 2);
+        sim->burstCount = 64;
+    }
+#endif
+
+    printf("Test TIS Sim:\tStats:\t\tPassed (%d accesses)\n",
+        (int)stats.lastCmdAccesses);
+}
+
+#ifdef WOLFTPM_TIS_PROFILE
+static void test_TIS_Profile(TPM2_CTX* ctx, TPM2_TIS_SIM* sim)
+{
+    int rc, i;
+    GetRandom_In in;
+    GetRandom_Out out;
+    TPM2_TIS_STATS stats;
+    TPM2_TIS_PROFILE profile;
+    const TPM2_TIS_PROFILE_CC* cmd;
+
+    sim->burstCount = 64;
+    sim->stallEvery = 0;
+    sim->execPolls = 2;
+
+    AssertIntEQ(TPM2_TIS_SetProfile(ctx, &profile), TPM_RC_SUCCESS);
+    AssertIntEQ(TPM2_TIS_ResetStats(ctx), TPM_RC_SUCCESS);
+    in.bytesRequested = 32;
+    for (i = 0; i < 2; i++) {
+        rc = TPM2_GetRandom(&in, &out);
+        AssertIntEQ(rc, TPM_RC_SUCCESS);
+    }
+    /* wait states reported by the HAL outside a command */
+    TPM2_TIS_ProfileWaitStates(ctx, 3);
+    AssertIntEQ(TPM2_TIS_SetProfile(ctx, NULL), TPM_RC_SUCCESS);
+    rc = TPM2_GetRandom(&in, &out);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+
+    AssertIntEQ(TPM2_TIS_GetStats(ctx, &stats), TPM_RC_SUCCESS);
+    cmd = TPM2_TIS_GetProfile(&profile, TPM_CC_GetRandom);
+    AssertTrue(cmd != NULL);
+    AssertIntEQ(cmd->commands, 2);
+    AssertIntEQ(cmd->fifoWrites, 2);
+    AssertIntEQ(cmd->fifoReads, 4);
+    AssertIntEQ(cmd->polls, (stats.polls - stats.lastCmdPolls));
+    AssertIntEQ(cmd->polls, 4);
+    AssertTrue(cmd->burstReads >= 2 && cmd->stsReads >= cmd->burstReads);
+    AssertIntEQ(cmd->stsReads + cmd->fifoWrites + cmd->fifoReads +
+        cmd->regAccesses, 2 * stats.lastCmdAccesses);
+    AssertTrue(cmd->bytes > 2 * (12 + TPM2_HEADER_SIZE + 2 + 32));
+    AssertIntEQ(cmd->ioErrors, 0);
+    AssertIntEQ(cmd->waitStates, 0);
+    AssertTrue(TPM2_TIS_GetProfile(&profile, TPM_CC_SelfTest) == NULL);
+
+    cmd = TPM2_TIS_GetProfile(&profile, 0);
+    AssertTrue(cmd != NULL);
+    AssertIntEQ(cmd->commands, 0);
+    AssertIntEQ(cmd->waitStates, 3);
+    AssertIntEQ(profile.dropped, 0);
+
+    printf("Test TIS Sim:\tProfile:\tPassed (%u bytes)\n",
+        (unsigned)(TPM2_TIS_GetProfile(&profile,
+            TPM_CC_GetRandom)->bytes / 2));
+}
+#endif
+
+/* transport decorator counting the commands sent through it */
+typedef struct CountTransport {
+    const TPM2_TRANSPORT* inner;
+    void* innerCtx;
+    int commands;
+} CountTransport;
+
+static int CountSend(TPM2_CTX* ctx, byte* buf, int cmdSz, int bufSz,
+    void* transportCtx)
+{
+    CountTransport* count = (CountTransport*)transportCtx;
+    count->commands++;
+    return count->inner->sendCommand(ctx, buf, cmdSz, bufSz, count->innerCtx);
+}
+
+static int CountAsyncSend(TPM2_CTX* ctx, TPM2_ASYNC* req, void* transportCtx)
+{
+    CountTransport* count = (CountTransport*)transportCtx;
+    count->commands++;
+    return count->inner->asyncSend(ctx, req, count->innerCtx);
+}
+
+static int CountAsyncRecv(TPM2_CTX* ctx, TPM2_ASYNC* req, void* transportCtx)
+{
+    CountTransport* count = (CountTransport*)transportCtx;
+    return count->inner->asyncRecv(ctx, req, count->innerCtx);
+}
+
+static int CountAsyncCancel(TPM2_CTX* ctx, TPM2_ASYNC* req,
+    void* transportCtx)
+{
+    CountTransport* count = (CountTransport*)transportCtx;
+    return count->inner->asyncCancel(ctx, req, count->innerCtx);
+}
+
+static const TPM2_TRANSPORT gCountTransport = {
+    "count", TPM2_TRANSPORT_FLAG_SHARED_BUS, CountSend,
+    CountAsyncSend, CountAsyncRecv, CountAsyncCancel, NULL
+};
+
+/* in-process backend running the simulated TPM without the TIS registers */
+static int DirectSend(TPM2_CTX* ctx, byte* buf, int cmdSz, int bufSz,
+    void* transportCtx)
+{
+    TPM2_TIS_SIM* sim = (TPM2_TIS_SIM*)transportCtx;
+    (void)ctx;
+
+    XMEMCPY(sim->cmd, buf, cmdSz);
+    sim->cmdSz = cmdSz;
+    SimExecute(sim, NULL);
+    if (sim->rspSz > bufSz)
+        return TPM_RC_SIZE;
+    XMEMCPY(buf, sim->rsp, sim->rspSz);
+    return TPM_RC_SUCCESS;
+}
+
+static const TPM2_TRANSPORT gDirectTransport = {
+    "direct", 0, DirectSend, NULL, NULL, NULL, NULL
+};
+
+static void test_Transport(TPM2_CTX* ctx, TPM2_TIS_SIM* sim)
+{
+    int rc;
+    void* builtinCtx;
+    byte buf[MAX_RESPONSE_SIZE];
+    TPM2_ASYNC req;
+    GetRandom_In in;
+    GetRandom_Out out;
+    CountTransport count;
+    TPM2_CTX directCtx;
+    static TPM2_TIS_SIM directSim;
+
+    sim->execPolls = 2;
+    in.bytesRequested = 16;
+
+    /* decorator around the built-in TIS transport */
+    count.inner = TPM2_GetTransport(ctx, &builtinCtx);
+    count.innerCtx = builtinCtx;
+    count.commands = 0;
+    AssertTrue(count.inner == TPM2_TIS_GetTransport());
+    AssertIntEQ(TPM2_SetTransport(ctx, &gCountTransport, &count),
+        TPM_RC_SUCCESS);
+
+    rc = TPM2_GetRandom(&in, &out);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    CheckRandom(out.randomBytes.buffer, out.randomBytes.size);
+    rc = TPM2_AsyncSubmit(ctx, &req, buf, MakeGetRandom(buf, 16),
+        sizeof(buf), NULL, NULL);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertIntEQ(TPM2_SetTransport(ctx, NULL, NULL), TPM_RC_RETRY);
+    AssertIntEQ(TPM2_AsyncWait(&req, -1), TPM_RC_SUCCESS);
+    AssertIntEQ(count.commands, 2);
+
+    AssertIntEQ(TPM2_SetTransport(ctx, NULL, NULL), TPM_RC_SUCCESS);
+    AssertTrue(TPM2_GetTransport(ctx, NULL) == TPM2_TIS_GetTransport());
+    rc = TPM2_GetRandom(&in, &out);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertIntEQ(count.commands, 2);
+
+    /* in-process backend on a second context, no HAL IO callback */
+    AssertIntEQ(TPM2_TisSim_Init(&directSim), TPM_RC_SUCCESS);
+    AssertIntEQ(TPM2_Init_Transport(&directCtx, &gDirectTransport,
+        &directSim), TPM_RC_SUCCESS);
+    rc = TPM2_GetRandom(&in, &out);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    CheckRandom(out.randomBytes.buffer, out.randomBytes.size);
+    rc = TPM2_AsyncSubmit(&directCtx, &req, buf, MakeGetRandom(buf, 8),
+        sizeof(buf), NULL, NULL);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertIntEQ(TPM2_AsyncWait(&req, -1), TPM_RC_SUCCESS);
+    AssertIntEQ(req.rspSz, TPM2_HEADER_SIZE + 2 + 8);
+    TPM2_Cleanup(&directCtx);
+    TPM2_SetActiveCtx(ctx);
+
+    printf("Test TIS Sim:\tTransport:\tPassed\n");
+}
+
+#if defined(WOLFTPM_TIMED_POLL) && defined(__linux__)
+static void test_TIS_Backoff(TPM2_CTX* ctx, TPM2_TIS_SIM* sim)
+{
+    int rc, i;
+    word32 firstPolls, lastPolls;
+    SelfTest_In in;
+    TPM2_TIS_STATS stats;
+
+    /* a 20ms command, polled with backoff instead of spinning */
+    sim->execPolls = 0;
+    sim->execUs = 20000;
+    in.fullTest = YES;
+
+    rc = TPM2_SelfTest(&in);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertIntEQ(TPM2_TIS_GetStats(ctx, &stats), TPM_RC_SUCCESS);
+    firstPolls = stats.lastCmdPolls;
+    AssertTrue(firstPolls < 100);
+
+    /* once the duration is learned the first poll is near completion */
+    for (i = 0; i < 8; i++) {
+        rc = TPM2_SelfTest(&in);
+        AssertIntEQ(rc, TPM_RC_SUCCESS);
+    }
+    AssertIntEQ(TPM2_TIS_GetStats(ctx, &stats), TPM_RC_SUCCESS);
+    lastPolls = stats.lastCmdPolls;
+    AssertTrue(lastPolls < firstPolls);
+    sim->execUs = 0;
+
+    printf("Test TIS Sim:\tBackoff:\tPassed (%d then %d polls)\n",
+        (int)firstPolls, (int)lastPolls);
+}
+#endif
+
+int main(void)
+{
+    TPM2_CTX ctx;
+    /* too large for the stack of some test runners */
+    static TPM2_TIS_SIM sim;
+
+    TPM2_TisSim_Init(&sim);
+    sim.execCb = SimExecute;
+    sim.burstCount = 64;
+
+    test_TIS_Startup(&ctx, &sim);
+    test_TIS_Blocking(&sim);
+    test_TIS_Resumable(&ctx, &sim);
+#ifdef WOLFTPM_TIS_LOCK
+    test_TIS_Lock(&ctx, &sim);
+#endif
+    test_TIS_Cancel(&ctx, &sim);
+    test_TIS_Timeout(&ctx, &sim);
+    test_TIS_Stats(&ctx, &sim);
+#ifdef WOLFTPM_TIS_PROFILE
+    test_TIS_Profile(&ctx, &sim);
+#endif
+    test_Transport(&ctx, &sim);
+#if defined(WOLFTPM_TIMED_POLL) && defined(__linux__)
+    test_TIS_Backoff(&ctx, &sim);
+#endif
+
+    TPM2_Cleanup(&ctx);
+    TPM2_TisSim_Cleanup(&sim);
+    return 0;
+}
+
+#else
+
+int main(void)
+{
+    printf("TIS simulator test requires the TIS (SPI/I2C) transport\n");
+    return 0;
+}
+
+#endif
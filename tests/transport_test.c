@@ -0,0 +1,652 @@
+/* transport_test.c
+ *
+ * Copyright (C) 2006-2020 wolfSSL Inc.
+ *
+ * This file is part of wolfTPM.
+ *
+ * wolfTPM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfTPM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+/* Tests the transports layered on another transport (replay, object
+ * manager), the command hooks against in-process TPMs and switching between
+ * the built backends. Built for every TPM interface, no TPM is needed. */
+
+#include <wolftpm/tpm2.h>
+#include <wolftpm/tpm2_tis.h>
+#include <wolftpm/tpm2_linux.h>
+#include <wolftpm/tpm2_swtpm.h>
+#include <wolftpm/tpm2_replay.h>
+#include <wolftpm/tpm2_stats.h>
+#include <wolftpm/tpm2_objmgr.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define Fail(description) do {                                                 \
+    printf("\nERROR - %s line %d failed: %s\n", __FILE__, __LINE__,           \
+        description);                                                          \
+    fflush(stdout);                                                            \
+    abort();                                                                   \
+} while(0)
+#define AssertTrue(x)     if (!(x)) Fail(#x)
+#define AssertIntEQ(x, y) if ((int)(x) != (int)(y)) Fail(#x " == " #y)
+
+static word32 GetU32(const byte* b)
+{
+    return ((word32)b[0] << 24) | ((word32)b[1] << 16) |
+           ((word32)b[2] << 8) | b[3];
+}
+
+static void PutU32(byte* b, word32 v)
+{
+    b[0] = (byte)(v >> 24); b[1] = (byte)(v >> 16);
+    b[2] = (byte)(v >> 8);  b[3] = (byte)v;
+}
+
+/* in-process TPM counting the commands sent to it. GetRandom returns bytes
+ * counting up from 0, all other commands succeed without parameters */
+typedef struct TestTpm {
+    int commands;
+    int cleanups;
+} TestTpm;
+
+static int TestSend(TPM2_CTX* ctx, byte* buf, int cmdSz, int bufSz,
+    void* transportCtx)
+{
+    TestTpm* tpm = (TestTpm*)transportCtx;
+    word32 cc = GetU32(&buf[6]);
+    int sz = TPM2_HEADER_SIZE, i, n = 0;
+    (void)ctx;
+    (void)cmdSz;
+
+    tpm->commands++;
+    if (cc == TPM_CC_GetRandom)
+        n = (buf[10] << 8) | buf[11];
+    if (TPM2_HEADER_SIZE + 2 + n > bufSz)
+        return TPM_RC_SIZE;
+
+    buf[0] = 0x80;
+    buf[1] = 0x01; /* TPM_ST_NO_SESSIONS */
+    PutU32(&buf[6], TPM_RC_SUCCESS);
+    if (cc == TPM_CC_GetRandom) {
+        buf[sz++] = (byte)(n >> 8);
+        buf[sz++] = (byte)n;
+        for (i = 0; i < n; i++)
+            buf[sz++] = (byte)i;
+    }
+    PutU32(&buf[2], sz);
+    return TPM_RC_SUCCESS;
+}
+
+/* the response is built on the first poll, so an asynchronous command is
+ * still pending after submit */
+static int TestAsyncSend(TPM2_CTX* ctx, TPM2_ASYNC* req, void* transportCtx)
+{
+    (void)ctx;
+    (void)req;
+    (void)transportCtx;
+    return TPM_RC_SUCCESS;
+}
+
+static int TestAsyncRecv(TPM2_CTX* ctx, TPM2_ASYNC* req, void* transportCtx)
+{
+    return TestSend(ctx, req->buf, req->cmdSz, req->bufSz, transportCtx);
+}
+
+static void TestCleanup(TPM2_CTX* ctx, void* transportCtx)
+{
+    TestTpm* tpm = (TestTpm*)transportCtx;
+    (void)ctx;
+    tpm->cleanups++;
+}
+
+static const TPM2_TRANSPORT gTestTransport = {
+    "test", 0, TestSend, TestAsyncSend, TestAsyncRecv, NULL, TestCleanup
+};
+
+#if defined(WOLFTPM_REPLAY) && !defined(NO_FILESYSTEM)
+#define REPLAY_TRACE_FILE "transport_replay.trc"
+
+static void CheckRandom(const byte* rnd, int sz)
+{
+    int i;
+    for (i = 0; i < sz; i++) {
+        AssertIntEQ(rnd[i], (byte)i);
+    }
+}
+
+/* command with two handles, one session with a nonce and HMAC, and an
+ * encrypted first parameter followed by a clear one */
+static int MakeSessionCmd(byte* buf, byte seed, byte clear)
+{
+    int sz = TPM2_HEADER_SIZE, i;
+
+    buf[0] = 0x80; buf[1] = 0x02;
+    PutU32(&buf[6], TPM_CC_NV_Write);
+    PutU32(&buf[sz], 0x01000000); sz += 4;
+    PutU32(&buf[sz], 0x01000000); sz += 4;
+    PutU32(&buf[sz], 4 + 2 + 16 + 1 + 2 + 32); sz += 4;
+    PutU32(&buf[sz], 0x02000000); sz += 4;
+    buf[sz++] = 0; buf[sz++] = 16;
+    for (i = 0; i < 16; i++)
+        buf[sz++] = (byte)(seed + i);
+    buf[sz++] = TPMA_SESSION_decrypt;
+    buf[sz++] = 0; buf[sz++] = 32;
+    for (i = 0; i < 32; i++)
+        buf[sz++] = (byte)(seed * 3 + i);
+    buf[sz++] = 0; buf[sz++] = 4;
+    for (i = 0; i < 4; i++)
+        buf[sz++] = (byte)(seed ^ i);
+    buf[sz++] = 0; buf[sz++] = clear;
+    PutU32(&buf[2], sz);
+    return sz;
+}
+
+static int ReplayCmd(TPM2_CTX* ctx, byte* buf, int cmdSz, int bufSz)
+{
+    TPM2_ASYNC req;
+    int rc;
+
+    rc = TPM2_AsyncSubmit(ctx, &req, buf, cmdSz, bufSz, NULL, NULL);
+    if (rc == TPM_RC_SUCCESS)
+        rc = TPM2_AsyncWait(&req, -1);
+    return rc;
+}
+
+static void test_Replay(TPM2_CTX* ctx, TestTpm* tpm)
+{
+    int rc;
+    byte buf[MAX_RESPONSE_SIZE];
+    byte trace[1024];
+    word32 traceSz = sizeof(trace);
+    GetRandom_In in;
+    GetRandom_Out out;
+    TPM2_REPLAY replay;
+    TPM2_AUTH_SESSION session[1];
+    TPM2_CTX replayCtx;
+    int commands, cleanups;
+
+    in.bytesRequested = 16;
+
+    /* record through the TPM transport */
+    AssertIntEQ(TPM2_Replay_Record(ctx, &replay, REPLAY_TRACE_FILE),
+        TPM_RC_SUCCESS);
+    rc = TPM2_GetRandom(&in, &out);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    rc = ReplayCmd(ctx, buf, MakeSessionCmd(buf, 1, 7), sizeof(buf));
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertIntEQ(replay.commands, 2);
+    AssertIntEQ(TPM2_Replay_Stop(ctx, &replay), TPM_RC_SUCCESS);
+    AssertTrue(TPM2_GetTransport(ctx, NULL) == &gTestTransport);
+
+    /* replay from memory, the TPM is not used */
+    AssertIntEQ(TPM2_Replay_LoadFile(REPLAY_TRACE_FILE, trace, &traceSz),
+        TPM_RC_SUCCESS);
+    remove(REPLAY_TRACE_FILE);
+    AssertIntEQ(TPM2_Replay_Start(ctx, &replay, trace, traceSz, 0),
+        TPM_RC_SUCCESS);
+    AssertIntEQ(replay.entries, 2);
+    commands = tpm->commands;
+
+    XMEMSET(&out, 0, sizeof(out));
+    rc = TPM2_GetRandom(&in, &out);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    CheckRandom(out.randomBytes.buffer, out.randomBytes.size);
+
+    /* other nonce, HMAC and encrypted parameter, recorded nonce restored */
+    XMEMSET(session, 0, sizeof(session));
+    session[0].sessionHandle = 0x02000000;
+    session[0].nonceCaller.size = 16;
+    AssertIntEQ(TPM2_SetSessionAuth(session), TPM_RC_SUCCESS);
+    rc = ReplayCmd(ctx, buf, MakeSessionCmd(buf, 9, 7), sizeof(buf));
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertIntEQ(session[0].nonceCaller.buffer[0], 1);
+    AssertIntEQ(TPM2_SetSessionAuth(NULL), TPM_RC_SUCCESS);
+
+    /* a different clear parameter is not in the trace */
+    rc = ReplayCmd(ctx, buf, MakeSessionCmd(buf, 1, 8), sizeof(buf));
+    AssertIntEQ(rc, TPM_RC_FAILURE);
+
+    /* a repeated command matches the last entry again, then the trace
+     * continues from the start */
+    rc = ReplayCmd(ctx, buf, MakeSessionCmd(buf, 1, 7), sizeof(buf));
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    rc = TPM2_GetRandom(&in, &out);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+
+    AssertIntEQ(replay.commands, 5);
+    AssertIntEQ(replay.exact, 3);
+    AssertIntEQ(replay.masked, 1);
+    AssertIntEQ(replay.misses, 1);
+    AssertIntEQ(tpm->commands, commands);
+    AssertIntEQ(TPM2_Replay_Stop(ctx, &replay), TPM_RC_SUCCESS);
+
+    /* loose matching serves the expected entry for other parameters */
+    AssertIntEQ(TPM2_Replay_Start(ctx, &replay, trace, traceSz,
+        TPM2_REPLAY_FLAG_LOOSE), TPM_RC_SUCCESS);
+    rc = TPM2_GetRandom(&in, &out);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    rc = ReplayCmd(ctx, buf, MakeSessionCmd(buf, 1, 8), sizeof(buf));
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertIntEQ(replay.loose, 1);
+    AssertIntEQ(TPM2_Replay_Stop(ctx, &replay), TPM_RC_SUCCESS);
+
+    /* back on the TPM */
+    rc = TPM2_GetRandom(&in, &out);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertIntEQ(tpm->commands, commands + 1);
+
+    /* cleanup while replaying releases the TPM transport */
+    AssertIntEQ(TPM2_Init_Transport(&replayCtx, &gTestTransport, tpm),
+        TPM_RC_SUCCESS);
+    AssertIntEQ(TPM2_Replay_Start(&replayCtx, &replay, trace, traceSz, 0),
+        TPM_RC_SUCCESS);
+    cleanups = tpm->cleanups;
+    TPM2_Cleanup(&replayCtx);
+    AssertIntEQ(tpm->cleanups, cleanups + 1);
+    TPM2_SetActiveCtx(ctx);
+
+    printf("Test Transport:\tReplay:\t\tPassed\n");
+}
+#endif
+
+#ifdef WOLFTPM_HOOKS
+static int MakeGetRandom(byte* buf, int bytes)
+{
+    buf[0] = 0x80; buf[1] = 0x01;
+    PutU32(&buf[2], 12);
+    PutU32(&buf[6], TPM_CC_GetRandom);
+    buf[10] = (byte)(bytes >> 8);
+    buf[11] = (byte)bytes;
+    return 12;
+}
+
+typedef struct HookLog {
+    int events[3];
+    TPM2_HOOK_INFO last;
+    int outOfOrder;
+} HookLog;
+
+static void LogHook(TPM2_CTX* ctx, TPM2_HOOK_EVENT event,
+    const TPM2_HOOK_INFO* info, void* hookCtx)
+{
+    HookLog* log = (HookLog*)hookCtx;
+    (void)ctx;
+
+    log->events[event]++;
+    if (info->sendNs < info->startNs ||
+            (event != TPM2_HOOK_SEND && info->recvNs < info->sendNs) ||
+            (event == TPM2_HOOK_DONE && info->doneNs < info->recvNs)) {
+        log->outOfOrder++;
+    }
+    log->last = *info;
+}
+
+static void test_Hooks(TPM2_CTX* ctx)
+{
+    int rc, len, i;
+    byte buf[MAX_RESPONSE_SIZE];
+    const char* line;
+    /* too large for the stack of some test runners */
+    static char text[32 * 1024];
+    TPM2_ASYNC req;
+    GetRandom_In in;
+    GetRandom_Out out;
+    HookLog log;
+    TPM2_STATS stats;
+    const TPM2_STATS_CC* cmd;
+    word32 us;
+
+    in.bytesRequested = 16;
+
+    XMEMSET(&log, 0, sizeof(log));
+    AssertIntEQ(TPM2_SetHook(ctx, LogHook, &log), TPM_RC_SUCCESS);
+    rc = TPM2_GetRandom(&in, &out);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertIntEQ(log.events[TPM2_HOOK_SEND], 1);
+    AssertIntEQ(log.events[TPM2_HOOK_RECV], 1);
+    AssertIntEQ(log.events[TPM2_HOOK_DONE], 1);
+    AssertIntEQ(log.last.cc, TPM_CC_GetRandom);
+    AssertIntEQ(log.last.rc, TPM_RC_SUCCESS);
+    AssertIntEQ(log.last.cmdSz, 12);
+    AssertIntEQ(log.last.rspSz, TPM2_HEADER_SIZE + 2 + 16);
+    AssertIntEQ(log.last.sessions, 0);
+
+    rc = TPM2_AsyncSubmit(ctx, &req, buf, MakeGetRandom(buf, 8),
+        sizeof(buf), NULL, NULL);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertIntEQ(log.events[TPM2_HOOK_SEND], 2);
+    AssertIntEQ(log.events[TPM2_HOOK_DONE], 1);
+    AssertIntEQ(TPM2_AsyncWait(&req, -1), TPM_RC_SUCCESS);
+    AssertIntEQ(log.events[TPM2_HOOK_DONE], 2);
+    AssertIntEQ(log.last.rspSz, TPM2_HEADER_SIZE + 2 + 8);
+    AssertIntEQ(log.outOfOrder, 0);
+
+    /* statistics registry */
+    AssertIntEQ(TPM2_Stats_Init(&stats), TPM_RC_SUCCESS);
+    AssertIntEQ(TPM2_SetHook(ctx, TPM2_Stats_Hook, &stats), TPM_RC_SUCCESS);
+    rc = TPM2_GetRandom(&in, &out);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    rc = TPM2_GetRandom(&in, &out);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    rc = TPM2_AsyncSubmit(ctx, &req, buf, MakeGetRandom(buf, 8),
+        sizeof(buf), NULL, NULL);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertIntEQ(TPM2_AsyncWait(&req, -1), TPM_RC_SUCCESS);
+    AssertIntEQ(TPM2_SetHook(ctx, NULL, NULL), TPM_RC_SUCCESS);
+
+    cmd = TPM2_Stats_Get(&stats, TPM_CC_GetRandom);
+    AssertTrue(cmd != NULL);
+    AssertIntEQ(cmd->count, 3);
+    AssertIntEQ(cmd->errors, 0);
+    AssertTrue(TPM2_Stats_Get(&stats, TPM_CC_SelfTest) == NULL);
+    AssertIntEQ(TPM2_Stats_Percentile(cmd, 5000, &us), TPM_RC_SUCCESS);
+    AssertTrue(us >= cmd->maxUs / 2);
+    AssertIntEQ(TPM2_Stats_Percentile(cmd, 10000, &us), TPM_RC_SUCCESS);
+    AssertTrue(us >= cmd->maxUs);
+
+    len = TPM2_Stats_Dump(&stats, text, sizeof(text));
+    AssertTrue(len > 0 && len == (int)XSTRLEN(text));
+    AssertTrue(strstr(text, "wolftpm_command_latency_microseconds_count"
+        "{cc=\"0x0000017b\"} 3\n") != NULL);
+    AssertTrue(strstr(text, "wolftpm_command_errors_total"
+        "{cc=\"0x0000017b\"} 0\n") != NULL);
+    /* every bucket is written, the last finite one holds all samples */
+    AssertTrue(strstr(text, "wolftpm_command_latency_microseconds_bucket"
+        "{cc=\"0x0000017b\",le=\"62914560\"} 3\n") != NULL);
+    for (i = 0, line = text; (line = strstr(line,
+            "_bucket{cc=\"0x0000017b\"")) != NULL; line++) {
+        i++;
+    }
+    AssertIntEQ(i, TPM2_STATS_BUCKETS);
+    AssertIntEQ(TPM2_Stats_Dump(&stats, text, 64), BUFFER_E);
+
+    printf("Test Transport:\tHooks:\t\tPassed\n");
+}
+#endif
+
+#ifdef WOLFTPM_OBJMGR
+/* in-process TPM with three object slots. Objects are numbered from 1 and
+ * their saved context holds the number. */
+#define SLOT_TPM_SLOTS 3
+typedef struct SlotTpm {
+    word32 slot[SLOT_TPM_SLOTS];    /* object number, 0 when free */
+    word32 next;
+} SlotTpm;
+
+static int SlotSend(TPM2_CTX* ctx, byte* buf, int cmdSz, int bufSz,
+    void* transportCtx)
+{
+    SlotTpm* tpm = (SlotTpm*)transportCtx;
+    word32 cc = GetU32(&buf[6]), obj = 0, rc = TPM_RC_SUCCESS;
+    word32 sz = TPM2_HEADER_SIZE, idx;
+    int i;
+    (void)ctx;
+    (void)cmdSz;
+    (void)bufSz;
+
+    idx = GetU32(&buf[TPM2_HEADER_SIZE]) - TRANSIENT_FIRST;
+    switch (cc) {
+        case TPM_CC_CreatePrimary:
+            obj = tpm->next + 1;
+            break;
+        case TPM_CC_ContextLoad:
+            /* sequence, savedHandle, hierarchy, blob size */
+            obj = GetU32(&buf[TPM2_HEADER_SIZE + 18]);
+            break;
+        case TPM_CC_ReadPublic:
+        case TPM_CC_ContextSave:
+        case TPM_CC_FlushContext:
+            if (idx >= SLOT_TPM_SLOTS || tpm->slot[idx] == 0) {
+                rc = TPM_RC_HANDLE;
+            }
+            else if (cc == TPM_CC_FlushContext) {
+                tpm->slot[idx] = 0;
+            }
+            else if (cc == TPM_CC_ReadPublic) {
+                PutU32(&buf[sz], tpm->slot[idx]);
+                sz += 4;
+            }
+            else {
+                XMEMSET(&buf[sz], 0, 8);
+                PutU32(&buf[sz + 8], TRANSIENT_FIRST);
+                PutU32(&buf[sz + 12], TPM_RH_OWNER);
+                buf[sz + 16] = 0;
+                buf[sz + 17] = 4;
+                PutU32(&buf[sz + 18], tpm->slot[idx]);
+                sz += 22;
+            }
+            break;
+        default:
+            rc = TPM_RC_COMMAND_CODE;
+            break;
+    }
+    if (obj != 0) {
+        for (i = 0; i < SLOT_TPM_SLOTS && tpm->slot[i] != 0; i++);
+        if (i == SLOT_TPM_SLOTS) {
+            rc = TPM_RC_OBJECT_MEMORY;
+        }
+        else {
+            if (cc == TPM_CC_CreatePrimary)
+                tpm->next++;
+            tpm->slot[i] = obj;
+            PutU32(&buf[sz], TRANSIENT_FIRST + i);
+            sz += 4;
+        }
+    }
+    if (rc != TPM_RC_SUCCESS)
+        sz = TPM2_HEADER_SIZE;
+
+    buf[0] = 0x80;
+    buf[1] = 0x01; /* TPM_ST_NO_SESSIONS */
+    PutU32(&buf[2], sz);
+    PutU32(&buf[6], rc);
+    return TPM_RC_SUCCESS;
+}
+
+static const TPM2_TRANSPORT gSlotTransport = {
+    "slots", 0, SlotSend, NULL, NULL, NULL, NULL
+};
+
+/* Send a command with one handle (or handle parameter), returns the
+ * response code */
+static word32 SlotCmd(TPM2_CTX* ctx, byte* buf, TPM_CC cc, word32 handle)
+{
+    TPM2_ASYNC req;
+
+    buf[0] = 0x80;
+    buf[1] = 0x01;
+    PutU32(&buf[2], TPM2_HEADER_SIZE + 4);
+    PutU32(&buf[6], cc);
+    PutU32(&buf[10], handle);
+    AssertIntEQ(TPM2_AsyncSubmit(ctx, &req, buf, TPM2_HEADER_SIZE + 4,
+        MAX_RESPONSE_SIZE, NULL, NULL), TPM_RC_SUCCESS);
+    return TPM2_AsyncWait(&req, -1);
+}
+
+/* too large for the stack of some test runners */
+static TPM2_OBJMGR gObjMgr;
+
+static void test_ObjMgr(TPM2_CTX* ctx)
+{
+    int i;
+    word32 saves;
+    byte buf[MAX_RESPONSE_SIZE];
+    TPM_HANDLE handles[8];
+    TPM2_CTX objCtx;
+    SlotTpm tpm;
+    TPM2_OBJMGR* mgr = &gObjMgr;
+    TPM2_ASYNC req;
+
+    XMEMSET(&tpm, 0, sizeof(tpm));
+    AssertIntEQ(TPM2_Init_Transport(&objCtx, &gSlotTransport, &tpm),
+        TPM_RC_SUCCESS);
+    AssertIntEQ(TPM2_ObjMgr_Start(&objCtx, mgr, 0), TPM_RC_SUCCESS);
+
+    /* more objects than slots, the oldest are saved and flushed */
+    for (i = 0; i < 8; i++) {
+        AssertIntEQ(SlotCmd(&objCtx, buf, TPM_CC_CreatePrimary,
+            TPM_RH_OWNER), TPM_RC_SUCCESS);
+        handles[i] = GetU32(&buf[TPM2_HEADER_SIZE]);
+        AssertTrue(handles[i] >= TPM2_OBJMGR_HANDLE_FIRST &&
+                   handles[i] <= TPM2_OBJMGR_HANDLE_LAST);
+    }
+    AssertIntEQ(mgr->loaded, SLOT_TPM_SLOTS);
+    AssertIntEQ(mgr->evictions, 8 - SLOT_TPM_SLOTS);
+    AssertIntEQ(mgr->saves, 8 - SLOT_TPM_SLOTS);
+
+    /* each handle reaches its object, reloaded as needed */
+    for (i = 0; i < 8; i++) {
+        AssertIntEQ(SlotCmd(&objCtx, buf, TPM_CC_ReadPublic, handles[i]),
+            TPM_RC_SUCCESS);
+        AssertIntEQ(GetU32(&buf[TPM2_HEADER_SIZE]), i + 1);
+    }
+    AssertIntEQ(mgr->reloads, 8);
+    /* every key has a saved context now, evicting only flushes */
+    saves = mgr->saves;
+    for (i = 0; i < 8; i++) {
+        AssertIntEQ(SlotCmd(&objCtx, buf, TPM_CC_ReadPublic, handles[i]),
+            TPM_RC_SUCCESS);
+        AssertIntEQ(GetU32(&buf[TPM2_HEADER_SIZE]), i + 1);
+    }
+    AssertIntEQ(mgr->saves, saves);
+    /* the most recently used stays loaded */
+    saves = mgr->reloads;
+    AssertIntEQ(SlotCmd(&objCtx, buf, TPM_CC_ReadPublic, handles[7]),
+        TPM_RC_SUCCESS);
+    AssertIntEQ(mgr->reloads, saves);
+
+    /* handle list has the virtual handles */
+    PutU32(&buf[2], TPM2_HEADER_SIZE + 12);
+    PutU32(&buf[6], TPM_CC_GetCapability);
+    PutU32(&buf[10], TPM_CAP_HANDLES);
+    PutU32(&buf[14], TRANSIENT_FIRST);
+    PutU32(&buf[18], 16);
+    AssertIntEQ(TPM2_AsyncSubmit(&objCtx, &req, buf, TPM2_HEADER_SIZE + 12,
+        sizeof(buf), NULL, NULL), TPM_RC_SUCCESS);
+    AssertIntEQ(TPM2_AsyncWait(&req, -1), TPM_RC_SUCCESS);
+    AssertIntEQ(GetU32(&buf[TPM2_HEADER_SIZE + 5]), 8);
+    AssertIntEQ(GetU32(&buf[TPM2_HEADER_SIZE + 9]), handles[0]);
+
+    /* flushing a saved object forgets it */
+    AssertIntEQ(SlotCmd(&objCtx, buf, TPM_CC_FlushContext, handles[0]),
+        TPM_RC_SUCCESS);
+    AssertTrue(SlotCmd(&objCtx, buf, TPM_CC_ReadPublic, handles[0]) ==
+        TPM_RC_HANDLE + TPM_RC_H + TPM_RC_1);
+
+    AssertIntEQ(TPM2_ObjMgr_Stop(&objCtx, mgr), TPM_RC_SUCCESS);
+    for (i = 0; i < SLOT_TPM_SLOTS; i++)
+        AssertIntEQ(tpm.slot[i], 0);
+    TPM2_Cleanup(&objCtx);
+    TPM2_SetActiveCtx(ctx);
+
+    printf("Test Transport:\tObject Manager:\tPassed\n");
+}
+#endif
+
+/* Each built backend is a transport a context can be switched to, with its
+ * own transport context. No command is sent. */
+static void test_Backends(TPM2_CTX* ctx)
+{
+    int rc;
+    TPM2_CTX backCtx;
+    const TPM2_TRANSPORT* builtin = TPM2_GetBuiltinTransport();
+    void* transportCtx = NULL;
+#ifdef WOLFTPM_LINUX_DEV
+    struct wolfTPM_devContext dev;
+#endif
+#ifdef WOLFTPM_SWTPM
+    struct wolfTPM_tcpContext tcp;
+#endif
+
+#if defined(WOLFTPM_LINUX_DEV)
+    AssertTrue(builtin == TPM2_LINUX_GetTransport());
+#elif defined(WOLFTPM_SWTPM)
+    AssertTrue(builtin == TPM2_SWTPM_GetTransport());
+#elif defined(WOLFTPM_TIS)
+    AssertTrue(builtin == TPM2_TIS_GetTransport());
+#endif
+    if (builtin == NULL || (builtin->flags & TPM2_TRANSPORT_FLAG_SHARED_BUS)) {
+        /* TIS only, it needs the HAL IO callback */
+        rc = TPM2_Init_ex(&backCtx, NULL, NULL, 0);
+        AssertIntEQ(rc, BAD_FUNC_ARG);
+        TPM2_SetActiveCtx(ctx);
+        return;
+    }
+
+    rc = TPM2_Init_ex(&backCtx, NULL, NULL, 0);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertTrue(TPM2_GetTransport(&backCtx, NULL) == builtin);
+
+#ifdef WOLFTPM_SWTPM
+    rc = TPM2_SWTPM_InitTcp(&tcp, "localhost", "2321", 1);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    rc = TPM2_SetTransport(&backCtx, TPM2_SWTPM_GetTransport(), &tcp);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertTrue(TPM2_GetTransport(&backCtx, &transportCtx) ==
+        TPM2_SWTPM_GetTransport());
+    AssertTrue(transportCtx == &tcp);
+#endif
+#ifdef WOLFTPM_LINUX_DEV
+    /* the resource manager device is always kept open */
+    rc = TPM2_LINUX_InitDev(&dev, "/dev/tpmrm0", 0);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertIntEQ(dev.keepOpen, 1);
+    rc = TPM2_SetTransport(&backCtx, TPM2_LINUX_GetTransport(), &dev);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertTrue(TPM2_GetTransport(&backCtx, &transportCtx) ==
+        TPM2_LINUX_GetTransport());
+    AssertTrue(transportCtx == &dev);
+    AssertTrue(TPM2_LINUX_GetTransport()->flags &
+        TPM2_TRANSPORT_FLAG_STARTED);
+#endif
+
+    /* back to the transport set by TPM2_Init */
+    rc = TPM2_SetTransport(&backCtx, NULL, NULL);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+    AssertTrue(TPM2_GetTransport(&backCtx, &transportCtx) == builtin);
+    AssertTrue(transportCtx == NULL);
+
+    TPM2_Cleanup(&backCtx);
+    TPM2_SetActiveCtx(ctx);
+
+    printf("Test Transport:\tBackends:\tPassed\n");
+}
+
+int main(void)
+{
+    int rc;
+    TPM2_CTX ctx;
+    TestTpm tpm;
+
+    XMEMSET(&tpm, 0, sizeof(tpm));
+    rc = TPM2_Init_Transport(&ctx, &gTestTransport, &tpm);
+    AssertIntEQ(rc, TPM_RC_SUCCESS);
+
+#if defined(WOLFTPM_REPLAY) && !defined(NO_FILESYSTEM)
+    test_Replay(&ctx, &tpm);
+#endif
+#ifdef WOLFTPM_HOOKS
+    test_Hooks(&ctx);
+#endif
+#ifdef WOLFTPM_OBJMGR
+    test_ObjMgr(&ctx);
+#endif
+    test_Backends(&ctx);
+
+    TPM2_Cleanup(&ctx);
+    return 0;
+}
@@ -25,6 +25,7 @@
 #include <wolftpm/tpm2.h>
 #include <wolftpm/tpm2_wrap.h>
 #include <wolftpm/tpm2_param_enc.h>
+#include <wolftpm/tpm2_keypool.h>
 
 #include <examples/tpm_io.h>
 #include <examples/tpm_test.h>
@@ -32,6 +33,13 @@
 
 #include <stdio.h>
 
+/* pool sessions started from one thread on the device of another */
+#if defined(WOLFTPM_THREAD_LOCAL_CTX) && !defined(WOLFTPM2_NO_WOLFCRYPT) && \
+    !defined(SINGLE_THREADED) && !defined(_WIN32)
+    #define UNIT_TEST_THREADS
+    #include <pthread.h>
+#endif
+
 /* Test Fail Helpers */
 #ifndef NO_ABORT
     #ifndef XABORT
@@ -236,6 +244,440 @@ static void test_wolfTPM2_GetRandom(void)
         rc == 0 ? "Passed" : "Failed");
 }
 
+static void test_wolfTPM2_UnloadHandles_Loaded(void)
+{
+    int rc;
+    WOLFTPM2_DEV dev;
+    word32 flushed = 0, failed = 0, count;
+    TPM_HANDLE handles[MAX_ACTIVE_SESSIONS];
+    WOLFTPM2_SESSION hmacSession, policySession;
+    WOLFTPM2_KEY key;
+    TPMT_PUBLIC publicTemplate;
+
+    rc = wolfTPM2_Init(&dev, TPM2_IoCb, NULL);
+    AssertIntEQ(rc, 0);
+
+    /* Test arguments */
+    rc = wolfTPM2_UnloadHandles_Loaded(NULL, WOLFTPM2_FLUSH_ALL, &flushed,
+        &failed);
+    AssertIntNE(rc, 0);
+    rc = wolfTPM2_UnloadHandles_Loaded(&dev, 0, &flushed, &failed);
+    AssertIntNE(rc, 0);
+    count = MAX_ACTIVE_SESSIONS;
+    rc = wolfTPM2_GetHandles(&dev, TRANSIENT_FIRST, NULL, &count);
+    AssertIntNE(rc, 0);
+
+    /* Test success: an HMAC session, a policy session and a key are flushed
+     * and nothing is left loaded */
+    rc = wolfTPM2_UnloadHandles_Loaded(&dev, WOLFTPM2_FLUSH_ALL, &flushed,
+        &failed);
+    AssertIntEQ(rc, 0);
+    rc = wolfTPM2_StartSession(&dev, &hmacSession, NULL, NULL, TPM_SE_HMAC,
+        TPM_ALG_NULL);
+    AssertIntEQ(rc, 0);
+    rc = wolfTPM2_StartSession(&dev, &policySession, NULL, NULL,
+        TPM_SE_POLICY, TPM_ALG_NULL);
+    AssertIntEQ(rc, 0);
+    rc = wolfTPM2_GetKeyTemplate_ECC_SRK(&publicTemplate);
+    AssertIntEQ(rc, 0);
+    rc = wolfTPM2_CreatePrimaryKey(&dev, &key, TPM_RH_OWNER, &publicTemplate,
+        NULL, 0);
+    AssertIntEQ(rc, 0);
+
+    rc = wolfTPM2_UnloadHandles_Loaded(&dev, WOLFTPM2_FLUSH_ALL, &flushed,
+        &failed);
+    AssertIntEQ(rc, 0);
+    AssertIntEQ(flushed, 3);
+    AssertIntEQ(failed, 0);
+    count = MAX_ACTIVE_SESSIONS;
+    rc = wolfTPM2_GetHandles(&dev, TRANSIENT_FIRST, handles, &count);
+    AssertIntEQ(rc, 0);
+    AssertIntEQ(count, 0);
+    count = MAX_ACTIVE_SESSIONS;
+    rc = wolfTPM2_GetHandles(&dev, LOADED_SESSION_FIRST, handles, &count);
+    AssertIntEQ(rc, 0);
+    AssertIntEQ(count, 0);
+
+    wolfTPM2_Cleanup(&dev);
+
+    printf("Test TPM Wrapper:\tUnload Loaded:\t%s\n",
+        rc == 0 ? "Passed" : "Failed");
+}
+
+#if defined(WOLFTPM_LINUX_DEV) || defined(WOLFTPM_SWTPM)
+static void test_wolfTPM2_AsyncCancel(void)
+{
+    int rc;
+    word32 i, count;
+    WOLFTPM2_DEV dev;
+    WOLFTPM2_KEY srk;
+    TPMT_PUBLIC publicTemplate;
+    TPM2_ASYNC req;
+    TPM_HANDLE handles[MAX_CAP_HANDLES];
+    byte buf[MAX_RESPONSE_SIZE];
+
+    rc = wolfTPM2_Init(&dev, TPM2_IoCb, NULL);
+    AssertIntEQ(rc, 0);
+    rc = wolfTPM2_GetKeyTemplate_ECC_SRK(&publicTemplate);
+    AssertIntEQ(rc, 0);
+    rc = wolfTPM2_CreatePrimaryKey(&dev, &srk, TPM_RH_OWNER, &publicTemplate,
+        NULL, 0);
+    AssertIntEQ(rc, 0);
+
+    /* cancel a GetRandom before its response is read */
+    XMEMSET(buf, 0, 12);
+    buf[0] = (byte)(TPM_ST_NO_SESSIONS >> 8);
+    buf[1] = (byte)TPM_ST_NO_SESSIONS;
+    buf[5] = 12; /* commandSize */
+    buf[8] = (byte)(TPM_CC_GetRandom >> 8);
+    buf[9] = (byte)TPM_CC_GetRandom;
+    buf[11] = 16; /* bytesRequested */
+    rc = TPM2_AsyncSubmit(&dev.ctx, &req, buf, 12, sizeof(buf), NULL, NULL);
+    AssertIntEQ(rc, 0);
+    rc = TPM2_AsyncCancel(&req);
+    AssertIntEQ(rc, 0);
+    AssertIntEQ(TPM2_AsyncPoll(&req), TPM_RC_CANCELED);
+
+    /* the connection (and with it the loaded key) is still there */
+    count = MAX_CAP_HANDLES;
+    rc = wolfTPM2_GetHandles(&dev, TRANSIENT_FIRST, handles, &count);
+    AssertIntEQ(rc, 0);
+    for (i = 0; i < count; i++) {
+        if (handles[i] == srk.handle.hndl)
+            break;
+    }
+    AssertTrue(i < count);
+
+    rc = wolfTPM2_UnloadHandle(&dev, &srk.handle);
+    AssertIntEQ(rc, 0);
+    wolfTPM2_Cleanup(&dev);
+
+    printf("Test TPM Wrapper:\tAsync Cancel:\t%s\n",
+        rc == 0 ? "Passed" : "Failed");
+}
+#endif
+
+static void test_wolfTPM2_SessionPool(void)
+{
+    int rc;
+    WOLFTPM2_DEV dev;
+    WOLFTPM2_SESSION_POOL pool;
+    WOLFTPM2_SESSION* session = NULL;
+    TPM_HANDLE first;
+
+    rc = wolfTPM2_Init(&dev, TPM2_IoCb, NULL);
+    AssertIntEQ(rc, 0);
+
+    /* Test arguments */
+    rc = wolfTPM2_SessionPool_Init(NULL, &pool, 2, NULL, NULL, TPM_SE_HMAC,
+        TPM_ALG_NULL, 1);
+    AssertIntNE(rc, 0);
+    rc = wolfTPM2_SessionPool_Init(&dev, &pool, WOLFTPM2_SESSION_POOL_MAX + 1,
+        NULL, NULL, TPM_SE_HMAC, TPM_ALG_NULL, 1);
+    AssertIntNE(rc, 0);
+
+    /* Test success: sessions are started once and reused */
+    rc = wolfTPM2_SessionPool_Init(&dev, &pool, 2, NULL, NULL, TPM_SE_HMAC,
+        TPM_ALG_NULL, 1);
+    AssertIntEQ(rc, 0);
+    rc = wolfTPM2_SessionPool_Acquire(&pool, &dev, 1, 0, &session);
+    AssertIntEQ(rc, 0);
+    first = session->handle.hndl;
+    AssertIntEQ(dev.session[1].sessionHandle, first);
+    rc = wolfTPM2_SessionPool_Acquire(&pool, &dev, 2, 0, NULL);
+    AssertIntEQ(rc, 0);
+    rc = wolfTPM2_SessionPool_Acquire(&pool, &dev, 0, 0, NULL);
+    AssertIntEQ(rc, TPM_RC_RETRY);
+
+    /* the idle session beyond maxLoaded is saved, then loaded again */
+    rc = wolfTPM2_SessionPool_Release(&pool, &dev, 1, 0);
+    AssertIntEQ(rc, 0);
+    AssertIntEQ(pool.saves, 1);
+    rc = wolfTPM2_SessionPool_Release(&pool, &dev, 2, 0);
+    AssertIntEQ(rc, 0);
+    rc = wolfTPM2_SessionPool_Acquire(&pool, &dev, 1, 0, NULL);
+    AssertIntEQ(rc, 0);
+    rc = wolfTPM2_SessionPool_Acquire(&pool, &dev, 2, 0, &session);
+    AssertIntEQ(rc, 0);
+    AssertIntEQ(session->handle.hndl, first);
+    AssertIntEQ(pool.starts, 2);
+    AssertIntEQ(pool.loads, 1);
+    rc = wolfTPM2_SessionPool_Release(&pool, &dev, 1, 0);
+    AssertIntEQ(rc, 0);
+    rc = wolfTPM2_SessionPool_Release(&pool, &dev, 2, 1);
+    AssertIntEQ(rc, 0);
+
+    rc = wolfTPM2_SessionPool_Free(&pool);
+    AssertIntEQ(rc, 0);
+    wolfTPM2_Cleanup(&dev);
+
+    printf("Test TPM Wrapper:\tSession Pool:\t%s\n",
+        rc == 0 ? "Passed" : "Failed");
+}
+
+#ifdef UNIT_TEST_THREADS
+typedef struct PoolThreadArgs {
+    WOLFTPM2_SESSION_POOL* pool;
+    WOLFTPM2_DEV* dev;
+    int rc;
+} PoolThreadArgs;
+
+/* start a new pool session on every acquire */
+static void* PoolAcquireThread(void* arg)
+{
+    PoolThreadArgs* args = (PoolThreadArgs*)arg;
+    int i, rc = 0;
+
+    for (i = 0; i < 20 && rc == 0; i++) {
+        rc = wolfTPM2_SessionPool_Acquire(args->pool, args->dev, 1, 0, NULL);
+        if (rc == 0)
+            rc = wolfTPM2_SessionPool_Release(args->pool, args->dev, 1, 1);
+    }
+    args->rc = rc;
+    return NULL;
+}
+
+static void test_wolfTPM2_SessionPool_Threads(void)
+{
+    int i, rc;
+    WOLFTPM2_DEV dev, other;
+    static WOLFTPM2_SESSION_POOL pool;
+    PoolThreadArgs args;
+    pthread_t thread;
+    TPM2B_AUTH auth;
+    byte rnd[16];
+
+    rc = wolfTPM2_Init(&dev, TPM2_IoCb, NULL);
+    AssertIntEQ(rc, 0);
+    rc = wolfTPM2_Init(&other, TPM2_IoCb, NULL);
+    AssertIntEQ(rc, 0);
+    rc = wolfTPM2_SessionPool_Init(&dev, &pool, 1, NULL, NULL, TPM_SE_HMAC,
+        TPM_ALG_NULL, 0);
+    AssertIntEQ(rc, 0);
+
+    auth.size = 5;
+    XMEMCPY(auth.buffer, "owner", auth.size);
+    rc = wolfTPM2_SetAuthPassword(&dev, 0, &auth);
+    AssertIntEQ(rc, 0);
+
+    /* the pool sessions are started on dev while its thread uses it */
+    args.pool = &pool;
+    args.dev = &other;
+    args.rc = -1;
+    AssertIntEQ(pthread_create(&thread, NULL, PoolAcquireThread, &args), 0);
+    for (i = 0; i < 20; i++) {
+        rc = wolfTPM2_GetRandom(&dev, rnd, sizeof(rnd));
+        AssertIntEQ(rc, 0);
+        AssertIntEQ(dev.session[0].sessionHandle, TPM_RS_PW);
+        AssertIntEQ(dev.session[0].auth.size, auth.size);
+        AssertIntEQ(XMEMCMP(dev.session[0].auth.buffer, auth.buffer,
+            auth.size), 0);
+    }
+    AssertIntEQ(pthread_join(thread, NULL), 0);
+    AssertIntEQ(args.rc, 0);
+    AssertIntEQ(pool.starts, 20);
+    AssertIntEQ(dev.session[0].auth.size, auth.size);
+    AssertIntEQ(XMEMCMP(dev.session[0].auth.buffer, auth.buffer,
+        auth.size), 0);
+
+    rc = wolfTPM2_SessionPool_Free(&pool);
+    AssertIntEQ(rc, 0);
+    wolfTPM2_Cleanup(&other);
+    wolfTPM2_Cleanup(&dev);
+
+    printf("Test TPM Wrapper:\tSession Pool Threads:\t%s\n",
+        rc == 0 ? "Passed" : "Failed");
+}
+#endif
+
+static void test_wolfTPM2_CreateLoadedKey(void)
+{
+    int rc;
+    WOLFTPM2_DEV dev;
+    WOLFTPM2_KEY srk;
+    WOLFTPM2_KEY key;
+    WOLFTPM2_KEYBLOB keyBlob;
+    TPMT_PUBLIC publicTemplate;
+
+    rc = wolfTPM2_Init(&dev, TPM2_IoCb, NULL);
+    AssertIntEQ(rc, 0);
+
+    rc = wolfTPM2_GetKeyTemplate_ECC_SRK(&publicTemplate);
+    AssertIntEQ(rc, 0);
+    rc = wolfTPM2_CreatePrimaryKey(&dev, &srk, TPM_RH_OWNER, &publicTemplate,
+        NULL, 0);
+    AssertIntEQ(rc, 0);
+    rc = wolfTPM2_GetKeyTemplate_ECC(&publicTemplate,
+        TPMA_OBJECT_sensitiveDataOrigin | TPMA_OBJECT_userWithAuth |
+        TPMA_OBJECT_sign | TPMA_OBJECT_noDA, TPM_ECC_NIST_P256, TPM_ALG_ECDSA);
+    AssertIntEQ(rc, 0);
+
+    /* Test arguments */
+    rc = wolfTPM2_CreateLoadedKey(NULL, &keyBlob, &srk.handle, &publicTemplate,
+        NULL, 0);
+    AssertIntNE(rc, 0);
+    rc = wolfTPM2_CreateLoadedKey(&dev, &keyBlob, &srk.handle, NULL, NULL, 0);
+    AssertIntNE(rc, 0);
+
+    /* Test success: with TPM2_CreateLoaded or TPM2_Create and TPM2_Load */
+    rc = wolfTPM2_CreateAndLoadKey(&dev, &key, &srk.handle, &publicTemplate,
+        NULL, 0);
+    AssertIntEQ(rc, 0);
+    AssertTrue(key.handle.hndl != 0);
+    AssertIntNE(dev.createLoaded, WOLFTPM2_CMD_UNKNOWN);
+    rc = wolfTPM2_UnloadHandle(&dev, &key.handle);
+    AssertIntEQ(rc, 0);
+
+    /* the blob of TPM2_CreateLoaded can be loaded again */
+    rc = wolfTPM2_CreateLoadedKey(&dev, &keyBlob, &srk.handle, &publicTemplate,
+        NULL, 0);
+    if (dev.createLoaded == WOLFTPM2_CMD_SUPPORTED) {
+        AssertIntEQ(rc, 0);
+        AssertTrue(keyBlob.priv.size > 0);
+        rc = wolfTPM2_UnloadHandle(&dev, &keyBlob.handle);
+        AssertIntEQ(rc, 0);
+        rc = wolfTPM2_LoadKey(&dev, &keyBlob, &srk.handle);
+        AssertIntEQ(rc, 0);
+        rc = wolfTPM2_UnloadHandle(&dev, &keyBlob.handle);
+        AssertIntEQ(rc, 0);
+    }
+    else {
+        AssertIntEQ(rc, TPM_RC_COMMAND_CODE);
+        rc = 0;
+    }
+
+    wolfTPM2_UnloadHandle(&dev, &srk.handle);
+    wolfTPM2_Cleanup(&dev);
+
+    printf("Test TPM Wrapper:\tCreate Loaded:\t%s\n",
+        rc == 0 ? "Passed" : "Failed");
+}
+
+#ifdef WOLFTPM_KEYPOOL
+static void test_wolfTPM2_KeyPool(void)
+{
+    int rc;
+    WOLFTPM2_DEV dev;
+    WOLFTPM2_KEY srk;
+    WOLFTPM2_KEYBLOB key;
+    WOLFTPM2_HANDLE other;
+    static WOLFTPM2_KEYPOOL pool;
+    TPMT_PUBLIC publicTemplate;
+    word32 created = 0, discarded;
+#ifndef NO_FILESYSTEM
+    const char* file = "keypool_test.bin";
+#else
+    const char* file = NULL;
+#endif
+
+    rc = wolfTPM2_Init(&dev, TPM2_IoCb, NULL);
+    AssertIntEQ(rc, 0);
+    rc = wolfTPM2_GetKeyTemplate_ECC_SRK(&publicTemplate);
+    AssertIntEQ(rc, 0);
+    rc = wolfTPM2_CreatePrimaryKey(&dev, &srk, TPM_RH_OWNER, &publicTemplate,
+        NULL, 0);
+    AssertIntEQ(rc, 0);
+    rc = wolfTPM2_GetKeyTemplate_ECC(&publicTemplate,
+        TPMA_OBJECT_sensitiveDataOrigin | TPMA_OBJECT_userWithAuth |
+        TPMA_OBJECT_sign | TPMA_OBJECT_noDA, TPM_ECC_NIST_P256, TPM_ALG_ECDSA);
+    AssertIntEQ(rc, 0);
+
+    /* Test arguments */
+    rc = wolfTPM2_KeyPool_Init(NULL, &srk.handle, &publicTemplate, NULL, 0,
+        1, 2, NULL);
+    AssertIntNE(rc, 0);
+    rc = wolfTPM2_KeyPool_Init(&pool, &srk.handle, &publicTemplate, NULL, 0,
+        0, 2, NULL);
+    AssertIntNE(rc, 0);
+    rc = wolfTPM2_KeyPool_Init(&pool, &srk.handle, &publicTemplate, NULL, 0,
+        1, WOLFTPM2_KEYPOOL_MAX + 1, NULL);
+    AssertIntNE(rc, 0);
+
+    /* Test success: fill to the high water mark, one key at a time */
+    rc = wolfTPM2_KeyPool_Init(&pool, &srk.handle, &publicTemplate, NULL, 0,
+        1, 2, file);
+    AssertIntEQ(rc, 0);
+    rc = wolfTPM2_KeyPool_Discard(&pool);
+    AssertIntEQ(rc, 0);
+    AssertIntEQ(wolfTPM2_KeyPool_NeedsFill(&pool), 1);
+    rc = wolfTPM2_KeyPool_Fill(&pool, &dev, 1, &created);
+    AssertIntEQ(rc, 0);
+    AssertIntEQ(created, 1);
+    AssertIntEQ(wolfTPM2_KeyPool_NeedsFill(&pool), 1);
+    rc = wolfTPM2_KeyPool_Fill(&pool, &dev, 0, &created);
+    AssertIntEQ(rc, 0);
+    AssertIntEQ(created, 1);
+    AssertIntEQ(pool.count, 2);
+    AssertIntEQ(wolfTPM2_KeyPool_NeedsFill(&pool), 0);
+
+    /* the blobs are kept in the file */
+    if (file != NULL) {
+        wolfTPM2_KeyPool_Free(&pool);
+        rc = wolfTPM2_KeyPool_Init(&pool, &srk.handle, &publicTemplate,
+            NULL, 0, 1, 2, file);
+        AssertIntEQ(rc, 0);
+        AssertIntEQ(pool.count, 2);
+    }
+
+    /* a request only loads, until the pool is empty */
+    rc = wolfTPM2_KeyPool_Take(&pool, &dev, &key);
+    AssertIntEQ(rc, 0);
+    AssertTrue(key.handle.hndl != 0);
+    wolfTPM2_UnloadHandle(&dev, &key.handle);
+    AssertIntEQ(wolfTPM2_KeyPool_NeedsFill(&pool), 0);
+    rc = wolfTPM2_KeyPool_Take(&pool, &dev, &key);
+    AssertIntEQ(rc, 0);
+    wolfTPM2_UnloadHandle(&dev, &key.handle);
+    rc = wolfTPM2_KeyPool_Take(&pool, &dev, &key);
+    AssertIntEQ(rc, 0);
+    wolfTPM2_UnloadHandle(&dev, &key.handle);
+    AssertIntEQ(pool.taken, 2);
+    AssertIntEQ(pool.misses, 1);
+
+    /* a wrong parent auth is not the blob's fault, it stays in the pool */
+    rc = wolfTPM2_KeyPool_Fill(&pool, &dev, 0, NULL);
+    AssertIntEQ(rc, 0);
+    AssertIntEQ(pool.count, 2);
+    discarded = pool.discarded;
+    other = srk.handle;
+    other.auth.size = 4;
+    XMEMCPY(other.auth.buffer, "oops", 4);
+    rc = wolfTPM2_KeyPool_SetParent(&pool, &other);
+    AssertIntEQ(rc, 0);
+    rc = wolfTPM2_KeyPool_Take(&pool, &dev, &key);
+    AssertIntNE(rc, 0);
+    AssertIntEQ(pool.count, 2);
+    AssertIntEQ(pool.discarded, discarded);
+    if (file != NULL) {
+        wolfTPM2_KeyPool_Free(&pool);
+        rc = wolfTPM2_KeyPool_Init(&pool, &srk.handle, &publicTemplate,
+            NULL, 0, 1, 2, file);
+        AssertIntEQ(rc, 0);
+        AssertIntEQ(pool.count, 2);
+    }
+
+    /* blobs of another parent are discarded */
+    other = srk.handle;
+    other.name.name[0] ^= 0xFF;
+    rc = wolfTPM2_KeyPool_SetParent(&pool, &srk.handle);
+    AssertIntEQ(rc, 0);
+    AssertIntEQ(pool.count, 2);
+    rc = wolfTPM2_KeyPool_SetParent(&pool, &other);
+    AssertIntEQ(rc, 0);
+    AssertIntEQ(pool.count, 0);
+
+    wolfTPM2_KeyPool_Free(&pool);
+#ifndef NO_FILESYSTEM
+    remove(file);
+#endif
+    wolfTPM2_UnloadHandle(&dev, &srk.handle);
+    wolfTPM2_Cleanup(&dev);
+
+    printf("Test TPM Wrapper:\tKey Pool:\t%s\n",
+        rc == 0 ? "Passed" : "Failed");
+}
+#endif
+
 static void test_wolfTPM2_Cleanup(void)
 {
     int rc;
@@ -303,6 +745,18 @@ int unit_tests(int argc, char *argv[])
     test_wolfTPM2_GetRandom();
     test_TPM2_KDFa();
     test_wolfTPM2_ReadPublicKey();
+    test_wolfTPM2_UnloadHandles_Loaded();
+#if defined(WOLFTPM_LINUX_DEV) || defined(WOLFTPM_SWTPM)
+    test_wolfTPM2_AsyncCancel();
+#endif
+    test_wolfTPM2_SessionPool();
+#ifdef UNIT_TEST_THREADS
+    test_wolfTPM2_SessionPool_Threads();
+#endif
+    test_wolfTPM2_CreateLoadedKey();
+#ifdef WOLFTPM_KEYPOOL
+    test_wolfTPM2_KeyPool();
+#endif
     test_wolfTPM2_Cleanup();
 #endif /* !WOLFTPM2_NO_WRAPPER */
 
@@ -1619,12 +1619,106 @@ static const BYTE TPM_20_EK_AUTH_POLICY[] = {
 /* HAL IO Callbacks */
 struct TPM2_CTX;
 
+#ifdef WOLFTPM_LINUX_DEV
+struct wolfTPM_devContext {
+    int fd;
+    int keepOpen; /* keep device open between commands */
+    int drain;    /* response of a cancelled command not read yet */
+    const char* path;
+};
+#endif /* WOLFTPM_LINUX_DEV */
+
 #ifdef WOLFTPM_SWTPM
 struct wolfTPM_tcpContext {
     int fd;
+    int keepAlive; /* keep connection open between commands */
+    int isUnix;    /* host is a Unix domain socket path */
+    const char* host;
+    const char* port;
 };
 #endif /* WOLFTPM_SWTPM */
 
+#ifdef WOLFTPM_TIS
+/* TIS register access counters, see TPM2_TIS_GetStats */
+typedef struct TPM2_TIS_STATS {
+    word32 commands;
+    word32 regReads;        /* status, burst count and other registers */
+    word32 regWrites;
+    word32 fifoReads;       /* data FIFO transfers */
+    word32 fifoWrites;
+    word32 lastCmdAccesses; /* register and FIFO accesses of last command */
+    word32 polls;           /* status polls that found the TPM not ready */
+    word32 lastCmdPolls;
+} TPM2_TIS_STATS;
+
+#ifdef WOLFTPM_TIS_PROFILE
+/* Command codes with their own bus profile, see TPM2_TIS_SetProfile */
+#ifndef TPM2_TIS_PROFILE_MAX_CC
+#define TPM2_TIS_PROFILE_MAX_CC 16
+#endif
+
+/* Bus activity of a command code. Entry 0 (cc 0) has the accesses made
+ * outside a command, such as locality requests and startup. */
+typedef struct TPM2_TIS_PROFILE_CC {
+    UINT32 cc;
+    word32 commands;
+    word32 stsReads;    /* status register reads */
+    word32 polls;       /* status reads that found the TPM not ready */
+    word32 burstReads;  /* burst count reads, alone or with the status */
+    word32 fifoWrites;  /* command chunks */
+    word32 fifoReads;   /* response chunks */
+    word32 regAccesses; /* other register reads and writes */
+    word32 waitStates;  /* SPI wait state retries, reported by the HAL */
+    word32 ioErrors;    /* HAL callback failures */
+    UINT64 bytes;       /* clocked on the bus, including frame headers */
+    UINT64 busNs;       /* spent in the HAL callback */
+} TPM2_TIS_PROFILE_CC;
+
+typedef struct TPM2_TIS_PROFILE {
+    TPM2_TIS_PROFILE_CC cmd[TPM2_TIS_PROFILE_MAX_CC];
+    word32 dropped;     /* commands with no free entry */
+} TPM2_TIS_PROFILE;
+#endif /* WOLFTPM_TIS_PROFILE */
+
+/* Progress of a TIS command, see TPM2_TIS_SendCommandStep */
+struct wolfTPM_tisContext {
+    int    state;
+    int    pos;     /* FIFO bytes written or read */
+    int    rspSz;
+    int    tries;   /* polls left for the current wait */
+    word16 burstCount; /* FIFO bytes left before the TPM must be polled */
+    byte*  buf;
+    int    cmdSz;
+    int    bufSz;
+    word32 cmdStartAccesses;
+    word32 cmdStartPolls;
+    TPM2_TIS_STATS stats;
+#ifdef WOLFTPM_TIS_PROFILE
+    TPM2_TIS_PROFILE* profile;      /* NULL when not profiling */
+    TPM2_TIS_PROFILE_CC* profileCmd; /* entry of the command in progress */
+#endif
+#if defined(WOLFTPM_TIMED_POLL) || defined(WOLFTPM_TIS_PROFILE)
+    UINT32 cc;          /* command code of the command in progress */
+#endif
+#ifdef WOLFTPM_TIS_LOCK
+    int    lockFd;    /* lock file shared with other processes */
+    int    lockCount; /* nested TPM2_TIS_Lock calls */
+#endif
+#ifdef WOLFTPM_TIMED_POLL
+    UINT64 deadline;    /* us, the current wait times out after this */
+    UINT64 nextPoll;    /* us, the TPM is not polled again before this */
+    UINT64 goTime;      /* us, when the command was started (GO) */
+    word32 goPolls;     /* stats.polls at GO */
+    word32 pollUs;      /* backoff interval */
+    word32 cmdTimeoutUs; /* longest execution wait, 0 for default */
+    struct {
+        UINT32 cc;
+        word32 us;      /* running average execution time */
+    } ccHistory[TPM_TIS_CC_HISTORY];
+#endif
+};
+#endif
+
 #ifdef WOLFTPM_WINAPI
 #include <tbs.h>
 
@@ -1652,23 +1746,162 @@ typedef int (*TPM2HalIoCb)(struct TPM2_CTX*, const BYTE* txBuf, BYTE* rxBuf,
     #define WOLFTPM2_USE_WOLF_RNG
 #endif
 
+#ifndef WOLFTPM2_USE_WOLF_RNG
+/* Session nonces are served from a pool of TPM random, fetched in bulk and
+ * topped up when fewer than TPM2_NONCE_POOL_REFILL bytes remain. When SHA-256
+ * is available each TPM seed is expanded for at most TPM2_NONCE_MAX_REUSE
+ * nonces (1 = use TPM random directly) */
+#ifndef TPM2_NONCE_POOL_SZ
+#define TPM2_NONCE_POOL_SZ      128
+#endif
+#ifndef TPM2_NONCE_POOL_REFILL
+#define TPM2_NONCE_POOL_REFILL  32
+#endif
+#ifndef TPM2_NONCE_MAX_REUSE
+#define TPM2_NONCE_MAX_REUSE    16
+#endif
+#if TPM2_NONCE_MAX_REUSE > 1 && !defined(WOLFTPM2_NO_WOLFCRYPT) && \
+    !defined(NO_SHA256)
+    #define WOLFTPM2_NONCE_EXPAND
+    #define TPM2_NONCE_SEED_SZ  TPM_SHA256_DIGEST_SIZE
+#endif
+#endif /* !WOLFTPM2_USE_WOLF_RNG */
+
+#ifdef WOLFTPM_HOOKS
+/* Command hook events, see TPM2_SetHook */
+typedef enum {
+    TPM2_HOOK_SEND, /* command marshalled, before it is given to the transport */
+    TPM2_HOOK_RECV, /* response received from the transport */
+    TPM2_HOOK_DONE, /* response parsed, the command is complete */
+} TPM2_HOOK_EVENT;
+
+/* Timestamps are from XTPM_TIME_NS (0 without a clock) and are set as the
+ * command reaches each stage */
+typedef struct TPM2_HOOK_INFO {
+    TPM_CC cc;
+    TPM_RC rc;          /* response code or transport / host error */
+    word32 cmdSz;
+    word32 rspSz;
+    int    sessions;    /* authorization sessions, 0 for asynchronous */
+    UINT64 startNs;     /* marshalling started, after the context lock */
+    UINT64 sendNs;      /* given to the transport */
+    UINT64 recvNs;      /* response received */
+    UINT64 doneNs;      /* response parsed */
+} TPM2_HOOK_INFO;
+
+struct TPM2_CTX;
+typedef void (*TPM2HookCb)(struct TPM2_CTX* ctx, TPM2_HOOK_EVENT event,
+    const TPM2_HOOK_INFO* info, void* hookCtx);
+#endif /* WOLFTPM_HOOKS */
+
+/* Asynchronous command request, see TPM2_AsyncSubmit */
+struct TPM2_ASYNC;
+typedef void (*TPM2AsyncCb)(struct TPM2_ASYNC* req, void* cbCtx);
+
+typedef struct TPM2_ASYNC {
+    struct TPM2_CTX* ctx;
+    byte*  buf;     /* marshalled command, replaced by the response */
+    int    bufSz;
+    int    cmdSz;
+    int    rspSz;   /* response size, once complete */
+    TPM_RC rc;      /* TPM_RC_YIELDED while pending, then the result */
+    TPM2AsyncCb cb;
+    void*  cbCtx;
+
+    /* transport state */
+    int    fd;
+    int    reused;  /* sent on a connection kept from a previous command */
+    int    rxSz;    /* bytes of the response frame received */
+    byte   rxFrame[2 * sizeof(UINT32)]; /* swtpm response size and ack */
+#ifdef WOLFTPM_HOOKS
+    TPM2_HOOK_INFO hook;
+#endif
+} TPM2_ASYNC;
+
+/* Transport backend, see TPM2_SetTransport */
+typedef struct TPM2_TRANSPORT {
+    const char* name;
+    word32 flags;   /* TPM2_TRANSPORT_FLAG_* */
+
+    /* Send the command in buf (cmdSz bytes) and receive the response into
+     * buf (bufSz bytes available). Required. */
+    int  (*sendCommand)(struct TPM2_CTX* ctx, byte* buf, int cmdSz,
+        int bufSz, void* transportCtx);
+
+    /* Optional asynchronous send and receive, see TPM2_AsyncSubmit. Without
+     * them TPM2_AsyncSubmit completes the command with sendCommand. Recv
+     * returns TPM_RC_YIELDED while the response is pending and may set
+     * req->fd to a descriptor to wait on. */
+    int  (*asyncSend)(struct TPM2_CTX* ctx, TPM2_ASYNC* req,
+        void* transportCtx);
+    int  (*asyncRecv)(struct TPM2_CTX* ctx, TPM2_ASYNC* req,
+        void* transportCtx);
+    int  (*asyncCancel)(struct TPM2_CTX* ctx, TPM2_ASYNC* req,
+        void* transportCtx);
+
+    /* Optional, release connections and descriptors. They must be opened
+     * again on the next command if the transport is used after this. */
+    void (*cleanup)(struct TPM2_CTX* ctx, void* transportCtx);
+} TPM2_TRANSPORT;
+
+/* A pending asynchronous command holds a bus shared with other contexts
+ * (TIS), so their commands return TPM_RC_RETRY until it completes */
+#define TPM2_TRANSPORT_FLAG_SHARED_BUS 0x01
+/* The TPM is started by the OS (kernel driver, TBS), so wolfTPM2_Init does
+ * not send TPM2_Startup */
+#define TPM2_TRANSPORT_FLAG_STARTED    0x02
+
+/* Exchanges with the TPM are serialized per bus. Contexts on a shared bus
+ * transport with the same HAL callback and user context share one, any other
+ * context has its own */
+typedef struct TPM2_BUS {
+    TPM2HalIoCb ioCb;
+    void* userCtx;
+    int refs;                /* contexts on a shared bus */
+    struct TPM2_CTX* owner;  /* context with a pending asynchronous command */
+#if !defined(WOLFTPM2_NO_WOLFCRYPT) && !defined(SINGLE_THREADED)
+    wolfSSL_Mutex lock;
+    int lockInit;
+#endif
+} TPM2_BUS;
+
 typedef struct TPM2_CTX {
     TPM2HalIoCb ioCb;
     void* userCtx;
+    const TPM2_TRANSPORT* transport;
+    void* transportCtx;
+    TPM2_BUS* bus;
+    TPM2_BUS ownBus;
+#ifdef WOLFTPM_LINUX_DEV
+    struct wolfTPM_devContext devCtx;
+#endif
 #ifdef WOLFTPM_SWTPM
     struct wolfTPM_tcpContext tcpCtx;
 #endif
 #ifdef WOLFTPM_WINAPI
     struct wolfTPM_winContext winCtx;
 #endif
+#ifdef WOLFTPM_TIS
+    struct wolfTPM_tisContext tisCtx;
+#endif
 #ifndef WOLFTPM2_NO_WOLFCRYPT
 #ifndef SINGLE_THREADED
     wolfSSL_Mutex hwLock;
+    wolfSSL_Mutex sessionLock; /* session nonces, held without hwLock */
 #endif
     #ifdef WOLFTPM2_USE_WOLF_RNG
     WC_RNG rng;
     #endif
 #endif /* !WOLFTPM2_NO_WOLFCRYPT */
+#ifndef WOLFTPM2_USE_WOLF_RNG
+    /* Pool of TPM random for session nonces, consumed from the end */
+    byte   noncePool[TPM2_NONCE_POOL_SZ];
+    word16 noncePoolAvail;
+    #ifdef WOLFTPM2_NONCE_EXPAND
+    byte   nonceSeed[TPM2_NONCE_SEED_SZ];
+    word32 nonceSeedUses; /* nonces derived from seed, 0 = no seed */
+    #endif
+#endif
 
     /* TPM TIS Info */
     int locality;
@@ -1682,6 +1915,15 @@ typedef struct TPM2_CTX {
     /* Command / Response Buffer */
     byte cmdBuf[MAX_COMMAND_SIZE];
 
+    /* Outstanding asynchronous command */
+    TPM2_ASYNC* asyncReq;
+
+#ifdef WOLFTPM_HOOKS
+    TPM2HookCb hookCb;
+    void* hookCtx;
+    TPM2_HOOK_INFO hookInfo; /* command in progress */
+#endif
+
     /* Informational Bits - use unsigned int for best compiler compatibility */
 #ifndef WOLFTPM2_NO_WOLFCRYPT
     #ifndef SINGLE_THREADED
@@ -2762,11 +3004,9 @@ WOLFTPM_API int TPM2_SetMode(SetMode_In* in);
 
 /* Non-standard API's */
 #define _TPM_Init TPM2_Init
-/* When using devtpm or swtpm, the ioCb and userCtx are not used
- * and should be NULL. TPM2_Init_minimal() calls TPM2_Init_ex()
- * with them set to NULL.
- *
- * In other modes, the ioCb shall be set in order to use TIS.
+/* With an ioCb the TPM is accessed through TIS (SPI / I2C). With ioCb and
+ * userCtx NULL the built-in devtpm, swtpm or TBS transport is used.
+ * TPM2_Init_minimal() calls TPM2_Init_ex() with them set to NULL.
  */
 WOLFTPM_API TPM_RC TPM2_Init(TPM2_CTX* ctx, TPM2HalIoCb ioCb, void* userCtx);
 WOLFTPM_API TPM_RC TPM2_Init_ex(TPM2_CTX* ctx, TPM2HalIoCb ioCb, void* userCtx,
@@ -2774,6 +3014,40 @@ WOLFTPM_API TPM_RC TPM2_Init_ex(TPM2_CTX* ctx, TPM2HalIoCb ioCb, void* userCtx,
 WOLFTPM_API TPM_RC TPM2_Init_minimal(TPM2_CTX* ctx);
 WOLFTPM_API TPM_RC TPM2_Cleanup(TPM2_CTX* ctx);
 
+/* Commands are exchanged with the TPM through the context's transport. Each
+ * built backend has one (TPM2_LINUX_GetTransport, TPM2_SWTPM_GetTransport,
+ * TPM2_WinApi_GetTransport, TPM2_TIS_GetTransport). TPM2_Init sets TIS when
+ * ioCb is given, otherwise the built-in default returned by
+ * TPM2_GetBuiltinTransport (devtpm, else swtpm, else TBS). TPM2_SetTransport
+ * replaces it, for example with another backend, an in-process TPM or a
+ * decorator (tracing, record/replay, latency injection) that wraps the
+ * transport returned by TPM2_GetTransport. The previous transport's cleanup
+ * is called; a backend reopens on its next use. NULL restores the transport
+ * set by TPM2_Init. Returns TPM_RC_RETRY while an asynchronous command is
+ * pending. */
+WOLFTPM_API TPM_RC TPM2_SetTransport(TPM2_CTX* ctx,
+    const TPM2_TRANSPORT* transport, void* transportCtx);
+WOLFTPM_API const TPM2_TRANSPORT* TPM2_GetTransport(TPM2_CTX* ctx,
+    void** transportCtx);
+WOLFTPM_API const TPM2_TRANSPORT* TPM2_GetBuiltinTransport(void);
+/* Initialize a context that only uses the given transport. No HAL IO
+ * callback is needed and no chip startup is done. */
+WOLFTPM_API TPM_RC TPM2_Init_Transport(TPM2_CTX* ctx,
+    const TPM2_TRANSPORT* transport, void* transportCtx);
+
+#ifdef WOLFTPM_HOOKS
+/* Call hookCb at each stage of the commands sent on the context (see
+ * TPM2_HOOK_EVENT), including asynchronous ones. The callback runs with the
+ * context locked, or for the send and receive of a command with auth
+ * sessions with its sessions locked, and must not send commands on it. NULL
+ * removes the hook. */
+WOLFTPM_API TPM_RC TPM2_SetHook(TPM2_CTX* ctx, TPM2HookCb hookCb,
+    void* hookCtx);
+#endif
+#ifdef WOLFTPM_TIME_NS_GETTIME
+WOLFTPM_LOCAL UINT64 TPM2_TimeNs(void);
+#endif
+
 /* Other API's - Not in TPM Specification */
 WOLFTPM_API TPM_RC TPM2_ChipStartup(TPM2_CTX* ctx, int timeoutTries);
 /* SetHalIoCb will fail if built with devtpm or swtpm as the callback
@@ -2784,9 +3058,48 @@ WOLFTPM_API TPM_RC TPM2_SetHalIoCb(TPM2_CTX* ctx, TPM2HalIoCb ioCb, void* userCt
 WOLFTPM_API TPM_RC TPM2_SetSessionAuth(TPM2_AUTH_SESSION *session);
 WOLFTPM_API int    TPM2_GetSessionAuthCount(TPM2_CTX* ctx);
 
+/* The TPM2_* commands operate on the active context. TPM2_Init sets it and
+ * the wolfTPM2_* wrappers select their device context on every call. It is
+ * shared by all threads unless built with WOLFTPM_THREAD_LOCAL_CTX, which
+ * is needed to use different contexts from several threads at once; each
+ * thread using the native API must then call TPM2_SetActiveCtx itself. */
 WOLFTPM_API void      TPM2_SetActiveCtx(TPM2_CTX* ctx);
 WOLFTPM_API TPM2_CTX* TPM2_GetActiveCtx(void);
 
+/* Asynchronous commands. The caller marshals a complete command into buf,
+ * which receives the response (bufSz bytes available). One command may be
+ * outstanding per context; synchronous TPM2_* calls on the context return
+ * TPM_RC_RETRY until it completes. On TIS (SPI/I2C) the command holds the
+ * bus, so commands on other contexts on the same bus (HAL callback and user
+ * context) return TPM_RC_RETRY as well.
+ *
+ * TPM2_AsyncPoll and TPM2_AsyncWait return TPM_RC_YIELDED while the command
+ * is pending, then the response code (or a transport error). The optional
+ * callback runs once on completion, after the context is free for the next
+ * command. With devtpm and swtpm TPM2_AsyncGetFd returns a descriptor to
+ * watch for readability (poll/epoll) before calling TPM2_AsyncPoll. The
+ * descriptor changes if swtpm reconnects, so fetch it again after each poll.
+ * TIS has no descriptor (-1): each TPM2_AsyncPoll advances the FIFO
+ * exchange as far as the TPM allows, for cooperative schedulers. With
+ * WOLFTPM_TIMED_POLL a poll before the backoff interval has passed returns
+ * TPM_RC_YIELDED without touching the bus. Windows
+ * TBS completes the command during TPM2_AsyncSubmit. */
+WOLFTPM_API TPM_RC TPM2_AsyncSubmit(TPM2_CTX* ctx, TPM2_ASYNC* req, byte* buf,
+    int cmdSz, int bufSz, TPM2AsyncCb cb, void* cbCtx);
+WOLFTPM_API TPM_RC TPM2_AsyncPoll(TPM2_ASYNC* req);
+/* timeoutMs < 0 waits until the command completes */
+WOLFTPM_API TPM_RC TPM2_AsyncWait(TPM2_ASYNC* req, int timeoutMs);
+WOLFTPM_API int    TPM2_AsyncGetFd(TPM2_ASYNC* req);
+/* Abandon a pending command. Completes with TPM_RC_CANCELED without calling
+ * the callback. The command may still run to completion in the TPM:
+ * - devtpm keeps the descriptor open (closing /dev/tpmrm0 would flush the
+ *   connection's objects and sessions) and discards the response when it
+ *   arrives, so the next command on the context first waits for the
+ *   cancelled one to finish.
+ * - swtpm closes the socket; the simulator keeps its objects.
+ * - TIS aborts the command with commandReady. */
+WOLFTPM_API TPM_RC TPM2_AsyncCancel(TPM2_ASYNC* req);
+
 WOLFTPM_API int TPM2_GetHashDigestSize(TPMI_ALG_HASH hashAlg);
 WOLFTPM_API int TPM2_GetHashType(TPMI_ALG_HASH hashAlg);
 WOLFTPM_API int TPM2_GetNonce(byte* nonceBuf, int nonceSz);
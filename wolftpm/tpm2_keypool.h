@@ -0,0 +1,115 @@
+/* tpm2_keypool.h
+ *
+ * Copyright (C) 2006-2020 wolfSSL Inc.
+ *
+ * This file is part of wolfTPM.
+ *
+ * wolfTPM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfTPM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#ifndef _TPM2_KEYPOOL_H_
+#define _TPM2_KEYPOOL_H_
+
+#include <wolftpm/tpm2.h>
+#include <wolftpm/tpm2_wrap.h>
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#ifdef WOLFTPM_KEYPOOL
+
+/* Key blobs a pool can hold */
+#ifndef WOLFTPM2_KEYPOOL_MAX
+#define WOLFTPM2_KEYPOOL_MAX 8
+#endif
+
+#define WOLFTPM2_KEYPOOL_MAGIC      "wTKP"
+#define WOLFTPM2_KEYPOOL_MAGIC_SZ   4
+
+/* Key created with TPM2_Create and not loaded yet */
+typedef struct WOLFTPM2_KEYPOOL_BLOB {
+    TPM2B_PUBLIC  pub;
+    TPM2B_PRIVATE priv;
+} WOLFTPM2_KEYPOOL_BLOB;
+
+/* Pool of keys created ahead of time (RSA key generation takes seconds on
+ * most TPMs). wolfTPM2_KeyPool_Fill creates keys from the template under the
+ * parent, from an idle loop or thread, until highWater keys are ready. It
+ * starts again once fewer than lowWater are left. wolfTPM2_KeyPool_Take then
+ * only sends a TPM2_Load. The blobs are kept in a file (optional), so they
+ * survive a restart, and are discarded when the parent changes. */
+typedef struct WOLFTPM2_KEYPOOL {
+    WOLFTPM2_HANDLE parent;     /* parent of the blobs, name identifies it */
+    TPMT_PUBLIC publicTemplate;
+    TPM2B_AUTH auth;            /* auth of the pool keys */
+    const char* file;           /* blobs saved after each change, or NULL */
+
+    word32 lowWater;
+    word32 highWater;
+    word32 count;
+    word32 generation;          /* changed when the blobs are discarded */
+    byte filling;
+    WOLFTPM2_KEYPOOL_BLOB blob[WOLFTPM2_KEYPOOL_MAX];
+#if !defined(WOLFTPM2_NO_WOLFCRYPT) && !defined(SINGLE_THREADED)
+    wolfSSL_Mutex lock;
+#endif
+
+    /* statistics */
+    word32 created;             /* TPM2_Create sent by fill */
+    word32 taken;               /* keys loaded from a blob */
+    word32 misses;              /* keys created on take, the pool was empty */
+    word32 discarded;           /* blobs dropped (parent changed, load failed) */
+} WOLFTPM2_KEYPOOL;
+
+/* Set up a pool of keys from publicTemplate under parent (with its auth and
+ * name set). The blobs of file (optional) created under the same parent
+ * and template are used again, others are discarded.
+ * 0 < lowWater <= highWater <= WOLFTPM2_KEYPOOL_MAX. */
+WOLFTPM_API int wolfTPM2_KeyPool_Init(WOLFTPM2_KEYPOOL* pool,
+    WOLFTPM2_HANDLE* parent, TPMT_PUBLIC* publicTemplate,
+    const byte* auth, int authSz, word32 lowWater, word32 highWater,
+    const char* file);
+/* Create keys with dev until highWater are ready, at most maxKeys
+ * (0 for no limit) so an idle loop can do one key at a time. The pool is not
+ * locked while TPM2_Create runs. created (optional) is set to the keys made. */
+WOLFTPM_API int wolfTPM2_KeyPool_Fill(WOLFTPM2_KEYPOOL* pool,
+    WOLFTPM2_DEV* dev, word32 maxKeys, word32* created);
+/* 1 when fill has keys to create */
+WOLFTPM_API int wolfTPM2_KeyPool_NeedsFill(WOLFTPM2_KEYPOOL* pool);
+/* Load a pool key with dev. A blob is used once: it is removed (and the file
+ * saved) before the key is loaded. When the pool is empty the key is created
+ * and loaded now. A blob the TPM rejects (integrity, size or value error) is
+ * discarded and the next one tried; on other errors, such as a wrong parent
+ * auth or a flushed parent, the blob is put back and the error returned. */
+WOLFTPM_API int wolfTPM2_KeyPool_Take(WOLFTPM2_KEYPOOL* pool,
+    WOLFTPM2_DEV* dev, WOLFTPM2_KEYBLOB* key);
+/* Use another parent. When its name differs from the current parent the blobs
+ * are discarded, otherwise only the handle is updated (a primary key created
+ * again). */
+WOLFTPM_API int wolfTPM2_KeyPool_SetParent(WOLFTPM2_KEYPOOL* pool,
+    WOLFTPM2_HANDLE* parent);
+/* Drop all blobs, and from the file */
+WOLFTPM_API int wolfTPM2_KeyPool_Discard(WOLFTPM2_KEYPOOL* pool);
+/* Release the pool. The blobs stay in the file for the next start. */
+WOLFTPM_API int wolfTPM2_KeyPool_Free(WOLFTPM2_KEYPOOL* pool);
+
+#endif /* WOLFTPM_KEYPOOL */
+
+#ifdef __cplusplus
+    }  /* extern "C" */
+#endif
+
+#endif /* _TPM2_KEYPOOL_H_ */
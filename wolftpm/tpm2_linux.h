@@ -29,8 +29,47 @@
     extern "C" {
 #endif
 
-/* TPM2 IO for using TPM through the Linux kernel driver */
-WOLFTPM_LOCAL int TPM2_LINUX_SendCommand(TPM2_CTX* ctx, TPM2_Packet* packet);
+#ifdef WOLFTPM_LINUX_DEV
+/* Default TPM device. Use "/dev/tpmrm0" for the kernel resource manager */
+#ifndef TPM2_LINUX_DEV
+#define TPM2_LINUX_DEV "/dev/tpm0"
+#endif
+#define TPM2_LINUX_DEV_RM "/dev/tpmrm0"
+
+/* Keep the device open between commands by default (1) or open and close
+ * it for every command (0). The resource manager device is always kept open,
+ * since the kernel flushes its transient objects on close. */
+#ifndef TPM2_LINUX_DEV_KEEP_OPEN
+#define TPM2_LINUX_DEV_KEEP_OPEN 0
+#endif
+
+/* Poll timeouts in milliseconds, selected by command code */
+#ifndef TPM2_LINUX_DEV_TIMEOUT_SHORT
+#define TPM2_LINUX_DEV_TIMEOUT_SHORT   2000   /* GetRandom, PCR_Read, ... */
+#endif
+#ifndef TPM2_LINUX_DEV_TIMEOUT_MEDIUM
+#define TPM2_LINUX_DEV_TIMEOUT_MEDIUM  10000  /* signing, decryption, ... */
+#endif
+#ifndef TPM2_LINUX_DEV_TIMEOUT_LONG
+#define TPM2_LINUX_DEV_TIMEOUT_LONG    300000 /* key generation, self test */
+#endif
+
+/* Transport for a TPM device exposed by the Linux kernel driver. Its
+ * transportCtx is a struct wolfTPM_devContext set up with TPM2_LINUX_InitDev,
+ * or NULL for the device of the context (see TPM2_LINUX_SetDev). */
+WOLFTPM_API const TPM2_TRANSPORT* TPM2_LINUX_GetTransport(void);
+
+/* Set up a device context for the transport, with the TPM device path (NULL
+ * for default) and whether the device stays open between commands */
+WOLFTPM_API int TPM2_LINUX_InitDev(struct wolfTPM_devContext* dev,
+    const char* devPath, int keepOpen);
+
+/* Select the TPM device path (NULL for default) and whether the device stays
+ * open for the lifetime of the context. Closes any currently open device. */
+WOLFTPM_API int TPM2_LINUX_SetDev(TPM2_CTX* ctx, const char* devPath,
+    int keepOpen);
+
+#endif /* WOLFTPM_LINUX_DEV */
 
 #ifdef __cplusplus
     }  /* extern "C" */
@@ -0,0 +1,102 @@
+/* tpm2_objmgr.h
+ *
+ * Copyright (C) 2006-2020 wolfSSL Inc.
+ *
+ * This file is part of wolfTPM.
+ *
+ * wolfTPM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfTPM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#ifndef _TPM2_OBJMGR_H_
+#define _TPM2_OBJMGR_H_
+
+#include <wolftpm/tpm2.h>
+#include <wolftpm/tpm2_packet.h>
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#ifdef WOLFTPM_OBJMGR
+
+/* Transient objects a manager can track, loaded or saved */
+#ifndef TPM2_OBJMGR_MAX_OBJECTS
+#define TPM2_OBJMGR_MAX_OBJECTS 16
+#endif
+
+/* Virtual handles given in place of the TPM transient handles */
+#define TPM2_OBJMGR_HANDLE_FIRST    (HR_TRANSIENT + 0x00FF0000)
+#define TPM2_OBJMGR_HANDLE_LAST \
+    (TPM2_OBJMGR_HANDLE_FIRST + TPM2_OBJMGR_MAX_OBJECTS - 1)
+
+/* marshalled TPMS_CONTEXT: sequence, savedHandle, hierarchy, contextBlob */
+#define TPM2_OBJMGR_CONTEXT_SZ      (8 + 4 + 4 + 2 + MAX_CONTEXT_SIZE)
+
+typedef struct TPM2_OBJMGR_ENTRY {
+    TPM_HANDLE handle;      /* TPM handle while loaded, otherwise 0 */
+    word32 lastUse;         /* command count of the last use */
+    byte used;
+    byte sequence;          /* hash or HMAC sequence, saved each eviction */
+    word16 contextSz;       /* saved context, 0 if none */
+    byte context[TPM2_OBJMGR_CONTEXT_SZ];
+} TPM2_OBJMGR_ENTRY;
+
+/* Object manager transport. It wraps the transport of a context and gives
+ * virtual handles for the transient objects created or loaded through it.
+ * When the TPM is out of object slots (TPM_RC_OBJECT_MEMORY or maxLoaded
+ * reached) the least recently used object is saved with TPM2_ContextSave
+ * and flushed, then loaded again with TPM2_ContextLoad when a command uses
+ * its handle. Handles in commands and responses are rewritten, so the
+ * wrappers and session HMACs (which use the object names) are unchanged.
+ * The saved context of a key is kept, so evicting it again only flushes.
+ *
+ * Objects are only tracked from TPM2_ObjMgr_Start, and transient handles
+ * listed by TPM2_GetCapability(TPM_CAP_HANDLES) are the virtual ones. */
+typedef struct TPM2_OBJMGR {
+    /* transport replaced by TPM2_ObjMgr_Start */
+    const TPM2_TRANSPORT* inner;
+    void* innerCtx;
+
+    word32 maxLoaded;       /* objects kept loaded, 0 for the TPM limit */
+    word32 loaded;
+    word32 clock;
+    TPM2_OBJMGR_ENTRY obj[TPM2_OBJMGR_MAX_OBJECTS];
+
+    /* command kept to send again after an eviction */
+    byte cmd[MAX_COMMAND_SIZE];
+    /* ContextSave, ContextLoad and FlushContext of the manager */
+    byte buf[TPM2_HEADER_SIZE + TPM2_OBJMGR_CONTEXT_SZ];
+
+    /* statistics */
+    word32 saves;           /* TPM2_ContextSave sent */
+    word32 reloads;         /* TPM2_ContextLoad sent */
+    word32 evictions;       /* objects flushed to free a slot */
+} TPM2_OBJMGR;
+
+/* Manage the transient objects of ctx. maxLoaded limits the objects loaded
+ * at once (0 to use the slots until the TPM returns TPM_RC_OBJECT_MEMORY). */
+WOLFTPM_API int TPM2_ObjMgr_Start(TPM2_CTX* ctx, TPM2_OBJMGR* mgr,
+    word32 maxLoaded);
+/* Flush the loaded objects and restore the previous transport. The virtual
+ * handles are no longer valid. */
+WOLFTPM_API int TPM2_ObjMgr_Stop(TPM2_CTX* ctx, TPM2_OBJMGR* mgr);
+
+#endif /* WOLFTPM_OBJMGR */
+
+#ifdef __cplusplus
+    }  /* extern "C" */
+#endif
+
+#endif /* _TPM2_OBJMGR_H_ */
@@ -0,0 +1,108 @@
+/* tpm2_replay.h
+ *
+ * Copyright (C) 2006-2020 wolfSSL Inc.
+ *
+ * This file is part of wolfTPM.
+ *
+ * wolfTPM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfTPM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#ifndef _TPM2_REPLAY_H_
+#define _TPM2_REPLAY_H_
+
+#include <wolftpm/tpm2.h>
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#ifdef WOLFTPM_REPLAY
+
+/* Trace format, sizes are big endian:
+ *   magic   TPM2_REPLAY_MAGIC (8 bytes)
+ *   entries cmdSz (4), command, rspSz (4), response
+ * A response size of 0 records an exchange that failed in the transport. */
+#define TPM2_REPLAY_MAGIC       "wTPMtrc1"
+#define TPM2_REPLAY_MAGIC_SZ    8
+
+/* Record and replay transports. Recording wraps the current transport of a
+ * context and appends each command / response pair to a trace file.
+ * Replaying serves the responses from a trace in memory, so the host side
+ * (marshalling, HMAC, parameter encryption, wrappers) runs without the TPM.
+ *
+ * Commands are matched against the entry after the last match, then the last
+ * match again (a loop running longer than when recorded), then the rest of
+ * the trace. A command with different session nonces, HMACs or encrypted
+ * first parameter than the recorded one still matches and the recorded
+ * nonceCaller is restored in the context sessions, so the response HMAC
+ * verifies. Salted and bound sessions
+ * derive their key from random data, so they only replay when the nonces are
+ * from the TPM (WOLFTPM2_USE_HW_RNG or no wolfCrypt) and the program sends
+ * the same commands as when recorded. */
+typedef struct TPM2_REPLAY {
+    /* transport replaced by TPM2_Replay_Record / TPM2_Replay_Start */
+    const TPM2_TRANSPORT* inner;
+    void* innerCtx;
+
+#ifndef NO_FILESYSTEM
+    XFILE fp;           /* trace being recorded */
+#endif
+
+    /* trace being replayed, owned by the caller */
+    word32 flags;       /* TPM2_REPLAY_FLAG_* */
+    const byte* trace;
+    word32 traceSz;
+    word32 entries;
+    word32 pos;         /* offset of the next entry expected */
+    word32 last;        /* offset of the last entry matched */
+
+    /* statistics */
+    word32 commands;
+    word32 exact;       /* matched byte for byte */
+    word32 masked;      /* matched ignoring nonces, HMACs and encryption */
+    word32 loose;       /* matched by command header only */
+    word32 misses;      /* no recorded entry, TPM_RC_FAILURE returned */
+} TPM2_REPLAY;
+
+#ifndef NO_FILESYSTEM
+/* Send the commands of ctx through its current transport and append them
+ * with their responses to the trace file */
+WOLFTPM_API int TPM2_Replay_Record(TPM2_CTX* ctx, TPM2_REPLAY* replay,
+    const char* file);
+/* Read a trace file into buf, *bufSz is the size of buf and is set to the
+ * trace size */
+WOLFTPM_API int TPM2_Replay_LoadFile(const char* file, byte* buf,
+    word32* bufSz);
+#endif
+/* When the expected or last entry has the same command code and size but
+ * other parameters, serve it. For benchmarks whose data comes from a timed
+ * loop (TPM random) and so differs from the recording. */
+#define TPM2_REPLAY_FLAG_LOOSE  0x01
+
+/* Serve the commands of ctx from the trace (kept by the caller until
+ * TPM2_Replay_Stop) */
+WOLFTPM_API int TPM2_Replay_Start(TPM2_CTX* ctx, TPM2_REPLAY* replay,
+    const byte* trace, word32 traceSz, word32 flags);
+/* Restore the transport used before recording or replaying and close the
+ * trace file */
+WOLFTPM_API int TPM2_Replay_Stop(TPM2_CTX* ctx, TPM2_REPLAY* replay);
+
+#endif /* WOLFTPM_REPLAY */
+
+#ifdef __cplusplus
+    }  /* extern "C" */
+#endif
+
+#endif /* _TPM2_REPLAY_H_ */
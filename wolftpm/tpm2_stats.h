@@ -0,0 +1,98 @@
+/* tpm2_stats.h
+ *
+ * Copyright (C) 2006-2020 wolfSSL Inc.
+ *
+ * This file is part of wolfTPM.
+ *
+ * wolfTPM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfTPM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#ifndef _TPM2_STATS_H_
+#define _TPM2_STATS_H_
+
+#include <wolftpm/tpm2.h>
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#ifdef WOLFTPM_HOOKS
+
+/* Command codes with their own statistics, later ones are counted in
+ * TPM2_STATS.dropped */
+#ifndef TPM2_STATS_MAX_CC
+#define TPM2_STATS_MAX_CC       32
+#endif
+
+/* Latency histogram in microseconds. Values below 2^TPM2_STATS_SUB_BITS
+ * have a bucket each, then each power of two is split in
+ * 2^TPM2_STATS_SUB_BITS buckets (12.5% resolution with 3). Values from
+ * 2^TPM2_STATS_MAX_BITS (67 seconds) are in the last bucket. */
+#ifndef TPM2_STATS_SUB_BITS
+#define TPM2_STATS_SUB_BITS     3
+#endif
+#ifndef TPM2_STATS_MAX_BITS
+#define TPM2_STATS_MAX_BITS     26
+#endif
+#define TPM2_STATS_SUB_BUCKETS  (1 << TPM2_STATS_SUB_BITS)
+#define TPM2_STATS_BUCKETS \
+    ((TPM2_STATS_MAX_BITS - TPM2_STATS_SUB_BITS + 1) * TPM2_STATS_SUB_BUCKETS)
+
+typedef struct TPM2_STATS_CC {
+    TPM_CC cc;              /* 0 while the slot is free */
+    word32 count;
+    word32 errors;          /* response code other than success */
+    word32 noResponse;      /* transport or host errors, no response */
+    word32 maxUs;
+    UINT64 totalNs;         /* marshalling to parsed response */
+    UINT64 transportNs;     /* given to the transport to response */
+    word32 buckets[TPM2_STATS_BUCKETS];
+} TPM2_STATS_CC;
+
+/* Per command code latency and error counters, filled by TPM2_Stats_Hook.
+ * Updates are atomic (GCC / Clang builtins), so one registry can be shared by
+ * the contexts of several threads without a lock. */
+typedef struct TPM2_STATS {
+    TPM2_STATS_CC cmd[TPM2_STATS_MAX_CC];
+    word32 dropped;
+} TPM2_STATS;
+
+WOLFTPM_API int TPM2_Stats_Init(TPM2_STATS* stats);
+/* Hook recording completed commands, install with
+ * TPM2_SetHook(ctx, TPM2_Stats_Hook, stats) */
+WOLFTPM_API void TPM2_Stats_Hook(TPM2_CTX* ctx, TPM2_HOOK_EVENT event,
+    const TPM2_HOOK_INFO* info, void* hookCtx);
+/* Statistics of a command code, NULL if it was not sent */
+WOLFTPM_API const TPM2_STATS_CC* TPM2_Stats_Get(const TPM2_STATS* stats,
+    TPM_CC cc);
+/* Latency in microseconds below which the given share of the commands
+ * completed, in hundredths of a percent (9900 = p99). The result is the
+ * upper bound of its histogram bucket. */
+WOLFTPM_API int TPM2_Stats_Percentile(const TPM2_STATS_CC* cmd,
+    word32 share, word32* us);
+/* Write the statistics as Prometheus text exposition format into buf.
+ * Each command code has all TPM2_STATS_BUCKETS - 1 histogram buckets and
+ * +Inf, about 16KB with the defaults. Returns the length written (without
+ * terminator) or BUFFER_E. */
+WOLFTPM_API int TPM2_Stats_Dump(const TPM2_STATS* stats, char* buf,
+    word32 bufSz);
+
+#endif /* WOLFTPM_HOOKS */
+
+#ifdef __cplusplus
+    }  /* extern "C" */
+#endif
+
+#endif /* _TPM2_STATS_H_ */
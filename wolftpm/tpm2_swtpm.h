@@ -42,8 +42,45 @@
 #define TPM_STOP                    21
 #endif
 
-/* TPM2 IO for using TPM through a Socket connection */
-WOLFTPM_LOCAL int TPM2_SWTPM_SendCommand(TPM2_CTX* ctx, TPM2_Packet* packet);
+#ifdef WOLFTPM_SWTPM
+#ifndef TPM2_SWTPM_HOST
+#define TPM2_SWTPM_HOST         "localhost"
+#endif
+#ifndef TPM2_SWTPM_PORT
+#define TPM2_SWTPM_PORT         "2321"
+#endif
+
+/* Define TPM2_SWTPM_UNIX_PATH to use a Unix domain socket by default */
+
+/* Keep the connection open between commands (1) or connect and disconnect
+ * for every command (0) */
+#ifndef TPM2_SWTPM_KEEP_ALIVE
+#define TPM2_SWTPM_KEEP_ALIVE   0
+#endif
+
+/* Transport for a TPM simulator through a socket. Its transportCtx is a
+ * struct wolfTPM_tcpContext set up with TPM2_SWTPM_InitTcp, or NULL for the
+ * connection of the context (see TPM2_SWTPM_SetServer). */
+WOLFTPM_API const TPM2_TRANSPORT* TPM2_SWTPM_GetTransport(void);
+
+/* Set up a connection for the transport to the simulator host and port (NULL
+ * for defaults), kept open between commands or not. The strings must remain
+ * valid while it is used. */
+WOLFTPM_API int TPM2_SWTPM_InitTcp(struct wolfTPM_tcpContext* tcp,
+    const char* host, const char* port, int keepAlive);
+
+/* Set the simulator host and port (NULL for defaults) and whether the
+ * connection is kept open between commands. Closes any open connection.
+ * The host and port strings must remain valid for the life of the ctx. */
+WOLFTPM_API int TPM2_SWTPM_SetServer(TPM2_CTX* ctx, const char* host,
+    const char* port, int keepAlive);
+
+/* Use a Unix domain socket at path instead of TCP. The path must remain
+ * valid for the life of the ctx. TPM2_SWTPM_SetServer switches back to TCP */
+WOLFTPM_API int TPM2_SWTPM_SetUnixSocket(TPM2_CTX* ctx, const char* path,
+    int keepAlive);
+
+#endif /* WOLFTPM_SWTPM */
 
 #ifdef __cplusplus
     }  /* extern "C" */
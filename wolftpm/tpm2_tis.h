@@ -41,9 +41,122 @@
 
 #define TPM_TIS_READY_MASK 0x01
 
+enum tpm_tis_access {
+    TPM_ACCESS_VALID            = 0x80,
+    TPM_ACCESS_ACTIVE_LOCALITY  = 0x20,
+    TPM_ACCESS_REQUEST_PENDING  = 0x04,
+    TPM_ACCESS_REQUEST_USE      = 0x02,
+};
+
+enum tpm_tis_status {
+    TPM_STS_VALID               = 0x80,
+    TPM_STS_COMMAND_READY       = 0x40,
+    TPM_STS_GO                  = 0x20,
+    TPM_STS_DATA_AVAIL          = 0x10,
+    TPM_STS_DATA_EXPECT         = 0x08,
+    TPM_STS_SELF_TEST_DONE      = 0x04,
+    TPM_STS_RESP_RETRY          = 0x02,
+};
+
+enum tpm_tis_int_flags {
+    TPM_GLOBAL_INT_ENABLE       = 0x80000000,
+    TPM_INTF_BURST_COUNT_STATIC = 0x100,
+    TPM_INTF_CMD_READY_INT      = 0x080,
+    TPM_INTF_INT_EDGE_FALLING   = 0x040,
+    TPM_INTF_INT_EDGE_RISING    = 0x020,
+    TPM_INTF_INT_LEVEL_LOW      = 0x010,
+    TPM_INTF_INT_LEVEL_HIGH     = 0x008,
+    TPM_INTF_LOC_CHANGE_INT     = 0x004,
+    TPM_INTF_STS_VALID_INT      = 0x002,
+    TPM_INTF_DATA_AVAIL_INT     = 0x001,
+};
+
+
+#define TPM_BASE_ADDRESS (0xD40000u)
+
+#ifdef WOLFTPM_I2C
+/* For I2C only the lower 8-bits of the address are used */
+#define TPM_ACCESS(l)           (TPM_BASE_ADDRESS | 0x0004u | ((l) << 12u))
+#define TPM_INTF_CAPS(l)        (TPM_BASE_ADDRESS | 0x0030u | ((l) << 12u))
+#define TPM_DID_VID(l)          (TPM_BASE_ADDRESS | 0x0048u | ((l) << 12u))
+#define TPM_RID(l)              (TPM_BASE_ADDRESS | 0x004Cu | ((l) << 12u))
+#define TPM_I2C_DEVICE_ADDR(l)  (TPM_BASE_ADDRESS | 0x0038u | ((l) << 12u))
+#define TPM_DATA_CSUM_ENABLE(l) (TPM_BASE_ADDRESS | 0x0040u | ((l) << 12u))
+#define TPM_DATA_CSUM(l)        (TPM_BASE_ADDRESS | 0x0044u | ((l) << 12u))
+#else
+#define TPM_ACCESS(l)           (TPM_BASE_ADDRESS | 0x0000u | ((l) << 12u))
+#define TPM_INTF_CAPS(l)        (TPM_BASE_ADDRESS | 0x0014u | ((l) << 12u))
+#define TPM_DID_VID(l)          (TPM_BASE_ADDRESS | 0x0F00u | ((l) << 12u))
+#define TPM_RID(l)              (TPM_BASE_ADDRESS | 0x0F04u | ((l) << 12u))
+#endif
+
+#define TPM_INT_ENABLE(l)       (TPM_BASE_ADDRESS | 0x0008u | ((l) << 12u))
+#define TPM_INT_VECTOR(l)       (TPM_BASE_ADDRESS | 0x000Cu | ((l) << 12u))
+#define TPM_INT_STATUS(l)       (TPM_BASE_ADDRESS | 0x0010u | ((l) << 12u))
+#define TPM_STS(l)              (TPM_BASE_ADDRESS | 0x0018u | ((l) << 12u))
+#define TPM_BURST_COUNT(l)      (TPM_BASE_ADDRESS | 0x0019u | ((l) << 12u))
+#define TPM_DATA_FIFO(l)        (TPM_BASE_ADDRESS | 0x0024u | ((l) << 12u))
+#define TPM_XDATA_FIFO(l)       (TPM_BASE_ADDRESS | 0x0083u | ((l) << 12u))
+
 
 WOLFTPM_LOCAL int TPM2_TIS_GetBurstCount(TPM2_CTX* ctx, word16* burstCount);
 WOLFTPM_LOCAL int TPM2_TIS_SendCommand(TPM2_CTX* ctx, TPM2_Packet* packet);
+/* Resumable TIS exchange. Start takes the command in buf, then each Step
+ * does the work possible without waiting on the TPM and returns
+ * TPM_RC_YIELDED until the response is in buf. TPM2_TIS_SendCommand is a
+ * polling loop over these. */
+WOLFTPM_LOCAL int TPM2_TIS_SendCommandStart(TPM2_CTX* ctx, byte* buf,
+    int cmdSz, int bufSz);
+WOLFTPM_LOCAL int TPM2_TIS_SendCommandStep(TPM2_CTX* ctx);
+WOLFTPM_LOCAL int TPM2_TIS_SendCommandAbort(TPM2_CTX* ctx);
+/* Release the TIS resources held by the context (lock file) */
+WOLFTPM_LOCAL void TPM2_TIS_Cleanup(TPM2_CTX* ctx);
+
+#ifdef WOLFTPM_TIS
+/* Transport for the TIS interface (SPI or I2C) through the HAL IO callback
+ * of the context, see TPM2_SetHalIoCb. The TIS state is kept in the context
+ * with its locality, so transportCtx is not used. */
+WOLFTPM_API const TPM2_TRANSPORT* TPM2_TIS_GetTransport(void);
+
+#ifdef WOLFTPM_TIS_LOCK
+/* Lock file held (flock) by the process using the TPM for each command.
+ * It must be in a directory other users cannot create files in, or only
+ * one with the sticky bit, and be owned by the user or root. */
+#ifndef WOLFTPM_TIS_LOCK_FILE
+#define WOLFTPM_TIS_LOCK_FILE "/run/lock/wolftpm.lock"
+#endif
+#endif
+
+/* Register and FIFO access counts, to measure bus transactions per command */
+WOLFTPM_API int TPM2_TIS_GetStats(TPM2_CTX* ctx, TPM2_TIS_STATS* stats);
+WOLFTPM_API int TPM2_TIS_ResetStats(TPM2_CTX* ctx);
+
+#ifdef WOLFTPM_TIS_PROFILE
+/* Attribute the bus activity (status polls, burst count reads, FIFO chunks,
+ * wait states, bytes and time in the HAL callback) to the command codes, in
+ * a profile owned by the caller. The profile is cleared, NULL stops. */
+WOLFTPM_API int TPM2_TIS_SetProfile(TPM2_CTX* ctx, TPM2_TIS_PROFILE* profile);
+/* Profile entry of a command code (0 for accesses outside commands), NULL
+ * if none was sent */
+WOLFTPM_API const TPM2_TIS_PROFILE_CC* TPM2_TIS_GetProfile(
+    const TPM2_TIS_PROFILE* profile, UINT32 cc);
+/* Called by SPI HAL callbacks for the wait state bytes polled on a
+ * transaction (WOLFTPM_CHECK_WAIT_STATE) */
+WOLFTPM_API void TPM2_TIS_ProfileWaitStates(TPM2_CTX* ctx, word32 count);
+#endif
+
+#ifdef WOLFTPM_TIMED_POLL
+/* Longest wait for a command response in microseconds, 0 restores the
+ * default TPM_TIS_DURATION_US */
+WOLFTPM_API int TPM2_TIS_SetCommandTimeout(TPM2_CTX* ctx, word32 timeoutUs);
+/* Microseconds until TPM2_TIS_SendCommandStep will poll the TPM again */
+WOLFTPM_LOCAL word32 TPM2_TIS_PollDelayUs(TPM2_CTX* ctx);
+#endif
+#endif
+
+#if defined(WOLFTPM_TIMED_POLL) && defined(__linux__)
+WOLFTPM_LOCAL UINT64 TPM2_TIS_TimeUs(void);
+#endif
 WOLFTPM_LOCAL int TPM2_TIS_Ready(TPM2_CTX* ctx);
 WOLFTPM_LOCAL int TPM2_TIS_WaitForStatus(TPM2_CTX* ctx, byte status, byte status_mask);
 WOLFTPM_LOCAL int TPM2_TIS_Status(TPM2_CTX* ctx, byte* status);
@@ -0,0 +1,129 @@
+/* tpm2_tis_sim.h
+ *
+ * Copyright (C) 2006-2020 wolfSSL Inc.
+ *
+ * This file is part of wolfTPM.
+ *
+ * wolfTPM is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfTPM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#ifndef _TPM2_TIS_SIM_H_
+#define _TPM2_TIS_SIM_H_
+
+#include <wolftpm/tpm2.h>
+
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#ifdef WOLFTPM_TIS_SIM
+
+/* Simulator defaults, each can be changed in TPM2_TIS_SIM after
+ * TPM2_TisSim_Init */
+#ifndef TPM2_TIS_SIM_HOST
+#define TPM2_TIS_SIM_HOST       "localhost"
+#endif
+#ifndef TPM2_TIS_SIM_PORT
+#define TPM2_TIS_SIM_PORT       "2321"
+#endif
+#ifndef TPM2_TIS_SIM_BURST
+#define TPM2_TIS_SIM_BURST      MAX_TIS_FRAMESIZE
+#endif
+#ifndef TPM2_TIS_SIM_WAIT_STATES
+#define TPM2_TIS_SIM_WAIT_STATES 0
+#endif
+#ifndef TPM2_TIS_SIM_ACCESS_NS
+#define TPM2_TIS_SIM_ACCESS_NS  0
+#endif
+#ifndef TPM2_TIS_SIM_BYTE_NS
+#define TPM2_TIS_SIM_BYTE_NS    0 /* 800 models a 10MHz SPI clock */
+#endif
+#ifndef TPM2_TIS_SIM_EXEC_US
+#define TPM2_TIS_SIM_EXEC_US    0
+#endif
+
+struct TPM2_TIS_SIM;
+
+/* Runs the command in sim->cmd (cmdSz bytes) and sets the response in
+ * sim->rsp and sim->rspSz */
+typedef int (*TPM2TisSimExecCb)(struct TPM2_TIS_SIM* sim, void* execCtx);
+
+/* TIS register interface emulated in memory. Commands written to the FIFO
+ * are executed when GO is set, by default on a TPM simulator (swtpm /
+ * ms-tpm-20-ref) on the TCP command port, and the response is read back
+ * through the FIFO. Each bus transaction takes the modeled time:
+ *   accessNs + (header + waitStates + size) * byteNs
+ * where the header is the 4-byte SPI header or the I2C register address. */
+typedef struct TPM2_TIS_SIM {
+    /* TPM simulator command port */
+    const char* host;
+    const char* port;
+
+    /* command execution, the TPM simulator on the command port when NULL */
+    TPM2TisSimExecCb execCb;
+    void*  execCtx;
+
+    /* bus model */
+    word16 burstCount;  /* FIFO bytes per burst, reported in TPM_STS */
+    word16 waitStates;  /* wait state bytes on each transaction */
+    word32 accessNs;    /* fixed cost of each transaction */
+    word32 byteNs;      /* cost of each byte on the bus */
+    word32 execUs;      /* minimum time from GO to response available */
+
+    /* fault injection */
+    word32 stallEvery;  /* every Nth burst count read returns 0, 0 for none */
+    word32 execPolls;   /* status reads from GO to response available */
+
+    /* statistics */
+    word32 transactions;
+    UINT64 busNs;       /* modeled bus time */
+    word32 burstReads;  /* burst count reads */
+    word32 aborts;      /* commands aborted with COMMAND_READY */
+
+    /* emulated TPM state */
+    int    fd;
+    byte   state;
+    byte   locality;    /* active locality, 0xFF for none */
+    int    cmdSz;
+    int    rspSz;
+    int    rspPos;
+    word32 execLeft;    /* status reads left before the response */
+    UINT64 readyNs;     /* response is available after this time */
+    byte   cmd[MAX_COMMAND_SIZE];
+    byte   rsp[MAX_RESPONSE_SIZE];
+} TPM2_TIS_SIM;
+
+/* Set the defaults above, no connection is made until the first command */
+WOLFTPM_API int TPM2_TisSim_Init(TPM2_TIS_SIM* sim);
+
+/* End the TPM simulator session and close the connection */
+WOLFTPM_API int TPM2_TisSim_Cleanup(TPM2_TIS_SIM* sim);
+
+/* HAL IO callback, pass the TPM2_TIS_SIM as the userCtx to TPM2_Init */
+#ifdef WOLFTPM_ADV_IO
+WOLFTPM_API int TPM2_TisSim_IoCb(TPM2_CTX* ctx, int isRead, word32 addr,
+    byte* buf, word16 size, void* userCtx);
+#else
+WOLFTPM_API int TPM2_TisSim_IoCb(TPM2_CTX* ctx, const byte* txBuf,
+    byte* rxBuf, word16 xferSz, void* userCtx);
+#endif
+
+#endif /* WOLFTPM_TIS_SIM */
+
+#ifdef __cplusplus
+    }  /* extern "C" */
+#endif
+
+#endif /* _TPM2_TIS_SIM_H_ */
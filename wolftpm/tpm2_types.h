@@ -173,6 +173,24 @@ typedef int64_t  INT64;
     #define printf XPRINTF
 #endif
 
+/* Storage of the active TPM context. By default one active context is
+ * shared by all threads. Define WOLFTPM_THREAD_LOCAL_CTX
+ * (--enable-threadctx) to give each thread its own, so threads can drive
+ * separate contexts at the same time. A thread then has no active context
+ * until it calls TPM2_SetActiveCtx or a wolfTPM2_* wrapper. */
+#ifndef WOLFTPM_THREAD_LS
+    #if !defined(WOLFTPM_THREAD_LOCAL_CTX) || defined(SINGLE_THREADED)
+        #define WOLFTPM_THREAD_LS
+    #elif defined(_MSC_VER)
+        #define WOLFTPM_THREAD_LS __declspec(thread)
+    #elif defined(__GNUC__) && (defined(__linux__) || defined(__APPLE__) || \
+            defined(_WIN32) || defined(__FreeBSD__))
+        #define WOLFTPM_THREAD_LS __thread
+    #else
+        #error WOLFTPM_THREAD_LOCAL_CTX is not supported with this compiler
+    #endif
+#endif
+
 
 
 /* ---------------------------------------------------------------------------*/
@@ -288,18 +306,63 @@ typedef int64_t  INT64;
 #define MAX_SPI_FRAMESIZE 64
 #endif
 
+/* Largest FIFO transfer in one bus transaction. The TIS SPI protocol allows
+ * 64 bytes, on I2C a transfer can be as large as the TPM burst count */
+#ifndef MAX_TIS_FRAMESIZE
+    #if defined(WOLFTPM_I2C) && defined(WOLFTPM_ADV_IO)
+    #define MAX_TIS_FRAMESIZE 256
+    #else
+    #define MAX_TIS_FRAMESIZE MAX_SPI_FRAMESIZE
+    #endif
+#endif
+
 #ifndef TPM_STARTUP_TEST_TRIES
 #define TPM_STARTUP_TEST_TRIES 2
 #endif
 
+/* The TIS transport (SPI / I2C through the HAL IO callback) is built with
+ * the devtpm and swtpm transports, unless WOLFTPM_NO_TIS is defined. Windows
+ * builds only use TBS. */
+#if !defined(WOLFTPM_WINAPI) && !defined(WOLFTPM_NO_TIS)
+    #define WOLFTPM_TIS
+#endif
+
 #ifndef TPM_TIMEOUT_TRIES
-    #if defined(WOLFTPM_LINUX_DEV) || defined(WOLFTPM_SWTPM) || defined(WOLFTPM_WINAPI)
-    #define TPM_TIMEOUT_TRIES 0
-    #else
+    #ifdef WOLFTPM_TIS
     #define TPM_TIMEOUT_TRIES 1000000
+    #else
+    #define TPM_TIMEOUT_TRIES 0
     #endif
 #endif
 
+/* TIS timeouts with WOLFTPM_TIMED_POLL (TCG PC Client PTP, Table 16) */
+#ifndef TPM_TIS_TIMEOUT_A_US
+#define TPM_TIS_TIMEOUT_A_US    750000  /* locality */
+#endif
+#ifndef TPM_TIS_TIMEOUT_B_US
+#define TPM_TIS_TIMEOUT_B_US    2000000 /* command ready, startup */
+#endif
+#ifndef TPM_TIS_TIMEOUT_C_US
+#define TPM_TIS_TIMEOUT_C_US    200000  /* status valid, data expect */
+#endif
+#ifndef TPM_TIS_TIMEOUT_D_US
+#define TPM_TIS_TIMEOUT_D_US    30000   /* burst count */
+#endif
+#ifndef TPM_TIS_DURATION_US
+#define TPM_TIS_DURATION_US     120000000 /* longest command execution */
+#endif
+/* Backoff between status polls, doubling from min to max */
+#ifndef TPM_TIS_POLL_MIN_US
+#define TPM_TIS_POLL_MIN_US     20
+#endif
+#ifndef TPM_TIS_POLL_MAX_US
+#define TPM_TIS_POLL_MAX_US     1000
+#endif
+/* Command codes with a remembered execution time */
+#ifndef TPM_TIS_CC_HISTORY
+#define TPM_TIS_CC_HISTORY      16
+#endif
+
 #ifndef TPM_SPI_WAIT_RETRY
 #define TPM_SPI_WAIT_RETRY 50
 #endif
@@ -357,6 +420,44 @@ typedef int64_t  INT64;
     #define XTPM_WAIT() /* just poll without delay by default */
 #endif
 
+/* Optional monotonic clock in microseconds (XTPM_TIME_US) and sleep
+ * (XTPM_SLEEP_US). With a clock the TIS layer waits on deadlines from the
+ * TCG PTP timeouts with exponential backoff between polls, instead of
+ * counting TPM_TIMEOUT_TRIES polls. Define WOLFTPM_NO_TIMED_POLL to always
+ * count polls. */
+#if !defined(WOLFTPM_NO_TIMED_POLL) && !defined(XTPM_TIME_US) && \
+    defined(__linux__)
+    #define XTPM_TIME_US() TPM2_TIS_TimeUs()
+    #ifndef XTPM_SLEEP_US
+        #include <unistd.h>
+        #define XTPM_SLEEP_US(us) usleep(us)
+    #endif
+#endif
+#if !defined(WOLFTPM_NO_TIMED_POLL) && defined(XTPM_TIME_US)
+    #define WOLFTPM_TIMED_POLL
+    #ifndef XTPM_SLEEP_US
+        #define XTPM_SLEEP_US(us) XTPM_WAIT()
+    #endif
+#endif
+
+/* The TIS bus profile only applies to the TIS (SPI / I2C) interface */
+#if defined(WOLFTPM_TIS_PROFILE) && !defined(WOLFTPM_TIS)
+    #undef WOLFTPM_TIS_PROFILE
+#endif
+
+/* Monotonic clock in nanoseconds for the command hooks (WOLFTPM_HOOKS) and
+ * the TIS bus profile (WOLFTPM_TIS_PROFILE) */
+#if defined(WOLFTPM_HOOKS) || defined(WOLFTPM_TIS_PROFILE)
+    #if !defined(XTPM_TIME_NS) && defined(__linux__)
+        #define XTPM_TIME_NS() TPM2_TimeNs()
+        #define WOLFTPM_TIME_NS_GETTIME
+    #elif !defined(XTPM_TIME_NS) && defined(XTPM_TIME_US)
+        #define XTPM_TIME_NS() ((UINT64)XTPM_TIME_US() * 1000)
+    #elif !defined(XTPM_TIME_NS)
+        #define XTPM_TIME_NS() 0
+    #endif
+#endif
+
 #ifndef BUFFER_ALIGNMENT
 #define BUFFER_ALIGNMENT 4
 #endif
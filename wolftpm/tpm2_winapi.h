@@ -29,11 +29,12 @@
     extern "C" {
 #endif
 
-/* TPM2 IO for using TPM through the Winapi kernel driver */
-WOLFTPM_LOCAL int TPM2_WinApi_SendCommand(TPM2_CTX* ctx, TPM2_Packet* packet);
+#ifdef WOLFTPM_WINAPI
+/* Transport for the TPM through the Windows TBS API. Its transportCtx is a
+ * struct wolfTPM_winContext, or NULL for the one of the context. */
+WOLFTPM_API const TPM2_TRANSPORT* TPM2_WinApi_GetTransport(void);
 
-/* Cleanup winpi context */
-WOLFTPM_LOCAL int TPM2_WinApi_Cleanup(TPM2_CTX* ctx);
+#endif /* WOLFTPM_WINAPI */
 
 #ifdef __cplusplus
     }  /* extern "C" */
@@ -49,8 +49,14 @@ typedef struct WOLFTPM2_SESSION {
 typedef struct WOLFTPM2_DEV {
     TPM2_CTX ctx;
     TPM2_AUTH_SESSION session[MAX_SESSION_NUM];
+    /* TPM2_CreateLoaded support, see WOLFTPM2_CMD_* (checked once) */
+    byte createLoaded;
 } WOLFTPM2_DEV;
 
+#define WOLFTPM2_CMD_UNKNOWN        0
+#define WOLFTPM2_CMD_SUPPORTED      1
+#define WOLFTPM2_CMD_UNSUPPORTED    2
+
 typedef struct WOLFTPM2_KEY {
     WOLFTPM2_HANDLE   handle;
     TPM2B_PUBLIC      pub;
@@ -112,6 +118,46 @@ typedef struct WOLFTPM2_CAPS {
     word16 req_wait_state : 1; /* requires SPI wait state */
 } WOLFTPM2_CAPS;
 
+/* Sessions of a wolfTPM2_SessionPool */
+#ifndef WOLFTPM2_SESSION_POOL_MAX
+    #define WOLFTPM2_SESSION_POOL_MAX 8
+#endif
+
+typedef struct WOLFTPM2_POOL_SESSION {
+    WOLFTPM2_SESSION session;
+    TPMS_CONTEXT     context;   /* while saved */
+    word32           lastUse;
+
+    /* bits */
+    word16 started : 1;
+    word16 inUse : 1;
+    word16 saved : 1;
+} WOLFTPM2_POOL_SESSION;
+
+typedef struct WOLFTPM2_SESSION_POOL {
+    WOLFTPM2_DEV*    dev;       /* starts, saves and loads the sessions */
+    WOLFTPM2_KEY*    tpmKey;    /* salt key, NULL for unsalted */
+    WOLFTPM2_HANDLE* bind;
+    TPM_SE           sesType;
+    int              encDecAlg;
+
+    word32 count;
+    word32 maxLoaded;           /* sessions kept loaded, 0 for no limit */
+    word32 loaded;
+    word32 clock;
+    word32 gapMax;              /* TPM_PT_CONTEXT_GAP_MAX */
+    WOLFTPM2_POOL_SESSION slot[WOLFTPM2_SESSION_POOL_MAX];
+#if !defined(WOLFTPM2_NO_WOLFCRYPT) && !defined(SINGLE_THREADED)
+    wolfSSL_Mutex lock;
+#endif
+
+    /* statistics */
+    word32 starts;              /* TPM2_StartAuthSession sent */
+    word32 saves;               /* TPM2_ContextSave sent */
+    word32 loads;               /* TPM2_ContextLoad sent */
+    word32 refreshes;           /* oldest saved session saved again */
+} WOLFTPM2_SESSION_POOL;
+
 /* NV Handles */
 #define TPM2_NV_RSA_EK_CERT 0x01C00002
 #define TPM2_NV_ECC_EK_CERT 0x01C0000A
@@ -145,6 +191,39 @@ WOLFTPM_API int wolfTPM2_StartSession(WOLFTPM2_DEV* dev,
     WOLFTPM2_SESSION* session, WOLFTPM2_KEY* tpmKey,
     WOLFTPM2_HANDLE* bind, TPM_SE sesType, int encDecAlg);
 
+/* Session pool: count sessions (up to WOLFTPM2_SESSION_POOL_MAX) of one type
+ * are started on first use and kept with continueSession, so the
+ * StartAuthSession and salt encryption cost is paid once per session. Idle
+ * sessions beyond maxLoaded (0 for no limit) are swapped out with
+ * TPM2_ContextSave, leaving the TPM session slots to others, and loaded again
+ * when acquired. The oldest saved session is saved again before the TPM
+ * context gap is reached. dev, tpmKey and bind must stay valid until
+ * wolfTPM2_SessionPool_Free. The pool does not change the auth sessions of
+ * dev. Using the pool from several threads at once needs
+ * WOLFTPM_THREAD_LOCAL_CTX, as the TPM2_* commands run on the active
+ * context. */
+WOLFTPM_API int wolfTPM2_SessionPool_Init(WOLFTPM2_DEV* dev,
+    WOLFTPM2_SESSION_POOL* pool, word32 count, WOLFTPM2_KEY* tpmKey,
+    WOLFTPM2_HANDLE* bind, TPM_SE sesType, int encDecAlg, word32 maxLoaded);
+/* Set a pool session as auth session index of dev (which may be the device of
+ * another thread), with continueSession added to the attributes. session
+ * (optional) is set to the pool session, for policy commands. Returns
+ * TPM_RC_RETRY when all sessions are in use. dev must share the TPM
+ * connection of the pool dev: with a resource manager (/dev/tpmrm0, TBS) the
+ * session handles are per connection, so only the pool dev is accepted
+ * (BAD_FUNC_ARG otherwise). The active context is left set to dev. */
+WOLFTPM_API int wolfTPM2_SessionPool_Acquire(WOLFTPM2_SESSION_POOL* pool,
+    WOLFTPM2_DEV* dev, int index, TPMA_SESSION sessionAttributes,
+    WOLFTPM2_SESSION** session);
+/* Give the session set at index of dev back to the pool with its nonces and
+ * clear the auth session. A policy session is restarted. With flush the
+ * session is flushed instead (after an error) and started again when
+ * needed. */
+WOLFTPM_API int wolfTPM2_SessionPool_Release(WOLFTPM2_SESSION_POOL* pool,
+    WOLFTPM2_DEV* dev, int index, int flush);
+/* Flush the sessions of the pool, loaded or saved */
+WOLFTPM_API int wolfTPM2_SessionPool_Free(WOLFTPM2_SESSION_POOL* pool);
+
 WOLFTPM_API int wolfTPM2_CreatePrimaryKey(WOLFTPM2_DEV* dev,
     WOLFTPM2_KEY* key, TPM_HANDLE primaryHandle, TPMT_PUBLIC* publicTemplate,
     const byte* auth, int authSz);
@@ -155,6 +234,14 @@ WOLFTPM_API int wolfTPM2_CreateKey(WOLFTPM2_DEV* dev,
     const byte* auth, int authSz);
 WOLFTPM_API int wolfTPM2_LoadKey(WOLFTPM2_DEV* dev,
     WOLFTPM2_KEYBLOB* keyBlob, WOLFTPM2_HANDLE* parent);
+/* Create and load a key with one TPM2_CreateLoaded (TPM 2.0 r1.38+). The key
+ * blob has the loaded handle and the private / public parts to load it again.
+ * Returns TPM_RC_COMMAND_CODE when the TPM does not have the command. */
+WOLFTPM_API int wolfTPM2_CreateLoadedKey(WOLFTPM2_DEV* dev,
+    WOLFTPM2_KEYBLOB* keyBlob, WOLFTPM2_HANDLE* parent,
+    TPMT_PUBLIC* publicTemplate, const byte* auth, int authSz);
+/* Uses TPM2_CreateLoaded when the TPM lists it in TPM_CAP_COMMANDS,
+ * otherwise TPM2_Create and TPM2_Load */
 WOLFTPM_API int wolfTPM2_CreateAndLoadKey(WOLFTPM2_DEV* dev,
     WOLFTPM2_KEY* key, WOLFTPM2_HANDLE* parent, TPMT_PUBLIC* publicTemplate,
     const byte* auth, int authSz);
@@ -339,6 +426,26 @@ WOLFTPM_API int wolfTPM2_UnloadHandles(WOLFTPM2_DEV* dev, word32 handleStart,
     word32 handleCount);
 WOLFTPM_API int wolfTPM2_UnloadHandles_AllTransient(WOLFTPM2_DEV* dev);
 
+/* Handles in use from handleStart to the end of its handle type, from
+ * TPM2_GetCapability(TPM_CAP_HANDLES). Loaded or saved sessions are listed
+ * with their HMAC or policy session handles. *count is the size of handles
+ * and is set to the number found. */
+WOLFTPM_API int wolfTPM2_GetHandles(WOLFTPM2_DEV* dev, TPM_HANDLE handleStart,
+    TPM_HANDLE* handles, word32* count);
+
+/* Flags for wolfTPM2_UnloadHandles_Loaded */
+#define WOLFTPM2_FLUSH_TRANSIENT        0x01 /* loaded objects */
+#define WOLFTPM2_FLUSH_LOADED_SESSIONS  0x02 /* HMAC and policy sessions */
+#define WOLFTPM2_FLUSH_SAVED_SESSIONS   0x04 /* sessions with saved context */
+#define WOLFTPM2_FLUSH_ALL              0x07
+
+/* Flush only the objects and sessions the TPM reports as in use, such as
+ * the ones left by a crashed process. flushed and failed (optional) are set
+ * to the number of handles flushed and that failed to flush. A failure does
+ * not stop the other handles being flushed, the first error is returned. */
+WOLFTPM_API int wolfTPM2_UnloadHandles_Loaded(WOLFTPM2_DEV* dev, int flags,
+    word32* flushed, word32* failed);
+
 /* Utility functions */
 WOLFTPM_API int wolfTPM2_GetKeyTemplate_RSA(TPMT_PUBLIC* publicTemplate,
     TPMA_OBJECT objectAttributes);